@@ -0,0 +1,661 @@
+/*
+ * Copyright (C) 2008-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-adium-template.h"
+
+#include <string.h>
+#include <tp-account-widgets/tpaw-time.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_CHAT
+#include "empathy-debug.h"
+
+/* An Adium message template (Content.html, Status.html, ...) is compiled
+ * once into a list of tokens. Each token is either a literal span of the
+ * template, already escaped to be embedded in a JavaScript string, or a
+ * keyword slot to be filled in with a value of the message. Rendering a
+ * message is then a single walk over the tokens. Keywords we know about
+ * but don't support yet are stripped at compile time. */
+
+typedef enum
+{
+  KEYWORD_LITERAL,
+  KEYWORD_USER_ICON_PATH,
+  KEYWORD_SENDER_SCREEN_NAME,
+  KEYWORD_SENDER,
+  KEYWORD_SENDER_COLOR,
+  KEYWORD_MESSAGE_DIRECTION,
+  KEYWORD_SENDER_DISPLAY_NAME,
+  KEYWORD_MESSAGE,
+  KEYWORD_TIME,
+  KEYWORD_SHORT_TIME,
+  KEYWORD_SERVICE,
+  KEYWORD_USER_ICONS,
+  KEYWORD_MESSAGE_CLASSES,
+} AdiumKeyword;
+
+typedef struct
+{
+  AdiumKeyword keyword;
+  /* KEYWORD_LITERAL: span in EmpathyAdiumTemplate->literals */
+  gsize offset;
+  gsize len;
+  /* KEYWORD_TIME: strftime format, or NULL for the default one */
+  gchar *format;
+} AdiumToken;
+
+struct _EmpathyAdiumTemplate
+{
+  /* array of AdiumToken */
+  GArray *tokens;
+  /* All the literal spans, concatenated */
+  GString *literals;
+};
+
+static void
+escape_and_append_len (GString *string, const gchar *str, gint len)
+{
+  while (str != NULL && *str != '\0' && len != 0)
+    {
+      switch (*str)
+        {
+          case '\\':
+            /* \ becomes \\ */
+            g_string_append (string, "\\\\");
+            break;
+          case '\"':
+            /* " becomes \" */
+            g_string_append (string, "\\\"");
+            break;
+          case '\n':
+            /* Remove end of lines */
+            break;
+          default:
+            g_string_append_c (string, *str);
+        }
+
+      str++;
+      len--;
+    }
+}
+
+/* If *str starts with match, returns TRUE and move pointer to the end */
+static gboolean
+template_match (const gchar **str,
+    const gchar *match)
+{
+  gint len;
+
+  len = strlen (match);
+  if (strncmp (*str, match, len) == 0)
+    {
+      *str += len - 1;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Like template_match() but also return the X part if match is
+ * like %foo{X}% */
+static gboolean
+template_match_with_format (const gchar **str,
+    const gchar *match,
+    gchar **format)
+{
+  const gchar *cur = *str;
+  const gchar *end;
+
+  if (!template_match (&cur, match))
+    return FALSE;
+
+  cur++;
+
+  end = strstr (cur, "}%");
+  if (!end)
+    return FALSE;
+
+  *format = g_strndup (cur , end - cur);
+  *str = end + 1;
+  return TRUE;
+}
+
+/* List of colors used by %senderColor%. Copied from
+ * adium/Frameworks/AIUtilities\ Framework/Source/AIColorAdditions.m
+ */
+static gchar *colors[] = {
+  "aqua", "aquamarine", "blue", "blueviolet", "brown", "burlywood", "cadetblue",
+  "chartreuse", "chocolate", "coral", "cornflowerblue", "crimson", "cyan",
+  "darkblue", "darkcyan", "darkgoldenrod", "darkgreen", "darkgrey", "darkkhaki",
+  "darkmagenta", "darkolivegreen", "darkorange", "darkorchid", "darkred",
+  "darksalmon", "darkseagreen", "darkslateblue", "darkslategrey",
+  "darkturquoise", "darkviolet", "deeppink", "deepskyblue", "dimgrey",
+  "dodgerblue", "firebrick", "forestgreen", "fuchsia", "gold", "goldenrod",
+  "green", "greenyellow", "grey", "hotpink", "indianred", "indigo", "lawngreen",
+  "lightblue", "lightcoral",
+  "lightgreen", "lightgrey", "lightpink", "lightsalmon", "lightseagreen",
+  "lightskyblue", "lightslategrey", "lightsteelblue", "lime", "limegreen",
+  "magenta", "maroon", "mediumaquamarine", "mediumblue", "mediumorchid",
+  "mediumpurple", "mediumseagreen", "mediumslateblue", "mediumspringgreen",
+  "mediumturquoise", "mediumvioletred", "midnightblue", "navy", "olive",
+  "olivedrab", "orange", "orangered", "orchid", "palegreen", "paleturquoise",
+  "palevioletred", "peru", "pink", "plum", "powderblue", "purple", "red",
+  "rosybrown", "royalblue", "saddlebrown", "salmon", "sandybrown", "seagreen",
+  "sienna", "silver", "skyblue", "slateblue", "slategrey", "springgreen",
+  "steelblue", "tan", "teal", "thistle", "tomato", "turquoise", "violet",
+  "yellowgreen",
+};
+
+static gchar *
+nsdate_to_strftime (const gchar *nsdate)
+{
+  /* Convert from NSDateFormatter
+   * (http://www.stepcase.com/blog/2008/12/02/format-string-for-the-iphone-nsdateformatter/)
+   * to strftime supported by g_date_time_format.
+   * FIXME: table is incomplete, doc of g_date_time_format has a table of
+   *        supported tags.
+   * FIXME: g_date_time_format in GLib 2.28 does 0 padding by default, but
+   *        in 2.29.x we have to explictely request padding with %0x */
+  static const gchar *convert_table[] = {
+    "a", "%p", // AM/PM
+    "A", NULL, // 0~86399999 (Millisecond of Day)
+
+    "cccc", "%A", // Sunday/Monday/Tuesday/Wednesday/Thursday/Friday/Saturday
+    "ccc", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+    "cc", "%u", // 1~7 (Day of Week)
+    "c", "%u", // 1~7 (Day of Week)
+
+    "dd", "%d", // 1~31 (0 padded Day of Month)
+    "d", "%d", // 1~31 (0 padded Day of Month)
+    "D", "%j", // 1~366 (0 padded Day of Year)
+
+    "e", "%u", // 1~7 (0 padded Day of Week)
+    "EEEE", "%A", // Sunday/Monday/Tuesday/Wednesday/Thursday/Friday/Saturday
+    "EEE", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+    "EE", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+    "E", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+
+    "F", NULL, // 1~5 (0 padded Week of Month, first day of week = Monday)
+
+    "g", NULL, // Julian Day Number (number of days since 4713 BC January 1)
+    "GGGG", NULL, // Before Christ/Anno Domini
+    "GGG", NULL, // BC/AD (Era Designator Abbreviated)
+    "GG", NULL, // BC/AD (Era Designator Abbreviated)
+    "G", NULL, // BC/AD (Era Designator Abbreviated)
+
+    "h", "%I", // 1~12 (0 padded Hour (12hr))
+    "H", "%H", // 0~23 (0 padded Hour (24hr))
+
+    "k", NULL, // 1~24 (0 padded Hour (24hr)
+    "K", NULL, // 0~11 (0 padded Hour (12hr))
+
+    "LLLL", "%B", // January/February/March/April/May/June/July/August/September/October/November/December
+    "LLL", "%b", // Jan/Feb/Mar/Apr/May/Jun/Jul/Aug/Sep/Oct/Nov/Dec
+    "LL", "%m", // 1~12 (0 padded Month)
+    "L", "%m", // 1~12 (0 padded Month)
+
+    "m", "%M", // 0~59 (0 padded Minute)
+    "MMMM", "%B", // January/February/March/April/May/June/July/August/September/October/November/December
+    "MMM", "%b", // Jan/Feb/Mar/Apr/May/Jun/Jul/Aug/Sep/Oct/Nov/Dec
+    "MM", "%m", // 1~12 (0 padded Month)
+    "M", "%m", // 1~12 (0 padded Month)
+
+    "qqqq", NULL, // 1st quarter/2nd quarter/3rd quarter/4th quarter
+    "qqq", NULL, // Q1/Q2/Q3/Q4
+    "qq", NULL, // 1~4 (0 padded Quarter)
+    "q", NULL, // 1~4 (0 padded Quarter)
+    "QQQQ", NULL, // 1st quarter/2nd quarter/3rd quarter/4th quarter
+    "QQQ", NULL, // Q1/Q2/Q3/Q4
+    "QQ", NULL, // 1~4 (0 padded Quarter)
+    "Q", NULL, // 1~4 (0 padded Quarter)
+
+    "s", "%S", // 0~59 (0 padded Second)
+    "S", NULL, // (rounded Sub-Second)
+
+    "u", "%Y", // (0 padded Year)
+
+    "vvvv", "%Z", // (General GMT Timezone Name)
+    "vvv", "%Z", // (General GMT Timezone Abbreviation)
+    "vv", "%Z", // (General GMT Timezone Abbreviation)
+    "v", "%Z", // (General GMT Timezone Abbreviation)
+
+    "w", "%W", // 1~53 (0 padded Week of Year, 1st day of week = Sunday, NB, 1st week of year starts from the last Sunday of last year)
+    "W", NULL, // 1~5 (0 padded Week of Month, 1st day of week = Sunday)
+
+    "yyyy", "%Y", // (Full Year)
+    "yyy", "%y", // (2 Digits Year)
+    "yy", "%y", // (2 Digits Year)
+    "y", "%Y", // (Full Year)
+    "YYYY", NULL, // (Full Year, starting from the Sunday of the 1st week of year)
+    "YYY", NULL, // (2 Digits Year, starting from the Sunday of the 1st week of year)
+    "YY", NULL, // (2 Digits Year, starting from the Sunday of the 1st week of year)
+    "Y", NULL, // (Full Year, starting from the Sunday of the 1st week of year)
+
+    "zzzz", NULL, // (Specific GMT Timezone Name)
+    "zzz", NULL, // (Specific GMT Timezone Abbreviation)
+    "zz", NULL, // (Specific GMT Timezone Abbreviation)
+    "z", NULL, // (Specific GMT Timezone Abbreviation)
+    "Z", "%z", // +0000 (RFC 822 Timezone)
+  };
+  GString *string;
+  guint i, j;
+
+  if (nsdate == NULL)
+    return NULL;
+
+  /* Copy nsdate into string, replacing occurences of NSDateFormatter tags
+   * by corresponding strftime tag. */
+  string = g_string_sized_new (strlen (nsdate));
+  for (i = 0; nsdate[i] != '\0'; i++)
+    {
+      gboolean found = FALSE;
+
+      /* even indexes are NSDateFormatter tag, odd indexes are the
+       * corresponding strftime tag */
+      for (j = 0; j < G_N_ELEMENTS (convert_table); j += 2)
+        {
+          if (g_str_has_prefix (nsdate + i, convert_table[j]))
+            {
+              found = TRUE;
+              break;
+            }
+        }
+
+      if (found)
+        {
+          /* If we don't have a replacement, just ignore that tag */
+          if (convert_table[j + 1] != NULL)
+            g_string_append (string, convert_table[j + 1]);
+
+          i += strlen (convert_table[j]) - 1;
+        }
+      else
+        {
+          g_string_append_c (string, nsdate[i]);
+        }
+    }
+
+  DEBUG ("Date format converted '%s' → '%s'", nsdate, string->str);
+
+  return g_string_free (string, FALSE);
+}
+
+static AdiumToken *
+template_add_token (EmpathyAdiumTemplate *self,
+    AdiumKeyword keyword)
+{
+  AdiumToken token = { keyword, 0, 0, NULL };
+
+  g_array_append_val (self->tokens, token);
+
+  return &g_array_index (self->tokens, AdiumToken, self->tokens->len - 1);
+}
+
+static void
+template_add_literal (EmpathyAdiumTemplate *self,
+    const gchar *str)
+{
+  AdiumToken *token = NULL;
+  gsize old_len = self->literals->len;
+
+  escape_and_append_len (self->literals, str, 1);
+
+  if (self->literals->len == old_len)
+    return;
+
+  /* Extend the literal we are building, if any */
+  if (self->tokens->len > 0)
+    {
+      token = &g_array_index (self->tokens, AdiumToken,
+          self->tokens->len - 1);
+
+      if (token->keyword != KEYWORD_LITERAL)
+        token = NULL;
+    }
+
+  if (token == NULL)
+    {
+      token = template_add_token (self, KEYWORD_LITERAL);
+      token->offset = old_len;
+    }
+
+  token->len += self->literals->len - old_len;
+}
+
+/**
+ * empathy_adium_template_new:
+ * @html: the content of an Adium HTML template, or %NULL
+ *
+ * Compiles @html into a list of literal spans and keyword slots, so it can be
+ * rendered many times without rescanning it.
+ *
+ * Returns: a new #EmpathyAdiumTemplate, free it with
+ * empathy_adium_template_free()
+ */
+EmpathyAdiumTemplate *
+empathy_adium_template_new (const gchar *html)
+{
+  EmpathyAdiumTemplate *self;
+  const gchar *cur;
+
+  self = g_slice_new0 (EmpathyAdiumTemplate);
+  self->tokens = g_array_new (FALSE, FALSE, sizeof (AdiumToken));
+  self->literals = g_string_sized_new (html != NULL ? strlen (html) : 0);
+
+  if (html == NULL)
+    return self;
+
+  for (cur = html; *cur != '\0'; cur++)
+    {
+      gchar *format = NULL;
+
+      /* All keywords start with '%' */
+      if (*cur != '%')
+        {
+          template_add_literal (self, cur);
+          continue;
+        }
+
+      /* Those are all well known keywords that needs replacement in
+       * html files. Please keep them in the same order than the adium
+       * spec. See http://trac.adium.im/wiki/CreatingMessageStyles */
+      if (template_match (&cur, "%userIconPath%"))
+        {
+          template_add_token (self, KEYWORD_USER_ICON_PATH);
+        }
+      else if (template_match (&cur, "%senderScreenName%"))
+        {
+          template_add_token (self, KEYWORD_SENDER_SCREEN_NAME);
+        }
+      else if (template_match (&cur, "%sender%"))
+        {
+          template_add_token (self, KEYWORD_SENDER);
+        }
+      else if (template_match (&cur, "%senderColor%"))
+        {
+          template_add_token (self, KEYWORD_SENDER_COLOR);
+        }
+      else if (template_match (&cur, "%senderStatusIcon%"))
+        {
+          /* FIXME: The path to the status icon of the sender
+           * (available, away, etc...)
+           */
+        }
+      else if (template_match (&cur, "%messageDirection%"))
+        {
+          template_add_token (self, KEYWORD_MESSAGE_DIRECTION);
+        }
+      else if (template_match (&cur, "%senderDisplayName%"))
+        {
+          template_add_token (self, KEYWORD_SENDER_DISPLAY_NAME);
+        }
+      else if (template_match (&cur, "%senderPrefix%"))
+        {
+          /* FIXME: If we supported IRC user mode flags, this
+           * would be replaced with @ if the user is an op, + if
+           * the user has voice, etc. as per
+           * http://hg.adium.im/adium/rev/b586b027de42. But we
+           * don't, so for now we just strip it. */
+        }
+      else if (template_match_with_format (&cur, "%textbackgroundcolor{",
+            &format))
+        {
+          /* FIXME: This keyword is used to represent the
+           * highlight background color. "X" is the opacity of the
+           * background, ranges from 0 to 1 and can be any decimal
+           * between.
+           */
+        }
+      else if (template_match (&cur, "%message%"))
+        {
+          template_add_token (self, KEYWORD_MESSAGE);
+        }
+      else if (template_match (&cur, "%time%") ||
+           template_match_with_format (&cur, "%time{", &format))
+        {
+          AdiumToken *token;
+
+          token = template_add_token (self, KEYWORD_TIME);
+          token->format = nsdate_to_strftime (format);
+        }
+      else if (template_match (&cur, "%shortTime%"))
+        {
+          template_add_token (self, KEYWORD_SHORT_TIME);
+        }
+      else if (template_match (&cur, "%service%"))
+        {
+          template_add_token (self, KEYWORD_SERVICE);
+        }
+      else if (template_match (&cur, "%variant%"))
+        {
+          /* FIXME: The name of the active message style variant,
+           * with all spaces replaced with an underscore.
+           * A variant named "Alternating Messages - Blue Red"
+           * will become "Alternating_Messages_-_Blue_Red".
+           */
+        }
+      else if (template_match (&cur, "%userIcons%"))
+        {
+          template_add_token (self, KEYWORD_USER_ICONS);
+        }
+      else if (template_match (&cur, "%messageClasses%"))
+        {
+          template_add_token (self, KEYWORD_MESSAGE_CLASSES);
+        }
+      else if (template_match (&cur, "%status%"))
+        {
+          /* FIXME: A description of the status event. This is
+           * neither in the user's local language nor expected to
+           * be displayed; it may be useful to use a different div
+           * class to present different types of status messages.
+           * The following is a list of some of the more important
+           * status messages; your message style should be able to
+           * handle being shown a status message not in this list,
+           * as even at present the list is incomplete and is
+           * certain to become out of date in the future:
+           *  online
+           *  offline
+           *  away
+           *  away_message
+           *  return_away
+           *  idle
+           *  return_idle
+           *  date_separator
+           *  contact_joined (group chats)
+           *  contact_left
+           *  error
+           *  timed_out
+           *  encryption (all OTR messages use this status)
+           *  purple (all IRC topic and join/part messages use this status)
+           *  fileTransferStarted
+           *  fileTransferCompleted
+           */
+        }
+      else
+        {
+          template_add_literal (self, cur);
+        }
+
+      g_free (format);
+    }
+
+  return self;
+}
+
+void
+empathy_adium_template_free (EmpathyAdiumTemplate *self)
+{
+  guint i;
+
+  if (self == NULL)
+    return;
+
+  for (i = 0; i < self->tokens->len; i++)
+    g_free (g_array_index (self->tokens, AdiumToken, i).format);
+
+  g_array_unref (self->tokens);
+  g_string_free (self->literals, TRUE);
+
+  g_slice_free (EmpathyAdiumTemplate, self);
+}
+
+/* Size of the template without its keywords, useful to preallocate the
+ * rendering buffer */
+gsize
+empathy_adium_template_get_size_hint (EmpathyAdiumTemplate *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->literals->len;
+}
+
+/**
+ * empathy_adium_template_render:
+ * @self: an #EmpathyAdiumTemplate
+ * @values: the values to substitute for the keywords
+ * @string: a #GString to append to
+ *
+ * Appends @self to @string, with each keyword replaced by the corresponding
+ * value from @values. The result is escaped to be used inside a double-quoted
+ * JavaScript string.
+ */
+void
+empathy_adium_template_render (EmpathyAdiumTemplate *self,
+    const EmpathyAdiumTemplateValues *values,
+    GString *string)
+{
+  guint i;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (values != NULL);
+
+  for (i = 0; i < self->tokens->len; i++)
+    {
+      const AdiumToken *token = &g_array_index (self->tokens, AdiumToken, i);
+      const gchar *replace = NULL;
+      gchar *dup_replace = NULL;
+
+      switch (token->keyword)
+        {
+          case KEYWORD_LITERAL:
+            g_string_append_len (string, self->literals->str + token->offset,
+                token->len);
+            continue;
+
+          case KEYWORD_USER_ICON_PATH:
+            replace = values->avatar_filename;
+            break;
+
+          case KEYWORD_SENDER_SCREEN_NAME:
+            replace = values->contact_id;
+            break;
+
+          case KEYWORD_SENDER:
+          case KEYWORD_SENDER_DISPLAY_NAME:
+            /* FIXME: %senderDisplayName% is the serverside (remotely set)
+             * name of the sender, such as an MSN display name.
+             *
+             *  We don't have access to that yet so we use
+             * local alias instead.
+             */
+            replace = values->name;
+            break;
+
+          case KEYWORD_SENDER_COLOR:
+            /* A color derived from the user's name.
+             * FIXME: If a colon separated list of HTML colors is at
+             * Incoming/SenderColors.txt it will be used instead of
+             * the default colors.
+             */
+
+            /* Ensure we always use the same color when sending messages
+             * (bgo #658821) */
+            if (values->outgoing)
+              {
+                replace = "inherit";
+              }
+            else if (values->contact_id != NULL)
+              {
+                guint hash = g_str_hash (values->contact_id);
+                replace = colors[hash % G_N_ELEMENTS (colors)];
+              }
+            break;
+
+          case KEYWORD_MESSAGE_DIRECTION:
+            switch (values->direction)
+              {
+                case PANGO_DIRECTION_LTR:
+                case PANGO_DIRECTION_TTB_LTR:
+                case PANGO_DIRECTION_WEAK_LTR:
+                  replace = "ltr";
+                  break;
+                case PANGO_DIRECTION_RTL:
+                case PANGO_DIRECTION_TTB_RTL:
+                case PANGO_DIRECTION_WEAK_RTL:
+                  replace = "rtl";
+                  break;
+                case PANGO_DIRECTION_NEUTRAL:
+                default:
+                  break;
+              }
+            break;
+
+          case KEYWORD_MESSAGE:
+            replace = values->message;
+            break;
+
+          case KEYWORD_TIME:
+            if (token->format != NULL)
+              dup_replace = tpaw_time_to_string_local (values->timestamp,
+                  token->format);
+            else if (values->is_backlog)
+              dup_replace = tpaw_time_to_string_local (values->timestamp,
+                  TPAW_TIME_DATE_FORMAT_DISPLAY_SHORT);
+            else
+              dup_replace = tpaw_time_to_string_local (values->timestamp,
+                  TPAW_TIME_FORMAT_DISPLAY_SHORT);
+
+            replace = dup_replace;
+            break;
+
+          case KEYWORD_SHORT_TIME:
+            dup_replace = tpaw_time_to_string_local (values->timestamp,
+                TPAW_TIME_FORMAT_DISPLAY_SHORT);
+            replace = dup_replace;
+            break;
+
+          case KEYWORD_SERVICE:
+            replace = values->service_name;
+            break;
+
+          case KEYWORD_USER_ICONS:
+            replace = values->show_avatars ? "showIcons" : "hideIcons";
+            break;
+
+          case KEYWORD_MESSAGE_CLASSES:
+            replace = values->message_classes;
+            break;
+
+          default:
+            break;
+        }
+
+      escape_and_append_len (string, replace, -1);
+      g_free (dup_replace);
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2008-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_ADIUM_TEMPLATE_H__
+#define __EMPATHY_ADIUM_TEMPLATE_H__
+
+#include <glib.h>
+#include <pango/pango.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyAdiumTemplate EmpathyAdiumTemplate;
+
+/* Values substituted for the keywords of a compiled template. All strings
+ * are borrowed and may be NULL, in which case the keyword expands to
+ * nothing. */
+typedef struct
+{
+  const gchar *message;
+  const gchar *avatar_filename;
+  const gchar *name;
+  const gchar *contact_id;
+  const gchar *service_name;
+  const gchar *message_classes;
+  gint64 timestamp;
+  gboolean is_backlog;
+  gboolean outgoing;
+  gboolean show_avatars;
+  PangoDirection direction;
+} EmpathyAdiumTemplateValues;
+
+EmpathyAdiumTemplate * empathy_adium_template_new (const gchar *html);
+void empathy_adium_template_free (EmpathyAdiumTemplate *self);
+
+gsize empathy_adium_template_get_size_hint (EmpathyAdiumTemplate *self);
+
+void empathy_adium_template_render (EmpathyAdiumTemplate *self,
+    const EmpathyAdiumTemplateValues *values,
+    GString *string);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_ADIUM_TEMPLATE_H__ */
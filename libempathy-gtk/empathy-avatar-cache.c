@@ -0,0 +1,752 @@
+/*
+ * Copyright (C) 2007-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-avatar-cache.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* Enough for a 2000 contacts roster at 32x32, or about 700 at 48x48 */
+#define DEFAULT_BUDGET (8 * 1024 * 1024)
+
+typedef struct
+{
+  gchar *key;
+  GdkPixbuf *pixbuf;
+  gsize size;
+} CacheEntry;
+
+typedef struct
+{
+  /* owned gchar * => borrowed GList link of lru */
+  GHashTable *entries;
+  /* CacheEntry, most recently used first */
+  GQueue lru;
+  gsize size;
+  gsize budget;
+  /* owned gchar * => borrowed DecodeJob */
+  GHashTable *pending;
+} AvatarCache;
+
+/* Only used from the main thread */
+static AvatarCache *avatar_cache = NULL;
+
+/* Everything but waiters is immutable once the job has been started, so
+ * the worker thread can read it without locking. */
+typedef struct
+{
+  /* NULL if the result is not to be cached */
+  gchar *key;
+  GBytes *data;
+  GLoadableIcon *icon;
+  gint width;
+  gint height;
+  gboolean rounded;
+  /* GTask, only touched from the main thread */
+  GPtrArray *waiters;
+} DecodeJob;
+
+static AvatarCache *
+avatar_cache_get (void)
+{
+  if (avatar_cache == NULL)
+    {
+      avatar_cache = g_slice_new0 (AvatarCache);
+      avatar_cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, NULL);
+      g_queue_init (&avatar_cache->lru);
+      avatar_cache->budget = DEFAULT_BUDGET;
+      avatar_cache->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, NULL);
+    }
+
+  return avatar_cache;
+}
+
+static gchar *
+avatar_cache_make_key (const gchar *source,
+    gint width,
+    gint height,
+    gboolean rounded)
+{
+  if (source == NULL)
+    return NULL;
+
+  return g_strdup_printf ("%dx%d%s:%s", width, height, rounded ? "r" : "",
+      source);
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->key);
+  g_object_unref (entry->pixbuf);
+  g_slice_free (CacheEntry, entry);
+}
+
+static void
+avatar_cache_evict (AvatarCache *self,
+    gsize budget)
+{
+  while (self->size > budget)
+    {
+      CacheEntry *entry = g_queue_pop_tail (&self->lru);
+
+      g_hash_table_remove (self->entries, entry->key);
+      self->size -= entry->size;
+      cache_entry_free (entry);
+    }
+}
+
+static GdkPixbuf *
+avatar_cache_lookup_key (AvatarCache *self,
+    const gchar *key)
+{
+  GList *link;
+
+  if (key == NULL)
+    return NULL;
+
+  link = g_hash_table_lookup (self->entries, key);
+  if (link == NULL)
+    return NULL;
+
+  g_queue_unlink (&self->lru, link);
+  g_queue_push_head_link (&self->lru, link);
+
+  return g_object_ref (((CacheEntry *) link->data)->pixbuf);
+}
+
+static void
+avatar_cache_insert (AvatarCache *self,
+    const gchar *key,
+    GdkPixbuf *pixbuf)
+{
+  CacheEntry *entry;
+  GList *link;
+  gsize size;
+
+  if (key == NULL)
+    return;
+
+  size = (gsize) gdk_pixbuf_get_rowstride (pixbuf) *
+    gdk_pixbuf_get_height (pixbuf);
+  if (size > self->budget)
+    return;
+
+  link = g_hash_table_lookup (self->entries, key);
+  if (link != NULL)
+    {
+      /* Decodes of a key are shared, but don't leak the entry if it got
+       * there anyway */
+      entry = link->data;
+      g_queue_unlink (&self->lru, link);
+      g_queue_push_head_link (&self->lru, link);
+
+      self->size -= entry->size;
+      g_object_unref (entry->pixbuf);
+      entry->pixbuf = g_object_ref (pixbuf);
+      entry->size = size;
+      self->size += size;
+    }
+  else
+    {
+      entry = g_slice_new (CacheEntry);
+      entry->key = g_strdup (key);
+      entry->pixbuf = g_object_ref (pixbuf);
+      entry->size = size;
+
+      g_queue_push_head (&self->lru, entry);
+      g_hash_table_insert (self->entries, g_strdup (key), self->lru.head);
+      self->size += size;
+    }
+
+  avatar_cache_evict (self, self->budget);
+}
+
+struct SizeData
+{
+  gint width;
+  gint height;
+  gboolean preserve_aspect_ratio;
+};
+
+static void
+pixbuf_from_avatar_size_prepared_cb (GdkPixbufLoader *loader,
+    int width,
+    int height,
+    struct SizeData *data)
+{
+  g_return_if_fail (width > 0 && height > 0);
+
+  if (data->preserve_aspect_ratio && (data->width > 0 || data->height > 0))
+    {
+      if (data->width < 0)
+        {
+          width = width * (double) data->height / (gdouble) height;
+          height = data->height;
+        }
+      else if (data->height < 0)
+        {
+          height = height * (double) data->width / (double) width;
+          width = data->width;
+        }
+      else if ((double) height * (double) data->width >
+           (double) width * (double) data->height)
+        {
+          width = 0.5 + (double) width * (double) data->height / (double) height;
+          height = data->height;
+        }
+      else
+        {
+          height = 0.5 + (double) height * (double) data->width / (double) width;
+          width = data->width;
+        }
+    }
+  else
+    {
+      if (data->width > 0)
+        width = data->width;
+
+      if (data->height > 0)
+        height = data->height;
+    }
+
+  gdk_pixbuf_loader_set_size (loader, width, height);
+}
+
+static void
+empathy_avatar_pixbuf_roundify (GdkPixbuf *pixbuf)
+{
+  gint width, height, rowstride;
+  guchar *pixels;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+
+  if (width < 6 || height < 6)
+    return;
+
+  /* Top left */
+  pixels[3] = 0;
+  pixels[7] = 0x80;
+  pixels[11] = 0xC0;
+  pixels[rowstride + 3] = 0x80;
+  pixels[rowstride * 2 + 3] = 0xC0;
+
+  /* Top right */
+  pixels[width * 4 - 1] = 0;
+  pixels[width * 4 - 5] = 0x80;
+  pixels[width * 4 - 9] = 0xC0;
+  pixels[rowstride + (width * 4) - 1] = 0x80;
+  pixels[(2 * rowstride) + (width * 4) - 1] = 0xC0;
+
+  /* Bottom left */
+  pixels[(height - 1) * rowstride + 3] = 0;
+  pixels[(height - 1) * rowstride + 7] = 0x80;
+  pixels[(height - 1) * rowstride + 11] = 0xC0;
+  pixels[(height - 2) * rowstride + 3] = 0x80;
+  pixels[(height - 3) * rowstride + 3] = 0xC0;
+
+  /* Bottom right */
+  pixels[height * rowstride - 1] = 0;
+  pixels[(height - 1) * rowstride - 1] = 0x80;
+  pixels[(height - 2) * rowstride - 1] = 0xC0;
+  pixels[height * rowstride - 5] = 0x80;
+  pixels[height * rowstride - 9] = 0xC0;
+}
+
+static gboolean
+empathy_gdk_pixbuf_is_opaque (GdkPixbuf *pixbuf)
+{
+  gint height, rowstride, i;
+  guchar *pixels;
+  guchar *row;
+
+  height = gdk_pixbuf_get_height (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+
+  row = pixels;
+  for (i = 3; i < rowstride; i+=4)
+    if (row[i] < 0xfe)
+      return FALSE;
+
+  for (i = 1; i < height - 1; i++)
+    {
+      row = pixels + (i*rowstride);
+      if (row[3] < 0xfe || row[rowstride-1] < 0xfe)
+        return FALSE;
+    }
+
+  row = pixels + ((height-1) * rowstride);
+  for (i = 3; i < rowstride; i+=4)
+    if (row[i] < 0xfe)
+      return FALSE;
+
+  return TRUE;
+}
+
+/**
+ * @pixbuf: (transfer all)
+ *
+ * Return: (transfer all)
+ */
+static GdkPixbuf *
+pixbuf_round_corners (GdkPixbuf *pixbuf)
+{
+  GdkPixbuf *result;
+
+  if (!gdk_pixbuf_get_has_alpha (pixbuf))
+    {
+      /* The pixbuf has already been scaled, so this copy is small */
+      result = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
+      g_object_unref (pixbuf);
+    }
+  else
+    {
+      result = pixbuf;
+    }
+
+  if (empathy_gdk_pixbuf_is_opaque (result))
+    empathy_avatar_pixbuf_roundify (result);
+
+  return result;
+}
+
+/* Thread safe */
+static GdkPixbuf *
+pixbuf_decode_data (const guchar *data,
+    gsize len,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GError **error)
+{
+  GdkPixbuf *pixbuf;
+  GdkPixbufLoader *loader;
+  struct SizeData size_data;
+
+  if (len == 0)
+    {
+      g_set_error_literal (error, GDK_PIXBUF_ERROR,
+          GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "Avatar has 0 length");
+      return NULL;
+    }
+
+  size_data.width = width;
+  size_data.height = height;
+  size_data.preserve_aspect_ratio = TRUE;
+
+  loader = gdk_pixbuf_loader_new ();
+
+  g_signal_connect (loader, "size-prepared",
+      G_CALLBACK (pixbuf_from_avatar_size_prepared_cb), &size_data);
+
+  if (!gdk_pixbuf_loader_write (loader, data, len, error))
+    {
+      gdk_pixbuf_loader_close (loader, NULL);
+      g_object_unref (loader);
+      return NULL;
+    }
+
+  gdk_pixbuf_loader_close (loader, NULL);
+
+  pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+  if (pixbuf == NULL)
+    {
+      g_set_error_literal (error, GDK_PIXBUF_ERROR,
+          GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "Avatar could not be decoded");
+      g_object_unref (loader);
+      return NULL;
+    }
+
+  g_object_ref (pixbuf);
+  g_object_unref (loader);
+
+  if (rounded)
+    pixbuf = pixbuf_round_corners (pixbuf);
+
+  return pixbuf;
+}
+
+/* Thread safe, as long as the icon's load () implementation is */
+static GdkPixbuf *
+pixbuf_decode_icon (GLoadableIcon *icon,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GInputStream *stream;
+  GdkPixbuf *pixbuf;
+
+  stream = g_loadable_icon_load (icon, width, NULL, cancellable, error);
+  if (stream == NULL)
+    return NULL;
+
+  /* Like pixbuf_decode_data(), sizes <= 0 don't constrain the pixbuf */
+  pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream,
+      width > 0 ? width : -1, height > 0 ? height : -1, TRUE,
+      cancellable, error);
+  g_object_unref (stream);
+
+  if (pixbuf != NULL && rounded)
+    pixbuf = pixbuf_round_corners (pixbuf);
+
+  return pixbuf;
+}
+
+static void
+decode_job_free (DecodeJob *job)
+{
+  g_free (job->key);
+  if (job->data != NULL)
+    g_bytes_unref (job->data);
+  g_clear_object (&job->icon);
+  g_ptr_array_unref (job->waiters);
+  g_slice_free (DecodeJob, job);
+}
+
+static void
+decode_job_thread_func (GTask *task,
+    gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  DecodeJob *job = task_data;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+
+  if (job->icon != NULL)
+    {
+      pixbuf = pixbuf_decode_icon (job->icon, job->width, job->height,
+          job->rounded, cancellable, &error);
+    }
+  else
+    {
+      gsize len;
+      const guchar *data = g_bytes_get_data (job->data, &len);
+
+      pixbuf = pixbuf_decode_data (data, len, job->width, job->height,
+          job->rounded, &error);
+    }
+
+  if (pixbuf == NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, pixbuf, g_object_unref);
+}
+
+static void
+decode_job_done_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  AvatarCache *self = avatar_cache_get ();
+  DecodeJob *job = g_task_get_task_data (G_TASK (result));
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+  guint i;
+
+  pixbuf = g_task_propagate_pointer (G_TASK (result), &error);
+
+  if (job->key != NULL)
+    g_hash_table_remove (self->pending, job->key);
+
+  if (pixbuf != NULL)
+    avatar_cache_insert (self, job->key, pixbuf);
+  else
+    DEBUG ("Failed to decode avatar: %s", error->message);
+
+  for (i = 0; i < job->waiters->len; i++)
+    {
+      GTask *waiter = g_ptr_array_index (job->waiters, i);
+
+      if (pixbuf != NULL)
+        g_task_return_pointer (waiter, g_object_ref (pixbuf), g_object_unref);
+      else
+        g_task_return_error (waiter, g_error_copy (error));
+    }
+
+  /* The job may be freed from the worker thread, so don't leave it the
+   * last ref on the waiters */
+  g_ptr_array_set_size (job->waiters, 0);
+
+  g_clear_object (&pixbuf);
+  g_clear_error (&error);
+}
+
+/* Takes ownership of key, data and icon */
+static void
+avatar_cache_load_async (gchar *key,
+    GBytes *data,
+    GLoadableIcon *icon,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  AvatarCache *self = avatar_cache_get ();
+  GTask *waiter, *task;
+  GdkPixbuf *pixbuf;
+  DecodeJob *job;
+
+  waiter = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (waiter, avatar_cache_load_async);
+
+  pixbuf = avatar_cache_lookup_key (self, key);
+  if (pixbuf != NULL)
+    {
+      g_task_return_pointer (waiter, pixbuf, g_object_unref);
+      goto out;
+    }
+
+  job = key != NULL ? g_hash_table_lookup (self->pending, key) : NULL;
+  if (job != NULL)
+    {
+      g_ptr_array_add (job->waiters, g_object_ref (waiter));
+      goto out;
+    }
+
+  job = g_slice_new0 (DecodeJob);
+  job->key = key;
+  job->data = data;
+  job->icon = icon;
+  job->width = width;
+  job->height = height;
+  job->rounded = rounded;
+  job->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (job->waiters, g_object_ref (waiter));
+
+  if (key != NULL)
+    g_hash_table_insert (self->pending, g_strdup (key), job);
+
+  /* The decode itself isn't cancellable as other requests may be waiting
+   * for it; waiters check their own cancellable when finishing. */
+  task = g_task_new (NULL, NULL, decode_job_done_cb, NULL);
+  g_task_set_task_data (task, job, (GDestroyNotify) decode_job_free);
+  g_task_run_in_thread (task, decode_job_thread_func);
+  g_object_unref (task);
+
+  g_object_unref (waiter);
+  return;
+
+out:
+  g_free (key);
+  if (data != NULL)
+    g_bytes_unref (data);
+  g_clear_object (&icon);
+  g_object_unref (waiter);
+}
+
+/**
+ * empathy_avatar_cache_lookup:
+ * @source: (allow-none): a string identifying the encoded avatar, e.g.
+ *   its filename
+ * @width: the maximal width, or -1
+ * @height: the maximal height, or -1
+ * @rounded: whether the corners are rounded
+ *
+ * Returns: (transfer full): the cached pixbuf, or %NULL if there isn't any
+ */
+GdkPixbuf *
+empathy_avatar_cache_lookup (const gchar *source,
+    gint width,
+    gint height,
+    gboolean rounded)
+{
+  GdkPixbuf *pixbuf;
+  gchar *key;
+
+  key = avatar_cache_make_key (source, width, height, rounded);
+  pixbuf = avatar_cache_lookup_key (avatar_cache_get (), key);
+  g_free (key);
+
+  return pixbuf;
+}
+
+/**
+ * empathy_avatar_cache_load_data_async:
+ * @source: (allow-none): a string identifying @data, or %NULL to bypass
+ *   the cache
+ * @data: (allow-none): the encoded avatar, copied, or %NULL to read it from
+ *   the file @source
+ * @len: the length of @data
+ * @width: the maximal width, or -1
+ * @height: the maximal height, or -1
+ * @rounded: whether the corners are rounded
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: called when the pixbuf is ready
+ * @user_data: data for @callback
+ *
+ * Decodes @data at the given size, in a worker thread on a cache miss.
+ */
+void
+empathy_avatar_cache_load_data_async (const gchar *source,
+    const guchar *data,
+    gsize len,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GLoadableIcon *icon = NULL;
+  GBytes *bytes = NULL;
+
+  if (data != NULL)
+    {
+      /* Copy the data, as EmpathyAvatar's refcount isn't thread safe */
+      bytes = g_bytes_new (data, len);
+    }
+  else
+    {
+      GFile *file;
+
+      g_return_if_fail (source != NULL);
+
+      /* Read in the worker thread too */
+      file = g_file_new_for_path (source);
+      icon = G_LOADABLE_ICON (g_file_icon_new (file));
+      g_object_unref (file);
+    }
+
+  avatar_cache_load_async (
+      avatar_cache_make_key (source, width, height, rounded),
+      bytes, icon, width, height, rounded,
+      cancellable, callback, user_data);
+}
+
+static GQuark
+icon_serial_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("empathy-avatar-cache-serial");
+
+  return quark;
+}
+
+/* Icons such as folks' GFileIcons keep the same file when the avatar
+ * changes, but a new icon is created; key on the icon object instead of
+ * its content. */
+static gchar *
+icon_make_source (GLoadableIcon *icon)
+{
+  static guint last_serial = 0;
+  guint serial;
+
+  serial = GPOINTER_TO_UINT (g_object_get_qdata (G_OBJECT (icon),
+        icon_serial_quark ()));
+  if (serial == 0)
+    {
+      serial = ++last_serial;
+      g_object_set_qdata (G_OBJECT (icon), icon_serial_quark (),
+          GUINT_TO_POINTER (serial));
+    }
+
+  return g_strdup_printf ("icon-%u", serial);
+}
+
+/**
+ * empathy_avatar_cache_load_icon_async:
+ * @icon: the avatar
+ * @width: the maximal width, or -1
+ * @height: the maximal height, or -1
+ * @rounded: whether the corners are rounded
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: called when the pixbuf is ready
+ * @user_data: data for @callback
+ *
+ * Loads and decodes @icon at the given size, in a worker thread on a cache
+ * miss.
+ */
+void
+empathy_avatar_cache_load_icon_async (GLoadableIcon *icon,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  gchar *source;
+
+  g_return_if_fail (G_IS_LOADABLE_ICON (icon));
+
+  source = icon_make_source (icon);
+  avatar_cache_load_async (
+      avatar_cache_make_key (source, width, height, rounded),
+      NULL, g_object_ref (icon), width, height, rounded,
+      cancellable, callback, user_data);
+  g_free (source);
+}
+
+/**
+ * empathy_avatar_cache_load_finish:
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or %NULL
+ *
+ * Returns: (transfer full): the decoded pixbuf, or %NULL on error
+ */
+GdkPixbuf *
+empathy_avatar_cache_load_finish (GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+      avatar_cache_load_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * empathy_avatar_cache_set_budget:
+ * @budget: the maximal size of the cached pixbufs, in bytes
+ *
+ * Evicts the least recently used pixbufs right away if they don't fit
+ * anymore.
+ */
+void
+empathy_avatar_cache_set_budget (gsize budget)
+{
+  AvatarCache *self = avatar_cache_get ();
+
+  self->budget = budget;
+  avatar_cache_evict (self, budget);
+}
+
+/**
+ * empathy_avatar_cache_get_size:
+ *
+ * Returns: the size of the cached pixbufs, in bytes
+ */
+gsize
+empathy_avatar_cache_get_size (void)
+{
+  return avatar_cache_get ()->size;
+}
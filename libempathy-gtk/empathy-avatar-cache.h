@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2007-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_AVATAR_CACHE_H__
+#define __EMPATHY_AVATAR_CACHE_H__
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/* Process-wide cache of decoded avatars, keyed by (source, width, height,
+ * rounded) and bounded by a budget in bytes, least recently used pixbufs
+ * being evicted first. Decoding happens in a worker thread; concurrent
+ * requests for the same key share one decode.
+ *
+ * Pixbufs returned are shared and must not be modified. All functions must
+ * be called from the main thread. */
+
+GdkPixbuf * empathy_avatar_cache_lookup (const gchar *source,
+    gint width,
+    gint height,
+    gboolean rounded);
+
+void empathy_avatar_cache_load_data_async (const gchar *source,
+    const guchar *data,
+    gsize len,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+void empathy_avatar_cache_load_icon_async (GLoadableIcon *icon,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+GdkPixbuf * empathy_avatar_cache_load_finish (GAsyncResult *result,
+    GError **error);
+
+void empathy_avatar_cache_set_budget (gsize budget);
+gsize empathy_avatar_cache_get_size (void);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_AVATAR_CACHE_H__ */
@@ -302,9 +302,11 @@ empathy_avatar_image_set (EmpathyAvatarImage *avatar_image,
 		priv->pixbuf = NULL;
 	}
 
-	if (avatar) {
+	if (avatar && avatar->data) {
 		priv->pixbuf = tpaw_pixbuf_from_data ((gchar *) avatar->data,
 				avatar->len);
+	} else if (avatar && avatar->filename) {
+		priv->pixbuf = gdk_pixbuf_new_from_file (avatar->filename, NULL);
 	}
 
 	if (!priv->pixbuf) {
@@ -35,15 +35,17 @@
 #include <glib/gi18n-lib.h>
 #include <tp-account-widgets/tpaw-keyring.h>
 #include <tp-account-widgets/tpaw-builder.h>
+#include <tp-account-widgets/tpaw-time.h>
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
 #include "empathy-client-factory.h"
 #include "empathy-gsettings.h"
 #include "empathy-individual-information-dialog.h"
-#include "empathy-individual-store-channel.h"
-#include "empathy-individual-view.h"
+#include "empathy-individual-menu.h"
+#include "empathy-individual-widget.h"
 #include "empathy-input-text-view.h"
+#include "empathy-member-store.h"
 #include "empathy-request-util.h"
 #include "empathy-search-bar.h"
 #include "empathy-spell.h"
@@ -58,6 +60,17 @@
 #define IS_ENTER(v) (v == GDK_KEY_Return || v == GDK_KEY_ISO_Enter || v == GDK_KEY_KP_Enter)
 #define COMPOSING_STOP_TIMEOUT 5
 
+/* Bounds of the number of log events fetched at once */
+#define BACKLOG_MIN_BATCH 5
+#define BACKLOG_MAX_BATCH 200
+/* Used for the first batch while the view's height is unknown */
+#define BACKLOG_DEFAULT_BATCH 20
+/* Rough height of a message in the view, in pixels */
+#define BACKLOG_EVENT_HEIGHT 24
+/* Batches keep growing while they are fetched this close to each other,
+ * in microseconds */
+#define BACKLOG_STREAK_TIMEOUT (2 * G_USEC_PER_SEC)
+
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyChat)
 struct _EmpathyChatPriv {
 	EmpathyTpChat     *tp_chat;
@@ -83,6 +96,16 @@ struct _EmpathyChatPriv {
 	 * restore the chat->view to the page it was on before the
 	 * latest batch of logs were inserted. */
 	guint              scroll_offset;
+	/* Only fetch logs older than this timestamp, or 0 for no limit. Set
+	 * when the oldest messages have been evicted from the chat->view so
+	 * that the new log walker resumes right before the ones still
+	 * displayed. */
+	gint64             backlog_before;
+	/* Number of log events requested by the latest fetch, or 0 to start
+	 * over with a page worth of them */
+	guint              backlog_batch_size;
+	/* Monotonic time at which the latest batch of logs was displayed */
+	gint64             backlog_last_fetch;
 
 	TpAccountManager  *account_manager;
 	GList             *input_history;
@@ -122,6 +145,7 @@ struct _EmpathyChatPriv {
 	GtkWidget         *expander_topic;
 	GtkWidget         *label_topic;
 	GtkWidget         *contact_list_view;
+	GtkWidget         *members_tooltip;
 	GtkWidget         *info_bar_vbox;
 	GtkWidget         *search_bar;
 
@@ -2493,26 +2517,35 @@ chat_log_filter (TplEvent *event,
 {
 	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	EmpathyMessage *message;
-	const GList *pending;
-	bool retval = FALSE;
+	TplTextEvent *text_event;
+	gint64 timestamp;
 
 	g_return_val_if_fail (TPL_IS_EVENT (event), FALSE);
 	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
 
-	pending = empathy_tp_chat_get_pending_messages (priv->tp_chat);
-	message = empathy_message_from_tpl_log_event (event);
+	/* Still displayed in the chat->view: it never evicts only some of
+	 * the messages sharing a timestamp, so all the ones at
+	 * backlog_before are still there */
+	if (priv->backlog_before != 0 &&
+	    tpl_event_get_timestamp (event) >= priv->backlog_before)
+		return FALSE;
 
-	for (; pending; pending = g_list_next (pending)) {
-		if (empathy_message_equal (message, pending->data))
-			goto out;
-	}
+	/* Pending messages are all text ones */
+	if (!TPL_IS_TEXT_EVENT (event))
+		return TRUE;
 
-	retval = TRUE;
+	text_event = TPL_TEXT_EVENT (event);
 
-out:
-	g_object_unref (message);
-	return retval;
+	/* Use the timestamp empathy_message_from_tpl_log_event () would
+	 * give to the message */
+	if (tp_str_empty (tpl_text_event_get_supersedes_token (text_event)))
+		timestamp = tpl_event_get_timestamp (event);
+	else
+		timestamp = tpl_text_event_get_edit_timestamp (text_event);
+
+	/* Skip the messages which are pending, they are displayed already */
+	return !empathy_tp_chat_has_pending_message (priv->tp_chat, timestamp,
+		tpl_text_event_get_message (text_event));
 }
 
 static void
@@ -2526,10 +2559,14 @@ show_pending_messages (EmpathyChat *chat) {
 
 	messages = empathy_tp_chat_get_pending_messages (priv->tp_chat);
 
+	empathy_theme_adium_begin_batch (chat->view);
+
 	for (l = messages; l != NULL ; l = g_list_next (l)) {
 		EmpathyMessage *message = EMPATHY_MESSAGE (l->data);
 		chat_message_received (chat, message, TRUE);
 	}
+
+	empathy_theme_adium_commit_batch (chat->view);
 }
 
 static gboolean
@@ -2572,6 +2609,15 @@ got_filtered_messages_cb (GObject *walker,
 		goto out;
 	}
 
+	if (TPL_LOG_WALKER (walker) != priv->log_walker) {
+		/* The walker has been replaced while fetching these, see
+		 * chat_view_scrollback_trimmed_cb () */
+		g_list_free_full (messages, g_object_unref);
+		goto out;
+	}
+
+	empathy_theme_adium_begin_batch (chat->view);
+
 	for (l = g_list_last (messages); l; l = g_list_previous (l)) {
 		EmpathyMessage *message;
 
@@ -2612,10 +2658,13 @@ got_filtered_messages_cb (GObject *walker,
 	}
 	g_list_free (messages);
 
+	empathy_theme_adium_commit_batch (chat->view);
+
 out:
 	/* FIXME: See Bug#610994, we are forcing the ACK of the queue. See comments
 	 * about it in EmpathyChatPriv definition */
 	priv->retrieving_backlogs = FALSE;
+	priv->backlog_last_fetch = g_get_monotonic_time ();
 	empathy_chat_messages_read (chat);
 
 	/* Turn back on scrolling */
@@ -2657,6 +2706,39 @@ out:
 	g_object_unref (chat);
 }
 
+static guint
+chat_get_backlog_batch_size (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	guint size;
+
+	if (priv->backlog_batch_size == 0 ||
+	    g_get_monotonic_time () - priv->backlog_last_fetch >
+	    BACKLOG_STREAK_TIMEOUT) {
+		GtkAdjustment *adjustment;
+		guint page_size;
+
+		/* First batch, or the user stopped going up: fetch about
+		 * enough to fill the view once */
+		adjustment = gtk_scrollable_get_vadjustment (
+		    GTK_SCROLLABLE (chat->view));
+		page_size = (guint) gtk_adjustment_get_page_size (adjustment);
+
+		if (page_size > 0)
+			size = page_size / BACKLOG_EVENT_HEIGHT + 1;
+		else
+			size = BACKLOG_DEFAULT_BATCH;
+	} else {
+		/* The user keeps going up through the history */
+		size = priv->backlog_batch_size * 2;
+	}
+
+	priv->backlog_batch_size = CLAMP (size, BACKLOG_MIN_BATCH,
+	    BACKLOG_MAX_BATCH);
+
+	return priv->backlog_batch_size;
+}
+
 static gboolean
 chat_add_logs (EmpathyChat *chat)
 {
@@ -2669,7 +2751,8 @@ chat_add_logs (EmpathyChat *chat)
 	/* Turn off scrolling temporarily */
 	empathy_theme_adium_scroll (chat->view, FALSE);
 
-	tpl_log_walker_get_events_async (priv->log_walker, 5,
+	tpl_log_walker_get_events_async (priv->log_walker,
+	    chat_get_backlog_batch_size (chat),
 	    got_filtered_messages_cb, g_object_ref (chat));
 
 	return G_SOURCE_REMOVE;
@@ -2684,7 +2767,7 @@ chat_schedule_logs (EmpathyChat *chat)
 		return;
 
 	priv->retrieving_backlogs = TRUE;
-	g_timeout_add_full (G_PRIORITY_LOW, 500, /* ms */
+	g_idle_add_full (G_PRIORITY_LOW,
 	    (GSourceFunc) chat_add_logs, g_object_ref (chat), g_object_unref);
 }
 
@@ -2721,8 +2804,9 @@ chat_view_adjustment_value_changed_cb (GtkAdjustment *adjustment,
 {
 	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	guint lower;
-	guint value;
+	gdouble lower;
+	gdouble range;
+	gdouble value;
 
 	if (tpl_log_walker_is_end (priv->log_walker)) {
 		g_signal_handlers_disconnect_by_func (adjustment,
@@ -2730,13 +2814,17 @@ chat_view_adjustment_value_changed_cb (GtkAdjustment *adjustment,
 		return;
 	}
 
-	lower = (guint) gtk_adjustment_get_lower (adjustment);
-	value = (guint) gtk_adjustment_get_value (adjustment);
-	if (value != lower)
+	lower = gtk_adjustment_get_lower (adjustment);
+	value = gtk_adjustment_get_value (adjustment);
+	range = gtk_adjustment_get_upper (adjustment) - lower -
+		gtk_adjustment_get_page_size (adjustment);
+	if (value - lower > range / 3)
 		return;
 
-	/* Request for more logs to be fetched if the user hit the
-	 * upper edge of the chat->view.
+	/* Prefetch more logs while the user is in the top third of the
+	 * chat->view, so they are there before the upper edge is hit.
+	 * Restoring the position once they are inserted moves the user
+	 * down, which stops the prefetching.
 	 */
 	chat_schedule_logs (chat);
 }
@@ -2758,6 +2846,59 @@ chat_scrollable_connect (gpointer user_data)
 	return G_SOURCE_REMOVE;
 }
 
+static void
+chat_create_log_walker (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	TplEntity *target;
+
+	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
+		target = tpl_entity_new_from_room_id (priv->id);
+	else
+		target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
+
+	tp_clear_object (&priv->log_walker);
+	priv->log_walker = tpl_log_manager_walk_filtered_events (priv->log_manager, priv->account, target,
+								 TPL_EVENT_MASK_TEXT, chat_log_filter, chat);
+	g_object_unref (target);
+}
+
+static void
+chat_view_scrollback_trimmed_cb (EmpathyThemeAdium *view,
+				 gint64             timestamp,
+				 EmpathyChat       *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GtkAdjustment *adjustment;
+
+	/* Only events remain in the view */
+	if (timestamp == 0)
+		timestamp = tpaw_time_get_current ();
+
+	DEBUG ("Oldest messages evicted, logs will resume before %"
+		G_GINT64_FORMAT, timestamp);
+
+	/* The current walker is past the evicted messages, start over from
+	 * the most recent logs; chat_log_filter () skips the ones that are
+	 * still displayed. */
+	priv->backlog_before = timestamp;
+	priv->backlog_batch_size = 0;
+	chat_create_log_walker (chat);
+
+	/* The handlers disconnect themselves once the previous walker
+	 * reached its end, and they are not connected at all in rooms
+	 * until logs have been fetched once. */
+	adjustment = gtk_scrollable_get_vadjustment (
+	    GTK_SCROLLABLE (chat->view));
+	g_signal_handlers_disconnect_by_func (adjustment,
+	    chat_view_adjustment_changed_cb, chat);
+	g_signal_handlers_disconnect_by_func (adjustment,
+	    chat_view_adjustment_value_changed_cb, chat);
+
+	priv->watch_scroll = TRUE;
+	chat_scrollable_connect (chat);
+}
+
 static gint
 chat_contacts_completion_func (const gchar *s1,
 			       const gchar *s2,
@@ -2847,31 +2988,44 @@ build_part_message (guint           reason,
 
 static void
 chat_members_changed_cb (EmpathyTpChat  *tp_chat,
-			 EmpathyContact *contact,
+			 GPtrArray      *added,
+			 GPtrArray      *removed,
 			 EmpathyContact *actor,
 			 guint           reason,
 			 gchar          *message,
-			 gboolean        is_member,
 			 EmpathyChat    *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	const gchar *name = empathy_contact_get_alias (contact);
-	gchar *str;
+	guint i;
 
 	g_return_if_fail (TP_CHANNEL_GROUP_CHANGE_REASON_RENAMED != reason);
 
 	if (priv->block_events_timeout_id != 0)
 		return;
 
-	if (is_member) {
-		str = g_strdup_printf (_("%s has joined the room"),
-				       name);
-	} else {
+	/* Insert all the events of the change with a single script */
+	empathy_theme_adium_begin_batch (chat->view);
+
+	for (i = 0; removed != NULL && i < removed->len; i++) {
+		const gchar *name;
+		gchar *str;
+
+		name = empathy_contact_get_alias (g_ptr_array_index (removed, i));
 		str = build_part_message (reason, name, actor, message);
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
 	}
 
-	empathy_theme_adium_append_event (chat->view, str);
-	g_free (str);
+	for (i = 0; added != NULL && i < added->len; i++) {
+		gchar *str;
+
+		str = g_strdup_printf (_("%s has joined the room"),
+				       empathy_contact_get_alias (g_ptr_array_index (added, i)));
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
+	}
+
+	empathy_theme_adium_commit_batch (chat->view);
 }
 
 static void
@@ -2919,6 +3073,296 @@ chat_contacts_visible_timeout_cb (gpointer chat)
 	return FALSE;
 }
 
+static EmpathyContact *
+chat_members_view_dup_contact (GtkTreeView *view,
+			       GtkTreePath *path)
+{
+	GtkTreeModel   *model = gtk_tree_view_get_model (view);
+	GtkTreeIter     iter;
+	EmpathyContact *contact = NULL;
+
+	if (gtk_tree_model_get_iter (model, &iter, path)) {
+		gtk_tree_model_get (model, &iter,
+				    EMPATHY_MEMBER_STORE_COL_CONTACT, &contact,
+				    -1);
+	}
+
+	return contact;
+}
+
+static void
+chat_members_view_row_activated_cb (GtkTreeView       *view,
+				    GtkTreePath       *path,
+				    GtkTreeViewColumn *column,
+				    EmpathyChat       *chat)
+{
+	EmpathyContact *contact;
+
+	contact = chat_members_view_dup_contact (view, path);
+	if (contact == NULL)
+		return;
+
+	if (!empathy_contact_is_user (contact))
+		empathy_chat_with_contact (contact, empathy_get_current_action_time ());
+
+	g_object_unref (contact);
+}
+
+static void
+chat_members_menu_deactivate_cb (GtkMenuShell *menushell,
+				 gpointer      user_data)
+{
+	g_signal_handlers_disconnect_by_func (menushell,
+		chat_members_menu_deactivate_cb, user_data);
+
+	gtk_menu_detach (GTK_MENU (menushell));
+}
+
+/* The individual is only needed for the menu and the tooltip, so it's
+ * created for the member being pointed at rather than for every member of
+ * the room */
+static FolksIndividual *
+chat_members_view_dup_individual (GtkTreeModel *model,
+				  GtkTreeIter  *iter)
+{
+	EmpathyContact  *contact = NULL;
+	TpContact       *tp_contact;
+	FolksIndividual *individual = NULL;
+
+	gtk_tree_model_get (model, iter,
+			    EMPATHY_MEMBER_STORE_COL_CONTACT, &contact,
+			    -1);
+	if (contact == NULL)
+		return NULL;
+
+	tp_contact = empathy_contact_get_tp_contact (contact);
+	if (tp_contact != NULL)
+		individual = empathy_ensure_individual_from_tp_contact (tp_contact);
+
+	g_object_unref (contact);
+
+	return individual;
+}
+
+/* Pops up the menu of the member at @path, returns FALSE if there is none */
+static gboolean
+chat_members_view_popup_menu (EmpathyChat *chat,
+			      GtkTreeView *view,
+			      GtkTreePath *path,
+			      guint        button,
+			      guint32      time)
+{
+	EmpathyChatPriv                *priv = GET_PRIV (chat);
+	GtkTreeModel                   *model = gtk_tree_view_get_model (view);
+	GtkTreeIter                     iter;
+	FolksIndividual                *individual;
+	EmpathyIndividualFeatureFlags   features;
+	GtkWidget                      *menu;
+
+	if (!gtk_tree_model_get_iter (model, &iter, path))
+		return FALSE;
+
+	individual = chat_members_view_dup_individual (model, &iter);
+	if (individual == NULL)
+		return FALSE;
+
+	features = EMPATHY_INDIVIDUAL_FEATURE_CHAT |
+		EMPATHY_INDIVIDUAL_FEATURE_CALL |
+		EMPATHY_INDIVIDUAL_FEATURE_LOG |
+		EMPATHY_INDIVIDUAL_FEATURE_INFO;
+
+	/* Members of rooms using channel specific handles (thanks XMPP...)
+	 * can't be added to the contact list as they are */
+	if ((tp_channel_group_get_flags (TP_CHANNEL (priv->tp_chat)) &
+	     TP_CHANNEL_GROUP_FLAG_CHANNEL_SPECIFIC_HANDLES) == 0)
+		features |= EMPATHY_INDIVIDUAL_FEATURE_ADD_CONTACT;
+
+	menu = empathy_individual_menu_new (individual, NULL, features, NULL);
+	g_object_unref (individual);
+
+	gtk_menu_attach_to_widget (GTK_MENU (menu), GTK_WIDGET (view), NULL);
+	gtk_widget_show (menu);
+	gtk_menu_popup (GTK_MENU (menu), NULL, NULL, NULL, NULL,
+			button, time);
+
+	/* Detach the menu once it's hidden so it's not kept until the view
+	 * is destroyed */
+	g_signal_connect (menu, "deactivate",
+		G_CALLBACK (chat_members_menu_deactivate_cb), NULL);
+
+	return TRUE;
+}
+
+static gboolean
+chat_members_view_button_press_event_cb (GtkTreeView    *view,
+					 GdkEventButton *event,
+					 EmpathyChat    *chat)
+{
+	GtkTreePath *path;
+	gboolean     shown;
+
+	if (event->button != 3)
+		return FALSE;
+
+	if (!gtk_tree_view_get_path_at_pos (view, event->x, event->y, &path,
+					    NULL, NULL, NULL))
+		return FALSE;
+
+	gtk_tree_selection_select_path (gtk_tree_view_get_selection (view),
+					path);
+	shown = chat_members_view_popup_menu (chat, view, path, event->button,
+					      event->time);
+	gtk_tree_path_free (path);
+
+	return shown;
+}
+
+/* Shift+F10 and the Menu key, on the selected member */
+static gboolean
+chat_members_view_popup_menu_cb (GtkTreeView *view,
+				 EmpathyChat *chat)
+{
+	GtkTreeModel *model;
+	GtkTreeIter   iter;
+	GtkTreePath  *path;
+	gboolean      shown;
+
+	if (!gtk_tree_selection_get_selected (
+		gtk_tree_view_get_selection (view), &model, &iter))
+		return FALSE;
+
+	path = gtk_tree_model_get_path (model, &iter);
+	shown = chat_members_view_popup_menu (chat, view, path, 0,
+					      gtk_get_current_event_time ());
+	gtk_tree_path_free (path);
+
+	return shown;
+}
+
+static void
+chat_members_tooltip_destroy_cb (GtkWidget   *widget,
+				 EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	tp_clear_object (&priv->members_tooltip);
+}
+
+static gboolean
+chat_members_view_query_tooltip_cb (GtkTreeView *view,
+				    gint         x,
+				    gint         y,
+				    gboolean     keyboard_mode,
+				    GtkTooltip  *tooltip,
+				    EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	FolksIndividual *individual;
+	GtkTreeModel    *model;
+	GtkTreeIter      iter;
+	GtkTreePath     *path;
+	static gint      running = 0;
+	gboolean         ret = FALSE;
+
+	/* Avoid an infinite loop. See GNOME bug #574377 */
+	if (running > 0)
+		return FALSE;
+
+	running++;
+
+	/* Don't show the tooltip if there's already a popup menu */
+	if (gtk_menu_get_for_attach_widget (GTK_WIDGET (view)) != NULL)
+		goto out;
+
+	if (!gtk_tree_view_get_tooltip_context (view, &x, &y, keyboard_mode,
+						&model, &path, &iter))
+		goto out;
+
+	gtk_tree_view_set_tooltip_row (view, tooltip, path);
+	gtk_tree_path_free (path);
+
+	individual = chat_members_view_dup_individual (model, &iter);
+	if (individual == NULL)
+		goto out;
+
+	if (priv->members_tooltip == NULL) {
+		priv->members_tooltip = empathy_individual_widget_new (individual,
+			EMPATHY_INDIVIDUAL_WIDGET_FOR_TOOLTIP |
+			EMPATHY_INDIVIDUAL_WIDGET_SHOW_LOCATION |
+			EMPATHY_INDIVIDUAL_WIDGET_SHOW_CLIENT_TYPES);
+		gtk_container_set_border_width (
+			GTK_CONTAINER (priv->members_tooltip), 8);
+		g_object_ref (priv->members_tooltip);
+
+		tp_g_signal_connect_object (priv->members_tooltip, "destroy",
+			G_CALLBACK (chat_members_tooltip_destroy_cb), chat, 0);
+
+		gtk_widget_show (priv->members_tooltip);
+	} else {
+		empathy_individual_widget_set_individual (
+			EMPATHY_INDIVIDUAL_WIDGET (priv->members_tooltip),
+			individual);
+	}
+
+	gtk_tooltip_set_custom (tooltip, priv->members_tooltip);
+	ret = TRUE;
+
+	g_object_unref (individual);
+out:
+	running--;
+
+	return ret;
+}
+
+static GtkWidget *
+chat_members_view_new (EmpathyChat *chat)
+{
+	EmpathyChatPriv   *priv = GET_PRIV (chat);
+	EmpathyMemberStore *store;
+	GtkWidget         *view;
+	GtkTreeViewColumn *column;
+	GtkCellRenderer   *renderer;
+
+	store = empathy_member_store_new (priv->tp_chat);
+	view = gtk_tree_view_new_with_model (GTK_TREE_MODEL (store));
+	g_object_unref (store);
+
+	gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (view), FALSE);
+	gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (view), TRUE);
+	gtk_tree_view_set_search_column (GTK_TREE_VIEW (view),
+					 EMPATHY_MEMBER_STORE_COL_NAME);
+
+	column = gtk_tree_view_column_new ();
+	gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_expand (column, TRUE);
+
+	renderer = gtk_cell_renderer_pixbuf_new ();
+	gtk_tree_view_column_pack_start (column, renderer, FALSE);
+	gtk_tree_view_column_add_attribute (column, renderer,
+		"icon-name", EMPATHY_MEMBER_STORE_COL_ICON_NAME);
+
+	renderer = gtk_cell_renderer_text_new ();
+	g_object_set (renderer, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+	gtk_tree_view_column_pack_start (column, renderer, TRUE);
+	gtk_tree_view_column_add_attribute (column, renderer,
+		"text", EMPATHY_MEMBER_STORE_COL_NAME);
+
+	gtk_tree_view_append_column (GTK_TREE_VIEW (view), column);
+
+	g_signal_connect (view, "row-activated",
+		G_CALLBACK (chat_members_view_row_activated_cb), chat);
+	g_signal_connect (view, "button-press-event",
+		G_CALLBACK (chat_members_view_button_press_event_cb), chat);
+	g_signal_connect (view, "popup-menu",
+		G_CALLBACK (chat_members_view_popup_menu_cb), chat);
+
+	gtk_widget_set_has_tooltip (view, TRUE);
+	g_signal_connect (view, "query-tooltip",
+		G_CALLBACK (chat_members_view_query_tooltip_cb), chat);
+
+	return view;
+}
+
 static void
 chat_update_contacts_visibility (EmpathyChat *chat,
 			 gboolean show)
@@ -2934,7 +3378,6 @@ chat_update_contacts_visibility (EmpathyChat *chat,
 	}
 
 	if (show && priv->contact_list_view == NULL) {
-		EmpathyIndividualStore *store;
 		gint                     min_width;
 		GtkAllocation            allocation;
 
@@ -2955,30 +3398,13 @@ chat_update_contacts_visibility (EmpathyChat *chat,
 		priv->contacts_visible_id = g_timeout_add (500,
 			chat_contacts_visible_timeout_cb, chat);
 
-		store = EMPATHY_INDIVIDUAL_STORE (
-				empathy_individual_store_channel_new ((TpChannel *) priv->tp_chat));
-
-		empathy_individual_store_set_show_groups (store, FALSE);
-
-		priv->contact_list_view = GTK_WIDGET (empathy_individual_view_new (store,
-			EMPATHY_INDIVIDUAL_VIEW_FEATURE_INDIVIDUAL_TOOLTIP,
-			EMPATHY_INDIVIDUAL_FEATURE_ADD_CONTACT |
-			EMPATHY_INDIVIDUAL_FEATURE_CHAT |
-			EMPATHY_INDIVIDUAL_FEATURE_CALL |
-			EMPATHY_INDIVIDUAL_FEATURE_LOG |
-			EMPATHY_INDIVIDUAL_FEATURE_INFO));
-
-		empathy_individual_view_set_show_offline (
-			EMPATHY_INDIVIDUAL_VIEW (priv->contact_list_view), TRUE);
-		empathy_individual_view_set_show_uninteresting (
-			EMPATHY_INDIVIDUAL_VIEW (priv->contact_list_view), TRUE);
+		priv->contact_list_view = chat_members_view_new (chat);
 
 		gtk_container_add (GTK_CONTAINER (priv->scrolled_window_contacts),
 				   priv->contact_list_view);
 
 		gtk_widget_show (priv->contact_list_view);
 		gtk_widget_show (priv->scrolled_window_contacts);
-		g_object_unref (store);
 	} else if (!show) {
 		priv->contacts_width = gtk_paned_get_position (GTK_PANED (priv->hpaned));
 		gtk_widget_hide (priv->scrolled_window_contacts);
@@ -3266,6 +3692,9 @@ chat_create_ui (EmpathyChat *chat)
 	g_signal_connect (chat->view, "focus_in_event",
 			  G_CALLBACK (chat_text_view_focus_in_event_cb),
 			  chat);
+	g_signal_connect (chat->view, "scrollback-trimmed",
+			  G_CALLBACK (chat_view_scrollback_trimmed_cb),
+			  chat);
 	gtk_container_add (GTK_CONTAINER (priv->scrolled_window_chat),
 			   GTK_WIDGET (chat->view));
 	gtk_widget_show (GTK_WIDGET (chat->view));
@@ -3411,6 +3840,10 @@ chat_finalize (GObject *object)
 		g_source_remove (priv->block_events_timeout_id);
 	}
 
+	if (priv->members_tooltip != NULL) {
+		g_object_unref (priv->members_tooltip);
+	}
+
 	g_free (priv->id);
 	g_free (priv->name);
 	g_free (priv->subject);
@@ -3426,7 +3859,6 @@ chat_constructed (GObject *object)
 {
 	EmpathyChat *chat = EMPATHY_CHAT (object);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	TplEntity *target;
 
 	if (priv->tp_chat != NULL) {
 		TpChannel *channel = TP_CHANNEL (priv->tp_chat);
@@ -3445,14 +3877,7 @@ chat_constructed (GObject *object)
 	 * longer needed. Pending messages are handled within
 	 * empathy_chat_set_tp_chat() so we don't have to care about them here.
 	 */
-	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
-		target = tpl_entity_new_from_room_id (priv->id);
-	else
-		target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
-
-	priv->log_walker = tpl_log_manager_walk_filtered_events (priv->log_manager, priv->account, target,
-								 TPL_EVENT_MASK_TEXT, chat_log_filter, chat);
-	g_object_unref (target);
+	chat_create_log_walker (chat);
 
 	if (priv->handle_type != TP_HANDLE_TYPE_ROOM) {
 		chat_add_logs (chat);
@@ -37,7 +37,7 @@
 #include "empathy-individual-edit-dialog.h"
 #include "empathy-individual-information-dialog.h"
 #include "empathy-individual-manager.h"
-#include "empathy-individual-store-channel.h"
+#include "empathy-log-index.h"
 #include "empathy-log-window.h"
 #include "empathy-request-util.h"
 #include "empathy-share-my-desktop.h"
@@ -1637,18 +1637,68 @@ log_menu_item_new (void)
   return item;
 }
 
+static void
+log_index_changed_cb (EmpathyLogIndex *log_index,
+    TpAccount *account,
+    const gchar *entity_id,
+    GtkWidget *item)
+{
+  EmpathyContact *contact;
+
+  contact = g_object_get_data (G_OBJECT (item), "contact");
+
+  if (account != empathy_contact_get_account (contact) ||
+      tp_strdiff (entity_id, empathy_contact_get_id (contact)))
+    return;
+
+  gtk_widget_set_sensitive (item,
+      empathy_contact_can_do_action (contact, EMPATHY_ACTION_VIEW_LOGS));
+}
+
+/* Whether @contact has logs may not be known yet when building the menu, so
+ * the item is updated once it is. */
+static void
+log_menu_item_set_contact (GtkWidget *item,
+    EmpathyContact *contact)
+{
+  EmpathyLogIndex *log_index;
+
+  if (contact == NULL)
+    {
+      gtk_widget_set_sensitive (item, FALSE);
+      return;
+    }
+
+  gtk_widget_set_sensitive (item,
+      empathy_contact_can_do_action (contact, EMPATHY_ACTION_VIEW_LOGS));
+
+  g_signal_connect_data (item, "activate",
+      G_CALLBACK (empathy_individual_log_menu_item_activated),
+      g_object_ref (contact), (GClosureNotify) g_object_unref, 0);
+
+  g_object_set_data_full (G_OBJECT (item), "contact", g_object_ref (contact),
+      g_object_unref);
+
+  log_index = empathy_log_index_dup_singleton ();
+  tp_g_signal_connect_object (log_index, "changed",
+      G_CALLBACK (log_index_changed_cb), item, 0);
+  g_object_unref (log_index);
+}
+
 static GtkWidget *
 log_menu_item_new_individual (FolksIndividual *individual)
 {
   GtkWidget *item;
+  EmpathyContact *contact;
 
   g_return_val_if_fail (FOLKS_IS_INDIVIDUAL (individual), NULL);
 
   item = log_menu_item_new ();
 
-  menu_item_set_first_contact (item, individual,
-      G_CALLBACK (empathy_individual_log_menu_item_activated),
+  contact = empathy_contact_dup_best_for_action (individual,
       EMPATHY_ACTION_VIEW_LOGS);
+  log_menu_item_set_contact (item, contact);
+  tp_clear_object (&contact);
 
   return item;
 }
@@ -1662,9 +1712,7 @@ log_menu_item_new_contact (EmpathyContact *contact)
 
   item = log_menu_item_new ();
 
-  menu_item_set_contact (item, contact,
-      G_CALLBACK (empathy_individual_log_menu_item_activated),
-      EMPATHY_ACTION_VIEW_LOGS);
+  log_menu_item_set_contact (item, contact);
 
   return item;
 }
@@ -2169,7 +2217,6 @@ static GtkWidget *
 add_menu_item_new_individual (EmpathyIndividualMenu *self,
     FolksIndividual *individual)
 {
-  EmpathyIndividualMenuPriv *priv = GET_PRIV (self);
   GtkWidget *item, *image;
   GeeSet *personas;
   GeeIterator *iter;
@@ -2192,28 +2239,6 @@ add_menu_item_new_individual (EmpathyIndividualMenu *self,
       if (contact == NULL)
         goto next;
 
-      /* be sure to use a not channel specific contact.
-       * TODO: Ideally tp-glib should do this for us (fdo #42702)*/
-      if (EMPATHY_IS_INDIVIDUAL_STORE_CHANNEL (priv->store))
-        {
-          TpChannel *channel;
-          TpChannelGroupFlags flags;
-
-          channel = empathy_individual_store_channel_get_channel (
-              EMPATHY_INDIVIDUAL_STORE_CHANNEL (priv->store));
-
-          flags = tp_channel_group_get_flags (channel);
-          if ((flags & TP_CHANNEL_GROUP_FLAG_CHANNEL_SPECIFIC_HANDLES) != 0)
-            {
-              /* Channel uses channel specific handles (thanks XMPP...) */
-              contact = tp_channel_group_get_contact_owner (channel, contact);
-
-              /* If we don't know the owner, we can't add the contact */
-              if (contact == NULL)
-                goto next;
-            }
-        }
-
       conn = tp_contact_get_connection (contact);
       if (conn == NULL)
         goto next;
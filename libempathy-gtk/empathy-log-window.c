@@ -40,6 +40,7 @@
 #include "empathy-gsettings.h"
 #include "empathy-images.h"
 #include "empathy-individual-information-dialog.h"
+#include "empathy-log-index.h"
 #include "empathy-request-util.h"
 #include "empathy-theme-manager.h"
 #include "empathy-ui-utils.h"
@@ -75,6 +76,16 @@ struct _EmpathyLogWindowPriv
 
   GtkTreeStore *store_events;
 
+  /* Calls to empathy-log-window.html functions not sent to the webview yet,
+   * see log_window_flush_script() */
+  GString *pending_script;
+  guint pending_calls;
+  /* offset of the last call in pending_script */
+  gsize pending_call_offset;
+  /* path of the row inserted by the last call, if any */
+  GtkTreePath *pending_insert_path;
+  guint flush_id;
+
   GtkWidget *account_chooser;
 
   gchar *last_find;
@@ -84,6 +95,7 @@ struct _EmpathyLogWindowPriv
 
   TplActionChain *chain;
   TplLogManager *log_manager;
+  EmpathyLogIndex *log_index;
 
   /* Hash of TpChannel<->TpAccount for use by the observer until we can
    * get a TpAccount from a TpConnection or wherever */
@@ -134,6 +146,10 @@ static void log_window_when_changed_cb           (GtkTreeSelection *selection,
                                                   EmpathyLogWindow *self);
 static void log_window_delete_menu_clicked_cb    (GtkMenuItem      *menuitem,
                                                   EmpathyLogWindow *self);
+static void log_window_log_index_changed_cb      (EmpathyLogIndex  *log_index,
+                                                  TpAccount        *account,
+                                                  const gchar      *entity_id,
+                                                  EmpathyLogWindow *self);
 static void start_spinner                        (void);
 
 static void log_window_create_observer           (EmpathyLogWindow *window);
@@ -236,6 +252,8 @@ static gboolean has_element;
 #define _date_copy(d) g_date_new_julian (g_date_get_julian (d))
 #endif
 
+typedef struct _FetchEvents FetchEvents;
+
 typedef struct
 {
   EmpathyLogWindow *self;
@@ -245,6 +263,8 @@ typedef struct
   TplEventTypeMask event_mask;
   EventSubtype subtype;
   guint count;
+  /* Set while fetching the events for @date */
+  FetchEvents *fetch;
 } Ctx;
 
 static Ctx *
@@ -349,6 +369,137 @@ toolbutton_av_clicked (GtkToolButton *toolbutton,
       video, gtk_get_current_event_time ());
 }
 
+/* Row updates are not sent to the webview one by one as executing a script is
+ * expensive and a single day of logs can have hundreds of rows. Calls are
+ * serialized to a JSON array which is passed to applyBatch() (see
+ * empathy-log-window.html) once we are back to the main loop, or once
+ * PENDING_CALLS_MAX calls are waiting. */
+#define PENDING_CALLS_MAX 1000
+
+static void
+log_window_flush_script (EmpathyLogWindow *self)
+{
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  tp_clear_pointer (&self->priv->pending_insert_path, gtk_tree_path_free);
+
+  if (self->priv->pending_script == NULL)
+    return;
+
+  g_string_append (self->priv->pending_script, "]);");
+
+  DEBUG ("Sending %u calls to the webview", self->priv->pending_calls);
+
+  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
+      self->priv->pending_script->str);
+
+  g_string_free (self->priv->pending_script, TRUE);
+  self->priv->pending_script = NULL;
+  self->priv->pending_calls = 0;
+}
+
+static gboolean
+log_window_flush_script_cb (gpointer user_data)
+{
+  EmpathyLogWindow *self = user_data;
+
+  self->priv->flush_id = 0;
+  log_window_flush_script (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+append_json_string (GString *string,
+    const gchar *str)
+{
+  const gchar *p;
+
+  g_string_append_c (string, '"');
+
+  for (p = str; p != NULL && *p != '\0'; p++)
+    {
+      guchar c = *p;
+
+      if (c == '"' || c == '\\')
+        {
+          g_string_append_c (string, '\\');
+          g_string_append_c (string, c);
+        }
+      else if (c < 0x20)
+        {
+          g_string_append_printf (string, "\\u%04x", c);
+        }
+      else if (c == 0xe2 && (guchar) p[1] == 0x80 &&
+          ((guchar) p[2] == 0xa8 || (guchar) p[2] == 0xa9))
+        {
+          /* U+2028 and U+2029 are valid in JSON but not in JavaScript
+           * strings */
+          g_string_append_printf (string, "\\u20%x", (guchar) p[2] - 0x80);
+          p += 2;
+        }
+      else
+        {
+          g_string_append_c (string, c);
+        }
+    }
+
+  g_string_append_c (string, '"');
+}
+
+static void
+append_json_path (GString *string,
+    GtkTreePath *path)
+{
+  gint *indices;
+  gint i, depth = 0;
+
+  indices = gtk_tree_path_get_indices_with_depth (path, &depth);
+
+  g_string_append_c (string, '[');
+
+  for (i = 0; i < depth; i++)
+    g_string_append_printf (string, i == 0 ? "%d" : ",%d", indices[i]);
+
+  g_string_append_c (string, ']');
+}
+
+/* Starts serializing a call to @method. Its arguments have to be appended to
+ * priv->pending_script, each one preceded by a comma, before calling
+ * log_window_end_call(). */
+static void
+log_window_begin_call (EmpathyLogWindow *self,
+    const gchar *method)
+{
+  if (self->priv->pending_script == NULL)
+    self->priv->pending_script = g_string_new ("javascript:applyBatch([");
+
+  self->priv->pending_call_offset = self->priv->pending_script->len;
+
+  if (self->priv->pending_calls > 0)
+    g_string_append_c (self->priv->pending_script, ',');
+
+  tp_clear_pointer (&self->priv->pending_insert_path, gtk_tree_path_free);
+
+  g_string_append_c (self->priv->pending_script, '[');
+  append_json_string (self->priv->pending_script, method);
+}
+
+static void
+log_window_end_call (EmpathyLogWindow *self)
+{
+  g_string_append_c (self->priv->pending_script, ']');
+
+  if (++self->priv->pending_calls >= PENDING_CALLS_MAX)
+    log_window_flush_script (self);
+  else if (self->priv->flush_id == 0)
+    self->priv->flush_id = g_idle_add (log_window_flush_script_cb, self);
+}
+
 static void
 insert_or_change_row (EmpathyLogWindow *self,
     const char *method,
@@ -356,11 +507,10 @@ insert_or_change_row (EmpathyLogWindow *self,
     GtkTreePath *path,
     GtkTreeIter *iter)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script, *text, *date, *stock_icon;
-  GString *escaped_text;
+  GString *script;
+  char *text, *date, *stock_icon;
   char *icon = NULL;
-  gint i;
+  gboolean insert;
 
   gtk_tree_model_get (model, iter,
       COL_EVENTS_TEXT, &text,
@@ -381,40 +531,41 @@ insert_or_change_row (EmpathyLogWindow *self,
       g_object_unref (icon_info);
     }
 
-  escaped_text = g_string_new (NULL);
+  insert = !tp_strdiff (method, "insertRow");
 
-  /* Only need to deal with «'» and «\».
-   *
-   * Note that these never appear in non-ascii utf8 characters, so just
-   * pretend like we have an ascii string...
-   */
-  for (i = 0; text && text[i]; i++)
+  if (!insert && self->priv->pending_insert_path != NULL &&
+      gtk_tree_path_compare (path, self->priv->pending_insert_path) == 0)
     {
-      gchar c = text[i];
+      /* Rows are appended empty and then set, so the last call usually
+       * inserted the very row which is now changed: insert it with its
+       * content right away. */
+      g_string_truncate (self->priv->pending_script,
+          self->priv->pending_call_offset);
+      self->priv->pending_calls--;
+      insert = TRUE;
+    }
 
-      if (c == '\'' || c == '\\')
-        g_string_append_c (escaped_text, '\\');
+  log_window_begin_call (self, insert ? "insertRow" : "changeRow");
+  script = self->priv->pending_script;
 
-      g_string_append_c (escaped_text, c);
-    }
+  g_string_append_c (script, ',');
+  append_json_path (script, path);
+  g_string_append_c (script, ',');
+  append_json_string (script, text);
+  g_string_append_c (script, ',');
+  append_json_string (script, icon);
+  g_string_append_c (script, ',');
+  append_json_string (script, date);
 
-  script = g_strdup_printf ("javascript:%s([%s], '%s', '%s', '%s');",
-      method,
-      g_strdelimit (str, ":", ','),
-      escaped_text->str,
-      icon != NULL ? icon : "",
-      date);
+  if (insert)
+    self->priv->pending_insert_path = gtk_tree_path_copy (path);
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
+  log_window_end_call (self);
 
-  g_string_free (escaped_text, TRUE);
-  g_free (str);
   g_free (text);
   g_free (date);
   g_free (stock_icon);
   g_free (icon);
-  g_free (script);
 }
 
 static void
@@ -440,17 +591,12 @@ store_events_row_deleted (GtkTreeModel *model,
     GtkTreePath *path,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script;
-
-  script = g_strdup_printf ("javascript:deleteRow([%s]);",
-      g_strdelimit (str, ":", ','));
+  log_window_begin_call (self, "deleteRow");
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
+  g_string_append_c (self->priv->pending_script, ',');
+  append_json_path (self->priv->pending_script, path);
 
-  g_free (str);
-  g_free (script);
+  log_window_end_call (self);
 }
 
 static void
@@ -459,18 +605,14 @@ store_events_has_child_rows (GtkTreeModel *model,
     GtkTreeIter *iter,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script;
-
-  script = g_strdup_printf ("javascript:hasChildRows([%s], %u);",
-      g_strdelimit (str, ":", ','),
-      gtk_tree_model_iter_has_child (model, iter));
+  log_window_begin_call (self, "hasChildRows");
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
+  g_string_append_c (self->priv->pending_script, ',');
+  append_json_path (self->priv->pending_script, path);
+  g_string_append (self->priv->pending_script,
+      gtk_tree_model_iter_has_child (model, iter) ? ",true" : ",false");
 
-  g_free (str);
-  g_free (script);
+  log_window_end_call (self);
 }
 
 static void
@@ -480,29 +622,21 @@ store_events_rows_reordered (GtkTreeModel *model,
     int *new_order,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
   int i, children = gtk_tree_model_iter_n_children (model, iter);
-  char **new_order_strv, *new_order_s;
-  char *script;
 
-  new_order_strv = g_new0 (char *, children + 1);
+  log_window_begin_call (self, "reorderRows");
 
-  for (i = 0; i < children; i++)
-    new_order_strv[i] = g_strdup_printf ("%i", new_order[i]);
-
-  new_order_s = g_strjoinv (",", new_order_strv);
+  g_string_append_c (self->priv->pending_script, ',');
+  append_json_path (self->priv->pending_script, path);
+  g_string_append (self->priv->pending_script, ",[");
 
-  script = g_strdup_printf ("javascript:reorderRows([%s], [%s]);",
-      str == NULL ? "" : g_strdelimit (str, ":", ','),
-      new_order_s);
+  for (i = 0; i < children; i++)
+    g_string_append_printf (self->priv->pending_script,
+        i == 0 ? "%d" : ",%d", new_order[i]);
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
+  g_string_append_c (self->priv->pending_script, ']');
 
-  g_free (str);
-  g_free (script);
-  g_free (new_order_s);
-  g_strfreev (new_order_strv);
+  log_window_end_call (self);
 }
 
 static gboolean
@@ -566,6 +700,7 @@ empathy_log_window_dispose (GObject *object)
 
   tp_clear_object (&self->priv->observer);
   tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->log_index);
   tp_clear_object (&self->priv->selected_account);
   tp_clear_object (&self->priv->selected_contact);
   tp_clear_object (&self->priv->events_contact);
@@ -576,6 +711,20 @@ empathy_log_window_dispose (GObject *object)
 
   tp_clear_object (&self->priv->store_events);
 
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  if (self->priv->pending_script != NULL)
+    {
+      g_string_free (self->priv->pending_script, TRUE);
+      self->priv->pending_script = NULL;
+    }
+
+  tp_clear_pointer (&self->priv->pending_insert_path, gtk_tree_path_free);
+
   G_OBJECT_CLASS (empathy_log_window_parent_class)->dispose (object);
 }
 
@@ -623,6 +772,9 @@ empathy_log_window_init (EmpathyLogWindow *self)
   self->priv->camera_monitor = tpaw_camera_monitor_dup_singleton ();
 
   self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  self->priv->log_index = empathy_log_index_dup_singleton ();
+  tp_g_signal_connect_object (self->priv->log_index, "changed",
+      G_CALLBACK (log_window_log_index_changed_cb), self, 0);
 
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
   self->priv->gsettings_desktop = g_settings_new (
@@ -1108,16 +1260,24 @@ model_is_parent (GtkTreeModel *model,
       is_same_confroom (event, stored_event)))
     {
       GtkTreeIter child;
-      gint64 timestamp;
+      gint64 first, last, timestamp;
+
+      gtk_tree_model_iter_nth_child (model, &child, iter, 0);
+      gtk_tree_model_get (model, &child,
+          COL_EVENTS_TS, &first,
+          -1);
 
       gtk_tree_model_iter_nth_child (model, &child, iter,
           gtk_tree_model_iter_n_children (model, iter) - 1);
-
       gtk_tree_model_get (model, &child,
-          COL_EVENTS_TS, &timestamp,
+          COL_EVENTS_TS, &last,
           -1);
 
-      if (ABS (tpl_event_get_timestamp (event) - timestamp) < MAX_GAP)
+      /* Days are not fetched in order so the event may be older than the
+       * ones already in this conversation */
+      timestamp = tpl_event_get_timestamp (event);
+
+      if (timestamp > first - MAX_GAP && timestamp < last + MAX_GAP)
         {
           /* The gap is smaller than 30 min */
           found = TRUE;
@@ -1190,6 +1350,34 @@ get_parent_iter_for_message (TplEvent *event,
 
   if (parent_found)
     {
+      gint64 parent_ts;
+
+      gtk_tree_model_get (model, &iter,
+          COL_EVENTS_TS, &parent_ts,
+          -1);
+
+      /* Days are not fetched in order: the conversation now starts with
+       * this older event */
+      if (tpl_event_get_timestamp (event) < parent_ts)
+        {
+          GDateTime *date;
+          gchar *pretty_date;
+
+          date = g_date_time_new_from_unix_local (
+              tpl_event_get_timestamp (event));
+
+          pretty_date = g_date_time_format (date,
+              C_("A date with the time", "%A, %e %B %Y %X"));
+
+          gtk_tree_store_set (store, &iter,
+              COL_EVENTS_TS, tpl_event_get_timestamp (event),
+              COL_EVENTS_PRETTY_DATE, pretty_date,
+              -1);
+
+          g_free (pretty_date);
+          g_date_time_unref (date);
+        }
+
       *parent = iter;
     }
   else
@@ -1630,7 +1818,8 @@ model_has_date (GtkTreeModel *model,
 }
 
 static void
-get_events_for_date (TplActionChain *chain, gpointer user_data);
+log_window_fetch_events (EmpathyLogWindow *self,
+    GList *jobs);
 
 static void
 populate_events_from_search_hits (GList *accounts,
@@ -1640,7 +1829,7 @@ populate_events_from_search_hits (GList *accounts,
   TplEventTypeMask event_mask;
   EventSubtype subtype;
   GDate *anytime;
-  GList *l;
+  GList *l, *jobs = NULL;
   gboolean is_anytime = FALSE;
 
   if (!log_window_get_selected (log_window,
@@ -1684,11 +1873,12 @@ populate_events_from_search_hits (GList *accounts,
 
           ctx = ctx_new (log_window, hit->account, hit->target, hit->date,
               event_mask, subtype, log_window->priv->count);
-          _tpl_action_chain_append (log_window->priv->chain,
-              get_events_for_date, ctx);
+          jobs = g_list_prepend (jobs, ctx);
         }
     }
 
+  log_window_fetch_events (log_window, jobs);
+
   start_spinner ();
   _tpl_action_chain_start (log_window->priv->chain);
 
@@ -2018,6 +2208,7 @@ log_window_find_populate (EmpathyLogWindow *self,
       self);
 
   /* highlight the search text */
+  log_window_flush_script (self);
   webkit_web_view_mark_text_matches (WEBKIT_WEB_VIEW (self->priv->webview),
       search_criteria, FALSE, 0);
 
@@ -2274,8 +2465,12 @@ log_window_update_what_sensitivity (EmpathyLogWindow *self)
           TpAccount *account = acc->data;
           TplEntity *target = targ->data;
 
-          if (tpl_log_manager_exists (self->priv->log_manager,
-                  account, target, type))
+          gboolean exists;
+
+          /* If we don't know yet, keep it sensitive until
+           * log_window_log_index_changed_cb() tells us otherwise */
+          if (!empathy_log_index_lookup (self->priv->log_index,
+                  account, target, type, &exists) || exists)
             {
               /* And then we set it (and its subtypes, again, if any)
                * as sensitive if there are logs of that type. */
@@ -2289,6 +2484,17 @@ log_window_update_what_sensitivity (EmpathyLogWindow *self)
   g_list_free_full (targets, g_object_unref);
 }
 
+static void
+log_window_log_index_changed_cb (EmpathyLogIndex *log_index,
+    TpAccount *account,
+    const gchar *entity_id,
+    EmpathyLogWindow *self)
+{
+  /* All the answers we need are cached by now, recomputing everything is
+   * cheap */
+  log_window_update_what_sensitivity (self);
+}
+
 static void
 log_window_who_changed_cb (GtkTreeSelection *selection,
     EmpathyLogWindow *self)
@@ -2573,10 +2779,15 @@ static void
 log_window_find_row (EmpathyLogWindow *self,
     GdkEventButton *event)
 {
-  WebKitHitTestResult *hit = webkit_web_view_get_hit_test_result (
-      WEBKIT_WEB_VIEW (self->priv->webview), event);
+  WebKitHitTestResult *hit;
   WebKitDOMNode *inner_node;
 
+  /* The DOM has to be up to date with the model */
+  log_window_flush_script (self);
+
+  hit = webkit_web_view_get_hit_test_result (
+      WEBKIT_WEB_VIEW (self->priv->webview), event);
+
   tp_clear_object (&self->priv->events_contact);
 
   g_object_get (hit,
@@ -3141,9 +3352,10 @@ log_window_maybe_expand_events (void)
 
   /* If there's only one result, expand it */
   if (gtk_tree_model_iter_n_children (model, NULL) == 1)
-    webkit_web_view_execute_script (
-        WEBKIT_WEB_VIEW (log_window->priv->webview),
-        "javascript:expandAll()");
+    {
+      log_window_begin_call (log_window, "expandAll");
+      log_window_end_call (log_window);
+    }
 }
 
 static gboolean
@@ -3164,17 +3376,88 @@ show_spinner (gpointer data)
 }
 
 static void
-show_events (TplActionChain *chain,
-    gpointer user_data)
+log_window_show_events_page (void)
 {
-  log_window_maybe_expand_events ();
   gtk_spinner_stop (GTK_SPINNER (log_window->priv->spinner));
   gtk_notebook_set_current_page (GTK_NOTEBOOK (log_window->priv->notebook),
       PAGE_EVENTS);
+}
+
+static void
+show_events (TplActionChain *chain,
+    gpointer user_data)
+{
+  log_window_maybe_expand_events ();
+  log_window_show_events_page ();
 
   _tpl_action_chain_continue (chain);
 }
 
+/* Maximum number of tpl_log_manager_get_events_for_date_async() calls
+ * running at the same time */
+#define FETCH_EVENTS_MAX_PENDING 4
+
+/* A single step of priv->chain fetching the events of several dates, a few
+ * of them at once. The events are displayed as soon as they are received. */
+struct _FetchEvents
+{
+  /* owned Ctx, most recent date first */
+  GQueue *jobs;
+  /* number of calls waiting for their callback */
+  guint pending;
+  /* priv->count when the fetch was requested */
+  guint count;
+  TplActionChain *chain;
+};
+
+static void
+fetch_events_free (FetchEvents *fetch)
+{
+  g_queue_free_full (fetch->jobs, (GDestroyNotify) ctx_free);
+  g_slice_free (FetchEvents, fetch);
+}
+
+static void
+log_window_got_messages_for_date_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data);
+
+static void
+fetch_events_next (FetchEvents *fetch)
+{
+  if (log_window->priv->count != fetch->count)
+    {
+      /* The selection changed, don't bother fetching the remaining dates */
+      g_queue_foreach (fetch->jobs, (GFunc) ctx_free, NULL);
+      g_queue_clear (fetch->jobs);
+    }
+
+  while (fetch->pending < FETCH_EVENTS_MAX_PENDING &&
+      !g_queue_is_empty (fetch->jobs))
+    {
+      Ctx *ctx = g_queue_pop_head (fetch->jobs);
+
+      ctx->fetch = fetch;
+      fetch->pending++;
+
+      tpl_log_manager_get_events_for_date_async (ctx->self->priv->log_manager,
+          ctx->account, ctx->entity, ctx->event_mask,
+          ctx->date,
+          log_window_got_messages_for_date_cb,
+          ctx);
+    }
+
+  if (fetch->pending == 0)
+    {
+      /* Wait for all the pending calls, even the cancelled ones, before
+       * moving on as the chain has to be continued only once */
+      TplActionChain *chain = fetch->chain;
+
+      fetch_events_free (fetch);
+      _tpl_action_chain_continue (chain);
+    }
+}
+
 static void
 start_spinner (void)
 {
@@ -3192,6 +3475,7 @@ log_window_got_messages_for_date_cb (GObject *manager,
     gpointer user_data)
 {
   Ctx *ctx = user_data;
+  FetchEvents *fetch = ctx->fetch;
   GtkTreeModel *model;
   GtkTreeIter iter;
   GList *events;
@@ -3199,9 +3483,15 @@ log_window_got_messages_for_date_cb (GObject *manager,
   GError *error = NULL;
   gint n;
 
+  fetch->pending--;
+
   if (log_window == NULL)
     {
       ctx_free (ctx);
+
+      if (fetch->pending == 0)
+        fetch_events_free (fetch);
+
       return;
     }
 
@@ -3276,46 +3566,78 @@ log_window_got_messages_for_date_cb (GObject *manager,
   if (n >= 0 && gtk_tree_model_iter_nth_child (model, &iter, NULL, n))
     {
       GtkTreePath *path;
-      char *str, *script;
 
       path = gtk_tree_model_get_path (model, &iter);
-      str = gtk_tree_path_to_string (path);
 
-      script = g_strdup_printf ("javascript:scrollToRow([%s]);",
-          g_strdelimit (str, ":", ','));
-
-      webkit_web_view_execute_script (
-          WEBKIT_WEB_VIEW (log_window->priv->webview),
-          script);
+      log_window_begin_call (log_window, "scrollToRow");
+      g_string_append_c (log_window->priv->pending_script, ',');
+      append_json_path (log_window->priv->pending_script, path);
+      log_window_end_call (log_window);
 
       gtk_tree_path_free (path);
-      g_free (str);
-      g_free (script);
+
+      /* Don't wait for the other dates to display what we have */
+      log_window_show_events_page ();
     }
 
+  /* Send the whole day at once */
+  log_window_flush_script (log_window);
+
  out:
   ctx_free (ctx);
 
-  _tpl_action_chain_continue (log_window->priv->chain);
+  fetch_events_next (fetch);
 }
 
 static void
-get_events_for_date (TplActionChain *chain, gpointer user_data)
+get_events_for_dates (TplActionChain *chain, gpointer user_data)
 {
-  Ctx *ctx = user_data;
+  FetchEvents *fetch = user_data;
 
-  tpl_log_manager_get_events_for_date_async (ctx->self->priv->log_manager,
-      ctx->account, ctx->entity, ctx->event_mask,
-      ctx->date,
-      log_window_got_messages_for_date_cb,
-      ctx);
+  fetch->chain = chain;
+  fetch_events_next (fetch);
+}
+
+static gint
+compare_ctx_by_date_desc (gconstpointer a,
+    gconstpointer b)
+{
+  const Ctx *ctx_a = a, *ctx_b = b;
+
+  return g_date_compare (ctx_b->date, ctx_a->date);
+}
+
+/* Takes ownership of @jobs, a list of Ctx */
+static void
+log_window_fetch_events (EmpathyLogWindow *self,
+    GList *jobs)
+{
+  FetchEvents *fetch;
+  GList *l;
+
+  if (jobs == NULL)
+    return;
+
+  fetch = g_slice_new0 (FetchEvents);
+  fetch->jobs = g_queue_new ();
+  fetch->count = self->priv->count;
+
+  /* Most recent first, that's what the user is the more likely to look at */
+  jobs = g_list_sort (jobs, compare_ctx_by_date_desc);
+
+  for (l = jobs; l != NULL; l = g_list_next (l))
+    g_queue_push_tail (fetch->jobs, l->data);
+
+  g_list_free (jobs);
+
+  _tpl_action_chain_append (self->priv->chain, get_events_for_dates, fetch);
 }
 
 static void
 log_window_get_messages_for_dates (EmpathyLogWindow *self,
     GList *dates)
 {
-  GList *accounts, *targets, *acc, *targ, *l;
+  GList *accounts, *targets, *acc, *targ, *l, *jobs = NULL;
   TplEventTypeMask event_mask;
   EventSubtype subtype;
   GDate *date, *anytime, *separator;
@@ -3348,7 +3670,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
 
               ctx = ctx_new (self, account, target, date, event_mask, subtype,
                   self->priv->count);
-              _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+              jobs = g_list_prepend (jobs, ctx);
             }
           else
             {
@@ -3373,7 +3695,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
                     {
                       ctx = ctx_new (self, account, target, d,
                           event_mask, subtype, self->priv->count);
-                      _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+                      jobs = g_list_prepend (jobs, ctx);
                     }
 
                   g_date_free (d);
@@ -3382,6 +3704,8 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
         }
     }
 
+  log_window_fetch_events (self, jobs);
+
   start_spinner ();
   _tpl_action_chain_start (self->priv->chain);
 
@@ -3719,6 +4043,8 @@ log_window_logger_clear_account_cb (TpProxy *proxy,
   if (error != NULL)
     g_warning ("Error when clearing logs: %s", error->message);
 
+  empathy_log_index_invalidate (self->priv->log_index, NULL, NULL);
+
   /* Refresh the log viewer so the logs are cleared if the account
    * has been deleted */
   gtk_tree_store_clear (self->priv->store_events);
@@ -0,0 +1,472 @@
+/*
+ * empathy-member-store.c - Source for the list of members of a chat room
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-member-store.h"
+
+#include "empathy-images.h"
+#include "empathy-ui-utils.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_CONTACT
+#include "empathy-debug.h"
+
+/* A flat list of the members of a room, sorted on their name. It doesn't
+ * create a FolksIndividual per member, only keeping what is displayed in the
+ * list of a chat. */
+
+struct _EmpathyMemberStorePriv
+{
+  /* Can be NULL */
+  EmpathyTpChat *tp_chat;
+
+  /* EmpathyContact => owned Row */
+  GHashTable *rows;
+};
+
+typedef struct
+{
+  GtkTreeIter iter;
+  /* owned, the COL_SORT_KEY column points to it so comparing two rows
+   * doesn't copy their keys */
+  gchar *sort_key;
+} Row;
+
+enum
+{
+  PROP_0,
+  PROP_TP_CHAT,
+};
+
+G_DEFINE_TYPE (EmpathyMemberStore, empathy_member_store, GTK_TYPE_LIST_STORE);
+
+static void
+row_free (Row *row)
+{
+  g_free (row->sort_key);
+  g_slice_free (Row, row);
+}
+
+static const gchar *
+get_icon_name (EmpathyContact *contact,
+    TpChannelChatState state)
+{
+  if (state == TP_CHANNEL_CHAT_STATE_COMPOSING)
+    return EMPATHY_IMAGE_TYPING;
+
+  return empathy_icon_name_for_contact (contact);
+}
+
+static void
+contact_notify_cb (EmpathyContact *contact,
+    GParamSpec *pspec,
+    EmpathyMemberStore *self)
+{
+  Row *row;
+
+  row = g_hash_table_lookup (self->priv->rows, contact);
+  if (row == NULL)
+    return;
+
+  if (!tp_strdiff (pspec->name, "alias"))
+    {
+      const gchar *name = empathy_contact_get_alias (contact);
+      gchar *old_key = row->sort_key;
+
+      /* The row points to the old key until it's updated */
+      row->sort_key = g_utf8_collate_key (name, -1);
+
+      gtk_list_store_set (GTK_LIST_STORE (self), &row->iter,
+          EMPATHY_MEMBER_STORE_COL_NAME, name,
+          EMPATHY_MEMBER_STORE_COL_SORT_KEY, row->sort_key,
+          -1);
+
+      g_free (old_key);
+    }
+  else if (!tp_strdiff (pspec->name, "presence"))
+    {
+      TpChannelChatState state;
+
+      gtk_tree_model_get (GTK_TREE_MODEL (self), &row->iter,
+          EMPATHY_MEMBER_STORE_COL_CHAT_STATE, &state,
+          -1);
+
+      gtk_list_store_set (GTK_LIST_STORE (self), &row->iter,
+          EMPATHY_MEMBER_STORE_COL_PRESENCE_TYPE,
+            empathy_contact_get_presence (contact),
+          EMPATHY_MEMBER_STORE_COL_ICON_NAME, get_icon_name (contact, state),
+          -1);
+    }
+}
+
+/**
+ * empathy_member_store_add_members:
+ * @self: a #EmpathyMemberStore
+ * @contacts: a #GPtrArray of #EmpathyContact
+ *
+ * Adds the members of @contacts not in @self yet. The rows are sorted
+ * once they have all been added, so this is much faster than adding them
+ * one by one when there are many of them.
+ */
+void
+empathy_member_store_add_members (EmpathyMemberStore *self,
+    GPtrArray *contacts)
+{
+  GtkListStore *store = GTK_LIST_STORE (self);
+  GtkTreeSortable *sortable = GTK_TREE_SORTABLE (self);
+  gint sort_column;
+  GtkSortType order;
+  gboolean resort = FALSE;
+  guint i;
+
+  g_return_if_fail (EMPATHY_IS_MEMBER_STORE (self));
+
+  if (contacts->len > 1 &&
+      gtk_tree_sortable_get_sort_column_id (sortable, &sort_column, &order))
+    {
+      gtk_tree_sortable_set_sort_column_id (sortable,
+          GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, order);
+      resort = TRUE;
+    }
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      EmpathyContact *contact = g_ptr_array_index (contacts, i);
+      const gchar *name;
+      Row *row;
+
+      if (g_hash_table_contains (self->priv->rows, contact))
+        continue;
+
+      name = empathy_contact_get_alias (contact);
+
+      row = g_slice_new0 (Row);
+      row->sort_key = g_utf8_collate_key (name, -1);
+
+      gtk_list_store_insert_with_values (store, &row->iter, -1,
+          EMPATHY_MEMBER_STORE_COL_CONTACT, contact,
+          EMPATHY_MEMBER_STORE_COL_NAME, name,
+          EMPATHY_MEMBER_STORE_COL_ICON_NAME,
+            get_icon_name (contact, TP_CHANNEL_CHAT_STATE_INACTIVE),
+          EMPATHY_MEMBER_STORE_COL_PRESENCE_TYPE,
+            empathy_contact_get_presence (contact),
+          EMPATHY_MEMBER_STORE_COL_CHAT_STATE, TP_CHANNEL_CHAT_STATE_INACTIVE,
+          EMPATHY_MEMBER_STORE_COL_SORT_KEY, row->sort_key,
+          -1);
+
+      g_hash_table_insert (self->priv->rows, g_object_ref (contact), row);
+
+      g_signal_connect (contact, "notify",
+          G_CALLBACK (contact_notify_cb), self);
+    }
+
+  if (resort)
+    gtk_tree_sortable_set_sort_column_id (sortable, sort_column, order);
+}
+
+void
+empathy_member_store_remove_members (EmpathyMemberStore *self,
+    GPtrArray *contacts)
+{
+  guint i;
+
+  g_return_if_fail (EMPATHY_IS_MEMBER_STORE (self));
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      EmpathyContact *contact = g_ptr_array_index (contacts, i);
+      Row *row;
+
+      row = g_hash_table_lookup (self->priv->rows, contact);
+      if (row == NULL)
+        continue;
+
+      g_signal_handlers_disconnect_by_func (contact, contact_notify_cb, self);
+      gtk_list_store_remove (GTK_LIST_STORE (self), &row->iter);
+      g_hash_table_remove (self->priv->rows, contact);
+    }
+}
+
+void
+empathy_member_store_set_chat_state (EmpathyMemberStore *self,
+    EmpathyContact *contact,
+    TpChannelChatState state)
+{
+  Row *row;
+
+  g_return_if_fail (EMPATHY_IS_MEMBER_STORE (self));
+
+  row = g_hash_table_lookup (self->priv->rows, contact);
+  if (row == NULL)
+    return;
+
+  gtk_list_store_set (GTK_LIST_STORE (self), &row->iter,
+      EMPATHY_MEMBER_STORE_COL_CHAT_STATE, state,
+      EMPATHY_MEMBER_STORE_COL_ICON_NAME, get_icon_name (contact, state),
+      -1);
+}
+
+static void
+tp_chat_members_changed_cb (EmpathyTpChat *tp_chat,
+    GPtrArray *added,
+    GPtrArray *removed,
+    EmpathyContact *actor,
+    guint reason,
+    const gchar *message,
+    EmpathyMemberStore *self)
+{
+  if (removed != NULL)
+    empathy_member_store_remove_members (self, removed);
+
+  if (added != NULL)
+    empathy_member_store_add_members (self, added);
+}
+
+static void
+tp_chat_member_renamed_cb (EmpathyTpChat *tp_chat,
+    EmpathyContact *old_contact,
+    EmpathyContact *new_contact,
+    guint reason,
+    const gchar *message,
+    EmpathyMemberStore *self)
+{
+  GPtrArray *contacts;
+
+  contacts = g_ptr_array_sized_new (1);
+
+  g_ptr_array_add (contacts, old_contact);
+  empathy_member_store_remove_members (self, contacts);
+
+  g_ptr_array_index (contacts, 0) = new_contact;
+  empathy_member_store_add_members (self, contacts);
+
+  g_ptr_array_unref (contacts);
+}
+
+static void
+tp_chat_contact_chat_state_changed_cb (TpTextChannel *channel,
+    TpContact *tp_contact,
+    TpChannelChatState state,
+    EmpathyMemberStore *self)
+{
+  EmpathyContact *contact;
+
+  contact = empathy_contact_dup_from_tp_contact (tp_contact);
+
+  /* We don't care about our own chat composing states */
+  if (!empathy_contact_is_user (contact))
+    {
+      DEBUG ("Contact %s entered chat state %d",
+          tp_contact_get_identifier (tp_contact), state);
+
+      empathy_member_store_set_chat_state (self, contact, state);
+    }
+
+  g_object_unref (contact);
+}
+
+static void
+member_store_set_tp_chat (EmpathyMemberStore *self,
+    EmpathyTpChat *tp_chat)
+{
+  GPtrArray *contacts;
+  GList *members, *l;
+
+  g_assert (self->priv->tp_chat == NULL); /* construct only */
+
+  if (tp_chat == NULL)
+    return;
+
+  self->priv->tp_chat = g_object_ref (tp_chat);
+
+  /* Load the initial members at once */
+  members = empathy_tp_chat_get_members (tp_chat);
+  contacts = g_ptr_array_new_full (g_list_length (members), g_object_unref);
+
+  for (l = members; l != NULL; l = g_list_next (l))
+    g_ptr_array_add (contacts, l->data);
+
+  g_list_free (members);
+
+  empathy_member_store_add_members (self, contacts);
+  g_ptr_array_unref (contacts);
+
+  tp_g_signal_connect_object (tp_chat, "members-changed",
+      G_CALLBACK (tp_chat_members_changed_cb), self, 0);
+  tp_g_signal_connect_object (tp_chat, "member-renamed",
+      G_CALLBACK (tp_chat_member_renamed_cb), self, 0);
+  tp_g_signal_connect_object (tp_chat, "contact-chat-state-changed",
+      G_CALLBACK (tp_chat_contact_chat_state_changed_cb), self, 0);
+}
+
+static gint
+sort_key_compare (GtkTreeModel *model,
+    GtkTreeIter *iter_a,
+    GtkTreeIter *iter_b,
+    gpointer user_data)
+{
+  const gchar *key_a, *key_b;
+
+  /* Pointers are not copied, unlike strings */
+  gtk_tree_model_get (model, iter_a,
+      EMPATHY_MEMBER_STORE_COL_SORT_KEY, &key_a,
+      -1);
+  gtk_tree_model_get (model, iter_b,
+      EMPATHY_MEMBER_STORE_COL_SORT_KEY, &key_b,
+      -1);
+
+  return g_strcmp0 (key_a, key_b);
+}
+
+static void
+member_store_dispose (GObject *object)
+{
+  EmpathyMemberStore *self = EMPATHY_MEMBER_STORE (object);
+
+  if (self->priv->rows != NULL)
+    {
+      GHashTableIter iter;
+      gpointer contact;
+
+      g_hash_table_iter_init (&iter, self->priv->rows);
+      while (g_hash_table_iter_next (&iter, &contact, NULL))
+        g_signal_handlers_disconnect_by_func (contact, contact_notify_cb,
+            self);
+
+      /* The rows point to the keys */
+      gtk_list_store_clear (GTK_LIST_STORE (self));
+      tp_clear_pointer (&self->priv->rows, g_hash_table_unref);
+    }
+
+  g_clear_object (&self->priv->tp_chat);
+
+  G_OBJECT_CLASS (empathy_member_store_parent_class)->dispose (object);
+}
+
+static void
+member_store_get_property (GObject *object,
+    guint param_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyMemberStore *self = EMPATHY_MEMBER_STORE (object);
+
+  switch (param_id)
+    {
+    case PROP_TP_CHAT:
+      g_value_set_object (value, self->priv->tp_chat);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
+      break;
+    };
+}
+
+static void
+member_store_set_property (GObject *object,
+    guint param_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  switch (param_id)
+    {
+    case PROP_TP_CHAT:
+      member_store_set_tp_chat (EMPATHY_MEMBER_STORE (object),
+          g_value_get_object (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
+      break;
+    };
+}
+
+static void
+empathy_member_store_class_init (EmpathyMemberStoreClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = member_store_dispose;
+  object_class->get_property = member_store_get_property;
+  object_class->set_property = member_store_set_property;
+
+  g_object_class_install_property (object_class,
+      PROP_TP_CHAT,
+      g_param_spec_object ("tp-chat",
+          "Chat",
+          "The chat whose members are listed",
+          EMPATHY_TYPE_TP_CHAT,
+          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS));
+
+  g_type_class_add_private (object_class, sizeof (EmpathyMemberStorePriv));
+}
+
+static void
+empathy_member_store_init (EmpathyMemberStore *self)
+{
+  GType types[] = {
+    EMPATHY_TYPE_CONTACT,         /* contact */
+    G_TYPE_STRING,                /* name */
+    G_TYPE_STRING,                /* icon name */
+    G_TYPE_UINT,                  /* presence type */
+    G_TYPE_UINT,                  /* chat state */
+    G_TYPE_POINTER,               /* sort key */
+  };
+
+  G_STATIC_ASSERT (G_N_ELEMENTS (types) == EMPATHY_MEMBER_STORE_COL_COUNT);
+
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_MEMBER_STORE, EmpathyMemberStorePriv);
+
+  self->priv->rows = g_hash_table_new_full (NULL, NULL, g_object_unref,
+      (GDestroyNotify) row_free);
+
+  gtk_list_store_set_column_types (GTK_LIST_STORE (self),
+      EMPATHY_MEMBER_STORE_COL_COUNT, types);
+
+  gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (self),
+      EMPATHY_MEMBER_STORE_COL_SORT_KEY, sort_key_compare, NULL, NULL);
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+      EMPATHY_MEMBER_STORE_COL_SORT_KEY, GTK_SORT_ASCENDING);
+}
+
+/**
+ * empathy_member_store_new:
+ * @tp_chat: (allow-none): the chat whose members are listed, or %NULL to
+ *   fill the store with empathy_member_store_add_members()
+ *
+ * Returns: a new #EmpathyMemberStore
+ */
+EmpathyMemberStore *
+empathy_member_store_new (EmpathyTpChat *tp_chat)
+{
+  g_return_val_if_fail (tp_chat == NULL || EMPATHY_IS_TP_CHAT (tp_chat),
+      NULL);
+
+  return g_object_new (EMPATHY_TYPE_MEMBER_STORE,
+      "tp-chat", tp_chat,
+      NULL);
+}
+
+EmpathyTpChat *
+empathy_member_store_get_tp_chat (EmpathyMemberStore *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_MEMBER_STORE (self), NULL);
+
+  return self->priv->tp_chat;
+}
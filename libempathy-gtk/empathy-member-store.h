@@ -0,0 +1,81 @@
+/*
+ * empathy-member-store.h - Header for the list of members of a chat room
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_MEMBER_STORE_H__
+#define __EMPATHY_MEMBER_STORE_H__
+
+#include <gtk/gtk.h>
+
+#include "empathy-contact.h"
+#include "empathy-tp-chat.h"
+
+G_BEGIN_DECLS
+
+#define EMPATHY_TYPE_MEMBER_STORE         (empathy_member_store_get_type ())
+#define EMPATHY_MEMBER_STORE(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), EMPATHY_TYPE_MEMBER_STORE, EmpathyMemberStore))
+#define EMPATHY_MEMBER_STORE_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), EMPATHY_TYPE_MEMBER_STORE, EmpathyMemberStoreClass))
+#define EMPATHY_IS_MEMBER_STORE(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), EMPATHY_TYPE_MEMBER_STORE))
+#define EMPATHY_IS_MEMBER_STORE_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), EMPATHY_TYPE_MEMBER_STORE))
+#define EMPATHY_MEMBER_STORE_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), EMPATHY_TYPE_MEMBER_STORE, EmpathyMemberStoreClass))
+
+typedef struct _EmpathyMemberStore EmpathyMemberStore;
+typedef struct _EmpathyMemberStoreClass EmpathyMemberStoreClass;
+typedef struct _EmpathyMemberStorePriv EmpathyMemberStorePriv;
+
+struct _EmpathyMemberStore
+{
+  GtkListStore parent;
+  EmpathyMemberStorePriv *priv;
+};
+
+struct _EmpathyMemberStoreClass
+{
+  GtkListStoreClass parent_class;
+};
+
+typedef enum
+{
+  EMPATHY_MEMBER_STORE_COL_CONTACT, /* EmpathyContact */
+  EMPATHY_MEMBER_STORE_COL_NAME, /* string */
+  EMPATHY_MEMBER_STORE_COL_ICON_NAME, /* string, status or typing icon */
+  EMPATHY_MEMBER_STORE_COL_PRESENCE_TYPE, /* TpConnectionPresenceType */
+  EMPATHY_MEMBER_STORE_COL_CHAT_STATE, /* TpChannelChatState */
+  EMPATHY_MEMBER_STORE_COL_SORT_KEY, /* borrowed string, collation key of
+                                        the name */
+  EMPATHY_MEMBER_STORE_COL_COUNT,
+} EmpathyMemberStoreCol;
+
+GType empathy_member_store_get_type (void) G_GNUC_CONST;
+
+EmpathyMemberStore * empathy_member_store_new (EmpathyTpChat *tp_chat);
+
+EmpathyTpChat * empathy_member_store_get_tp_chat (EmpathyMemberStore *self);
+
+void empathy_member_store_add_members (EmpathyMemberStore *self,
+    GPtrArray *contacts);
+void empathy_member_store_remove_members (EmpathyMemberStore *self,
+    GPtrArray *contacts);
+
+void empathy_member_store_set_chat_state (EmpathyMemberStore *self,
+    EmpathyContact *contact,
+    TpChannelChatState state);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_MEMBER_STORE_H__ */
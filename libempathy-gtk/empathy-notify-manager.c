@@ -164,20 +164,73 @@ empathy_notify_manager_has_capability (EmpathyNotifyManager *self,
   return g_hash_table_lookup (priv->capabilities, cap) != NULL;
 }
 
-GdkPixbuf *
-empathy_notify_manager_get_pixbuf_for_notification (EmpathyNotifyManager *self,
+typedef struct
+{
+  NotifyNotification *notification;
+  gchar *icon_name;
+} ShowData;
+
+static void
+show_notification (NotifyNotification *notification,
+    GdkPixbuf *pixbuf,
+    const gchar *icon_name)
+{
+  if (pixbuf == NULL)
+    pixbuf = tpaw_pixbuf_from_icon_name_sized (icon_name, 48);
+  else
+    g_object_ref (pixbuf);
+
+  if (pixbuf != NULL)
+    {
+      notify_notification_set_image_from_pixbuf (notification, pixbuf);
+      g_object_unref (pixbuf);
+    }
+
+  notify_notification_show (notification, NULL);
+}
+
+static void
+notification_avatar_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  ShowData *data = user_data;
+  GdkPixbuf *pixbuf;
+
+  pixbuf = empathy_pixbuf_avatar_from_contact_scaled_finish (
+      EMPATHY_CONTACT (source), result, NULL);
+
+  show_notification (data->notification, pixbuf, data->icon_name);
+
+  g_clear_object (&pixbuf);
+  g_object_unref (data->notification);
+  g_free (data->icon_name);
+  g_slice_free (ShowData, data);
+}
+
+/* Shows @notification with the avatar of @contact, or @icon_name if there
+ * isn't any. The avatar is decoded off the main thread, so the notification
+ * may be shown after this returns. */
+void
+empathy_notify_manager_show_notification (EmpathyNotifyManager *self,
+    NotifyNotification *notification,
     EmpathyContact *contact,
     const char *icon_name)
 {
-  GdkPixbuf *pixbuf = NULL;
+  ShowData *data;
 
-  if (contact != NULL)
-    pixbuf = empathy_pixbuf_avatar_from_contact_scaled (contact, 48, 48);
+  if (contact == NULL)
+    {
+      show_notification (notification, NULL, icon_name);
+      return;
+    }
 
-  if (pixbuf == NULL)
-    pixbuf = tpaw_pixbuf_from_icon_name_sized (icon_name, 48);
+  data = g_slice_new (ShowData);
+  data->notification = g_object_ref (notification);
+  data->icon_name = g_strdup (icon_name);
 
-  return pixbuf;
+  empathy_pixbuf_avatar_from_contact_scaled_async (contact, 48, 48, NULL,
+      notification_avatar_loaded_cb, data);
 }
 
 gboolean
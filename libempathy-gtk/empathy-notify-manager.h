@@ -100,8 +100,8 @@ gboolean empathy_notify_manager_has_capability (EmpathyNotifyManager *self,
 gboolean empathy_notify_manager_notification_is_enabled  (
     EmpathyNotifyManager *self);
 
-GdkPixbuf * empathy_notify_manager_get_pixbuf_for_notification (
-    EmpathyNotifyManager *self,
+void empathy_notify_manager_show_notification (EmpathyNotifyManager *self,
+    NotifyNotification *notification,
     EmpathyContact *contact,
     const char *icon_name);
 
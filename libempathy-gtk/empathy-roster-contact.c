@@ -46,6 +46,13 @@ struct _EmpathyRosterContactPriv
   gchar *event_icon;
 
   gboolean online;
+
+  /* g_utf8_collate_key() of the alias, so sorting the roster doesn't have
+   * to collate the aliases on each comparison */
+  gchar *sort_key;
+  /* Whether this contact is displayed at the top of the roster. Maintained
+   * by the EmpathyRosterView, which is the one knowing the model. */
+  gboolean top;
 };
 
 static const gchar *
@@ -157,7 +164,14 @@ avatar_changed_cb (FolksIndividual *individual,
 static void
 update_alias (EmpathyRosterContact *self)
 {
-  gtk_label_set_text (GTK_LABEL (self->priv->alias), get_alias (self));
+  const gchar *alias;
+
+  alias = get_alias (self);
+
+  gtk_label_set_text (GTK_LABEL (self->priv->alias), alias);
+
+  g_free (self->priv->sort_key);
+  self->priv->sort_key = g_utf8_collate_key (alias != NULL ? alias : "", -1);
 
   g_object_notify (G_OBJECT (self), "alias");
 }
@@ -343,6 +357,7 @@ empathy_roster_contact_finalize (GObject *object)
 
   g_free (self->priv->group);
   g_free (self->priv->event_icon);
+  g_free (self->priv->sort_key);
 
   if (chain_up != NULL)
     chain_up (object);
@@ -493,6 +508,27 @@ empathy_roster_contact_get_group (EmpathyRosterContact *self)
   return self->priv->group;
 }
 
+/* Returns a key such as comparing two of them with strcmp() is equivalent
+ * to comparing the aliases with g_utf8_collate() */
+const gchar *
+empathy_roster_contact_get_sort_key (EmpathyRosterContact *self)
+{
+  return self->priv->sort_key;
+}
+
+gboolean
+empathy_roster_contact_is_top (EmpathyRosterContact *self)
+{
+  return self->priv->top;
+}
+
+void
+empathy_roster_contact_set_top (EmpathyRosterContact *self,
+    gboolean top)
+{
+  self->priv->top = top;
+}
+
 void
 empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
     const gchar *icon)
@@ -56,6 +56,12 @@ const gchar * empathy_roster_contact_get_group (EmpathyRosterContact *self);
 
 gboolean empathy_roster_contact_is_online (EmpathyRosterContact *self);
 
+const gchar * empathy_roster_contact_get_sort_key (EmpathyRosterContact *self);
+
+gboolean empathy_roster_contact_is_top (EmpathyRosterContact *self);
+void empathy_roster_contact_set_top (EmpathyRosterContact *self,
+    gboolean top);
+
 void empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
     const gchar *icon);
 
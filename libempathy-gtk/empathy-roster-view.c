@@ -1,6 +1,7 @@
 #include "config.h"
 #include "empathy-roster-view.h"
 
+#include <string.h>
 #include <glib/gi18n-lib.h>
 
 #include "empathy-contact-groups.h"
@@ -62,6 +63,13 @@ struct _EmpathyRosterViewPriv
   gboolean display_flash_event;
 
   guint search_id;
+  /* FolksIndividual (borrowed) -> EmpathyIndividualTokens (owned), built the
+   * first time the individual is matched against a search */
+  GHashTable *search_tokens;
+  /* Set of FolksIndividual (borrowed) matching search_text */
+  GHashTable *search_matches;
+  /* Text search_matches has been computed for, or NULL */
+  gchar *search_text;
 
   gboolean show_offline;
   gboolean show_groups;
@@ -172,15 +180,48 @@ roster_contact_changed_cb (GtkListBoxRow *child,
   gtk_list_box_row_changed (child);
 }
 
+static gboolean
+individual_in_top (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  GList *groups;
+  gboolean result = FALSE;
+
+  groups = empathy_roster_model_dup_groups_for_individual (
+      self->priv->model, individual);
+
+  if (g_list_find_custom (groups, EMPATHY_ROSTER_MODEL_GROUP_TOP_GROUP,
+        (GCompareFunc) g_strcmp0) != NULL)
+    result = TRUE;
+
+  g_list_free_full (groups, g_free);
+
+  return result;
+}
+
 static GtkWidget *
 add_roster_contact (EmpathyRosterView *self,
     FolksIndividual *individual,
     const gchar *group)
 {
   GtkWidget *contact;
+  gboolean top;
 
   contact = empathy_roster_contact_new (individual, group);
 
+  if (!self->priv->show_groups)
+    /* Always display top contacts in non-group mode. */
+    top = individual_in_top (self, individual);
+  else
+    /* If we are displaying groups, we only want to *always* display the
+     * RosterContact which is displayed at the top; not the ones displayed in
+     * the 'normal' group sections */
+    top = !tp_strdiff (group, EMPATHY_ROSTER_MODEL_GROUP_TOP_GROUP);
+
+  /* The sort and filter functions are called a lot, cache this once for all.
+   * groups_changed_cb() keeps it up to date. */
+  empathy_roster_contact_set_top (EMPATHY_ROSTER_CONTACT (contact), top);
+
   /* Need to refilter if online is changed */
   g_signal_connect (contact, "notify::online",
       G_CALLBACK (roster_contact_changed_cb), self);
@@ -360,6 +401,80 @@ add_to_group (EmpathyRosterView *self,
     }
 }
 
+static gboolean
+is_searching (EmpathyRosterView *self)
+{
+  if (self->priv->search == NULL)
+    return FALSE;
+
+  return gtk_widget_get_visible (GTK_WIDGET (self->priv->search));
+}
+
+static const gchar *
+get_search_text (EmpathyRosterView *self)
+{
+  const gchar *text;
+
+  text = tpaw_live_search_get_text (self->priv->search);
+
+  return text != NULL ? text : "";
+}
+
+static gboolean
+individual_match_search (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  EmpathyIndividualTokens *tokens;
+
+  tokens = g_hash_table_lookup (self->priv->search_tokens, individual);
+  if (tokens == NULL)
+    {
+      tokens = empathy_individual_tokens_new (individual);
+      g_hash_table_insert (self->priv->search_tokens, individual, tokens);
+    }
+
+  return empathy_individual_tokens_match (tokens, get_search_text (self),
+      tpaw_live_search_get_words (self->priv->search));
+}
+
+static void
+update_search_matches (EmpathyRosterView *self)
+{
+  const gchar *text = get_search_text (self);
+  GHashTableIter iter;
+  gpointer k;
+
+  if (!tp_strdiff (self->priv->search_text, text))
+    return;
+
+  if (self->priv->search_text != NULL &&
+      g_str_has_prefix (text, self->priv->search_text))
+    {
+      /* The search has been refined, only the individuals matching the
+       * previous text can match the new one. */
+      g_hash_table_iter_init (&iter, self->priv->search_matches);
+      while (g_hash_table_iter_next (&iter, &k, NULL))
+        {
+          if (!individual_match_search (self, k))
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+  else
+    {
+      g_hash_table_remove_all (self->priv->search_matches);
+
+      g_hash_table_iter_init (&iter, self->priv->roster_contacts);
+      while (g_hash_table_iter_next (&iter, &k, NULL))
+        {
+          if (individual_match_search (self, k))
+            g_hash_table_add (self->priv->search_matches, k);
+        }
+    }
+
+  g_free (self->priv->search_text);
+  self->priv->search_text = g_strdup (text);
+}
+
 static void
 individual_favourite_change_cb (FolksIndividual *individual,
     GParamSpec *spec,
@@ -386,6 +501,68 @@ individual_favourite_change_cb (FolksIndividual *individual,
   gtk_list_box_row_changed (GTK_LIST_BOX_ROW (contact));
 }
 
+/* Update whether @individual matches the search, if the matches are known */
+static void
+update_individual_match (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  if (self->priv->search_text == NULL)
+    return;
+
+  if (tp_strdiff (self->priv->search_text, get_search_text (self)))
+    {
+      /* The search changed since the matches were computed; just compute them
+       * again from scratch next time. */
+      g_clear_pointer (&self->priv->search_text, g_free);
+      return;
+    }
+
+  if (individual_match_search (self, individual))
+    g_hash_table_add (self->priv->search_matches, individual);
+  else
+    g_hash_table_remove (self->priv->search_matches, individual);
+}
+
+static void
+individual_search_changed (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  GHashTable *contacts;
+  GHashTableIter iter;
+  gpointer v;
+
+  g_hash_table_remove (self->priv->search_tokens, individual);
+  update_individual_match (self, individual);
+
+  if (!is_searching (self))
+    return;
+
+  contacts = g_hash_table_lookup (self->priv->roster_contacts, individual);
+  if (contacts == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, contacts);
+  while (g_hash_table_iter_next (&iter, NULL, &v))
+    gtk_list_box_row_changed (GTK_LIST_BOX_ROW (v));
+}
+
+static void
+individual_alias_changed_cb (FolksIndividual *individual,
+    GParamSpec *spec,
+    EmpathyRosterView *self)
+{
+  individual_search_changed (self, individual);
+}
+
+static void
+individual_personas_changed_cb (FolksIndividual *individual,
+    GeeSet *added,
+    GeeSet *removed,
+    EmpathyRosterView *self)
+{
+  individual_search_changed (self, individual);
+}
+
 static void
 individual_added (EmpathyRosterView *self,
     FolksIndividual *individual)
@@ -400,6 +577,9 @@ individual_added (EmpathyRosterView *self,
 
   g_hash_table_insert (self->priv->roster_contacts, individual, contacts);
 
+  /* Before adding the rows, so they are filtered accordingly */
+  update_individual_match (self, individual);
+
   if (!self->priv->show_groups)
     {
       add_to_group (self, individual, NO_GROUP);
@@ -429,6 +609,12 @@ individual_added (EmpathyRosterView *self,
 
   tp_g_signal_connect_object (individual, "notify::is-favourite",
       G_CALLBACK (individual_favourite_change_cb), self, 0);
+
+  /* Keep the search index up to date */
+  tp_g_signal_connect_object (individual, "notify::alias",
+      G_CALLBACK (individual_alias_changed_cb), self, 0);
+  tp_g_signal_connect_object (individual, "personas-changed",
+      G_CALLBACK (individual_personas_changed_cb), self, 0);
 }
 
 static void
@@ -571,6 +757,13 @@ individual_removed (EmpathyRosterView *self,
       gtk_container_remove (GTK_CONTAINER (self), contact);
     }
 
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_alias_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_personas_changed_cb, self);
+
+  g_hash_table_remove (self->priv->search_tokens, individual);
+  g_hash_table_remove (self->priv->search_matches, individual);
   g_hash_table_remove (self->priv->roster_contacts, individual);
 }
 
@@ -590,55 +783,14 @@ individual_removed_cb (EmpathyRosterModel *model,
   individual_removed (self, individual);
 }
 
-static gboolean
-contact_in_top (EmpathyRosterView *self,
-    EmpathyRosterContact *contact)
-{
-  if (!self->priv->show_groups)
-    {
-      /* Always display top contacts in non-group mode. */
-      GList *groups;
-      FolksIndividual *individual;
-      gboolean result = FALSE;
-
-      individual = empathy_roster_contact_get_individual (contact);
-
-      groups = empathy_roster_model_dup_groups_for_individual (
-          self->priv->model, individual);
-
-      if (g_list_find_custom (groups, EMPATHY_ROSTER_MODEL_GROUP_TOP_GROUP,
-            (GCompareFunc) g_strcmp0) != NULL)
-        result = TRUE;
-
-      g_list_free_full (groups, g_free);
-
-      return result;
-    }
-
-  if (!tp_strdiff (empathy_roster_contact_get_group (contact),
-          EMPATHY_ROSTER_MODEL_GROUP_TOP_GROUP))
-    /* If we are displaying contacts, we only want to *always* display the
-     * RosterContact which is displayed at the top; not the ones displayed in
-     * the 'normal' group sections */
-    return TRUE;
-
-  return FALSE;
-}
-
 static gint
 compare_roster_contacts_by_alias (EmpathyRosterContact *a,
     EmpathyRosterContact *b)
 {
-  FolksIndividual *ind_a, *ind_b;
-  const gchar *alias_a, *alias_b;
-
-  ind_a = empathy_roster_contact_get_individual (a);
-  ind_b = empathy_roster_contact_get_individual (b);
-
-  alias_a = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (ind_a));
-  alias_b = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (ind_b));
-
-  return g_utf8_collate (alias_a, alias_b);
+  /* The keys are computed using g_utf8_collate_key() when the alias
+   * changes */
+  return strcmp (empathy_roster_contact_get_sort_key (a),
+      empathy_roster_contact_get_sort_key (b));
 }
 
 static gint
@@ -648,8 +800,8 @@ compare_roster_contacts_no_group (EmpathyRosterView *self,
 {
   gboolean top_a, top_b;
 
-  top_a = contact_in_top (self, a);
-  top_b = contact_in_top (self, b);
+  top_a = empathy_roster_contact_is_top (a);
+  top_b = empathy_roster_contact_is_top (b);
 
   if (top_a == top_b)
     /* Both contacts are in the top of the roster (or not). Sort them
@@ -779,15 +931,6 @@ update_header (GtkListBoxRow *row,
       gtk_separator_new (GTK_ORIENTATION_HORIZONTAL));
 }
 
-static gboolean
-is_searching (EmpathyRosterView *self)
-{
-  if (self->priv->search == NULL)
-    return FALSE;
-
-  return gtk_widget_get_visible (GTK_WIDGET (self->priv->search));
-}
-
 static void
 add_to_displayed (EmpathyRosterView *self,
     EmpathyRosterContact *contact)
@@ -858,19 +1001,16 @@ contact_should_be_displayed (EmpathyRosterView *self,
 {
   if (is_searching (self))
     {
-      FolksIndividual *individual;
-
-      individual = empathy_roster_contact_get_individual (contact);
+      update_search_matches (self);
 
-      return empathy_individual_match_string (individual,
-          tpaw_live_search_get_text (self->priv->search),
-          tpaw_live_search_get_words (self->priv->search));
+      return g_hash_table_contains (self->priv->search_matches,
+          empathy_roster_contact_get_individual (contact));
     }
 
   if (self->priv->show_offline)
       return TRUE;
 
-  if (contact_in_top (self, contact) &&
+  if (empathy_roster_contact_is_top (contact) &&
       contact_is_favorite (contact))
     /* Favorite top contacts are always displayed */
     return TRUE;
@@ -1016,7 +1156,24 @@ groups_changed_cb (EmpathyRosterModel *model,
 {
   if (!self->priv->show_groups)
     {
-      gtk_list_box_invalidate_sort (GTK_LIST_BOX (self));
+      GHashTable *contacts;
+      GtkWidget *contact;
+
+      /* Only the top group matters when not displaying groups */
+      if (tp_strdiff (group, EMPATHY_ROSTER_MODEL_GROUP_TOP_GROUP))
+        return;
+
+      contacts = g_hash_table_lookup (self->priv->roster_contacts, individual);
+      if (contacts == NULL)
+        return;
+
+      contact = g_hash_table_lookup (contacts, NO_GROUP);
+      if (contact == NULL)
+        return;
+
+      empathy_roster_contact_set_top (EMPATHY_ROSTER_CONTACT (contact),
+          is_member);
+      gtk_list_box_row_changed (GTK_LIST_BOX_ROW (contact));
       return;
     }
 
@@ -1067,6 +1224,22 @@ empathy_roster_view_constructed (GObject *object)
 static void
 clear_view (EmpathyRosterView *self)
 {
+  GHashTableIter iter;
+  gpointer k;
+
+  g_hash_table_iter_init (&iter, self->priv->roster_contacts);
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      g_signal_handlers_disconnect_by_func (k,
+          individual_alias_changed_cb, self);
+      g_signal_handlers_disconnect_by_func (k,
+          individual_personas_changed_cb, self);
+    }
+
+  g_hash_table_remove_all (self->priv->search_tokens);
+  g_hash_table_remove_all (self->priv->search_matches);
+  g_clear_pointer (&self->priv->search_text, g_free);
+
   g_hash_table_remove_all (self->priv->roster_contacts);
   g_hash_table_remove_all (self->priv->roster_groups);
   g_hash_table_remove_all (self->priv->displayed_contacts);
@@ -1111,6 +1284,9 @@ empathy_roster_view_finalize (GObject *object)
   g_hash_table_unref (self->priv->roster_contacts);
   g_hash_table_unref (self->priv->roster_groups);
   g_hash_table_unref (self->priv->displayed_contacts);
+  g_hash_table_unref (self->priv->search_tokens);
+  g_hash_table_unref (self->priv->search_matches);
+  g_free (self->priv->search_text);
   g_queue_free_full (self->priv->events, event_free);
 
   if (chain_up != NULL)
@@ -1388,6 +1564,9 @@ empathy_roster_view_init (EmpathyRosterView *self)
   self->priv->roster_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, NULL);
   self->priv->displayed_contacts = g_hash_table_new (NULL, NULL);
+  self->priv->search_tokens = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) empathy_individual_tokens_free);
+  self->priv->search_matches = g_hash_table_new (NULL, NULL);
 
   self->priv->events = g_queue_new ();
 
@@ -1497,6 +1676,8 @@ void
 empathy_roster_view_set_live_search (EmpathyRosterView *self,
     TpawLiveSearch *search)
 {
+  g_clear_pointer (&self->priv->search_text, g_free);
+
   if (self->priv->search != NULL)
     {
       g_signal_handlers_disconnect_by_func (self->priv->search,
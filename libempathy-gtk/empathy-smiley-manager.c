@@ -23,64 +23,54 @@
 #include "config.h"
 #include "empathy-smiley-manager.h"
 
+#include <string.h>
 #include <tp-account-widgets/tpaw-pixbuf-utils.h>
 #include <tp-account-widgets/tpaw-utils.h>
 
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
-typedef struct _SmileyManagerTree SmileyManagerTree;
+/* Smileys are matched with a trie over the bytes of their UTF-8 strings.
+ * The trie is compiled lazily into a flat transition table: bytes appearing
+ * in at least one smiley are mapped to a small alphabet of classes (class 0
+ * being "not part of any smiley"), and each node owns one row of n_classes
+ * child indices, 0 meaning no child. Following an edge is then a single
+ * array lookup. */
+typedef struct {
+	gchar       *str;
+	GdkPixbuf   *pixbuf;
+	gchar       *path;
+} SmileyPattern;
+
+typedef struct {
+	/* Borrowed from the SmileyPattern ending at this node, if any */
+	GdkPixbuf   *pixbuf;
+	const gchar *path;
+} SmileyNode;
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathySmileyManager)
 typedef struct {
-	SmileyManagerTree *tree;
+	GArray            *patterns;
 	GSList            *smileys;
-} EmpathySmileyManagerPriv;
 
-struct _SmileyManagerTree {
-	gunichar     c;
-	GdkPixbuf   *pixbuf;
-	gchar       *path;
-	GSList      *childrens;
-};
+	/* Compiled from patterns, rebuilt when dirty */
+	gboolean           dirty;
+	guint8             classes[256];
+	guint              n_classes;
+	GArray            *nodes;
+	GArray            *transitions;
+} EmpathySmileyManagerPriv;
 
 G_DEFINE_TYPE (EmpathySmileyManager, empathy_smiley_manager, G_TYPE_OBJECT);
 
 static EmpathySmileyManager *manager_singleton = NULL;
 
-static SmileyManagerTree *
-smiley_manager_tree_new (gunichar c)
-{
-	SmileyManagerTree *tree;
-
-	tree = g_slice_new0 (SmileyManagerTree);
-	tree->c = c;
-	tree->pixbuf = NULL;
-	tree->childrens = NULL;
-	tree->path = NULL;
-
-	return tree;
-}
-
 static void
-smiley_manager_tree_free (SmileyManagerTree *tree)
+smiley_pattern_clear (SmileyPattern *pattern)
 {
-	GSList *l;
-
-	if (!tree) {
-		return;
-	}
-
-	for (l = tree->childrens; l; l = l->next) {
-		smiley_manager_tree_free (l->data);
-	}
-
-	if (tree->pixbuf) {
-		g_object_unref (tree->pixbuf);
-	}
-	g_slist_free (tree->childrens);
-	g_free (tree->path);
-	g_slice_free (SmileyManagerTree, tree);
+	g_free (pattern->str);
+	g_object_unref (pattern->pixbuf);
+	g_free (pattern->path);
 }
 
 static EmpathySmiley *
@@ -108,7 +98,9 @@ smiley_manager_finalize (GObject *object)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (object);
 
-	smiley_manager_tree_free (priv->tree);
+	g_array_unref (priv->patterns);
+	g_array_unref (priv->nodes);
+	g_array_unref (priv->transitions);
 	g_slist_foreach (priv->smileys, (GFunc) smiley_free, NULL);
 	g_slist_free (priv->smileys);
 }
@@ -151,8 +143,13 @@ empathy_smiley_manager_init (EmpathySmileyManager *manager)
 		EMPATHY_TYPE_SMILEY_MANAGER, EmpathySmileyManagerPriv);
 
 	manager->priv = priv;
-	priv->tree = smiley_manager_tree_new ('\0');
+	priv->patterns = g_array_new (FALSE, FALSE, sizeof (SmileyPattern));
+	g_array_set_clear_func (priv->patterns,
+				(GDestroyNotify) smiley_pattern_clear);
 	priv->smileys = NULL;
+	priv->nodes = g_array_new (FALSE, TRUE, sizeof (SmileyNode));
+	priv->transitions = g_array_new (FALSE, TRUE, sizeof (guint16));
+	priv->dirty = TRUE;
 
 	empathy_smiley_manager_load (manager);
 }
@@ -163,55 +160,71 @@ empathy_smiley_manager_dup_singleton (void)
 	return g_object_new (EMPATHY_TYPE_SMILEY_MANAGER, NULL);
 }
 
-static SmileyManagerTree *
-smiley_manager_tree_find_child (SmileyManagerTree *tree, gunichar c)
+static void
+smiley_manager_compile (EmpathySmileyManager *manager)
 {
-	GSList *l;
-
-	for (l = tree->childrens; l; l = l->next) {
-		SmileyManagerTree *child = l->data;
-
-		if (child->c == c) {
-			return child;
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	guint                     i;
+
+	memset (priv->classes, 0, sizeof (priv->classes));
+	priv->n_classes = 1;
+	for (i = 0; i < priv->patterns->len; i++) {
+		SmileyPattern *pattern;
+		const guchar  *p;
+
+		pattern = &g_array_index (priv->patterns, SmileyPattern, i);
+		for (p = (const guchar *) pattern->str; *p != '\0'; p++) {
+			if (priv->classes[*p] == 0) {
+				priv->classes[*p] = priv->n_classes++;
+			}
 		}
 	}
 
-	return NULL;
-}
-
-static SmileyManagerTree *
-smiley_manager_tree_find_or_insert_child (SmileyManagerTree *tree, gunichar c)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_child (tree, c);
-
-	if (!child) {
-		child = smiley_manager_tree_new (c);
-		tree->childrens = g_slist_prepend (tree->childrens, child);
-	}
-
-	return child;
-}
-
-static void
-smiley_manager_tree_insert (SmileyManagerTree *tree,
-			    GdkPixbuf         *pixbuf,
-			    const gchar       *str,
-			    const gchar       *path)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_or_insert_child (tree, g_utf8_get_char (str));
+	/* Node 0 is the root */
+	g_array_set_size (priv->nodes, 0);
+	g_array_set_size (priv->nodes, 1);
+	g_array_set_size (priv->transitions, 0);
+	g_array_set_size (priv->transitions, priv->n_classes);
+
+	for (i = 0; i < priv->patterns->len; i++) {
+		SmileyPattern *pattern;
+		SmileyNode    *node;
+		const guchar  *p;
+		guint          cur = 0;
+
+		pattern = &g_array_index (priv->patterns, SmileyPattern, i);
+		for (p = (const guchar *) pattern->str; *p != '\0'; p++) {
+			guint16 *child;
+
+			child = &g_array_index (priv->transitions, guint16,
+						cur * priv->n_classes +
+						priv->classes[*p]);
+			if (*child == 0) {
+				g_return_if_fail (priv->nodes->len < G_MAXUINT16);
+
+				*child = priv->nodes->len;
+				g_array_set_size (priv->nodes,
+						  priv->nodes->len + 1);
+				g_array_set_size (priv->transitions,
+						  priv->transitions->len +
+						  priv->n_classes);
+
+				/* Growing the array may have moved it */
+				child = &g_array_index (priv->transitions,
+							guint16,
+							cur * priv->n_classes +
+							priv->classes[*p]);
+			}
+			cur = *child;
+		}
 
-	str = g_utf8_next_char (str);
-	if (*str) {
-		smiley_manager_tree_insert (child, pixbuf, str, path);
-		return;
+		/* Smileys added later win over duplicates */
+		node = &g_array_index (priv->nodes, SmileyNode, cur);
+		node->pixbuf = pattern->pixbuf;
+		node->path = pattern->path;
 	}
 
-	child->pixbuf = g_object_ref (pixbuf);
-	child->path = g_strdup (path);
+	priv->dirty = FALSE;
 }
 
 static void
@@ -226,8 +239,14 @@ smiley_manager_add_valist (EmpathySmileyManager *manager,
 	EmpathySmiley            *smiley;
 
 	for (str = first_str; str; str = va_arg (var_args, gchar*)) {
-		smiley_manager_tree_insert (priv->tree, pixbuf, str, path);
+		SmileyPattern pattern;
+
+		pattern.str = g_strdup (str);
+		pattern.pixbuf = g_object_ref (pixbuf);
+		pattern.path = g_strdup (path);
+		g_array_append_val (priv->patterns, pattern);
 	}
+	priv->dirty = TRUE;
 
 	g_object_set_data_full (G_OBJECT (pixbuf), "smiley_str",
 				g_strdup (first_str), g_free);
@@ -316,119 +335,74 @@ empathy_smiley_manager_load (EmpathySmileyManager *manager)
 	empathy_smiley_manager_add (manager, "emblem-favorite", "❤",     "<3", NULL);
 }
 
-static EmpathySmileyHit *
-smiley_hit_new (SmileyManagerTree *tree,
-		guint              start,
-		guint              end)
-{
-	EmpathySmileyHit *hit;
-
-	hit = g_slice_new (EmpathySmileyHit);
-	hit->pixbuf = tree->pixbuf;
-	hit->path = tree->path;
-	hit->start = start;
-	hit->end = end;
-
-	return hit;
-}
-
 void
-empathy_smiley_hit_free (EmpathySmileyHit *hit)
+empathy_smiley_manager_foreach_hit (EmpathySmileyManager *manager,
+				    const gchar          *text,
+				    gssize                len,
+				    EmpathySmileyHitFunc  func,
+				    gpointer              user_data)
 {
-	g_return_if_fail (hit != NULL);
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	const guint16            *transitions;
+	const SmileyNode         *nodes;
+	gsize                     pos = 0;
 
-	g_slice_free (EmpathySmileyHit, hit);
-}
+	g_return_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager));
+	g_return_if_fail (text != NULL);
+	g_return_if_fail (func != NULL);
 
-GSList *
-empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
-				  const gchar          *text,
-				  gssize                len)
-{
-	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
-	EmpathySmileyHit         *hit;
-	GSList                   *hits = NULL;
-	SmileyManagerTree        *cur_tree = priv->tree;
-	const gchar              *cur_str;
-	const gchar              *start = NULL;
+	if (priv->dirty) {
+		smiley_manager_compile (manager);
+	}
 
-	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
-	g_return_val_if_fail (text != NULL, NULL);
+	transitions = (const guint16 *) priv->transitions->data;
+	nodes = (const SmileyNode *) priv->nodes->data;
 
 	/* If len is negative, parse the string until we find '\0' */
 	if (len < 0) {
 		len = G_MAXSSIZE;
 	}
 
-	/* Parse the len first bytes of text to find smileys. Each time a smiley
-	 * is detected, append a EmpathySmileyHit struct to the returned list,
-	 * containing the smiley pixbuf and the position of the text to be
-	 * replaced by it.
-	 * cur_str is a pointer in the text showing the current position
-	 * of the parsing. It is always at the begining of an UTF-8 character,
-	 * because we support unicode smileys! For example we could want to
-	 * replace ™ by an image. */
-
-	for (cur_str = text;
-	     *cur_str != '\0' && cur_str - text < len;
-	     cur_str = g_utf8_next_char (cur_str)) {
-		SmileyManagerTree *child;
-		gunichar           c;
-
-		c = g_utf8_get_char (cur_str);
-		child = smiley_manager_tree_find_child (cur_tree, c);
-
-		/* If we have a child it means c is part of a smiley */
-		if (child) {
-			if (cur_tree == priv->tree) {
-				/* c is the first char of some smileys, keep
-				 * the begining position */
-				start = cur_str;
+	/* Parse the len first bytes of text to find smileys. At each position
+	 * we follow the trie as far as it goes and keep the longest smiley
+	 * seen on the way, so ">:(" gives ":(" and ":-))" is preferred to
+	 * ":-)". The hit is reported to func and parsing resumes after it.
+	 *
+	 * Matching works on bytes, but no smiley starts with a UTF-8
+	 * continuation byte so hits are always on character boundaries. Since
+	 * no smiley is longer than a few bytes, each message is parsed in
+	 * linear time, without allocating anything. */
+	while ((gssize) pos < len && text[pos] != '\0') {
+		EmpathySmileyHit hit;
+		guint            cur = 0;
+		gsize            end = 0;
+		gsize            i;
+
+		for (i = pos; (gssize) i < len && text[i] != '\0'; i++) {
+			cur = transitions[cur * priv->n_classes +
+					  priv->classes[(guchar) text[i]]];
+			if (cur == 0) {
+				break;
 			}
-			cur_tree = child;
-			continue;
-		}
 
-		/* c is not part of a smiley. let's check if we found a smiley
-		 * before it. */
-		if (cur_tree->pixbuf != NULL) {
-			/* found! */
-			hit = smiley_hit_new (cur_tree, start - text,
-					      cur_str - text);
-			hits = g_slist_prepend (hits, hit);
-
-			/* c was not part of this smiley, check if a new smiley
-			 * start with it. */
-			cur_tree = smiley_manager_tree_find_child (priv->tree, c);
-			if (cur_tree) {
-				start = cur_str;
-			} else {
-				cur_tree = priv->tree;
+			if (nodes[cur].pixbuf != NULL) {
+				hit.pixbuf = nodes[cur].pixbuf;
+				hit.path = nodes[cur].path;
+				end = i + 1;
 			}
-		} else if (cur_tree != priv->tree) {
-			/* We searched a smiley starting at 'start' but we ended
-			 * with no smiley. Look again starting from next char.
-			 *
-			 * For example ">:)" and ":(" are both valid smileys,
-			 * when parsing text ">:(" we first see '>' which could
-			 * be the start of a smiley. 'start' variable is set to
-			 * that position and we parse next char which is ':' and
-			 * is still potential smiley. Then we see '(' which is
-			 * NOT part of the smiley, ">:(" does not exist, so we
-			 * have to start again from ':' to find ":(" which is
-			 * correct smiley. */
-			cur_str = start;
-			cur_tree = priv->tree;
 		}
-	}
 
-	/* Check if last char of the text was the end of a smiley */
-	if (cur_tree->pixbuf != NULL) {
-		hit = smiley_hit_new (cur_tree, start - text, cur_str - text);
-		hits = g_slist_prepend (hits, hit);
-	}
+		if (end == 0) {
+			pos++;
+			continue;
+		}
+
+		hit.start = pos;
+		hit.end = end;
+		func (&hit, user_data);
 
-	return g_slist_reverse (hits);
+		pos = end;
+	}
 }
 
 GSList *
@@ -58,6 +58,10 @@ typedef struct {
 	guint        end;
 } EmpathySmileyHit;
 
+/* The hit is only valid for the duration of the call */
+typedef void (*EmpathySmileyHitFunc) (const EmpathySmileyHit *hit,
+				      gpointer                user_data);
+
 typedef void (*EmpathySmileyMenuFunc) (EmpathySmileyManager *manager,
 				       EmpathySmiley        *smiley,
 				       gpointer              user_data);
@@ -70,13 +74,14 @@ void                  empathy_smiley_manager_add             (EmpathySmileyManag
 							      const gchar          *first_str,
 							      ...);
 GSList *              empathy_smiley_manager_get_all         (EmpathySmileyManager *manager);
-GSList *              empathy_smiley_manager_parse_len       (EmpathySmileyManager *manager,
+void                  empathy_smiley_manager_foreach_hit     (EmpathySmileyManager *manager,
 							      const gchar          *text,
-							      gssize                len);
+							      gssize                len,
+							      EmpathySmileyHitFunc  func,
+							      gpointer              user_data);
 GtkWidget *           empathy_smiley_menu_new                (EmpathySmileyManager *manager,
 							      EmpathySmileyMenuFunc func,
 							      gpointer              user_data);
-void                  empathy_smiley_hit_free                (EmpathySmileyHit     *hit);
 
 G_END_DECLS
 
@@ -23,6 +23,34 @@
 
 #include "empathy-smiley-manager.h"
 
+typedef struct {
+	const gchar *text;
+	guint last;
+	TpawStringReplace replace_func;
+	TpawStringParser *sub_parsers;
+	gpointer user_data;
+} MatchSmileyData;
+
+static void
+match_smiley_hit_cb (const EmpathySmileyHit *hit,
+		     gpointer user_data)
+{
+	MatchSmileyData *data = user_data;
+
+	if (hit->start > data->last) {
+		/* Append the text between last smiley (or the
+		 * start of the message) and this smiley */
+		tpaw_string_parser_substr (data->text + data->last,
+					   hit->start - data->last,
+					   data->sub_parsers, data->user_data);
+	}
+
+	data->replace_func (data->text + hit->start, hit->end - hit->start,
+			    (gpointer) hit, data->user_data);
+
+	data->last = hit->end;
+}
+
 void
 empathy_string_match_smiley (const gchar *text,
 			     gssize len,
@@ -30,34 +58,15 @@ empathy_string_match_smiley (const gchar *text,
 			     TpawStringParser *sub_parsers,
 			     gpointer user_data)
 {
-	guint last = 0;
 	EmpathySmileyManager *smiley_manager;
-	GSList *hits, *l;
+	MatchSmileyData data = { text, 0, replace_func, sub_parsers,
+				 user_data };
 
 	smiley_manager = empathy_smiley_manager_dup_singleton ();
-	hits = empathy_smiley_manager_parse_len (smiley_manager, text, len);
-
-	for (l = hits; l; l = l->next) {
-		EmpathySmileyHit *hit = l->data;
-
-		if (hit->start > last) {
-			/* Append the text between last smiley (or the
-			 * start of the message) and this smiley */
-			tpaw_string_parser_substr (text + last,
-						   hit->start - last,
-						   sub_parsers, user_data);
-		}
-
-		replace_func (text + hit->start, hit->end - hit->start,
-			      hit, user_data);
-
-		last = hit->end;
-
-		empathy_smiley_hit_free (hit);
-	}
-	g_slist_free (hits);
+	empathy_smiley_manager_foreach_hit (smiley_manager, text, len,
+					    match_smiley_hit_cb, &data);
 	g_object_unref (smiley_manager);
 
-	tpaw_string_parser_substr (text + last, len - last,
+	tpaw_string_parser_substr (text + data.last, len - data.last,
 				   sub_parsers, user_data);
 }
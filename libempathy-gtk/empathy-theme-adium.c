@@ -28,6 +28,7 @@
 #include <tp-account-widgets/tpaw-pixbuf-utils.h>
 #include <tp-account-widgets/tpaw-utils.h>
 
+#include "empathy-adium-template.h"
 #include "empathy-gsettings.h"
 #include "empathy-images.h"
 #include "empathy-plist.h"
@@ -44,6 +45,13 @@
 /* "Join" consecutive messages with timestamps within five minutes */
 #define MESSAGE_JOIN_PERIOD 5*60
 
+/* Seconds to wait after new messages before trimming the scrollback */
+#define SCROLLBACK_TRIM_DELAY 2
+
+/* What counts against the scrollback limit: messages and events (joins,
+ * parts, status changes...) */
+#define SCROLLBACK_ITEMS_SELECTOR ".x-empathy-message, .x-empathy-event"
+
 struct _EmpathyThemeAdiumPriv
 {
   EmpathyAdiumData *data;
@@ -71,6 +79,18 @@ struct _EmpathyThemeAdiumPriv
   gchar *variant;
   gboolean in_construction;
   gboolean show_avatars;
+  /* TRUE if the helpers of empathy-chat.js are loaded in the page */
+  gboolean has_helpers;
+
+  /* Nesting level of empathy_theme_adium_begin_batch() */
+  guint batch_depth;
+  /* Scripts gathered while a batch is open, or NULL */
+  GString *batch;
+
+  /* Source func ID for theme_adium_trim_scrollback_cb () */
+  guint trim_scrollback_id;
+  /* Number of messages and events displayed, as far as we know */
+  guint n_messages;
 };
 
 struct _EmpathyAdiumData
@@ -84,8 +104,6 @@ struct _EmpathyAdiumData
   GHashTable *info;
   guint version;
   gboolean custom_template;
-  /* gchar* -> gchar* both owned */
-  GHashTable *date_format_cache;
 
   /* HTML bits */
   const gchar *template_html;
@@ -104,6 +122,21 @@ struct _EmpathyAdiumData
    * We do this because of fallbacks, some htmls could be pointing the
    * same string. */
   GPtrArray *strings_to_free;
+
+  /* Compiled versions of the above html strings, used to render messages.
+   * Like the strings, they can be shared between fallbacks. */
+  EmpathyAdiumTemplate *in_content;
+  EmpathyAdiumTemplate *in_context;
+  EmpathyAdiumTemplate *in_nextcontent;
+  EmpathyAdiumTemplate *in_nextcontext;
+  EmpathyAdiumTemplate *out_content;
+  EmpathyAdiumTemplate *out_context;
+  EmpathyAdiumTemplate *out_nextcontent;
+  EmpathyAdiumTemplate *out_nextcontext;
+  EmpathyAdiumTemplate *status;
+
+  /* Owns the compiled templates */
+  GPtrArray *templates_to_free;
 };
 
 static gchar * adium_info_dup_path_for_variant (GHashTable *info,
@@ -116,6 +149,14 @@ enum
   PROP_VARIANT,
 };
 
+enum
+{
+  SCROLLBACK_TRIMMED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
 G_DEFINE_TYPE (EmpathyThemeAdium, empathy_theme_adium,
        WEBKIT_TYPE_WEB_VIEW)
 
@@ -230,6 +271,12 @@ theme_adium_load_template (EmpathyThemeAdium *self)
   gchar *template;
 
   self->priv->pages_loading++;
+  self->priv->n_messages = 0;
+
+  /* Whatever hasn't been committed yet would be for the old page */
+  if (self->priv->batch != NULL)
+    g_string_truncate (self->priv->batch, 0);
+
   basedir_uri = g_strconcat ("file://", self->priv->data->basedir, NULL);
 
   variant_path = adium_info_dup_path_for_variant (self->priv->data->info,
@@ -249,7 +296,8 @@ theme_adium_load_template (EmpathyThemeAdium *self)
 static gchar *
 theme_adium_parse_body (EmpathyThemeAdium *self,
   const gchar *text,
-  const gchar *token)
+  const gchar *token,
+  gint64 timestamp)
 {
   TpawStringParser *parsers;
   GString *string;
@@ -278,253 +326,220 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
 
   /* Wrap body in order to make tabs and multiple spaces displayed
    * properly. See bug #625745. */
-  g_string_prepend (string, "<div style=\"display: inline; "
-                 "white-space: pre-wrap\"'>");
   g_string_append (string, "</div>");
 
+  /* Also keep the timestamp of the message, so we know where to resume
+   * fetching logs once older messages have been evicted from the view */
+  if (timestamp != 0)
+    {
+      gchar *div;
+
+      div = g_strdup_printf ("<div class=\"x-empathy-message\" "
+          "data-timestamp=\"%" G_GINT64_FORMAT "\" "
+          "style=\"display: inline; white-space: pre-wrap\"'>", timestamp);
+      g_string_prepend (string, div);
+      g_free (div);
+    }
+  else
+    {
+      g_string_prepend (string, "<div style=\"display: inline; "
+                     "white-space: pre-wrap\"'>");
+    }
+
   return g_string_free (string, FALSE);
 }
 
-static void
-escape_and_append_len (GString *string, const gchar *str, gint len)
+static gboolean
+theme_adium_is_near_bottom (EmpathyThemeAdium *self)
 {
-  while (str != NULL && *str != '\0' && len != 0)
-    {
-      switch (*str)
-        {
-          case '\\':
-            /* \ becomes \\ */
-            g_string_append (string, "\\\\");
-            break;
-          case '\"':
-            /* " becomes \" */
-            g_string_append (string, "\\\"");
-            break;
-          case '\n':
-            /* Remove end of lines */
-            break;
-          default:
-            g_string_append_c (string, *str);
-        }
+  GtkAdjustment *adjustment;
+  gdouble page_size;
+
+  adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (self));
+  if (adjustment == NULL)
+    return TRUE;
 
-      str++;
-      len--;
+  page_size = gtk_adjustment_get_page_size (adjustment);
+
+  return gtk_adjustment_get_value (adjustment) + 2 * page_size >=
+    gtk_adjustment_get_upper (adjustment);
+}
+
+static gint64
+theme_adium_get_message_timestamp (WebKitDOMNode *message)
+{
+  gchar *str;
+  gint64 timestamp;
+
+  /* Events don't have one */
+  str = webkit_dom_element_get_attribute (WEBKIT_DOM_ELEMENT (message),
+      "data-timestamp");
+  if (tp_str_empty (str))
+    {
+      g_free (str);
+      return 0;
     }
+
+  timestamp = g_ascii_strtoll (str, NULL, 10);
+  g_free (str);
+
+  return timestamp;
 }
 
-/* If *str starts with match, returns TRUE and move pointer to the end */
-static gboolean
-theme_adium_match (const gchar **str,
-    const gchar *match)
+/* Returns the messages and events in @node, in the order they are
+ * displayed */
+static WebKitDOMNodeList *
+theme_adium_get_messages (WebKitDOMElement *node)
 {
-  gint len;
+  return webkit_dom_element_query_selector_all (node,
+      SCROLLBACK_ITEMS_SELECTOR, NULL);
+}
 
-  len = strlen (match);
-  if (strncmp (*str, match, len) == 0)
+/* Returns the timestamp of the first message found in @node or its next
+ * siblings, or 0 */
+static gint64
+theme_adium_get_first_timestamp (WebKitDOMElement *node)
+{
+  for (; node != NULL;
+       node = webkit_dom_element_get_next_element_sibling (node))
     {
-      *str += len - 1;
-      return TRUE;
+      WebKitDOMElement *message;
+      gint64 timestamp;
+
+      message = webkit_dom_element_query_selector (node,
+          ".x-empathy-message", NULL);
+      if (message == NULL)
+        continue;
+
+      timestamp = theme_adium_get_message_timestamp (
+          WEBKIT_DOM_NODE (message));
+
+      if (timestamp != 0)
+        return timestamp;
     }
 
-  return FALSE;
+  return 0;
 }
 
-/* Like theme_adium_match() but also return the X part if match is
- * like %foo{X}% */
 static gboolean
-theme_adium_match_with_format (const gchar **str,
-    const gchar *match,
-    gchar **format)
+theme_adium_trim_scrollback_cb (gpointer user_data)
 {
-  const gchar *cur = *str;
-  const gchar *end;
+  EmpathyThemeAdium *self = user_data;
+  WebKitDOMDocument *dom;
+  WebKitDOMElement *chat;
+  WebKitDOMElement *first;
+  WebKitDOMNodeList *messages;
+  gulong n_messages;
+  guint limit, target;
+  gint64 last_evicted = 0;
+  gint64 timestamp;
 
-  if (!theme_adium_match (&cur, match))
-    return FALSE;
+  self->priv->trim_scrollback_id = 0;
 
-  cur++;
+  /* Don't pull the messages the user is reading from under their feet, the
+   * next message appended tries again */
+  if (!theme_adium_is_near_bottom (self))
+    return G_SOURCE_REMOVE;
 
-  end = strstr (cur, "}%");
-  if (!end)
-    return FALSE;
+  limit = g_settings_get_uint (self->priv->gsettings_chat,
+      EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT);
+  if (limit == 0 || self->priv->pages_loading != 0)
+    return G_SOURCE_REMOVE;
 
-  *format = g_strndup (cur , end - cur);
-  *str = end + 1;
-  return TRUE;
-}
+  dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
+  if (dom == NULL)
+    return G_SOURCE_REMOVE;
 
-/* List of colors used by %senderColor%. Copied from
- * adium/Frameworks/AIUtilities\ Framework/Source/AIColorAdditions.m
- */
-static gchar *colors[] = {
-  "aqua", "aquamarine", "blue", "blueviolet", "brown", "burlywood", "cadetblue",
-  "chartreuse", "chocolate", "coral", "cornflowerblue", "crimson", "cyan",
-  "darkblue", "darkcyan", "darkgoldenrod", "darkgreen", "darkgrey", "darkkhaki",
-  "darkmagenta", "darkolivegreen", "darkorange", "darkorchid", "darkred",
-  "darksalmon", "darkseagreen", "darkslateblue", "darkslategrey",
-  "darkturquoise", "darkviolet", "deeppink", "deepskyblue", "dimgrey",
-  "dodgerblue", "firebrick", "forestgreen", "fuchsia", "gold", "goldenrod",
-  "green", "greenyellow", "grey", "hotpink", "indianred", "indigo", "lawngreen",
-  "lightblue", "lightcoral",
-  "lightgreen", "lightgrey", "lightpink", "lightsalmon", "lightseagreen",
-  "lightskyblue", "lightslategrey", "lightsteelblue", "lime", "limegreen",
-  "magenta", "maroon", "mediumaquamarine", "mediumblue", "mediumorchid",
-  "mediumpurple", "mediumseagreen", "mediumslateblue", "mediumspringgreen",
-  "mediumturquoise", "mediumvioletred", "midnightblue", "navy", "olive",
-  "olivedrab", "orange", "orangered", "orchid", "palegreen", "paleturquoise",
-  "palevioletred", "peru", "pink", "plum", "powderblue", "purple", "red",
-  "rosybrown", "royalblue", "saddlebrown", "salmon", "sandybrown", "seagreen",
-  "sienna", "silver", "skyblue", "slateblue", "slategrey", "springgreen",
-  "steelblue", "tan", "teal", "thistle", "tomato", "turquoise", "violet",
-  "yellowgreen",
-};
+  chat = webkit_dom_document_get_element_by_id (dom, "Chat");
+  if (chat == NULL)
+    return G_SOURCE_REMOVE;
 
-static const gchar *
-nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
-{
-  /* Convert from NSDateFormatter
-   * (http://www.stepcase.com/blog/2008/12/02/format-string-for-the-iphone-nsdateformatter/)
-   * to strftime supported by g_date_time_format.
-   * FIXME: table is incomplete, doc of g_date_time_format has a table of
-   *        supported tags.
-   * FIXME: g_date_time_format in GLib 2.28 does 0 padding by default, but
-   *        in 2.29.x we have to explictely request padding with %0x */
-  static const gchar *convert_table[] = {
-    "a", "%p", // AM/PM
-    "A", NULL, // 0~86399999 (Millisecond of Day)
-
-    "cccc", "%A", // Sunday/Monday/Tuesday/Wednesday/Thursday/Friday/Saturday
-    "ccc", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
-    "cc", "%u", // 1~7 (Day of Week)
-    "c", "%u", // 1~7 (Day of Week)
-
-    "dd", "%d", // 1~31 (0 padded Day of Month)
-    "d", "%d", // 1~31 (0 padded Day of Month)
-    "D", "%j", // 1~366 (0 padded Day of Year)
-
-    "e", "%u", // 1~7 (0 padded Day of Week)
-    "EEEE", "%A", // Sunday/Monday/Tuesday/Wednesday/Thursday/Friday/Saturday
-    "EEE", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
-    "EE", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
-    "E", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
-
-    "F", NULL, // 1~5 (0 padded Week of Month, first day of week = Monday)
-
-    "g", NULL, // Julian Day Number (number of days since 4713 BC January 1)
-    "GGGG", NULL, // Before Christ/Anno Domini
-    "GGG", NULL, // BC/AD (Era Designator Abbreviated)
-    "GG", NULL, // BC/AD (Era Designator Abbreviated)
-    "G", NULL, // BC/AD (Era Designator Abbreviated)
-
-    "h", "%I", // 1~12 (0 padded Hour (12hr))
-    "H", "%H", // 0~23 (0 padded Hour (24hr))
-
-    "k", NULL, // 1~24 (0 padded Hour (24hr)
-    "K", NULL, // 0~11 (0 padded Hour (12hr))
-
-    "LLLL", "%B", // January/February/March/April/May/June/July/August/September/October/November/December
-    "LLL", "%b", // Jan/Feb/Mar/Apr/May/Jun/Jul/Aug/Sep/Oct/Nov/Dec
-    "LL", "%m", // 1~12 (0 padded Month)
-    "L", "%m", // 1~12 (0 padded Month)
-
-    "m", "%M", // 0~59 (0 padded Minute)
-    "MMMM", "%B", // January/February/March/April/May/June/July/August/September/October/November/December
-    "MMM", "%b", // Jan/Feb/Mar/Apr/May/Jun/Jul/Aug/Sep/Oct/Nov/Dec
-    "MM", "%m", // 1~12 (0 padded Month)
-    "M", "%m", // 1~12 (0 padded Month)
-
-    "qqqq", NULL, // 1st quarter/2nd quarter/3rd quarter/4th quarter
-    "qqq", NULL, // Q1/Q2/Q3/Q4
-    "qq", NULL, // 1~4 (0 padded Quarter)
-    "q", NULL, // 1~4 (0 padded Quarter)
-    "QQQQ", NULL, // 1st quarter/2nd quarter/3rd quarter/4th quarter
-    "QQQ", NULL, // Q1/Q2/Q3/Q4
-    "QQ", NULL, // 1~4 (0 padded Quarter)
-    "Q", NULL, // 1~4 (0 padded Quarter)
-
-    "s", "%S", // 0~59 (0 padded Second)
-    "S", NULL, // (rounded Sub-Second)
-
-    "u", "%Y", // (0 padded Year)
-
-    "vvvv", "%Z", // (General GMT Timezone Name)
-    "vvv", "%Z", // (General GMT Timezone Abbreviation)
-    "vv", "%Z", // (General GMT Timezone Abbreviation)
-    "v", "%Z", // (General GMT Timezone Abbreviation)
-
-    "w", "%W", // 1~53 (0 padded Week of Year, 1st day of week = Sunday, NB, 1st week of year starts from the last Sunday of last year)
-    "W", NULL, // 1~5 (0 padded Week of Month, 1st day of week = Sunday)
-
-    "yyyy", "%Y", // (Full Year)
-    "yyy", "%y", // (2 Digits Year)
-    "yy", "%y", // (2 Digits Year)
-    "y", "%Y", // (Full Year)
-    "YYYY", NULL, // (Full Year, starting from the Sunday of the 1st week of year)
-    "YYY", NULL, // (2 Digits Year, starting from the Sunday of the 1st week of year)
-    "YY", NULL, // (2 Digits Year, starting from the Sunday of the 1st week of year)
-    "Y", NULL, // (Full Year, starting from the Sunday of the 1st week of year)
-
-    "zzzz", NULL, // (Specific GMT Timezone Name)
-    "zzz", NULL, // (Specific GMT Timezone Abbreviation)
-    "zz", NULL, // (Specific GMT Timezone Abbreviation)
-    "z", NULL, // (Specific GMT Timezone Abbreviation)
-    "Z", "%z", // +0000 (RFC 822 Timezone)
-  };
-  const gchar *str;
-  GString *string;
-  guint i, j;
+  /* Consecutive messages are grouped in a single child of #Chat, count
+   * the messages and events themselves */
+  messages = theme_adium_get_messages (chat);
+  n_messages = webkit_dom_node_list_get_length (messages);
 
-  if (nsdate == NULL)
-    return NULL;
+  self->priv->n_messages = n_messages;
+  if (n_messages <= limit)
+    return G_SOURCE_REMOVE;
 
-  str = g_hash_table_lookup (data->date_format_cache, nsdate);
-  if (str != NULL) {
-    return str;
-  }
+  /* Evict a bit more than needed, so we don't have to do it again (and
+   * restart fetching logs) for each new message */
+  target = MAX (1, limit - limit / 4);
 
-  /* Copy nsdate into string, replacing occurences of NSDateFormatter tags
-   * by corresponding strftime tag. */
-  string = g_string_sized_new (strlen (nsdate));
-  for (i = 0; nsdate[i] != '\0'; i++)
+  DEBUG ("Evicting %lu old messages and events from the view",
+      n_messages - target);
+
+  for (first = webkit_dom_element_get_first_element_child (chat);
+       first != NULL;
+       first = webkit_dom_element_get_first_element_child (chat))
     {
-      gboolean found = FALSE;
+      gulong n, i;
+
+      /* Messages sharing a timestamp are evicted together: the logs are
+       * fetched again from before the first message remaining */
+      if (n_messages <= target &&
+          theme_adium_get_first_timestamp (first) != last_evicted)
+        break;
 
-      /* even indexes are NSDateFormatter tag, odd indexes are the
-       * corresponding strftime tag */
-      for (j = 0; j < G_N_ELEMENTS (convert_table); j += 2)
+      messages = theme_adium_get_messages (first);
+      n = webkit_dom_node_list_get_length (messages);
+
+      /* Events have no timestamp, look for the last message */
+      for (i = n; i > 0; i--)
         {
-          if (g_str_has_prefix (nsdate + i, convert_table[j]))
+          timestamp = theme_adium_get_message_timestamp (
+              webkit_dom_node_list_item (messages, i - 1));
+          if (timestamp != 0)
             {
-              found = TRUE;
+              last_evicted = timestamp;
               break;
             }
         }
 
-      if (found)
-        {
-          /* If we don't have a replacement, just ignore that tag */
-          if (convert_table[j + 1] != NULL)
-            g_string_append (string, convert_table[j + 1]);
-
-          i += strlen (convert_table[j]) - 1;
-        }
-      else
-        {
-          g_string_append_c (string, nsdate[i]);
-        }
+      n_messages -= MIN (n, n_messages);
+      webkit_dom_node_remove_child (WEBKIT_DOM_NODE (chat),
+          WEBKIT_DOM_NODE (first), NULL);
     }
 
-  DEBUG ("Date format converted '%s' → '%s'", nsdate, string->str);
+  self->priv->n_messages = n_messages;
 
-  /* The cache takes ownership of string->str */
-  g_hash_table_insert (data->date_format_cache, g_strdup (nsdate), string->str);
-  return g_string_free (string, FALSE);
+  /* The first message displayed changed, don't try to join it with the next
+   * prepended one */
+  g_clear_object (&self->priv->first_contact);
+
+  timestamp = theme_adium_get_first_timestamp (
+      webkit_dom_element_get_first_element_child (chat));
+
+  g_signal_emit (self, signals[SCROLLBACK_TRIMMED], 0, timestamp);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Trims the scrollback a bit after messages were added, once they are more
+ * than the limit */
+static void
+theme_adium_schedule_trim_scrollback (EmpathyThemeAdium *self)
+{
+  guint limit;
+
+  if (self->priv->trim_scrollback_id != 0)
+    return;
+
+  limit = g_settings_get_uint (self->priv->gsettings_chat,
+      EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT);
+  if (limit == 0 || self->priv->n_messages <= limit)
+    return;
+
+  self->priv->trim_scrollback_id = g_timeout_add_seconds_full (
+      G_PRIORITY_LOW, SCROLLBACK_TRIM_DELAY, theme_adium_trim_scrollback_cb,
+      self, NULL);
 }
 
 static void
 theme_adium_add_html (EmpathyThemeAdium *self,
     const gchar *func,
-    const gchar *html,
+    EmpathyAdiumTemplate *html,
     const gchar *message,
     const gchar *avatar_filename,
     const gchar *name,
@@ -536,213 +551,75 @@ theme_adium_add_html (EmpathyThemeAdium *self,
     gboolean outgoing,
     PangoDirection direction)
 {
-  GBytes *bytes;
+  EmpathyAdiumTemplateValues values = { NULL, };
   GString *string;
-  const gchar *cur = NULL;
-  const gchar *js;
   gchar *script;
 
-  /* Make some search-and-replace in the html code */
-  string = g_string_sized_new (strlen (html) + strlen (message));
+  values.message = message;
+  values.avatar_filename = avatar_filename;
+  values.name = name;
+  values.contact_id = contact_id;
+  values.service_name = service_name;
+  values.message_classes = message_classes;
+  values.timestamp = timestamp;
+  values.is_backlog = is_backlog;
+  values.outgoing = outgoing;
+  values.show_avatars = self->priv->show_avatars;
+  values.direction = direction;
+
+  /* Fill the keywords of the compiled html template */
+  string = g_string_sized_new (empathy_adium_template_get_size_hint (html) +
+      strlen (message));
   g_string_append_printf (string, "%s(\"", func);
+  empathy_adium_template_render (html, &values, string);
+  g_string_append (string, "\")");
 
-  for (cur = html; *cur != '\0'; cur++)
+  /* The helpers of empathy-chat.js have been injected when the page
+   * finished loading, see theme_adium_load_helpers() */
+  if (self->priv->batch_depth > 0)
     {
-      const gchar *replace = NULL;
-      gchar *dup_replace = NULL;
-      gchar *format = NULL;
-
-      /* Those are all well known keywords that needs replacement in
-       * html files. Please keep them in the same order than the adium
-       * spec. See http://trac.adium.im/wiki/CreatingMessageStyles */
-      if (theme_adium_match (&cur, "%userIconPath%"))
-        {
-          replace = avatar_filename;
-        }
-      else if (theme_adium_match (&cur, "%senderScreenName%"))
-        {
-          replace = contact_id;
-        }
-      else if (theme_adium_match (&cur, "%sender%"))
-        {
-          replace = name;
-        }
-      else if (theme_adium_match (&cur, "%senderColor%"))
-        {
-          /* A color derived from the user's name.
-           * FIXME: If a colon separated list of HTML colors is at
-           * Incoming/SenderColors.txt it will be used instead of
-           * the default colors.
-           */
-
-          /* Ensure we always use the same color when sending messages
-           * (bgo #658821) */
-          if (outgoing)
-            {
-              replace = "inherit";
-            }
-          else if (contact_id != NULL)
-            {
-              guint hash = g_str_hash (contact_id);
-              replace = colors[hash % G_N_ELEMENTS (colors)];
-            }
-        }
-      else if (theme_adium_match (&cur, "%senderStatusIcon%"))
-        {
-          /* FIXME: The path to the status icon of the sender
-           * (available, away, etc...)
-           */
-        }
-      else if (theme_adium_match (&cur, "%messageDirection%"))
-        {
-          switch (direction)
-            {
-              case PANGO_DIRECTION_LTR:
-              case PANGO_DIRECTION_TTB_LTR:
-              case PANGO_DIRECTION_WEAK_LTR:
-                replace = "ltr";
-                break;
-              case PANGO_DIRECTION_RTL:
-              case PANGO_DIRECTION_TTB_RTL:
-              case PANGO_DIRECTION_WEAK_RTL:
-                replace = "rtl";
-                break;
-              case PANGO_DIRECTION_NEUTRAL:
-              default:
-                break;
-            }
-        }
-      else if (theme_adium_match (&cur, "%senderDisplayName%"))
-        {
-          /* FIXME: The serverside (remotely set) name of the
-           * sender, such as an MSN display name.
-           *
-           *  We don't have access to that yet so we use
-           * local alias instead.
-           */
-          replace = name;
-        }
-      else if (theme_adium_match (&cur, "%senderPrefix%"))
-        {
-          /* FIXME: If we supported IRC user mode flags, this
-           * would be replaced with @ if the user is an op, + if
-           * the user has voice, etc. as per
-           * http://hg.adium.im/adium/rev/b586b027de42. But we
-           * don't, so for now we just strip it. */
-        }
-      else if (theme_adium_match_with_format (&cur, "%textbackgroundcolor{",
-            &format))
-        {
-          /* FIXME: This keyword is used to represent the
-           * highlight background color. "X" is the opacity of the
-           * background, ranges from 0 to 1 and can be any decimal
-           * between.
-           */
-        }
-      else if (theme_adium_match (&cur, "%message%"))
-        {
-          replace = message;
-        }
-      else if (theme_adium_match (&cur, "%time%") ||
-           theme_adium_match_with_format (&cur, "%time{", &format))
-        {
-          const gchar *strftime_format;
-
-          strftime_format = nsdate_to_strftime (self->priv->data, format);
-          if (is_backlog)
-            dup_replace = tpaw_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
-              TPAW_TIME_DATE_FORMAT_DISPLAY_SHORT);
-          else
-            dup_replace = tpaw_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
-              TPAW_TIME_FORMAT_DISPLAY_SHORT);
-
-          replace = dup_replace;
-        }
-      else if (theme_adium_match (&cur, "%shortTime%"))
-        {
-          dup_replace = tpaw_time_to_string_local (timestamp,
-            TPAW_TIME_FORMAT_DISPLAY_SHORT);
-          replace = dup_replace;
-        }
-      else if (theme_adium_match (&cur, "%service%"))
-        {
-          replace = service_name;
-        }
-      else if (theme_adium_match (&cur, "%variant%"))
-        {
-          /* FIXME: The name of the active message style variant,
-           * with all spaces replaced with an underscore.
-           * A variant named "Alternating Messages - Blue Red"
-           * will become "Alternating_Messages_-_Blue_Red".
-           */
-        }
-      else if (theme_adium_match (&cur, "%userIcons%"))
-        {
-          replace = self->priv->show_avatars ? "showIcons" : "hideIcons";
-        }
-      else if (theme_adium_match (&cur, "%messageClasses%"))
-        {
-          replace = message_classes;
-        }
-      else if (theme_adium_match (&cur, "%status%"))
-        {
-          /* FIXME: A description of the status event. This is
-           * neither in the user's local language nor expected to
-           * be displayed; it may be useful to use a different div
-           * class to present different types of status messages.
-           * The following is a list of some of the more important
-           * status messages; your message style should be able to
-           * handle being shown a status message not in this list,
-           * as even at present the list is incomplete and is
-           * certain to become out of date in the future:
-           *  online
-           *  offline
-           *  away
-           *  away_message
-           *  return_away
-           *  idle
-           *  return_idle
-           *  date_separator
-           *  contact_joined (group chats)
-           *  contact_left
-           *  error
-           *  timed_out
-           *  encryption (all OTR messages use this status)
-           *  purple (all IRC topic and join/part messages use this status)
-           *  fileTransferStarted
-           *  fileTransferCompleted
-           */
-        }
-      else
-        {
-          escape_and_append_len (string, cur, 1);
-          continue;
-        }
+      g_string_append_len (self->priv->batch, string->str, string->len);
+      g_string_append (self->priv->batch, ";\n");
+      g_string_free (string, TRUE);
+      return;
+    }
 
-      /* Here we have a replacement to make */
-      escape_and_append_len (string, replace, -1);
+  script = g_string_free (string, FALSE);
+  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self), script);
+  g_free (script);
 
-      g_free (dup_replace);
-      g_free (format);
-    }
-  g_string_append (string, "\")");
+  theme_adium_schedule_trim_scrollback (self);
+}
 
-  bytes = g_resources_lookup_data ("/org/gnome/Empathy/Chat/empathy-chat.js",
-      G_RESOURCE_LOOKUP_FLAGS_NONE,
-      NULL);
+/* Run the scripts gathered so far in the open batch as a single script, so
+ * the prepended and appended messages are inserted in the DOM all at once. The
+ * batch stays open. */
+static void
+theme_adium_flush_batch (EmpathyThemeAdium *self)
+{
+  GString *batch = self->priv->batch;
+
+  if (batch == NULL || batch->len == 0)
+    return;
 
-  if (bytes != NULL)
+  if (self->priv->has_helpers)
     {
-      js = (const gchar *) g_bytes_get_data (bytes, NULL);
-      g_string_prepend (string, js);
-      g_bytes_unref (bytes);
+      g_string_prepend (batch, "beginBatch();\n");
+      g_string_append (batch, "commitBatch();");
     }
 
-  script = g_string_free (string, FALSE);
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self), script);
-  g_free (script);
+  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self), batch->str);
+  g_string_truncate (batch, 0);
+
+  theme_adium_schedule_trim_scrollback (self);
+}
+
+/* While a batch is open, appended messages are gathered in a
+ * DocumentFragment too, see batchAppendMessage() in empathy-chat.js */
+static gboolean
+theme_adium_batch_appends (EmpathyThemeAdium *self)
+{
+  return self->priv->batch_depth > 0 && self->priv->has_helpers;
 }
 
 static void
@@ -750,10 +627,24 @@ theme_adium_append_event_escaped (EmpathyThemeAdium *self,
     const gchar *escaped,
     PangoDirection direction)
 {
-  theme_adium_add_html (self, "appendMessage",
-      self->priv->data->status_html, escaped, NULL, NULL, NULL,
+  gchar *event;
+
+  /* Mark the event so it is counted against the scrollback limit and
+   * evicted with old messages */
+  event = g_strdup_printf ("<span class=\"x-empathy-event\">%s</span>",
+      escaped);
+
+  /* Before the html is added, which may schedule trimming the scrollback */
+  self->priv->n_messages++;
+
+  theme_adium_add_html (self,
+      theme_adium_batch_appends (self) ? "batchAppendMessage" :
+        "appendMessage",
+      self->priv->data->status, event, NULL, NULL, NULL,
       NULL, "event", tpaw_time_get_current (), FALSE, FALSE, direction);
 
+  g_free (event);
+
   /* There is no last contact */
   if (self->priv->last_contact)
     {
@@ -895,7 +786,7 @@ theme_adium_add_message (EmpathyThemeAdium *self,
   EmpathyAvatar *avatar;
   const gchar *avatar_filename = NULL;
   gint64 timestamp;
-  const gchar *html = NULL;
+  EmpathyAdiumTemplate *html = NULL;
   const gchar *func;
   const gchar *service_name;
   GString *message_classes = NULL;
@@ -915,7 +806,8 @@ theme_adium_add_message (EmpathyThemeAdium *self,
   timestamp = empathy_message_get_timestamp (msg);
   body_escaped = theme_adium_parse_body (self,
     empathy_message_get_body (msg),
-    empathy_message_get_token (msg));
+    empathy_message_get_token (msg),
+    timestamp);
   name = empathy_contact_get_logged_alias (sender);
   contact_id = empathy_contact_get_id (sender);
   action = (empathy_message_get_tptype (msg) ==
@@ -1043,14 +935,18 @@ theme_adium_add_message (EmpathyThemeAdium *self,
       /* out */
       if (is_backlog)
         /* context */
-        html = consecutive ? self->priv->data->out_nextcontext_html :
-          self->priv->data->out_context_html;
+        html = consecutive ? self->priv->data->out_nextcontext :
+          self->priv->data->out_context;
       else
         /* content */
-        html = consecutive ? self->priv->data->out_nextcontent_html :
-          self->priv->data->out_content_html;
+        html = consecutive ? self->priv->data->out_nextcontent :
+          self->priv->data->out_content;
+
+      /* remove all the unread marks when we are sending a message; the
+       * marked messages may still be in the batch */
+      if (self->priv->has_unread_message)
+        theme_adium_flush_batch (self);
 
-      /* remove all the unread marks when we are sending a message */
       theme_adium_remove_all_focus_marks (self);
     }
   else
@@ -1058,16 +954,20 @@ theme_adium_add_message (EmpathyThemeAdium *self,
       /* in */
       if (is_backlog)
         /* context */
-        html = consecutive ? self->priv->data->in_nextcontext_html :
-          self->priv->data->in_context_html;
+        html = consecutive ? self->priv->data->in_nextcontext :
+          self->priv->data->in_context;
       else
         /* content */
-        html = consecutive ? self->priv->data->in_nextcontent_html :
-          self->priv->data->in_content_html;
+        html = consecutive ? self->priv->data->in_nextcontent :
+          self->priv->data->in_content;
     }
 
   direction = pango_find_base_dir (empathy_message_get_body (msg), -1);
 
+  /* Before the html is added, which may schedule trimming the scrollback */
+  if (timestamp != 0)
+    self->priv->n_messages++;
+
   theme_adium_add_html (self, func, html, body_escaped,
       avatar_filename, name_escaped, contact_id,
       service_name, message_classes->str,
@@ -1095,6 +995,10 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
       "appendNextMessageNoScroll",
       "appendMessage",
       "appendMessageNoScroll" };
+  const gchar *batch_js_funcs[] = { "batchAppendNextMessage",
+      "batchAppendNextMessageNoScroll",
+      "batchAppendMessage",
+      "batchAppendMessageNoScroll" };
 
   if (self->priv->pages_loading != 0)
     {
@@ -1105,7 +1009,8 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
 
   theme_adium_add_message (self, msg, &self->priv->last_contact,
       &self->priv->last_timestamp, &self->priv->last_is_backlog,
-      should_highlight, js_funcs);
+      should_highlight,
+      theme_adium_batch_appends (self) ? batch_js_funcs : js_funcs);
 }
 
 void
@@ -1177,12 +1082,15 @@ empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
       return;
     }
 
+  /* The message to edit may still be in the batch */
+  theme_adium_flush_batch (self);
+
   id = g_strdup_printf ("message-token-%s",
     empathy_message_get_supersedes (message));
   /* we don't pass a token here, because doing so will return another
    * <span> element, and we don't want nested <span> elements */
   parsed_body = theme_adium_parse_body (self,
-    empathy_message_get_body (message), NULL);
+    empathy_message_get_body (message), NULL, 0);
 
   /* find the element */
   doc = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
@@ -1263,6 +1171,35 @@ finally:
   g_free (parsed_body);
 }
 
+/**
+ * empathy_theme_adium_begin_batch:
+ * @self: an #EmpathyThemeAdium
+ *
+ * Starts gathering the messages and events added to @self, until
+ * empathy_theme_adium_commit_batch() is called. They are then inserted in
+ * the view with a single script, and a single reflow. Batches can be nested.
+ */
+void
+empathy_theme_adium_begin_batch (EmpathyThemeAdium *self)
+{
+  g_return_if_fail (EMPATHY_IS_THEME_ADIUM (self));
+
+  if (self->priv->batch_depth++ == 0 && self->priv->batch == NULL)
+    self->priv->batch = g_string_sized_new (4096);
+}
+
+void
+empathy_theme_adium_commit_batch (EmpathyThemeAdium *self)
+{
+  g_return_if_fail (EMPATHY_IS_THEME_ADIUM (self));
+  g_return_if_fail (self->priv->batch_depth > 0);
+
+  if (--self->priv->batch_depth > 0)
+    return;
+
+  theme_adium_flush_batch (self);
+}
+
 void
 empathy_theme_adium_scroll (EmpathyThemeAdium *self,
     gboolean allow_scrolling)
@@ -1477,6 +1414,27 @@ empathy_theme_adium_set_show_avatars (EmpathyThemeAdium *self,
   self->priv->show_avatars = show_avatars;
 }
 
+/* Evaluate the JavaScript helpers used to insert messages (prepend(),
+ * prependPrev()...) once in the freshly loaded page, so the per-message
+ * scripts are just calls to them. */
+static void
+theme_adium_load_helpers (EmpathyThemeAdium *self)
+{
+  GBytes *bytes;
+
+  bytes = g_resources_lookup_data ("/org/gnome/Empathy/Chat/empathy-chat.js",
+      G_RESOURCE_LOOKUP_FLAGS_NONE,
+      NULL);
+
+  self->priv->has_helpers = (bytes != NULL);
+  if (bytes == NULL)
+    return;
+
+  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self),
+      (const gchar *) g_bytes_get_data (bytes, NULL));
+  g_bytes_unref (bytes);
+}
+
 static void
 theme_adium_load_finished_cb (WebKitWebView *view,
     WebKitWebFrame *frame,
@@ -1491,7 +1449,11 @@ theme_adium_load_finished_cb (WebKitWebView *view,
   if (self->priv->pages_loading != 0)
     return;
 
+  theme_adium_load_helpers (self);
+
   /* Display queued messages */
+  empathy_theme_adium_begin_batch (self);
+
   for (l = self->priv->message_queue.head; l != NULL; l = l->next)
     {
       QueuedItem *item = l->data;
@@ -1516,6 +1478,8 @@ theme_adium_load_finished_cb (WebKitWebView *view,
     }
 
   g_queue_clear (&self->priv->message_queue);
+
+  empathy_theme_adium_commit_batch (self);
 }
 
 static void
@@ -1530,6 +1494,9 @@ theme_adium_finalize (GObject *object)
 
   g_free (self->priv->variant);
 
+  if (self->priv->batch != NULL)
+    g_string_free (self->priv->batch, TRUE);
+
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->finalize (object);
 }
 
@@ -1563,6 +1530,12 @@ theme_adium_dispose (GObject *object)
       g_queue_clear (&self->priv->acked_messages);
     }
 
+  if (self->priv->trim_scrollback_id != 0)
+    {
+      g_source_remove (self->priv->trim_scrollback_id);
+      self->priv->trim_scrollback_id = 0;
+    }
+
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->dispose (object);
 }
 
@@ -1748,6 +1721,23 @@ empathy_theme_adium_class_init (EmpathyThemeAdiumClass *klass)
         G_PARAM_READWRITE |
         G_PARAM_STATIC_STRINGS));
 
+  /**
+   * EmpathyThemeAdium::scrollback-trimmed:
+   * @self: the #EmpathyThemeAdium
+   * @timestamp: the timestamp of the oldest message still displayed, or 0
+   *
+   * Emitted when the oldest messages have been removed from the view because
+   * it was holding more than #EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT of them.
+   * Messages older than @timestamp should be fetched from the logs again if
+   * the user scrolls up.
+   */
+  signals[SCROLLBACK_TRIMMED] = g_signal_new ("scrollback-trimmed",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0, NULL, NULL, NULL,
+      G_TYPE_NONE,
+      1, G_TYPE_INT64);
+
   g_type_class_add_private (object_class, sizeof (EmpathyThemeAdiumPriv));
 }
 
@@ -2025,6 +2015,40 @@ empathy_adium_data_get_type (void)
   return type_id;
 }
 
+/* Compile each html string once, even if it is used by several fallbacks */
+static void
+adium_data_compile_templates (EmpathyAdiumData *data)
+{
+  GHashTable *compiled;
+
+  /* const gchar* -> EmpathyAdiumTemplate*, both borrowed */
+  compiled = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+#define COMPILE(html, tmpl) \
+  { \
+    tmpl = g_hash_table_lookup (compiled, html); \
+    if (tmpl == NULL) { \
+      tmpl = empathy_adium_template_new (html); \
+      g_ptr_array_add (data->templates_to_free, tmpl); \
+      g_hash_table_insert (compiled, (gpointer) html, tmpl); \
+    } \
+  }
+
+  COMPILE (data->in_content_html,      data->in_content);
+  COMPILE (data->in_context_html,      data->in_context);
+  COMPILE (data->in_nextcontent_html,  data->in_nextcontent);
+  COMPILE (data->in_nextcontext_html,  data->in_nextcontext);
+  COMPILE (data->out_content_html,     data->out_content);
+  COMPILE (data->out_context_html,     data->out_context);
+  COMPILE (data->out_nextcontent_html, data->out_nextcontent);
+  COMPILE (data->out_nextcontext_html, data->out_nextcontext);
+  COMPILE (data->status_html,          data->status);
+
+#undef COMPILE
+
+  g_hash_table_unref (compiled);
+}
+
 EmpathyAdiumData *
 empathy_adium_data_new_with_info (const gchar *path,
     GHashTable *info)
@@ -2044,8 +2068,8 @@ empathy_adium_data_new_with_info (const gchar *path,
   data->info = g_hash_table_ref (info);
   data->version = adium_info_get_version (info);
   data->strings_to_free = g_ptr_array_new_with_free_func (g_free);
-  data->date_format_cache = g_hash_table_new_full (g_str_hash,
-    g_str_equal, g_free, g_free);
+  data->templates_to_free = g_ptr_array_new_with_free_func (
+    (GDestroyNotify) empathy_adium_template_free);
 
   DEBUG ("Loading theme at %s", path);
 
@@ -2110,6 +2134,8 @@ empathy_adium_data_new_with_info (const gchar *path,
 
 #undef FALLBACK
 
+  adium_data_compile_templates (data);
+
   /* template -> empathy's template */
   data->custom_template = (template_html != NULL);
   if (template_html == NULL)
@@ -2214,7 +2240,7 @@ empathy_adium_data_unref (EmpathyAdiumData *data)
     g_free (data->default_outgoing_avatar_filename);
     g_hash_table_unref (data->info);
     g_ptr_array_unref (data->strings_to_free);
-    tp_clear_pointer (&data->date_format_cache, g_hash_table_unref);
+    g_ptr_array_unref (data->templates_to_free);
 
     g_slice_free (EmpathyAdiumData, data);
   }
@@ -94,6 +94,10 @@ void empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
 void empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
     EmpathyMessage *message);
 
+void empathy_theme_adium_begin_batch (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_commit_batch (EmpathyThemeAdium *self);
+
 void empathy_theme_adium_scroll (EmpathyThemeAdium *self,
     gboolean allow_scrolling);
 
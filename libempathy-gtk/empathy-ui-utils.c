@@ -40,6 +40,7 @@
 #include <tp-account-widgets/tpaw-pixbuf-utils.h>
 #include <tp-account-widgets/tpaw-utils.h>
 
+#include "empathy-avatar-cache.h"
 #include "empathy-ft-factory.h"
 #include "empathy-images.h"
 #include "empathy-utils.h"
@@ -156,327 +157,96 @@ empathy_protocol_name_for_contact (EmpathyContact *contact)
   return tp_account_get_icon_name (account);
 }
 
-struct SizeData
-{
-  gint width;
-  gint height;
-  gboolean preserve_aspect_ratio;
-};
-
-static void
-pixbuf_from_avatar_size_prepared_cb (GdkPixbufLoader *loader,
-    int width,
-    int height,
-    struct SizeData *data)
-{
-  g_return_if_fail (width > 0 && height > 0);
-
-  if (data->preserve_aspect_ratio && (data->width > 0 || data->height > 0))
-    {
-      if (data->width < 0)
-        {
-          width = width * (double) data->height / (gdouble) height;
-          height = data->height;
-        }
-      else if (data->height < 0)
-        {
-          height = height * (double) data->width / (double) width;
-          width = data->width;
-        }
-      else if ((double) height * (double) data->width >
-           (double) width * (double) data->height)
-        {
-          width = 0.5 + (double) width * (double) data->height / (double) height;
-          height = data->height;
-        }
-      else
-        {
-          height = 0.5 + (double) height * (double) data->width / (double) width;
-          width = data->width;
-        }
-    }
-  else
-    {
-      if (data->width > 0)
-        width = data->width;
-
-      if (data->height > 0)
-        height = data->height;
-    }
-
-  gdk_pixbuf_loader_set_size (loader, width, height);
-}
-
 static void
-empathy_avatar_pixbuf_roundify (GdkPixbuf *pixbuf)
-{
-  gint width, height, rowstride;
-  guchar *pixels;
-
-  width = gdk_pixbuf_get_width (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-
-  if (width < 6 || height < 6)
-    return;
-
-  /* Top left */
-  pixels[3] = 0;
-  pixels[7] = 0x80;
-  pixels[11] = 0xC0;
-  pixels[rowstride + 3] = 0x80;
-  pixels[rowstride * 2 + 3] = 0xC0;
-
-  /* Top right */
-  pixels[width * 4 - 1] = 0;
-  pixels[width * 4 - 5] = 0x80;
-  pixels[width * 4 - 9] = 0xC0;
-  pixels[rowstride + (width * 4) - 1] = 0x80;
-  pixels[(2 * rowstride) + (width * 4) - 1] = 0xC0;
-
-  /* Bottom left */
-  pixels[(height - 1) * rowstride + 3] = 0;
-  pixels[(height - 1) * rowstride + 7] = 0x80;
-  pixels[(height - 1) * rowstride + 11] = 0xC0;
-  pixels[(height - 2) * rowstride + 3] = 0x80;
-  pixels[(height - 3) * rowstride + 3] = 0xC0;
-
-  /* Bottom right */
-  pixels[height * rowstride - 1] = 0;
-  pixels[(height - 1) * rowstride - 1] = 0x80;
-  pixels[(height - 2) * rowstride - 1] = 0xC0;
-  pixels[height * rowstride - 5] = 0x80;
-  pixels[height * rowstride - 9] = 0xC0;
-}
-
-static gboolean
-empathy_gdk_pixbuf_is_opaque (GdkPixbuf *pixbuf)
-{
-  gint height, rowstride, i;
-  guchar *pixels;
-  guchar *row;
-
-  height = gdk_pixbuf_get_height (pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-
-  row = pixels;
-  for (i = 3; i < rowstride; i+=4)
-    if (row[i] < 0xfe)
-      return FALSE;
-
-  for (i = 1; i < height - 1; i++)
-    {
-      row = pixels + (i*rowstride);
-      if (row[3] < 0xfe || row[rowstride-1] < 0xfe)
-        return FALSE;
-    }
-
-  row = pixels + ((height-1) * rowstride);
-  for (i = 3; i < rowstride; i+=4)
-    if (row[i] < 0xfe)
-      return FALSE;
-
-  return TRUE;
-}
-
-static GdkPixbuf *
-pixbuf_round_corners (GdkPixbuf *pixbuf)
+avatar_from_contact_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
 {
-  GdkPixbuf *result;
+  GTask *task = user_data;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
 
-  if (!gdk_pixbuf_get_has_alpha (pixbuf))
+  pixbuf = empathy_avatar_cache_load_finish (result, &error);
+  if (pixbuf == NULL)
     {
-      result = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
-          gdk_pixbuf_get_width (pixbuf),
-          gdk_pixbuf_get_height (pixbuf));
-
-      gdk_pixbuf_copy_area (pixbuf, 0, 0,
-          gdk_pixbuf_get_width (pixbuf),
-          gdk_pixbuf_get_height (pixbuf),
-          result,
-          0, 0);
+      DEBUG ("Couldn't load avatar image: %s", error->message);
+      g_task_return_error (task, error);
     }
   else
     {
-      result = g_object_ref (pixbuf);
+      g_task_return_pointer (task, pixbuf, g_object_unref);
     }
 
-  if (empathy_gdk_pixbuf_is_opaque (result))
-    empathy_avatar_pixbuf_roundify (result);
-
-  return result;
-}
-
-static GdkPixbuf *
-avatar_pixbuf_from_loader (GdkPixbufLoader *loader)
-{
-  GdkPixbuf *pixbuf;
-
-  pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
-
-  return pixbuf_round_corners (pixbuf);
+  g_object_unref (task);
 }
 
-static GdkPixbuf *
-empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
+void
+empathy_pixbuf_avatar_from_contact_scaled_async (EmpathyContact *contact,
     gint width,
-    gint height)
+    gint height,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
 {
-  GdkPixbuf *pixbuf;
-  GdkPixbufLoader *loader;
-  struct SizeData data;
-  GError *error = NULL;
-
-  if (!avatar)
-    return NULL;
-
-  data.width = width;
-  data.height = height;
-  data.preserve_aspect_ratio = TRUE;
+  EmpathyAvatar *avatar;
+  GTask *task;
 
-  loader = gdk_pixbuf_loader_new ();
+  g_return_if_fail (EMPATHY_IS_CONTACT (contact));
 
-  g_signal_connect (loader, "size-prepared",
-      G_CALLBACK (pixbuf_from_avatar_size_prepared_cb), &data);
+  task = g_task_new (contact, cancellable, callback, user_data);
+  g_task_set_source_tag (task,
+      empathy_pixbuf_avatar_from_contact_scaled_async);
 
-  if (avatar->len == 0)
-    {
-      g_warning ("Avatar has 0 length");
-      return NULL;
-    }
-  else if (!gdk_pixbuf_loader_write (loader, avatar->data, avatar->len, &error))
+  avatar = empathy_contact_get_avatar (contact);
+  if (avatar == NULL)
     {
-      g_warning ("Couldn't write avatar image:%p with "
-          "length:%" G_GSIZE_FORMAT " to pixbuf loader: %s",
-          avatar->data, avatar->len, error->message);
-
-      g_error_free (error);
-      return NULL;
+      g_task_return_new_error (task, G_IO_ERROR,
+        G_IO_ERROR_NOT_FOUND, "no avatar found");
+      g_object_unref (task);
+      return;
     }
 
-  gdk_pixbuf_loader_close (loader, NULL);
-  pixbuf = avatar_pixbuf_from_loader (loader);
-
-  g_object_unref (loader);
-
-  return pixbuf;
+  /* Decoded in a thread and shared with every other user of this avatar */
+  empathy_avatar_cache_load_data_async (avatar->filename, avatar->data,
+      avatar->len, width, height, TRUE, cancellable,
+      avatar_from_contact_loaded_cb, task);
 }
 
+/* Return a ref on the GdkPixbuf */
 GdkPixbuf *
-empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
-    gint width,
-    gint height)
+empathy_pixbuf_avatar_from_contact_scaled_finish (EmpathyContact *contact,
+    GAsyncResult *result,
+    GError **error)
 {
-  EmpathyAvatar *avatar;
-
   g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, contact), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+      empathy_pixbuf_avatar_from_contact_scaled_async, NULL);
 
-  avatar = empathy_contact_get_avatar (contact);
-
-  return empathy_pixbuf_from_avatar_scaled (avatar, width, height);
-}
-
-typedef struct
-{
-  GSimpleAsyncResult *result;
-  guint width;
-  guint height;
-  GCancellable *cancellable;
-} PixbufAvatarFromIndividualClosure;
-
-static PixbufAvatarFromIndividualClosure *
-pixbuf_avatar_from_individual_closure_new (FolksIndividual *individual,
-    GSimpleAsyncResult *result,
-    gint width,
-    gint height,
-    GCancellable *cancellable)
-{
-  PixbufAvatarFromIndividualClosure *closure;
-
-  g_return_val_if_fail (FOLKS_IS_INDIVIDUAL (individual), NULL);
-  g_return_val_if_fail (G_IS_ASYNC_RESULT (result), NULL);
-
-  closure = g_slice_new0 (PixbufAvatarFromIndividualClosure);
-  closure->result = g_object_ref (result);
-  closure->width = width;
-  closure->height = height;
-
-  if (cancellable != NULL)
-    closure->cancellable = g_object_ref (cancellable);
-
-  return closure;
+  return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 static void
-pixbuf_avatar_from_individual_closure_free (
-    PixbufAvatarFromIndividualClosure *closure)
-{
-  g_clear_object (&closure->cancellable);
-  g_object_unref (closure->result);
-  g_slice_free (PixbufAvatarFromIndividualClosure, closure);
-}
-
-/**
- * @pixbuf: (transfer all)
- *
- * Return: (transfer all)
- */
-static GdkPixbuf *
-transform_pixbuf (GdkPixbuf *pixbuf)
-{
-  GdkPixbuf *result;
-
-  result = pixbuf_round_corners (pixbuf);
-  g_object_unref (pixbuf);
-
-  return result;
-}
-
-static void
-avatar_icon_load_cb (GObject *object,
+avatar_from_individual_loaded_cb (GObject *source,
     GAsyncResult *result,
     gpointer user_data)
 {
-  GLoadableIcon *icon = G_LOADABLE_ICON (object);
-  PixbufAvatarFromIndividualClosure *closure = user_data;
-  GInputStream *stream;
-  GError *error = NULL;
+  GTask *task = user_data;
   GdkPixbuf *pixbuf;
-  GdkPixbuf *final_pixbuf;
-
-  stream = g_loadable_icon_load_finish (icon, result, NULL, &error);
-  if (error != NULL)
-    {
-      DEBUG ("Failed to open avatar stream: %s", error->message);
-      g_simple_async_result_set_from_error (closure->result, error);
-      goto out;
-    }
-
-  pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream,
-      closure->width, closure->height, TRUE, closure->cancellable, &error);
-
-  g_object_unref (stream);
+  GError *error = NULL;
 
+  pixbuf = empathy_avatar_cache_load_finish (result, &error);
   if (pixbuf == NULL)
     {
       DEBUG ("Failed to read avatar: %s", error->message);
-      g_simple_async_result_set_from_error (closure->result, error);
-      goto out;
+      g_task_return_error (task, error);
+    }
+  else
+    {
+      g_task_return_pointer (task, pixbuf, g_object_unref);
     }
 
-  final_pixbuf = transform_pixbuf (pixbuf);
-
-  /* Pass ownership of final_pixbuf to the result */
-  g_simple_async_result_set_op_res_gpointer (closure->result,
-      final_pixbuf, g_object_unref);
-
-out:
-  g_simple_async_result_complete (closure->result);
-
-  g_clear_error (&error);
-  pixbuf_avatar_from_individual_closure_free (closure);
+  g_object_unref (task);
 }
 
 void
@@ -489,34 +259,26 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
     gpointer user_data)
 {
   GLoadableIcon *avatar_icon;
-  GSimpleAsyncResult *result;
-  PixbufAvatarFromIndividualClosure *closure;
+  GTask *task;
 
-  result = g_simple_async_result_new (G_OBJECT (individual),
-      callback, user_data, empathy_pixbuf_avatar_from_individual_scaled_async);
+  task = g_task_new (individual, cancellable, callback, user_data);
+  g_task_set_source_tag (task,
+      empathy_pixbuf_avatar_from_individual_scaled_async);
 
   avatar_icon = folks_avatar_details_get_avatar (
       FOLKS_AVATAR_DETAILS (individual));
 
   if (avatar_icon == NULL)
     {
-      g_simple_async_result_set_error (result, G_IO_ERROR,
+      g_task_return_new_error (task, G_IO_ERROR,
         G_IO_ERROR_NOT_FOUND, "no avatar found");
-
-      g_simple_async_result_complete (result);
-      g_object_unref (result);
+      g_object_unref (task);
       return;
     }
 
-  closure = pixbuf_avatar_from_individual_closure_new (individual, result,
-      width, height, cancellable);
-
-  g_return_if_fail (closure != NULL);
-
-  g_loadable_icon_load_async (avatar_icon, width, cancellable,
-      avatar_icon_load_cb, closure);
-
-  g_object_unref (result);
+  /* Decoded in a thread and shared with every other user of this avatar */
+  empathy_avatar_cache_load_icon_async (avatar_icon, width, height, TRUE,
+      cancellable, avatar_from_individual_loaded_cb, task);
 }
 
 /* Return a ref on the GdkPixbuf */
@@ -526,24 +288,12 @@ empathy_pixbuf_avatar_from_individual_scaled_finish (
     GAsyncResult *result,
     GError **error)
 {
-  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
-  gboolean result_valid;
-  GdkPixbuf *pixbuf;
-
   g_return_val_if_fail (FOLKS_IS_INDIVIDUAL (individual), NULL);
-  g_return_val_if_fail (G_IS_SIMPLE_ASYNC_RESULT (simple), NULL);
-
-  if (g_simple_async_result_propagate_error (simple, error))
-    return NULL;
-
-  result_valid = g_simple_async_result_is_valid (result,
-      G_OBJECT (individual),
-      empathy_pixbuf_avatar_from_individual_scaled_async);
+  g_return_val_if_fail (g_task_is_valid (result, individual), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+      empathy_pixbuf_avatar_from_individual_scaled_async, NULL);
 
-  g_return_val_if_fail (result_valid, NULL);
-
-  pixbuf = g_simple_async_result_get_op_res_gpointer (simple);
-  return pixbuf != NULL ? g_object_ref (pixbuf) : NULL;
+  return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 GdkPixbuf *
@@ -1007,66 +757,175 @@ empathy_get_current_action_time (void)
   return (tp_user_action_time_from_x11 (gtk_get_current_event_time ()));
 }
 
-/* @words = tpaw_live_search_strip_utf8_string (@text);
+struct _EmpathyIndividualTokens
+{
+  /* GPtrArray of the stripped words of each string @text is matched
+   * against: the alias, then the display ID of each interesting persona
+   * without its @server part. Words are only matched against the words of
+   * the same string. */
+  GPtrArray *fields;
+  /* Full display IDs of the interesting personas */
+  GPtrArray *ids;
+};
+
+static void
+tokens_add_field (EmpathyIndividualTokens *tokens,
+    const gchar *str)
+{
+  GPtrArray *words;
+
+  words = tpaw_live_search_strip_utf8_string (str);
+  if (words != NULL)
+    g_ptr_array_add (tokens->fields, words);
+}
+
+/**
+ * empathy_individual_tokens_new:
+ * @individual: a #FolksIndividual
  *
- * User has to pass both so we don't have to compute @words ourself each time
- * this function is called. */
-gboolean
-empathy_individual_match_string (FolksIndividual *individual,
-    const char *text,
-    GPtrArray *words)
+ * Splits the strings of @individual checked by
+ * empathy_individual_match_string() into normalized words. The result has to
+ * be created again when the alias or the personas of @individual change.
+ *
+ * Returns: a new #EmpathyIndividualTokens
+ */
+EmpathyIndividualTokens *
+empathy_individual_tokens_new (FolksIndividual *individual)
 {
-  const gchar *str;
+  EmpathyIndividualTokens *tokens;
   GeeSet *personas;
   GeeIterator *iter;
-  gboolean retval = FALSE;
 
-  /* check alias name */
-  str = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual));
+  tokens = g_slice_new (EmpathyIndividualTokens);
+  tokens->fields = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_ptr_array_unref);
+  tokens->ids = g_ptr_array_new_with_free_func (g_free);
 
-  if (tpaw_live_search_match_words (str, words))
-    return TRUE;
+  tokens_add_field (tokens,
+      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)));
 
   personas = folks_individual_get_personas (individual);
 
-  /* check contact id, remove the @server.com part */
   iter = gee_iterable_iterator (GEE_ITERABLE (personas));
-  while (retval == FALSE && gee_iterator_next (iter))
+  while (gee_iterator_next (iter))
     {
       FolksPersona *persona = gee_iterator_get (iter);
-      const gchar *p;
 
       if (empathy_folks_persona_is_interesting (persona))
         {
-          str = folks_persona_get_display_id (persona);
+          const gchar *str = folks_persona_get_display_id (persona);
+          const gchar *p;
+
+          g_ptr_array_add (tokens->ids, g_strdup (str));
 
-          /* Accept the persona if @text is a full prefix of his ID; that allows
-           * user to find, say, a jabber contact by typing his JID. */
-          if (g_str_has_prefix (str, text))
+          p = strstr (str, "@");
+          if (p != NULL)
             {
-              retval = TRUE;
+              gchar *dup_str = g_strndup (str, p - str);
+
+              tokens_add_field (tokens, dup_str);
+              g_free (dup_str);
             }
           else
             {
-              gchar *dup_str = NULL;
-              gboolean visible;
-
-              p = strstr (str, "@");
-              if (p != NULL)
-                str = dup_str = g_strndup (str, p - str);
-
-              visible = tpaw_live_search_match_words (str, words);
-              g_free (dup_str);
-              if (visible)
-                retval = TRUE;
+              tokens_add_field (tokens, str);
             }
         }
       g_clear_object (&persona);
     }
   g_clear_object (&iter);
 
-  /* FIXME: Add more rules here, we could check phone numbers in
+  return tokens;
+}
+
+void
+empathy_individual_tokens_free (EmpathyIndividualTokens *tokens)
+{
+  if (tokens == NULL)
+    return;
+
+  g_ptr_array_unref (tokens->fields);
+  g_ptr_array_unref (tokens->ids);
+  g_slice_free (EmpathyIndividualTokens, tokens);
+}
+
+static gboolean
+field_match_words (GPtrArray *field,
+    GPtrArray *words)
+{
+  guint i, j;
+
+  for (i = 0; i < words->len; i++)
+    {
+      const gchar *word = g_ptr_array_index (words, i);
+      gboolean found = FALSE;
+
+      for (j = 0; !found && j < field->len; j++)
+        found = g_str_has_prefix (g_ptr_array_index (field, j), word);
+
+      if (!found)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * empathy_individual_tokens_match:
+ * @tokens: the #EmpathyIndividualTokens of an individual
+ * @text: the text of the search
+ * @words: the result of tpaw_live_search_strip_utf8_string() on @text
+ *
+ * Same as empathy_individual_match_string(), without looking at the
+ * individual again.
+ *
+ * Returns: %TRUE if the individual of @tokens matches the search
+ */
+gboolean
+empathy_individual_tokens_match (EmpathyIndividualTokens *tokens,
+    const gchar *text,
+    GPtrArray *words)
+{
+  guint i;
+
+  if (words == NULL)
+    return TRUE;
+
+  /* Accept the persona if @text is a full prefix of his ID; that allows
+   * user to find, say, a jabber contact by typing his JID. */
+  for (i = 0; i < tokens->ids->len; i++)
+    {
+      if (g_str_has_prefix (g_ptr_array_index (tokens->ids, i), text))
+        return TRUE;
+    }
+
+  for (i = 0; i < tokens->fields->len; i++)
+    {
+      if (field_match_words (g_ptr_array_index (tokens->fields, i), words))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* @words = tpaw_live_search_strip_utf8_string (@text);
+ *
+ * User has to pass both so we don't have to compute @words ourself each time
+ * this function is called. */
+gboolean
+empathy_individual_match_string (FolksIndividual *individual,
+    const char *text,
+    GPtrArray *words)
+{
+  EmpathyIndividualTokens *tokens;
+  gboolean retval;
+
+  /* FIXME: Add more rules to the tokens, we could check phone numbers in
    * contact's vCard for example. */
+  tokens = empathy_individual_tokens_new (individual);
+  retval = empathy_individual_tokens_match (tokens, text, words);
+  empathy_individual_tokens_free (tokens);
+
   return retval;
 }
 
@@ -69,9 +69,17 @@ GdkPixbuf * empathy_pixbuf_avatar_from_individual_scaled_finish (
     FolksIndividual *individual,
     GAsyncResult *result,
     GError **error);
-GdkPixbuf * empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
+void empathy_pixbuf_avatar_from_contact_scaled_async (
+    EmpathyContact *contact,
     gint width,
-    gint height);
+    gint height,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+GdkPixbuf * empathy_pixbuf_avatar_from_contact_scaled_finish (
+    EmpathyContact *contact,
+    GAsyncResult *result,
+    GError **error);
 GdkPixbuf * empathy_pixbuf_contact_status_icon (EmpathyContact *contact,
     gboolean show_protocol);
 GdkPixbuf * empathy_pixbuf_contact_status_icon_with_icon_name (
@@ -106,6 +114,17 @@ gboolean empathy_individual_match_string (
     const gchar *text,
     GPtrArray *words);
 
+/* Normalized words of an individual, to match it against a live search
+ * without walking its personas again */
+typedef struct _EmpathyIndividualTokens EmpathyIndividualTokens;
+
+EmpathyIndividualTokens * empathy_individual_tokens_new (
+    FolksIndividual *individual);
+void empathy_individual_tokens_free (EmpathyIndividualTokens *tokens);
+gboolean empathy_individual_tokens_match (EmpathyIndividualTokens *tokens,
+    const gchar *text,
+    GPtrArray *words);
+
 void empathy_launch_program (const gchar *dir,
     const gchar *name,
     const gchar *args);
@@ -29,6 +29,7 @@
 #endif
 
 #include "empathy-location.h"
+#include "empathy-log-index.h"
 #include "empathy-utils.h"
 #include "empathy-enum-types.h"
 
@@ -44,6 +45,8 @@ typedef struct {
   gchar *alias;
   gchar *logged_alias;
   EmpathyAvatar *avatar;
+  /* Bumped whenever the avatar changes, so out of date loads are ignored */
+  guint avatar_serial;
   TpConnectionPresenceType presence;
   guint handle;
   EmpathyCapabilities capabilities;
@@ -82,6 +85,9 @@ static void set_capabilities_from_tp_caps (EmpathyContact *self,
 static void contact_set_avatar (EmpathyContact *contact,
     EmpathyAvatar *avatar);
 static void contact_set_avatar_from_tp_contact (EmpathyContact *contact);
+static gboolean contact_set_avatar_file (EmpathyContact *contact,
+    const gchar *path,
+    const gchar *mime);
 static gboolean contact_load_avatar_cache (EmpathyContact *contact,
     const gchar *token);
 
@@ -770,9 +776,29 @@ empathy_contact_from_tpl_contact (TpAccount *account,
         }
     }
 
-  if (!TPAW_STR_EMPTY (tpl_entity_get_avatar_token (tpl_entity)))
-    contact_load_avatar_cache (retval,
-        tpl_entity_get_avatar_token (tpl_entity));
+  /* The backlog is displayed as soon as the log events are, and isn't
+   * re-rendered when the avatars of their senders change: set them right
+   * away. Only their file is needed to display them. */
+  if (empathy_contact_get_avatar (retval) == NULL)
+    {
+      TpContact *tp_contact = empathy_contact_get_tp_contact (retval);
+      GFile *file = NULL;
+      gchar *path = NULL;
+
+      if (tp_contact != NULL)
+        file = tp_contact_get_avatar_file (tp_contact);
+
+      if (file != NULL)
+        path = g_file_get_path (file);
+
+      if ((path == NULL || !contact_set_avatar_file (retval, path,
+              tp_contact_get_avatar_mime_type (tp_contact))) &&
+          !TPAW_STR_EMPTY (tpl_entity_get_avatar_token (tpl_entity)))
+        contact_load_avatar_cache (retval,
+            tpl_entity_get_avatar_token (tpl_entity));
+
+      g_free (path);
+    }
 
   return retval;
 }
@@ -944,6 +970,8 @@ contact_set_avatar (EmpathyContact *contact,
 
   priv = GET_PRIV (contact);
 
+  priv->avatar_serial++;
+
   if (priv->avatar == avatar)
     return;
 
@@ -1267,22 +1295,71 @@ empathy_contact_can_use_rfb_stream_tube (EmpathyContact *contact)
   return priv->capabilities & EMPATHY_CAPABILITIES_RFB_STREAM_TUBE;
 }
 
+/* Kept alive for the whole process so what it learnt is not lost */
+static EmpathyLogIndex *log_index = NULL;
+
+static EmpathyLogIndex *
+get_log_index (void)
+{
+  if (log_index == NULL)
+    log_index = empathy_log_index_dup_singleton ();
+
+  return log_index;
+}
+
 static gboolean
-contact_has_log (EmpathyContact *contact)
+contact_lookup_log (EmpathyContact *contact,
+    gboolean *have_log)
 {
-  TplLogManager *manager;
+  TpAccount *account;
   TplEntity *entity;
-  gboolean have_log;
+  gboolean known;
+
+  account = empathy_contact_get_account (contact);
+  if (account == NULL)
+    return FALSE;
 
-  manager = tpl_log_manager_dup_singleton ();
   entity = tpl_entity_new (empathy_contact_get_id (contact),
       TPL_ENTITY_CONTACT, NULL, NULL);
 
-  have_log = tpl_log_manager_exists (manager,
-      empathy_contact_get_account (contact), entity, TPL_EVENT_MASK_TEXT);
+  known = empathy_log_index_lookup (get_log_index (), account, entity,
+      TPL_EVENT_MASK_TEXT, have_log);
 
   g_object_unref (entity);
-  g_object_unref (manager);
+
+  return known;
+}
+
+/* Warms the log index once nothing else is going on, so menus don't have to
+ * wait */
+static void
+contact_prefetch_log (EmpathyContact *contact)
+{
+  TpAccount *account;
+  TplEntity *entity;
+
+  account = empathy_contact_get_account (contact);
+  if (account == NULL)
+    return;
+
+  entity = tpl_entity_new (empathy_contact_get_id (contact),
+      TPL_ENTITY_CONTACT, NULL, NULL);
+
+  empathy_log_index_prefetch (get_log_index (), account, entity,
+      TPL_EVENT_MASK_TEXT);
+
+  g_object_unref (entity);
+}
+
+static gboolean
+contact_has_log (EmpathyContact *contact)
+{
+  gboolean have_log;
+
+  /* Don't block on the disk: if we don't know yet, assume there are logs;
+   * EmpathyLogIndex::changed will tell if we were wrong. */
+  if (!contact_lookup_log (contact, &have_log))
+    return TRUE;
 
   return have_log;
 }
@@ -1344,7 +1421,6 @@ contact_get_avatar_filename (EmpathyContact *contact,
       tp_account_get_cm_name (account),
       tp_account_get_protocol_name (account),
       NULL);
-  g_mkdir_with_parents (avatar_path, 0700);
 
   avatar_file = g_build_filename (avatar_path, token_escaped, NULL);
 
@@ -1354,43 +1430,189 @@ contact_get_avatar_filename (EmpathyContact *contact,
   return avatar_file;
 }
 
-static gboolean
-contact_load_avatar_cache (EmpathyContact *contact,
-                           const gchar *token)
-{
-  EmpathyAvatar *avatar = NULL;
-  gchar *filename;
-  gchar *data = NULL;
+/* Avatars are read in a thread. Loads requested during the same main loop
+ * iteration, typically all the contacts of an account which just
+ * connected, are batched into a single task. */
+typedef struct {
+  EmpathyContact *contact;
+  guint serial;
+  GFile *file;
+  gchar *mime;
+  /* Whether to unset the current avatar if the file can't be read */
+  gboolean clear_on_error;
+
+  /* Set by the thread */
+  gchar *data;
   gsize len;
-  GError *error = NULL;
+  GError *error;
+} AvatarLoad;
 
-  g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), FALSE);
-  g_return_val_if_fail (!TPAW_STR_EMPTY (token), FALSE);
+/* AvatarLoad not yet handed to a thread */
+static GPtrArray *avatar_loads = NULL;
+static guint avatar_loads_id = 0;
 
-  /* Load the avatar from file if it exists */
-  filename = contact_get_avatar_filename (contact, token);
-  if (filename && g_file_test (filename, G_FILE_TEST_EXISTS))
+static void
+avatar_load_free (AvatarLoad *load)
+{
+  g_object_unref (load->contact);
+  g_object_unref (load->file);
+  g_free (load->mime);
+  g_free (load->data);
+  g_clear_error (&load->error);
+  g_slice_free (AvatarLoad, load);
+}
+
+static void
+avatar_loads_thread_func (GTask *task,
+    gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  GPtrArray *loads = task_data;
+  guint i;
+
+  for (i = 0; i < loads->len; i++)
+    {
+      AvatarLoad *load = g_ptr_array_index (loads, i);
+
+      g_file_load_contents (load->file, NULL, &load->data, &load->len, NULL,
+          &load->error);
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+avatar_loads_done_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GPtrArray *loads = g_task_get_task_data (G_TASK (result));
+  guint i;
+
+  for (i = 0; i < loads->len; i++)
     {
-      if (!g_file_get_contents (filename, &data, &len, &error))
+      AvatarLoad *load = g_ptr_array_index (loads, i);
+      EmpathyContactPriv *priv = GET_PRIV (load->contact);
+      EmpathyAvatar *avatar;
+      gchar *path;
+
+      /* The avatar changed in the meantime */
+      if (load->serial != priv->avatar_serial)
+        continue;
+
+      if (load->error != NULL)
         {
-          DEBUG ("Failed to load avatar from cache: %s",
-            error ? error->message : "No error given");
-          g_clear_error (&error);
+          DEBUG ("Failed to load avatar: %s", load->error->message);
+
+          if (load->clear_on_error)
+            contact_set_avatar (load->contact, NULL);
+
+          continue;
         }
+
+      path = g_file_get_path (load->file);
+      DEBUG ("Avatar loaded from %s", path);
+
+      avatar = empathy_avatar_new ((guchar *) load->data, load->len,
+          load->mime, path);
+      contact_set_avatar (load->contact, avatar);
+
+      empathy_avatar_unref (avatar);
+      g_free (path);
     }
 
-  if (data != NULL)
+  /* Release the contacts here rather than in whichever thread drops the
+   * last ref on the task */
+  g_ptr_array_set_size (loads, 0);
+}
+
+static gboolean
+avatar_loads_start_cb (gpointer user_data)
+{
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, avatar_loads_done_cb, NULL);
+  g_task_set_task_data (task, avatar_loads,
+      (GDestroyNotify) g_ptr_array_unref);
+  g_task_run_in_thread (task, avatar_loads_thread_func);
+  g_object_unref (task);
+
+  avatar_loads = NULL;
+  avatar_loads_id = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+contact_queue_avatar_load (EmpathyContact *contact,
+    GFile *file,
+    const gchar *mime,
+    gboolean clear_on_error)
+{
+  EmpathyContactPriv *priv = GET_PRIV (contact);
+  AvatarLoad *load;
+
+  load = g_slice_new0 (AvatarLoad);
+  load->contact = g_object_ref (contact);
+  load->serial = ++priv->avatar_serial;
+  load->file = g_object_ref (file);
+  load->mime = g_strdup (mime);
+  load->clear_on_error = clear_on_error;
+
+  if (avatar_loads == NULL)
+    avatar_loads = g_ptr_array_new_with_free_func (
+        (GDestroyNotify) avatar_load_free);
+
+  g_ptr_array_add (avatar_loads, load);
+
+  if (avatar_loads_id == 0)
+    avatar_loads_id = g_idle_add (avatar_loads_start_cb, NULL);
+}
+
+/* Only for the few contacts which have to be displayed with their avatar
+ * straight away, the others go through contact_queue_avatar_load(). The
+ * avatar only refers to @path, which is read only if its data is ever
+ * needed. */
+static gboolean
+contact_set_avatar_file (EmpathyContact *contact,
+    const gchar *path,
+    const gchar *mime)
+{
+  EmpathyAvatar *avatar;
+
+  if (!g_file_test (path, G_FILE_TEST_IS_REGULAR))
     {
-      DEBUG ("Avatar loaded from %s", filename);
-      avatar = empathy_avatar_new ((guchar *) data, len, NULL, filename);
-      contact_set_avatar (contact, avatar);
-      empathy_avatar_unref (avatar);
+      DEBUG ("No avatar in %s", path);
+      return FALSE;
     }
 
-  g_free (data);
+  /* Also discards any load of an older avatar still queued */
+  avatar = empathy_avatar_new (NULL, 0, mime, path);
+  contact_set_avatar (contact, avatar);
+  empathy_avatar_unref (avatar);
+
+  return TRUE;
+}
+
+static gboolean
+contact_load_avatar_cache (EmpathyContact *contact,
+                           const gchar *token)
+{
+  gchar *filename;
+  gboolean loaded;
+
+  g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), FALSE);
+  g_return_val_if_fail (!TPAW_STR_EMPTY (token), FALSE);
+
+  filename = contact_get_avatar_filename (contact, token);
+  if (filename == NULL)
+    return FALSE;
+
+  loaded = contact_set_avatar_file (contact, filename, NULL);
   g_free (filename);
 
-  return data != NULL;
+  return loaded;
 }
 
 GType
@@ -1410,7 +1632,8 @@ empathy_avatar_get_type (void)
 
 /**
  * empathy_avatar_new:
- * @data: the avatar data
+ * @data: (allow-none): the avatar data, or %NULL if it hasn't been read from
+ *   @filename yet
  * @len: the size of avatar data
  * @format: the mime type of the avatar image
  * @filename: the filename where the avatar is stored in cache
@@ -1477,8 +1700,22 @@ empathy_avatar_save_to_file (EmpathyAvatar *self,
                              const gchar *filename,
                              GError **error)
 {
-  return g_file_set_contents (filename, (const gchar *) self->data, self->len,
-      error);
+  gchar *data;
+  gsize len;
+  gboolean ret;
+
+  if (self->data != NULL)
+    return g_file_set_contents (filename, (const gchar *) self->data,
+        self->len, error);
+
+  /* Not read yet */
+  if (!g_file_get_contents (self->filename, &data, &len, error))
+    return FALSE;
+
+  ret = g_file_set_contents (filename, data, len, error);
+  g_free (data);
+
+  return ret;
 }
 
 /**
@@ -1739,36 +1976,38 @@ contact_set_avatar_from_tp_contact (EmpathyContact *contact)
   mime = tp_contact_get_avatar_mime_type (priv->tp_contact);
   file = tp_contact_get_avatar_file (priv->tp_contact);
 
-  if (file != NULL)
+  if (file == NULL)
     {
-      EmpathyAvatar *avatar;
-      gchar *data;
-      gsize len;
-      gchar *path;
-      GError *error = NULL;
+      contact_set_avatar (contact, NULL);
+      return;
+    }
 
-      if (!g_file_load_contents (file, NULL, &data, &len, NULL, &error))
-        {
-          DEBUG ("Failed to load avatar: %s", error->message);
+  /* Contacts created for log events share their TpContact with the one
+   * from the roster, which most likely loaded this file already. Reuse its
+   * avatar so messages can be displayed with it straight away. */
+  if (contacts_table != NULL)
+    {
+      EmpathyContact *existing;
 
-          g_error_free (error);
-          contact_set_avatar (contact, NULL);
-          return;
+      existing = g_hash_table_lookup (contacts_table, priv->tp_contact);
+      if (existing != NULL && existing != contact)
+        {
+          EmpathyAvatar *avatar = empathy_contact_get_avatar (existing);
+          gchar *path = g_file_get_path (file);
+          gboolean same;
+
+          same = avatar != NULL && !tp_strdiff (avatar->filename, path);
+          g_free (path);
+
+          if (same)
+            {
+              contact_set_avatar (contact, avatar);
+              return;
+            }
         }
-
-      path = g_file_get_path (file);
-
-      avatar = empathy_avatar_new ((guchar *) data, len, mime, path);
-
-      contact_set_avatar (contact, avatar);
-      empathy_avatar_unref (avatar);
-      g_free (path);
-      g_free (data);
-    }
-  else
-    {
-      contact_set_avatar (contact, NULL);
     }
+
+  contact_queue_avatar_load (contact, file, mime, TRUE);
 }
 
 EmpathyContact *
@@ -1791,6 +2030,8 @@ empathy_contact_dup_from_tp_contact (TpContact *tp_contact)
        * contact keeps a ref to tp_contact, and is removed from the table in
        * contact_dispose() */
       g_hash_table_insert (contacts_table, tp_contact, contact);
+
+      contact_prefetch_log (contact);
     }
   else
     {
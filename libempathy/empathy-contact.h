@@ -51,6 +51,7 @@ struct _EmpathyContactClass
 };
 
 typedef struct {
+  /* NULL if it hasn't been read from filename yet */
   guchar *data;
   gsize len;
   gchar *format;
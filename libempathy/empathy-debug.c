@@ -72,57 +72,95 @@ empathy_debug_flag_is_set (EmpathyDebugFlags flag)
   return (flag & flags) != 0;
 }
 
-GHashTable *flag_to_keys = NULL;
+/* Our reference on the debug sender, and whether a client enabled it. Both
+ * are set up once, by the first empathy_debug_is_enabled() call of any
+ * thread. debug_sender_enabled is only accessed atomically, it changes in
+ * the main thread while others may be logging. */
+static gsize debug_initialized = 0;
+static TpDebugSender *debug_sender = NULL;
+static volatile gint debug_sender_enabled = FALSE;
 
-static const gchar *
-debug_flag_to_key (EmpathyDebugFlags flag)
+/* Domain of the messages of each flag, indexed by the bit of the flag */
+static gchar *flag_domains[32];
+
+static void
+debug_sender_notify_enabled_cb (GObject *sender,
+    GParamSpec *pspec,
+    gpointer user_data)
 {
-  if (flag_to_keys == NULL)
-    {
-      guint i;
+  gboolean enabled;
+
+  g_object_get (sender, "enabled", &enabled, NULL);
+  g_atomic_int_set (&debug_sender_enabled, enabled);
+}
 
-      flag_to_keys = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-          NULL, g_free);
+static void
+debug_init (void)
+{
+  guint i;
+
+  for (i = 0; keys[i].value; i++)
+    {
+      gint bit = g_bit_nth_lsf (keys[i].value, -1);
 
-      for (i = 0; keys[i].value; i++)
-        {
-          GDebugKey key = (GDebugKey) keys[i];
-          g_hash_table_insert (flag_to_keys, GUINT_TO_POINTER (key.value),
-              g_strdup (key.key));
-        }
+      /* Flags sharing a bit use the domain of the last key */
+      g_free (flag_domains[bit]);
+      flag_domains[bit] = g_strdup_printf ("%s/%s", G_LOG_DOMAIN,
+          keys[i].key);
     }
 
-  return g_hash_table_lookup (flag_to_keys, GUINT_TO_POINTER (flag));
+  debug_sender = tp_debug_sender_dup ();
+
+  g_signal_connect (debug_sender, "notify::enabled",
+      G_CALLBACK (debug_sender_notify_enabled_cb), NULL);
+  debug_sender_notify_enabled_cb (G_OBJECT (debug_sender), NULL, NULL);
 }
 
-void
-empathy_debug_free (void)
+/**
+ * empathy_debug_is_enabled:
+ * @flag: a #EmpathyDebugFlags
+ *
+ * Returns: %TRUE if messages for @flag would be logged or sent to a debug
+ *   client, so formatting them is worth it
+ */
+gboolean
+empathy_debug_is_enabled (EmpathyDebugFlags flag)
 {
-  if (flag_to_keys == NULL)
-    return;
+  if (g_once_init_enter (&debug_initialized))
+    {
+      debug_init ();
+      g_once_init_leave (&debug_initialized, 1);
+    }
 
-  g_hash_table_unref (flag_to_keys);
-  flag_to_keys = NULL;
+  return g_atomic_int_get (&debug_sender_enabled) || (flag & flags) != 0;
 }
 
-static void
-log_to_debug_sender (EmpathyDebugFlags flag,
-    const gchar *message)
+static const gchar *
+debug_flag_to_domain (EmpathyDebugFlags flag)
 {
-  TpDebugSender *sender;
-  gchar *domain;
-  GTimeVal now;
+  gint bit = g_bit_nth_lsf (flag, -1);
 
-  sender = tp_debug_sender_dup ();
+  if (bit < 0 || flag_domains[bit] == NULL)
+    return G_LOG_DOMAIN;
 
-  g_get_current_time (&now);
+  return flag_domains[bit];
+}
 
-  domain = g_strdup_printf ("%s/%s", G_LOG_DOMAIN, debug_flag_to_key (flag));
+void
+empathy_debug_free (void)
+{
+  guint i;
 
-  tp_debug_sender_add_message (sender, &now, domain, G_LOG_LEVEL_DEBUG, message);
+  if (debug_sender != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (debug_sender,
+          debug_sender_notify_enabled_cb, NULL);
+      g_atomic_int_set (&debug_sender_enabled, FALSE);
+      tp_clear_object (&debug_sender);
+    }
 
-  g_free (domain);
-  g_object_unref (sender);
+  for (i = 0; i < G_N_ELEMENTS (flag_domains); i++)
+    tp_clear_pointer (&flag_domains[i], g_free);
 }
 
 void
@@ -133,11 +171,22 @@ empathy_debug (EmpathyDebugFlags flag,
   gchar *message;
   va_list args;
 
+  if (!empathy_debug_is_enabled (flag))
+    return;
+
   va_start (args, format);
   message = g_strdup_vprintf (format, args);
   va_end (args);
 
-  log_to_debug_sender (flag, message);
+  if (g_atomic_int_get (&debug_sender_enabled))
+    {
+      GTimeVal now;
+
+      g_get_current_time (&now);
+
+      tp_debug_sender_add_message (debug_sender, &now,
+          debug_flag_to_domain (flag), G_LOG_LEVEL_DEBUG, message);
+    }
 
   if (flag & flags)
     g_log (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG, "%s", message);
@@ -153,6 +202,12 @@ empathy_debug_flag_is_set (EmpathyDebugFlags flag)
   return FALSE;
 }
 
+gboolean
+empathy_debug_is_enabled (EmpathyDebugFlags flag)
+{
+  return FALSE;
+}
+
 void
 empathy_debug (EmpathyDebugFlags flag, const gchar *format, ...)
 {
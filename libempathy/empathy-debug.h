@@ -48,6 +48,7 @@ typedef enum
 } EmpathyDebugFlags;
 
 gboolean empathy_debug_flag_is_set (EmpathyDebugFlags flag);
+gboolean empathy_debug_is_enabled (EmpathyDebugFlags flag);
 void empathy_debug (EmpathyDebugFlags flag, const gchar *format, ...)
     G_GNUC_PRINTF (2, 3);
 void empathy_debug_free (void);
@@ -79,7 +80,10 @@ G_END_DECLS
 
 #undef DEBUG
 #define DEBUG(format, ...) \
-  empathy_debug (DEBUG_FLAG, "%s: " format, G_STRFUNC, ##__VA_ARGS__)
+  G_STMT_START { \
+    if (empathy_debug_is_enabled (DEBUG_FLAG)) \
+      empathy_debug (DEBUG_FLAG, "%s: " format, G_STRFUNC, ##__VA_ARGS__); \
+  } G_STMT_END
 
 #undef DEBUGGING
 #define DEBUGGING empathy_debug_flag_is_set (DEBUG_FLAG)
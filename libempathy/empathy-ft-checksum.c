@@ -0,0 +1,149 @@
+/*
+ * empathy-ft-checksum.c - Source for file checksumming helpers
+ * Copyright (C) 2009-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-ft-checksum.h"
+
+/* Large enough for the per-read overhead to vanish next to the hashing
+ * itself, small enough to stay in cache. */
+#define BUFFER_SIZE (256 * 1024)
+
+/**
+ * empathy_ft_checksum_file:
+ * @file: the file to checksum
+ * @checksum: the #GChecksum to update with the content of @file
+ * @cancellable: (allow-none): a #GCancellable
+ * @progress_func: (allow-none): called with the number of bytes hashed so
+ *   far, at most every %EMPATHY_FT_CHECKSUM_PROGRESS_INTERVAL and once at
+ *   the end
+ * @user_data: data for @progress_func
+ * @error: return location for a #GError, or %NULL
+ *
+ * Reads @file and feeds it to @checksum, using a single buffer for the
+ * whole file. This blocks, so it should be called from a worker thread;
+ * @progress_func is called from that thread too.
+ *
+ * Returns: %TRUE on success, %FALSE if @file could not be read
+ */
+gboolean
+empathy_ft_checksum_file (GFile *file,
+    GChecksum *checksum,
+    GCancellable *cancellable,
+    EmpathyFTChecksumProgressFunc progress_func,
+    gpointer user_data,
+    GError **error)
+{
+  return empathy_ft_checksum_file_full (file, checksum, cancellable,
+      progress_func, NULL, user_data, error);
+}
+
+/**
+ * empathy_ft_checksum_file_full:
+ * @file: the file to checksum
+ * @checksum: the #GChecksum to update with the content of @file
+ * @cancellable: (allow-none): a #GCancellable
+ * @progress_func: (allow-none): as for empathy_ft_checksum_file()
+ * @wait_func: (allow-none): called from the worker thread each time the
+ *   end of @file is reached
+ * @user_data: data for @progress_func and @wait_func
+ * @error: return location for a #GError, or %NULL
+ *
+ * Like empathy_ft_checksum_file(), but allows hashing a file while it is
+ * being written: as long as @wait_func returns %TRUE, reaching the end of
+ * @file means that more data may still come. @wait_func is expected to
+ * block until it does, or until @cancellable is cancelled.
+ *
+ * Returns: %TRUE on success, %FALSE if @file could not be read
+ */
+gboolean
+empathy_ft_checksum_file_full (GFile *file,
+    GChecksum *checksum,
+    GCancellable *cancellable,
+    EmpathyFTChecksumProgressFunc progress_func,
+    EmpathyFTChecksumWaitFunc wait_func,
+    gpointer user_data,
+    GError **error)
+{
+  GFileInputStream *stream;
+  guchar *buffer;
+  guint64 total_read = 0;
+  gint64 last_report = 0;
+  gssize bytes_read;
+  gboolean result;
+
+  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+  g_return_val_if_fail (checksum != NULL, FALSE);
+
+  stream = g_file_read (file, cancellable, error);
+  if (stream == NULL)
+    return FALSE;
+
+  buffer = g_malloc (BUFFER_SIZE);
+
+  /* A mapping would save a copy, but a file truncated while we are reading
+   * it would then kill the whole process with SIGBUS. */
+  for (;;)
+    {
+      gint64 now;
+
+      bytes_read = g_input_stream_read (G_INPUT_STREAM (stream), buffer,
+          BUFFER_SIZE, cancellable, error);
+
+      if (bytes_read == 0 && wait_func != NULL &&
+          wait_func (total_read, user_data))
+        continue;
+
+      if (bytes_read <= 0)
+        break;
+
+      g_checksum_update (checksum, buffer, bytes_read);
+      total_read += bytes_read;
+
+      if (progress_func == NULL)
+        continue;
+
+      now = g_get_monotonic_time ();
+      if (now - last_report >= EMPATHY_FT_CHECKSUM_PROGRESS_INTERVAL)
+        {
+          progress_func (total_read, user_data);
+          last_report = now;
+        }
+    }
+
+  result = bytes_read == 0;
+
+  g_free (buffer);
+
+  if (result)
+    {
+      result = g_input_stream_close (G_INPUT_STREAM (stream), cancellable,
+          error);
+    }
+  else
+    {
+      g_input_stream_close (G_INPUT_STREAM (stream), NULL, NULL);
+    }
+
+  g_object_unref (stream);
+
+  if (result && progress_func != NULL)
+    progress_func (total_read, user_data);
+
+  return result;
+}
@@ -0,0 +1,55 @@
+/*
+ * empathy-ft-checksum.h - Header for file checksumming helpers
+ * Copyright (C) 2009-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_FT_CHECKSUM_H__
+#define __EMPATHY_FT_CHECKSUM_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Minimal interval between two progress reports */
+#define EMPATHY_FT_CHECKSUM_PROGRESS_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+
+typedef void (*EmpathyFTChecksumProgressFunc) (guint64 current_bytes,
+    gpointer user_data);
+
+/* Returns TRUE if the file may still grow, in which case reading is retried
+ * once the function returns. */
+typedef gboolean (*EmpathyFTChecksumWaitFunc) (guint64 current_bytes,
+    gpointer user_data);
+
+gboolean empathy_ft_checksum_file (GFile *file,
+    GChecksum *checksum,
+    GCancellable *cancellable,
+    EmpathyFTChecksumProgressFunc progress_func,
+    gpointer user_data,
+    GError **error);
+
+gboolean empathy_ft_checksum_file_full (GFile *file,
+    GChecksum *checksum,
+    GCancellable *cancellable,
+    EmpathyFTChecksumProgressFunc progress_func,
+    EmpathyFTChecksumWaitFunc wait_func,
+    gpointer user_data,
+    GError **error);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_FT_CHECKSUM_H__ */
@@ -29,6 +29,7 @@
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "empathy-ft-checksum.h"
 #include "empathy-utils.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
@@ -60,7 +61,9 @@
  * In addition, if the handler is created with checksumming enabled,
  * other three signals (::hashing-started, ::hashing-progress, ::hashing-done)
  * will be emitted before or after the transfer, depending on the direction
- * (respectively outgoing and incoming) of the handler.
+ * (respectively outgoing and incoming) of the handler. Incoming files which
+ * don't replace an existing one are actually hashed while they are received,
+ * so that ::hashing-done follows ::transfer-done shortly.
  * At any time between the call to empathy_ft_handler_start_transfer() and
  * the last signal, a ::transfer-error can be emitted, indicating that an
  * error has happened in the operation. The message of the error is localized
@@ -71,7 +74,8 @@ G_DEFINE_TYPE (EmpathyFTHandler, empathy_ft_handler, G_TYPE_OBJECT)
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyFTHandler)
 
-#define BUFFER_SIZE 4096
+/* How often inline hashing checks for new data if it isn't told about it */
+#define INLINE_HASH_POLL_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
 
 enum {
   PROP_CHANNEL = 1,
@@ -98,13 +102,25 @@ enum {
 };
 
 typedef struct {
-  GInputStream *stream;
+  GIOSchedulerJob *job;
+  GFile *file;
   GError *error /* comment to make the style checker happy */;
-  guchar *buffer;
   GChecksum *checksum;
-  gssize total_read;
   guint64 total_bytes;
   EmpathyFTHandler *handler;
+  GCancellable *cancellable;
+
+  /* Whether ::hashing-started has been emitted. Inline hashing of incoming
+   * files starts silently when the transfer does. Only used from the main
+   * thread. */
+  gboolean announced;
+
+  /* Protects the fields below, which are shared with the hashing thread */
+  GMutex mutex;
+  GCond cond;
+  /* Whether the file is still being written by the transfer */
+  gboolean follow;
+  guint64 total_read;
 } HashingData;
 
 typedef struct {
@@ -135,6 +151,11 @@ typedef struct {
   guint64 mtime;
   gchar *content_hash;
   TpFileHashType content_hash_type;
+  /* borrowed, set while an incoming file is hashed along its transfer */
+  HashingData *inline_hash;
+  /* Whether the incoming file is written in place, so that it can be
+   * hashed along its transfer */
+  gboolean can_hash_inline;
 
   gint64 user_action_time;
 
@@ -148,8 +169,10 @@ typedef struct {
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
-static gboolean do_hash_job_incoming (GIOSchedulerJob *job,
-    GCancellable *cancellable, gpointer user_data);
+static HashingData * ft_handler_start_hashing (EmpathyFTHandler *handler,
+    GChecksumType type,
+    gboolean follow);
+static void cancel_inline_hash_incoming (EmpathyFTHandler *handler);
 
 /* GObject implementations */
 static void
@@ -252,6 +275,8 @@ do_dispose (GObject *object)
 
   priv->dispose_run = TRUE;
 
+  cancel_inline_hash_incoming (EMPATHY_FT_HANDLER (object));
+
   if (priv->contact != NULL) {
     g_object_unref (priv->contact);
     priv->contact = NULL;
@@ -551,10 +576,8 @@ empathy_ft_handler_init (EmpathyFTHandler *self)
 static void
 hash_data_free (HashingData *data)
 {
-  g_free (data->buffer);
-
-  if (data->stream != NULL)
-    g_object_unref (data->stream);
+  if (data->file != NULL)
+    g_object_unref (data->file);
 
   if (data->checksum != NULL)
     g_checksum_free (data->checksum);
@@ -565,6 +588,12 @@ hash_data_free (HashingData *data)
   if (data->handler != NULL)
     g_object_unref (data->handler);
 
+  if (data->cancellable != NULL)
+    g_object_unref (data->cancellable);
+
+  g_mutex_clear (&data->mutex);
+  g_cond_clear (&data->cond);
+
   g_slice_free (HashingData, data);
 }
 
@@ -596,24 +625,79 @@ tp_file_hash_to_g_checksum (TpFileHashType type)
 static void
 check_hash_incoming (EmpathyFTHandler *handler)
 {
-  HashingData *hash_data;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
 
   if (!TPAW_STR_EMPTY (priv->content_hash))
     {
-      hash_data = g_slice_new0 (HashingData);
-      hash_data->total_bytes = priv->total_bytes;
-      hash_data->handler = g_object_ref (handler);
-      hash_data->checksum = g_checksum_new
-        (tp_file_hash_to_g_checksum (priv->content_hash_type));
-
-      g_signal_emit (handler, signals[HASHING_STARTED], 0);
+      DEBUG ("checking integrity for incoming handler");
 
-      g_io_scheduler_push_job (do_hash_job_incoming, hash_data, NULL,
-                               G_PRIORITY_DEFAULT, priv->cancellable);
+      ft_handler_start_hashing (handler,
+          tp_file_hash_to_g_checksum (priv->content_hash_type), FALSE);
     }
 }
 
+static void
+start_inline_hash_incoming (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  if (!priv->use_hash || TPAW_STR_EMPTY (priv->content_hash) ||
+      !priv->can_hash_inline || priv->inline_hash != NULL)
+    return;
+
+  DEBUG ("checking integrity of incoming file while it is transferred");
+
+  priv->inline_hash = ft_handler_start_hashing (handler,
+      tp_file_hash_to_g_checksum (priv->content_hash_type), TRUE);
+}
+
+/* Returns FALSE if there was no inline hashing going on */
+static gboolean
+finish_inline_hash_incoming (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->inline_hash;
+
+  if (hash_data == NULL)
+    return FALSE;
+
+  g_mutex_lock (&hash_data->mutex);
+  hash_data->follow = FALSE;
+  g_cond_signal (&hash_data->cond);
+  g_mutex_unlock (&hash_data->mutex);
+
+  /* Most of the file has already been hashed, so the remaining progress
+   * and ::hashing-done come shortly */
+  hash_data->announced = TRUE;
+  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+
+  return TRUE;
+}
+
+/* Stops hashing the incoming file if the transfer ended before completing,
+ * otherwise the thread would keep waiting for more data. */
+static void
+cancel_inline_hash_incoming (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->inline_hash;
+
+  if (hash_data == NULL || hash_data->announced)
+    return;
+
+  DEBUG ("Transfer ended, stop hashing the incoming file");
+
+  g_mutex_lock (&hash_data->mutex);
+  hash_data->follow = FALSE;
+  g_cond_signal (&hash_data->cond);
+  g_mutex_unlock (&hash_data->mutex);
+
+  g_cancellable_cancel (hash_data->cancellable);
+
+  /* hash_job_done() frees it */
+  priv->inline_hash = NULL;
+}
+
 static void
 emit_error_signal (EmpathyFTHandler *handler,
     const GError *error)
@@ -672,6 +756,10 @@ ft_transfer_transferred_bytes_cb (TpFileTransferChannel *channel,
     {
       priv->last_update_time = tpaw_time_get_current ();
       g_signal_emit (handler, signals[TRANSFER_STARTED], 0, channel);
+
+      /* The file exists now, start hashing it as it arrives */
+      if (empathy_ft_handler_is_incoming (handler))
+        start_inline_hash_incoming (handler);
     }
 
   if (priv->transferred_bytes != bytes)
@@ -774,17 +862,35 @@ ft_transfer_state_cb (TpFileTransferChannel *channel,
 
       if (empathy_ft_handler_is_incoming (handler) && priv->use_hash)
         {
-          check_hash_incoming (handler);
+          /* Fall back to hashing the complete file if it couldn't be
+           * done while it was transferred */
+          if (!finish_inline_hash_incoming (handler))
+            check_hash_incoming (handler);
         }
     }
   else if (state == TP_FILE_TRANSFER_STATE_CANCELLED)
     {
       GError *error = error_from_state_change_reason (reason);
+
+      cancel_inline_hash_incoming (handler);
       emit_error_signal (handler, error);
       g_clear_error (&error);
     }
 }
 
+static void
+ft_transfer_invalidated_cb (TpProxy *proxy,
+    guint domain,
+    gint code,
+    gchar *message,
+    EmpathyFTHandler *handler)
+{
+  DEBUG ("Channel invalidated: %s", message);
+
+  /* The channel may go away without reaching the Cancelled state */
+  cancel_inline_hash_incoming (handler);
+}
+
 static void
 ft_handler_create_channel_cb (GObject *source,
     GAsyncResult *result,
@@ -868,10 +974,22 @@ hash_job_done (gpointer user_data)
   EmpathyFTHandlerPriv *priv;
   GError *error = NULL;
 
-  DEBUG ("Closing stream after hashing.");
-
   priv = GET_PRIV (handler);
 
+  if (priv->inline_hash == hash_data)
+    priv->inline_hash = NULL;
+
+  if (!hash_data->announced)
+    {
+      /* Inline hashing was interrupted before the end of the transfer:
+       * either the transfer failed, which has already been reported, or
+       * the file couldn't be followed and will be hashed again once
+       * complete. */
+      DEBUG ("Inline hashing stopped: %s", hash_data->error != NULL ?
+          hash_data->error->message : "no error");
+      goto out;
+    }
+
   if (hash_data->error != NULL)
     {
       error = hash_data->error;
@@ -927,6 +1045,7 @@ cleanup:
         ft_handler_push_to_dispatcher (handler);
     }
 
+out:
   hash_data_free (hash_data);
 
   return FALSE;
@@ -936,120 +1055,109 @@ static gboolean
 emit_hashing_progress (gpointer user_data)
 {
   HashingData *hash_data = user_data;
+  guint64 total_read;
+
+  if (!hash_data->announced)
+    return FALSE;
+
+  g_mutex_lock (&hash_data->mutex);
+  total_read = hash_data->total_read;
+  g_mutex_unlock (&hash_data->mutex);
 
   g_signal_emit (hash_data->handler, signals[HASHING_PROGRESS], 0,
-      (guint64) hash_data->total_read, (guint64) hash_data->total_bytes);
+      total_read, hash_data->total_bytes);
 
   return FALSE;
 }
 
-static gboolean
-do_hash_job (GIOSchedulerJob *job,
-    GCancellable *cancellable,
+/* Called from the hashing thread */
+static void
+hash_job_progress (guint64 current_bytes,
     gpointer user_data)
 {
   HashingData *hash_data = user_data;
-  gssize bytes_read;
-  GError *error = NULL;
-
-again:
-  if (hash_data->buffer == NULL)
-    hash_data->buffer = g_malloc0 (BUFFER_SIZE);
 
-  bytes_read = g_input_stream_read (hash_data->stream, hash_data->buffer,
-                                    BUFFER_SIZE, cancellable, &error);
-  if (error != NULL)
-    goto out;
+  g_mutex_lock (&hash_data->mutex);
+  hash_data->total_read = current_bytes;
+  g_mutex_unlock (&hash_data->mutex);
 
-  hash_data->total_read += bytes_read;
-
-  /* we now have the chunk */
-  if (bytes_read > 0)
-    {
-      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
-      g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
-          hash_data, NULL);
+  g_io_scheduler_job_send_to_mainloop_async (hash_data->job,
+      emit_hashing_progress, hash_data, NULL);
+}
 
-      g_free (hash_data->buffer);
-      hash_data->buffer = NULL;
+/* Called from the hashing thread when it caught up with the transfer */
+static gboolean
+hash_job_wait (guint64 current_bytes,
+    gpointer user_data)
+{
+  HashingData *hash_data = user_data;
+  gboolean follow;
 
-      goto again;
-    }
-  else
-  {
-    g_input_stream_close (hash_data->stream, cancellable, &error);
-  }
+  g_mutex_lock (&hash_data->mutex);
 
-out:
-  if (error != NULL)
-    hash_data->error = error;
+  /* Once the transfer is complete, read until the end of the file once
+   * more before stopping */
+  follow = hash_data->follow;
+  if (follow)
+    g_cond_wait_until (&hash_data->cond, &hash_data->mutex,
+        g_get_monotonic_time () + INLINE_HASH_POLL_INTERVAL);
 
-  g_io_scheduler_job_send_to_mainloop_async (job, hash_job_done,
-      hash_data, NULL);
+  g_mutex_unlock (&hash_data->mutex);
 
-  return FALSE;
+  return follow;
 }
 
 static gboolean
-do_hash_job_incoming (GIOSchedulerJob *job,
+do_hash_job (GIOSchedulerJob *job,
     GCancellable *cancellable,
     gpointer user_data)
 {
   HashingData *hash_data = user_data;
-  EmpathyFTHandler *handler = hash_data->handler;
-  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
   GError *error = NULL;
 
-  DEBUG ("checking integrity for incoming handler");
+  hash_data->job = job;
 
-  /* need to get the stream first */
-  hash_data->stream =
-    G_INPUT_STREAM (g_file_read (priv->gfile, cancellable, &error));
+  if (!empathy_ft_checksum_file_full (hash_data->file, hash_data->checksum,
+          cancellable, hash_job_progress, hash_job_wait, hash_data, &error))
+    hash_data->error = error;
 
-  if (error != NULL)
-    {
-      hash_data->error = error;
-      g_io_scheduler_job_send_to_mainloop_async (job, hash_job_done,
-          hash_data, NULL);
-      return FALSE;
-    }
+  g_io_scheduler_job_send_to_mainloop_async (job, hash_job_done,
+      hash_data, NULL);
 
-  return do_hash_job (job, cancellable, user_data);
+  return FALSE;
 }
 
-static void
-ft_handler_read_async_cb (GObject *source,
-    GAsyncResult *res,
-    gpointer user_data)
+/* If follow is TRUE, the file is hashed as it is being written, until
+ * finish_inline_hash_incoming() is called; ::hashing-started is emitted
+ * then. */
+static HashingData *
+ft_handler_start_hashing (EmpathyFTHandler *handler,
+    GChecksumType type,
+    gboolean follow)
 {
-  GFileInputStream *stream;
-  GError *error = NULL;
-  HashingData *hash_data;
-  EmpathyFTHandler *handler = user_data;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-
-  DEBUG ("GFile read async CB.");
-
-  stream = g_file_read_finish (priv->gfile, res, &error);
-  if (error != NULL)
-    {
-      emit_error_signal (handler, error);
-      g_clear_error (&error);
-
-      return;
-    }
+  HashingData *hash_data;
 
   hash_data = g_slice_new0 (HashingData);
-  hash_data->stream = G_INPUT_STREAM (stream);
+  hash_data->file = g_object_ref (priv->gfile);
   hash_data->total_bytes = priv->total_bytes;
   hash_data->handler = g_object_ref (handler);
-  /* FIXME: MD5 is the only ContentHashType supported right now */
-  hash_data->checksum = g_checksum_new (G_CHECKSUM_MD5);
-
-  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+  /* Inline hashing can be stopped on its own when the transfer ends */
+  hash_data->cancellable = follow ?
+      g_cancellable_new () : g_object_ref (priv->cancellable);
+  hash_data->checksum = g_checksum_new (type);
+  g_mutex_init (&hash_data->mutex);
+  g_cond_init (&hash_data->cond);
+  hash_data->follow = follow;
+  hash_data->announced = !follow;
+
+  if (hash_data->announced)
+    g_signal_emit (handler, signals[HASHING_STARTED], 0);
 
   g_io_scheduler_push_job (do_hash_job, hash_data, NULL,
-      G_PRIORITY_DEFAULT, priv->cancellable);
+      G_PRIORITY_DEFAULT, hash_data->cancellable);
+
+  return hash_data;
 }
 
 static void
@@ -1200,9 +1308,9 @@ ft_handler_complete_request (EmpathyFTHandler *handler)
   ft_handler_populate_outgoing_request (handler);
 
   if (priv->use_hash)
-    /* start hashing the file */
-    g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT,
-        priv->cancellable, ft_handler_read_async_cb, handler);
+    /* start hashing the file.
+     * FIXME: MD5 is the only ContentHashType supported right now */
+    ft_handler_start_hashing (handler, G_CHECKSUM_MD5, FALSE);
   else
     /* push directly the handler to the dispatcher */
     ft_handler_push_to_dispatcher (handler);
@@ -1427,6 +1535,11 @@ empathy_ft_handler_start_transfer (EmpathyFTHandler *handler)
     }
   else
     {
+      /* When the destination already exists, GIO writes the new file
+       * aside and only renames it over the destination once it's closed,
+       * so it can only be hashed once the transfer is complete. */
+      priv->can_hash_inline = !g_file_query_exists (priv->gfile, NULL);
+
       /* TODO: add support for resume. */
       tp_file_transfer_channel_accept_file_async (priv->channel,
           priv->gfile, 0, ft_transfer_accept_cb, handler);
@@ -1435,6 +1548,8 @@ empathy_ft_handler_start_transfer (EmpathyFTHandler *handler)
           G_CALLBACK (ft_transfer_state_cb), handler, 0);
       tp_g_signal_connect_object (priv->channel, "notify::transferred-bytes",
           G_CALLBACK (ft_transfer_transferred_bytes_cb), handler, 0);
+      tp_g_signal_connect_object (priv->channel, "invalidated",
+          G_CALLBACK (ft_transfer_invalidated_cb), handler, 0);
     }
 }
 
@@ -54,6 +54,8 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_CALL_SCHEMA EMPATHY_PREFS_SCHEMA ".call"
 #define EMPATHY_PREFS_CALL_CAMERA_DEVICE           "camera-device"
 #define EMPATHY_PREFS_CALL_ECHO_CANCELLATION       "echo-cancellation"
+#define EMPATHY_PREFS_CALL_TEST_SOURCES            "test-sources"
+#define EMPATHY_PREFS_CALL_STATS_FILE              "stats-file"
 
 #define EMPATHY_PREFS_CHAT_SCHEMA EMPATHY_PREFS_SCHEMA ".conversation"
 #define EMPATHY_PREFS_CHAT_SHOW_SMILEYS            "graphical-smileys"
@@ -68,6 +70,7 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_CHAT_WEBKIT_DEVELOPER_TOOLS  "enable-webkit-developer-tools"
 #define EMPATHY_PREFS_CHAT_ROOM_LAST_ACCOUNT       "room-last-account"
 #define EMPATHY_PREFS_CHAT_SEND_CHAT_STATES        "send-chat-states"
+#define EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT        "scrollback-limit"
 
 #define EMPATHY_PREFS_UI_SCHEMA EMPATHY_PREFS_SCHEMA ".ui"
 #define EMPATHY_PREFS_UI_SEPARATE_CHAT_WINDOWS     "separate-chat-windows"
@@ -77,6 +80,7 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_UI_CHAT_WINDOW_PANED_POS     "chat-window-paned-pos"
 #define EMPATHY_PREFS_UI_SHOW_OFFLINE              "show-offline"
 #define EMPATHY_PREFS_UI_SHOW_GROUPS               "show-groups"
+#define EMPATHY_PREFS_UI_DEBUG_WINDOW_MAX_MESSAGES "debug-window-max-messages"
 
 #define EMPATHY_PREFS_HINTS_SCHEMA EMPATHY_PREFS_SCHEMA ".hints"
 #define EMPATHY_PREFS_HINTS_CLOSE_MAIN_WINDOW      "close-main-window"
@@ -55,14 +55,24 @@ typedef struct
   GHashTable *individuals; /* Individual.id -> Individual */
   gboolean contacts_loaded;
 
-  /* reffed FolksIndividual sorted by popularity (most popular first) */
+  /* owned PopularityEntry sorted by popularity (most popular first) */
   GSequence *individuals_pop;
+  /* FolksIndividual (borrowed) -> GSequenceIter from individuals_pop */
+  GHashTable *individuals_pop_iters;
   /* The TOP_INDIVIDUALS_LEN first FolksIndividual (borrowed) from
    * individuals_pop */
   GList *top_individuals;
   guint global_interaction_counter;
 } EmpathyIndividualManagerPriv;
 
+/* The popularity is cached so the individuals_pop sequence can be kept
+ * sorted without calling compute_popularity() on each comparison */
+typedef struct
+{
+  FolksIndividual *individual;
+  guint popularity;
+} PopularityEntry;
+
 enum
 {
   PROP_TOP_INDIVIDUALS = 1,
@@ -156,6 +166,56 @@ compute_popularity (FolksIndividual *individual)
   return count;
 }
 
+static PopularityEntry *
+popularity_entry_new (FolksIndividual *individual)
+{
+  PopularityEntry *entry = g_slice_new (PopularityEntry);
+
+  entry->individual = g_object_ref (individual);
+  entry->popularity = compute_popularity (individual);
+
+  return entry;
+}
+
+static void
+popularity_entry_free (PopularityEntry *entry)
+{
+  g_object_unref (entry->individual);
+  g_slice_free (PopularityEntry, entry);
+}
+
+static gint
+compare_individual_by_pop (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const PopularityEntry *entry_a = a, *entry_b = b;
+
+  if (entry_a->popularity > entry_b->popularity)
+    return -1;
+  else if (entry_a->popularity < entry_b->popularity)
+    return 1;
+
+  return 0;
+}
+
+/* Recompute the popularity of the individual at @iter and move it to its new
+ * position if needed. Returns TRUE if it changed. */
+static gboolean
+update_popularity (GSequenceIter *iter)
+{
+  PopularityEntry *entry = g_sequence_get (iter);
+  guint pop;
+
+  pop = compute_popularity (entry->individual);
+  if (pop == entry->popularity)
+    return FALSE;
+
+  entry->popularity = pop;
+  g_sequence_sort_changed (iter, compare_individual_by_pop, NULL);
+  return TRUE;
+}
+
 static void
 check_top_individuals (EmpathyIndividualManager *self)
 {
@@ -165,6 +225,25 @@ check_top_individuals (EmpathyIndividualManager *self)
   gboolean modified = FALSE;
   guint i;
 
+  /* Cached popularities of individuals we didn't interact with for a while
+   * may be outdated as they depend on the time of the last interaction. Only
+   * refresh the ones which may end up in the top list. */
+  iter = g_sequence_get_begin_iter (priv->individuals_pop);
+  i = 0;
+  while (i < TOP_INDIVIDUALS_LEN && !g_sequence_iter_is_end (iter))
+    {
+      if (update_popularity (iter))
+        {
+          /* @iter moved, start again */
+          iter = g_sequence_get_begin_iter (priv->individuals_pop);
+          i = 0;
+          continue;
+        }
+
+      iter = g_sequence_iter_next (iter);
+      i++;
+    }
+
   iter = g_sequence_get_begin_iter (priv->individuals_pop);
   l = priv->top_individuals;
 
@@ -172,12 +251,11 @@ check_top_individuals (EmpathyIndividualManager *self)
    * still the same as the ones in top_individuals */
   for (i = 0; i < TOP_INDIVIDUALS_LEN && !g_sequence_iter_is_end (iter); i++)
     {
-      FolksIndividual *individual = g_sequence_get (iter);
-      guint pop;
+      PopularityEntry *entry = g_sequence_get (iter);
+      FolksIndividual *individual = entry->individual;
 
       /* Don't include individual having 0 as pop */
-      pop = compute_popularity (individual);
-      if (pop <= 0)
+      if (entry->popularity == 0)
         break;
 
       if (!modified)
@@ -207,44 +285,33 @@ check_top_individuals (EmpathyIndividualManager *self)
     {
       DEBUG ("Top individuals changed:");
 
+      iter = g_sequence_get_begin_iter (priv->individuals_pop);
       for (l = priv->top_individuals; l != NULL; l = g_list_next (l))
         {
-          FolksIndividual *individual = l->data;
+          PopularityEntry *entry = g_sequence_get (iter);
+
+          DEBUG ("  %s (%u)", folks_alias_details_get_alias (
+                FOLKS_ALIAS_DETAILS (entry->individual)), entry->popularity);
 
-          DEBUG ("  %s (%u)",
-              folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
-              compute_popularity (individual));
+          iter = g_sequence_iter_next (iter);
         }
 
       g_object_notify (G_OBJECT (self), "top-individuals");
     }
 }
 
-static gint
-compare_individual_by_pop (gconstpointer a,
-    gconstpointer b,
-    gpointer user_data)
-{
-  guint pop_a, pop_b;
-
-  pop_a = compute_popularity (FOLKS_INDIVIDUAL (a));
-  pop_b = compute_popularity (FOLKS_INDIVIDUAL (b));
-
-  return pop_b - pop_a;
-}
-
 static void
 individual_notify_im_interaction_count (FolksIndividual *individual,
     GParamSpec *pspec,
     EmpathyIndividualManager *self)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GSequenceIter *iter;
 
-  /* We don't use g_sequence_sort_changed() because we'll first have to find
-   * the iter of @individual using g_sequence_lookup() but the lookup function
-   * won't work as it assumes that the sequence is sorted which is no longer
-   * the case at this point as @individual's popularity just changed. */
-  g_sequence_sort (priv->individuals_pop, compare_individual_by_pop, NULL);
+  /* Only move @individual, the other popularities didn't change */
+  iter = g_hash_table_lookup (priv->individuals_pop_iters, individual);
+  if (iter != NULL)
+    update_popularity (iter);
 
   /* Only check for top individuals after 10 interaction events happen */
   if (priv->global_interaction_counter % 10 == 0)
@@ -256,13 +323,15 @@ static void
 add_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GSequenceIter *iter;
 
   g_hash_table_insert (priv->individuals,
       g_strdup (folks_individual_get_id (individual)),
       g_object_ref (individual));
 
-  g_sequence_insert_sorted (priv->individuals_pop, g_object_ref (individual),
-      compare_individual_by_pop, NULL);
+  iter = g_sequence_insert_sorted (priv->individuals_pop,
+      popularity_entry_new (individual), compare_individual_by_pop, NULL);
+  g_hash_table_insert (priv->individuals_pop_iters, individual, iter);
   check_top_individuals (self);
 
   g_signal_connect (individual, "group-changed",
@@ -279,10 +348,11 @@ remove_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
   GSequenceIter *iter;
 
-  iter = g_sequence_lookup (priv->individuals_pop, individual,
-      compare_individual_by_pop, NULL);
+  iter = g_hash_table_lookup (priv->individuals_pop_iters, individual);
   if (iter != NULL)
     {
+      g_hash_table_remove (priv->individuals_pop_iters, individual);
+
       /* priv->top_individuals borrows its reference from
        * priv->individuals_pop so we take a reference on the individual while
        * removing it to make sure it stays alive while calling
@@ -449,6 +519,7 @@ individual_manager_finalize (GObject *object)
   EmpathyIndividualManagerPriv *priv = GET_PRIV (object);
 
   g_sequence_free (priv->individuals_pop);
+  g_hash_table_unref (priv->individuals_pop_iters);
 
   G_OBJECT_CLASS (empathy_individual_manager_parent_class)->finalize (object);
 }
@@ -583,7 +654,9 @@ empathy_individual_manager_init (EmpathyIndividualManager *self)
   priv->individuals = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, g_object_unref);
 
-  priv->individuals_pop = g_sequence_new (g_object_unref);
+  priv->individuals_pop = g_sequence_new (
+      (GDestroyNotify) popularity_entry_free);
+  priv->individuals_pop_iters = g_hash_table_new (NULL, NULL);
 
   priv->aggregator = folks_individual_aggregator_dup ();
   tp_g_signal_connect_object (priv->aggregator, "individuals-changed-detailed",
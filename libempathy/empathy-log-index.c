@@ -0,0 +1,695 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-log-index.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* Caches the result of tpl_log_manager_exists() for each (account, entity,
+ * event types) so building a contact menu never has to hit the disk. The
+ * checks themselves are done in worker threads, a few at a time.
+ *
+ * Logs are only removed by clearing them from the log window, which
+ * invalidates the whole index, so a positive answer stays valid. A negative
+ * one becomes wrong as soon as something is logged; EmpathyTpChat invalidates
+ * the entity when a message goes through but other kinds of events are not
+ * tracked so negative answers are re-checked after NEGATIVE_TTL.
+ *
+ * The logger writes events a little after they went through, so a negative
+ * answer found shortly after an invalidation may be about to become wrong: it
+ * is only kept for LOGGER_DELAY.
+ *
+ * Entities can also be prefetched, so the index is warm by the time a menu
+ * asks. They are only checked one at a time, from a low priority idle
+ * callback and when no other check is queued. */
+
+/* Number of tpl_log_manager_exists() calls running at the same time */
+#define MAX_RUNNING 2
+
+#define NEGATIVE_TTL (5 * 60 * G_TIME_SPAN_SECOND)
+#define LOGGER_DELAY (5 * G_TIME_SPAN_SECOND)
+
+enum
+{
+  CHANGED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+struct _EmpathyLogIndexPriv
+{
+  TplLogManager *manager;
+
+  /* owned gchar * key -> owned Entry */
+  GHashTable *entries;
+  /* borrowed Entry waiting to be checked, most urgent first */
+  GQueue *queue;
+  guint running;
+
+  /* owned Invalidation of the last LOGGER_DELAY, oldest first */
+  GQueue *invalidations;
+
+  /* owned Prefetch waiting for the index to be idle, oldest first */
+  GQueue *prefetches;
+  guint prefetch_id;
+};
+
+typedef struct
+{
+  gchar *key;
+  TpAccount *account;
+  TplEntity *entity;
+  TplEventTypeMask type_mask;
+
+  gboolean known;
+  gboolean exists;
+  /* monotonic time of the last check */
+  gint64 checked;
+  /* how long a negative answer stays valid */
+  gint64 negative_ttl;
+
+  /* TRUE while in the queue or being checked; the Entry is not removed
+   * from the table in that case */
+  gboolean busy;
+  /* Invalidated while busy, check it again once done */
+  gboolean invalidated;
+
+  /* GTask waiting for this entry to be checked */
+  GList *waiters;
+} Entry;
+
+typedef struct
+{
+  /* owned, NULL for all accounts */
+  TpAccount *account;
+  /* NULL for all entities */
+  gchar *entity_id;
+  /* monotonic time */
+  gint64 time;
+} Invalidation;
+
+typedef struct
+{
+  TpAccount *account;
+  TplEntity *entity;
+  TplEventTypeMask type_mask;
+} Prefetch;
+
+/* What the worker thread needs, so it doesn't touch the Entry */
+typedef struct
+{
+  TplLogManager *manager;
+  TpAccount *account;
+  TplEntity *entity;
+  TplEventTypeMask type_mask;
+} CheckData;
+
+G_DEFINE_TYPE (EmpathyLogIndex, empathy_log_index, G_TYPE_OBJECT);
+
+static EmpathyLogIndex *singleton = NULL;
+
+static void
+entry_free (Entry *entry)
+{
+  g_assert (entry->waiters == NULL);
+
+  g_free (entry->key);
+  g_object_unref (entry->account);
+  g_object_unref (entry->entity);
+  g_slice_free (Entry, entry);
+}
+
+static void
+invalidation_free (Invalidation *invalidation)
+{
+  g_clear_object (&invalidation->account);
+  g_free (invalidation->entity_id);
+  g_slice_free (Invalidation, invalidation);
+}
+
+static void
+prefetch_free (Prefetch *prefetch)
+{
+  g_object_unref (prefetch->account);
+  g_object_unref (prefetch->entity);
+  g_slice_free (Prefetch, prefetch);
+}
+
+static void
+check_data_free (CheckData *data)
+{
+  g_object_unref (data->manager);
+  g_object_unref (data->account);
+  g_object_unref (data->entity);
+  g_slice_free (CheckData, data);
+}
+
+static gchar *
+make_key (TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask)
+{
+  return g_strdup_printf ("%s/%u/%d/%s", tp_proxy_get_object_path (account),
+      type_mask, tpl_entity_get_entity_type (entity),
+      tpl_entity_get_identifier (entity));
+}
+
+static Entry *
+ensure_entry (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask)
+{
+  Entry *entry;
+  gchar *key;
+
+  key = make_key (account, entity, type_mask);
+
+  entry = g_hash_table_lookup (self->priv->entries, key);
+  if (entry != NULL)
+    {
+      g_free (key);
+      return entry;
+    }
+
+  entry = g_slice_new0 (Entry);
+  entry->key = key;
+  entry->account = g_object_ref (account);
+  entry->entity = g_object_ref (entity);
+  entry->type_mask = type_mask;
+
+  g_hash_table_insert (self->priv->entries, entry->key, entry);
+
+  return entry;
+}
+
+static gboolean
+entry_is_outdated (Entry *entry)
+{
+  if (!entry->known)
+    return TRUE;
+
+  return !entry->exists &&
+      g_get_monotonic_time () - entry->checked > entry->negative_ttl;
+}
+
+static gboolean
+entry_matches (Entry *entry,
+    TpAccount *account,
+    const gchar *entity_id)
+{
+  if (account != NULL && entry->account != account)
+    return FALSE;
+
+  if (entity_id != NULL &&
+      tp_strdiff (tpl_entity_get_identifier (entry->entity), entity_id))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+prune_invalidations (EmpathyLogIndex *self,
+    gint64 now)
+{
+  Invalidation *invalidation;
+
+  while ((invalidation = g_queue_peek_head (self->priv->invalidations)) !=
+      NULL && now - invalidation->time > LOGGER_DELAY)
+    invalidation_free (g_queue_pop_head (self->priv->invalidations));
+}
+
+/* Whether what is logged about @entry may still be changing */
+static gboolean
+entry_recently_invalidated (EmpathyLogIndex *self,
+    Entry *entry,
+    gint64 now)
+{
+  GList *l;
+
+  prune_invalidations (self, now);
+
+  for (l = self->priv->invalidations->head; l != NULL; l = g_list_next (l))
+    {
+      Invalidation *invalidation = l->data;
+
+      if (entry_matches (entry, invalidation->account,
+            invalidation->entity_id))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+check_thread_func (GTask *task,
+    gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  CheckData *data = task_data;
+
+  g_task_return_boolean (task, tpl_log_manager_exists (data->manager,
+        data->account, data->entity, data->type_mask));
+}
+
+static void run_next (EmpathyLogIndex *self);
+static void queue_check (EmpathyLogIndex *self,
+    Entry *entry,
+    gboolean urgent);
+static void schedule_prefetch (EmpathyLogIndex *self);
+
+static void
+check_done_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (source);
+  Entry *entry = user_data;
+  GList *waiters, *l;
+  gboolean exists;
+
+  exists = g_task_propagate_boolean (G_TASK (result), NULL);
+
+  self->priv->running--;
+  entry->busy = FALSE;
+
+  waiters = entry->waiters;
+  entry->waiters = NULL;
+
+  for (l = waiters; l != NULL; l = g_list_next (l))
+    {
+      g_task_return_boolean (l->data, exists);
+      g_object_unref (l->data);
+    }
+
+  g_list_free (waiters);
+
+  if (entry->invalidated)
+    {
+      /* Check again, someone may be waiting for ::changed */
+      entry->invalidated = FALSE;
+      queue_check (self, entry, FALSE);
+    }
+  else
+    {
+      gboolean changed = !entry->known || entry->exists != exists;
+
+      entry->known = TRUE;
+      entry->exists = exists;
+      entry->checked = g_get_monotonic_time ();
+
+      if (entry_recently_invalidated (self, entry, entry->checked))
+        entry->negative_ttl = LOGGER_DELAY;
+      else
+        entry->negative_ttl = NEGATIVE_TTL;
+
+      if (changed)
+        g_signal_emit (self, signals[CHANGED], 0, entry->account,
+            tpl_entity_get_identifier (entry->entity));
+    }
+
+  run_next (self);
+}
+
+static void
+run_next (EmpathyLogIndex *self)
+{
+  while (self->priv->running < MAX_RUNNING &&
+      !g_queue_is_empty (self->priv->queue))
+    {
+      Entry *entry = g_queue_pop_head (self->priv->queue);
+      CheckData *data;
+      GTask *task;
+
+      data = g_slice_new0 (CheckData);
+      data->manager = g_object_ref (self->priv->manager);
+      data->account = g_object_ref (entry->account);
+      data->entity = g_object_ref (entry->entity);
+      data->type_mask = entry->type_mask;
+
+      task = g_task_new (self, NULL, check_done_cb, entry);
+      g_task_set_task_data (task, data, (GDestroyNotify) check_data_free);
+      g_task_run_in_thread (task, check_thread_func);
+      g_object_unref (task);
+
+      self->priv->running++;
+    }
+
+  schedule_prefetch (self);
+}
+
+static gboolean
+prefetch_cb (gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  Prefetch *prefetch;
+
+  self->priv->prefetch_id = 0;
+
+  /* Something more urgent came up, run_next() calls us again */
+  if (self->priv->running > 0 || !g_queue_is_empty (self->priv->queue))
+    return G_SOURCE_REMOVE;
+
+  while ((prefetch = g_queue_pop_head (self->priv->prefetches)) != NULL)
+    {
+      Entry *entry;
+
+      entry = ensure_entry (self, prefetch->account, prefetch->entity,
+          prefetch->type_mask);
+      prefetch_free (prefetch);
+
+      if (entry_is_outdated (entry) && !entry->busy)
+        {
+          queue_check (self, entry, FALSE);
+          break;
+        }
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_prefetch (EmpathyLogIndex *self)
+{
+  if (self->priv->prefetch_id != 0 ||
+      g_queue_is_empty (self->priv->prefetches) ||
+      self->priv->running > 0 || !g_queue_is_empty (self->priv->queue))
+    return;
+
+  self->priv->prefetch_id = g_idle_add_full (G_PRIORITY_LOW, prefetch_cb,
+      self, NULL);
+}
+
+static void
+queue_check (EmpathyLogIndex *self,
+    Entry *entry,
+    gboolean urgent)
+{
+  if (entry->busy)
+    {
+      GList *link;
+
+      if (!urgent)
+        return;
+
+      /* Someone is waiting for it, move it to the front if it didn't
+       * start yet */
+      link = g_queue_find (self->priv->queue, entry);
+      if (link != NULL)
+        {
+          g_queue_unlink (self->priv->queue, link);
+          g_queue_push_head_link (self->priv->queue, link);
+        }
+
+      return;
+    }
+
+  entry->busy = TRUE;
+
+  if (urgent)
+    g_queue_push_head (self->priv->queue, entry);
+  else
+    g_queue_push_tail (self->priv->queue, entry);
+
+  run_next (self);
+}
+
+static void
+log_index_finalize (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  /* Tasks keep a ref on us so nothing can be running at this point */
+  g_assert (self->priv->running == 0);
+
+  if (self->priv->prefetch_id != 0)
+    g_source_remove (self->priv->prefetch_id);
+
+  g_queue_free (self->priv->queue);
+  g_queue_free_full (self->priv->invalidations,
+      (GDestroyNotify) invalidation_free);
+  g_queue_free_full (self->priv->prefetches, (GDestroyNotify) prefetch_free);
+  g_hash_table_unref (self->priv->entries);
+  g_object_unref (self->priv->manager);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->finalize (object);
+}
+
+static GObject *
+log_index_constructor (GType type,
+    guint n_props,
+    GObjectConstructParam *props)
+{
+  GObject *retval;
+
+  if (singleton != NULL)
+    {
+      retval = g_object_ref (singleton);
+    }
+  else
+    {
+      retval = G_OBJECT_CLASS (empathy_log_index_parent_class)->
+        constructor (type, n_props, props);
+
+      singleton = EMPATHY_LOG_INDEX (retval);
+      g_object_add_weak_pointer (retval, (gpointer) &singleton);
+    }
+
+  return retval;
+}
+
+static void
+empathy_log_index_class_init (EmpathyLogIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = log_index_finalize;
+  object_class->constructor = log_index_constructor;
+
+  /**
+   * EmpathyLogIndex::changed:
+   * @self: the #EmpathyLogIndex
+   * @account: the #TpAccount of the entity
+   * @entity_id: the identifier of the entity
+   *
+   * Emitted when finding out whether there are logs for this entity, or
+   * when it changed.
+   */
+  signals[CHANGED] =
+    g_signal_new ("changed",
+        G_TYPE_FROM_CLASS (klass),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL,
+        g_cclosure_marshal_generic,
+        G_TYPE_NONE,
+        2, TP_TYPE_ACCOUNT, G_TYPE_STRING);
+
+  g_type_class_add_private (object_class, sizeof (EmpathyLogIndexPriv));
+}
+
+static void
+empathy_log_index_init (EmpathyLogIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexPriv);
+
+  self->priv->manager = tpl_log_manager_dup_singleton ();
+  self->priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+      NULL, (GDestroyNotify) entry_free);
+  self->priv->queue = g_queue_new ();
+  self->priv->invalidations = g_queue_new ();
+  self->priv->prefetches = g_queue_new ();
+}
+
+EmpathyLogIndex *
+empathy_log_index_dup_singleton (void)
+{
+  return g_object_new (EMPATHY_TYPE_LOG_INDEX, NULL);
+}
+
+/**
+ * empathy_log_index_lookup:
+ * @self: a #EmpathyLogIndex
+ * @account: a #TpAccount
+ * @entity: a #TplEntity
+ * @type_mask: the types of event to look for
+ * @exists: (out): set to whether there are logs for @entity
+ *
+ * Looks up in the index whether there are logs of one of the @type_mask
+ * types for @entity, without blocking. If the answer is not known yet, it is
+ * looked for in the background and #EmpathyLogIndex::changed will be emitted
+ * once it is.
+ *
+ * Returns: %TRUE if @exists has been set, %FALSE if the answer is unknown
+ */
+gboolean
+empathy_log_index_lookup (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask,
+    gboolean *exists)
+{
+  Entry *entry;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), FALSE);
+  g_return_val_if_fail (TPL_IS_ENTITY (entity), FALSE);
+
+  entry = ensure_entry (self, account, entity, type_mask);
+
+  if (entry_is_outdated (entry))
+    queue_check (self, entry, FALSE);
+
+  if (!entry->known)
+    return FALSE;
+
+  if (exists != NULL)
+    *exists = entry->exists;
+
+  return TRUE;
+}
+
+void
+empathy_log_index_exists_async (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  Entry *entry;
+  GTask *task;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (TPL_IS_ENTITY (entity));
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, empathy_log_index_exists_async);
+
+  entry = ensure_entry (self, account, entity, type_mask);
+
+  if (!entry_is_outdated (entry))
+    {
+      g_task_return_boolean (task, entry->exists);
+      g_object_unref (task);
+      return;
+    }
+
+  entry->waiters = g_list_prepend (entry->waiters, task);
+  queue_check (self, entry, TRUE);
+}
+
+gboolean
+empathy_log_index_exists_finish (EmpathyLogIndex *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * empathy_log_index_prefetch:
+ * @self: a #EmpathyLogIndex
+ * @account: a #TpAccount
+ * @entity: a #TplEntity
+ * @type_mask: the types of event to look for
+ *
+ * Looks for whether there are logs of one of the @type_mask types for
+ * @entity once nothing else is going on, so later lookups are answered
+ * right away. #EmpathyLogIndex::changed is emitted once it is known.
+ */
+void
+empathy_log_index_prefetch (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask)
+{
+  Prefetch *prefetch;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (TPL_IS_ENTITY (entity));
+
+  prefetch = g_slice_new0 (Prefetch);
+  prefetch->account = g_object_ref (account);
+  prefetch->entity = g_object_ref (entity);
+  prefetch->type_mask = type_mask;
+  g_queue_push_tail (self->priv->prefetches, prefetch);
+
+  schedule_prefetch (self);
+}
+
+/**
+ * empathy_log_index_invalidate:
+ * @self: a #EmpathyLogIndex
+ * @account: (allow-none): a #TpAccount, or %NULL for all the accounts
+ * @entity_id: (allow-none): the identifier of an entity, or %NULL for all
+ *  the entities of @account
+ *
+ * Forgets what is known about the logs of @entity_id, to be called when they
+ * may have changed. As the logger may not have written the new events yet,
+ * finding no logs in the next few seconds is not cached for long.
+ */
+void
+empathy_log_index_invalidate (EmpathyLogIndex *self,
+    TpAccount *account,
+    const gchar *entity_id)
+{
+  GHashTableIter iter;
+  gpointer value;
+  Invalidation *invalidation;
+  gint64 now;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  now = g_get_monotonic_time ();
+  prune_invalidations (self, now);
+
+  invalidation = g_slice_new0 (Invalidation);
+  invalidation->account = account != NULL ? g_object_ref (account) : NULL;
+  invalidation->entity_id = g_strdup (entity_id);
+  invalidation->time = now;
+  g_queue_push_tail (self->priv->invalidations, invalidation);
+
+  g_hash_table_iter_init (&iter, self->priv->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Entry *entry = value;
+
+      if (!entry_matches (entry, account, entity_id))
+        continue;
+
+      if (entry->busy)
+        {
+          entry->known = FALSE;
+          entry->invalidated = TRUE;
+        }
+      else
+        {
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+}
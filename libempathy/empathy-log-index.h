@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_INDEX_H__
+#define __EMPATHY_LOG_INDEX_H__
+
+#include <glib-object.h>
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-logger/telepathy-logger.h>
+
+G_BEGIN_DECLS
+
+#define EMPATHY_TYPE_LOG_INDEX         (empathy_log_index_get_type ())
+#define EMPATHY_LOG_INDEX(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndex))
+#define EMPATHY_LOG_INDEX_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexClass))
+#define EMPATHY_IS_LOG_INDEX(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_IS_LOG_INDEX_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_LOG_INDEX_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexClass))
+
+typedef struct _EmpathyLogIndex      EmpathyLogIndex;
+typedef struct _EmpathyLogIndexClass EmpathyLogIndexClass;
+typedef struct _EmpathyLogIndexPriv  EmpathyLogIndexPriv;
+
+struct _EmpathyLogIndex {
+  GObject parent;
+  EmpathyLogIndexPriv *priv;
+};
+
+struct _EmpathyLogIndexClass
+{
+  GObjectClass parent_class;
+};
+
+GType empathy_log_index_get_type (void) G_GNUC_CONST;
+
+EmpathyLogIndex * empathy_log_index_dup_singleton (void);
+
+gboolean empathy_log_index_lookup (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask,
+    gboolean *exists);
+
+void empathy_log_index_exists_async (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+gboolean empathy_log_index_exists_finish (EmpathyLogIndex *self,
+    GAsyncResult *result,
+    GError **error);
+
+void empathy_log_index_prefetch (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    TplEventTypeMask type_mask);
+
+void empathy_log_index_invalidate (EmpathyLogIndex *self,
+    TpAccount *account,
+    const gchar *entity_id);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_INDEX_H__ */
@@ -0,0 +1,179 @@
+/*
+ * empathy-member-set.c - Source for the set of members of a chat room
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-member-set.h"
+
+struct _EmpathyMemberSet
+{
+  /* owned EmpathyContact => itself */
+  GHashTable *members;
+};
+
+EmpathyMemberSet *
+empathy_member_set_new (void)
+{
+  EmpathyMemberSet *self = g_slice_new (EmpathyMemberSet);
+
+  self->members = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+
+  return self;
+}
+
+void
+empathy_member_set_free (EmpathyMemberSet *self)
+{
+  if (self == NULL)
+    return;
+
+  g_hash_table_unref (self->members);
+  g_slice_free (EmpathyMemberSet, self);
+}
+
+guint
+empathy_member_set_get_size (EmpathyMemberSet *self)
+{
+  return g_hash_table_size (self->members);
+}
+
+gboolean
+empathy_member_set_contains (EmpathyMemberSet *self,
+    EmpathyContact *contact)
+{
+  return g_hash_table_contains (self->members, contact);
+}
+
+/**
+ * empathy_member_set_add:
+ * @self: a #EmpathyMemberSet
+ * @contact: the #EmpathyContact joining
+ *
+ * Adds a reference on @contact to @self, unless it's already a member.
+ *
+ * Returns: %TRUE if @contact was not a member yet
+ */
+gboolean
+empathy_member_set_add (EmpathyMemberSet *self,
+    EmpathyContact *contact)
+{
+  g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), FALSE);
+
+  if (g_hash_table_contains (self->members, contact))
+    return FALSE;
+
+  g_hash_table_add (self->members, g_object_ref (contact));
+  return TRUE;
+}
+
+/**
+ * empathy_member_set_remove:
+ * @self: a #EmpathyMemberSet
+ * @contact: the #EmpathyContact leaving
+ *
+ * Returns: %TRUE if @contact was a member
+ */
+gboolean
+empathy_member_set_remove (EmpathyMemberSet *self,
+    EmpathyContact *contact)
+{
+  return g_hash_table_remove (self->members, contact);
+}
+
+static GPtrArray *
+member_set_change (EmpathyMemberSet *self,
+    GPtrArray *contacts,
+    gboolean add)
+{
+  GPtrArray *changed;
+  guint i;
+
+  changed = g_ptr_array_new_full (contacts->len, g_object_unref);
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      EmpathyContact *contact = g_ptr_array_index (contacts, i);
+
+      if (add)
+        {
+          if (empathy_member_set_add (self, contact))
+            g_ptr_array_add (changed, g_object_ref (contact));
+        }
+      else
+        {
+          /* Pass the set's reference to @changed */
+          if (g_hash_table_steal (self->members, contact))
+            g_ptr_array_add (changed, contact);
+        }
+    }
+
+  return changed;
+}
+
+/**
+ * empathy_member_set_add_many:
+ * @self: a #EmpathyMemberSet
+ * @contacts: a #GPtrArray of #EmpathyContact
+ *
+ * Adds all of @contacts to @self.
+ *
+ * Returns: (transfer full): a new #GPtrArray holding a reference on the
+ *   contacts of @contacts which were not members yet, in the same order
+ */
+GPtrArray *
+empathy_member_set_add_many (EmpathyMemberSet *self,
+    GPtrArray *contacts)
+{
+  return member_set_change (self, contacts, TRUE);
+}
+
+/**
+ * empathy_member_set_remove_many:
+ * @self: a #EmpathyMemberSet
+ * @contacts: a #GPtrArray of #EmpathyContact
+ *
+ * Removes all of @contacts from @self.
+ *
+ * Returns: (transfer full): a new #GPtrArray holding a reference on the
+ *   contacts of @contacts which were members, in the same order
+ */
+GPtrArray *
+empathy_member_set_remove_many (EmpathyMemberSet *self,
+    GPtrArray *contacts)
+{
+  return member_set_change (self, contacts, FALSE);
+}
+
+/**
+ * empathy_member_set_dup_members:
+ * @self: a #EmpathyMemberSet
+ *
+ * Returns: (transfer full): a new #GList of references on the members of
+ *   @self, in no particular order
+ */
+GList *
+empathy_member_set_dup_members (EmpathyMemberSet *self)
+{
+  GList *members, *l;
+
+  members = g_hash_table_get_keys (self->members);
+  for (l = members; l != NULL; l = g_list_next (l))
+    g_object_ref (l->data);
+
+  return members;
+}
@@ -0,0 +1,52 @@
+/*
+ * empathy-member-set.h - Header for the set of members of a chat room
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_MEMBER_SET_H__
+#define __EMPATHY_MEMBER_SET_H__
+
+#include "empathy-contact.h"
+
+G_BEGIN_DECLS
+
+/* Set of EmpathyContact, with constant time membership changes. There is a
+ * single EmpathyContact per TpContact so contacts are hashed directly. */
+typedef struct _EmpathyMemberSet EmpathyMemberSet;
+
+EmpathyMemberSet * empathy_member_set_new (void);
+void empathy_member_set_free (EmpathyMemberSet *self);
+
+guint empathy_member_set_get_size (EmpathyMemberSet *self);
+gboolean empathy_member_set_contains (EmpathyMemberSet *self,
+    EmpathyContact *contact);
+
+gboolean empathy_member_set_add (EmpathyMemberSet *self,
+    EmpathyContact *contact);
+gboolean empathy_member_set_remove (EmpathyMemberSet *self,
+    EmpathyContact *contact);
+
+GPtrArray * empathy_member_set_add_many (EmpathyMemberSet *self,
+    GPtrArray *contacts);
+GPtrArray * empathy_member_set_remove_many (EmpathyMemberSet *self,
+    GPtrArray *contacts);
+
+GList * empathy_member_set_dup_members (EmpathyMemberSet *self);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_MEMBER_SET_H__ */
@@ -0,0 +1,188 @@
+/*
+ * empathy-room-list-cache.c - Source for the rooms listed on an account
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-room-list-cache.h"
+
+#include <string.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+#define CACHE_HEADER "# Empathy room list 1\n"
+
+EmpathyRoomEntry *
+empathy_room_entry_new (const gchar *room,
+    const gchar *name,
+    const gchar *topic,
+    gint members,
+    gboolean invite_only,
+    gboolean need_password)
+{
+  EmpathyRoomEntry *entry;
+  gchar *tmp;
+
+  entry = g_slice_new0 (EmpathyRoomEntry);
+  entry->room = g_strdup (room);
+  entry->name = g_strdup (name);
+  entry->topic = g_strdup (topic);
+  entry->members = members;
+  entry->invite_only = invite_only;
+  entry->need_password = need_password;
+
+  tmp = g_strdup_printf ("%s\n%s\n%s", room, name != NULL ? name : "",
+      topic != NULL ? topic : "");
+  entry->search_text = g_utf8_casefold (tmp, -1);
+  g_free (tmp);
+
+  return entry;
+}
+
+void
+empathy_room_entry_free (EmpathyRoomEntry *entry)
+{
+  g_free (entry->room);
+  g_free (entry->name);
+  g_free (entry->topic);
+  g_free (entry->search_text);
+  g_slice_free (EmpathyRoomEntry, entry);
+}
+
+/**
+ * empathy_room_entry_matches:
+ * @entry: an #EmpathyRoomEntry
+ * @filter: (allow-none): casefolded text, or %NULL
+ *
+ * Returns: %TRUE if the room, name or topic of @entry contain @filter, or if
+ * @filter is %NULL
+ */
+gboolean
+empathy_room_entry_matches (EmpathyRoomEntry *entry,
+    const gchar *filter)
+{
+  if (filter == NULL)
+    return TRUE;
+
+  return strstr (entry->search_text, filter) != NULL;
+}
+
+gchar *
+empathy_room_list_cache_dup_filename (TpAccount *account)
+{
+  gchar *escaped;
+  gchar *filename;
+
+  escaped = tp_escape_as_identifier (tp_account_get_path_suffix (account));
+  filename = g_build_filename (g_get_user_cache_dir (), "empathy",
+      "room-lists", escaped, NULL);
+
+  g_free (escaped);
+  return filename;
+}
+
+/**
+ * empathy_room_list_cache_serialize:
+ * @entries: a #GPtrArray of #EmpathyRoomEntry
+ *
+ * Returns: the contents of a room list cache file for @entries, to be
+ * read back with empathy_room_list_cache_parse()
+ */
+gchar *
+empathy_room_list_cache_serialize (GPtrArray *entries)
+{
+  GString *contents;
+  guint i;
+
+  contents = g_string_new (CACHE_HEADER);
+
+  for (i = 0; i < entries->len; i++)
+    {
+      EmpathyRoomEntry *entry = g_ptr_array_index (entries, i);
+      gchar *room, *name, *topic;
+
+      /* Escaped so they don't contain tabs nor new lines */
+      room = g_strescape (entry->room, NULL);
+      name = g_strescape (entry->name != NULL ? entry->name : "", NULL);
+      topic = g_strescape (entry->topic != NULL ? entry->topic : "", NULL);
+
+      g_string_append_printf (contents, "%s\t%s\t%s\t%d\t%d\t%d\n",
+          room, name, topic, entry->members, entry->invite_only,
+          entry->need_password);
+
+      g_free (room);
+      g_free (name);
+      g_free (topic);
+    }
+
+  return g_string_free (contents, FALSE);
+}
+
+/**
+ * empathy_room_list_cache_parse:
+ * @contents: the contents of a room list cache file
+ *
+ * Returns: (transfer full): a #GPtrArray of the #EmpathyRoomEntry in
+ * @contents, freeing them when it is, or %NULL if @contents are not in a
+ * known format
+ */
+GPtrArray *
+empathy_room_list_cache_parse (const gchar *contents)
+{
+  GPtrArray *entries;
+  gchar **lines;
+  guint i;
+
+  if (!g_str_has_prefix (contents, CACHE_HEADER))
+    return NULL;
+
+  entries = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) empathy_room_entry_free);
+
+  lines = g_strsplit (contents + strlen (CACHE_HEADER), "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar **fields = g_strsplit (lines[i], "\t", -1);
+
+      if (g_strv_length (fields) == 6)
+        {
+          gchar *room = g_strcompress (fields[0]);
+          gchar *name = g_strcompress (fields[1]);
+          gchar *topic = g_strcompress (fields[2]);
+
+          g_ptr_array_add (entries, empathy_room_entry_new (room, name,
+                topic, g_ascii_strtoll (fields[3], NULL, 10),
+                !tp_strdiff (fields[4], "1"), !tp_strdiff (fields[5], "1")));
+
+          g_free (room);
+          g_free (name);
+          g_free (topic);
+        }
+      else if (lines[i][0] != '\0')
+        {
+          DEBUG ("Ignoring malformed line: %s", lines[i]);
+        }
+
+      g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+
+  return entries;
+}
@@ -0,0 +1,57 @@
+/*
+ * empathy-room-list-cache.h - Header for the rooms listed on an account
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_ROOM_LIST_CACHE_H__
+#define __EMPATHY_ROOM_LIST_CACHE_H__
+
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  gchar *room;
+  gchar *name;
+  gchar *topic;
+  gint members;
+  gboolean invite_only;
+  gboolean need_password;
+  /* Casefolded room, name and topic, looked up when filtering */
+  gchar *search_text;
+} EmpathyRoomEntry;
+
+EmpathyRoomEntry * empathy_room_entry_new (const gchar *room,
+    const gchar *name,
+    const gchar *topic,
+    gint members,
+    gboolean invite_only,
+    gboolean need_password);
+void empathy_room_entry_free (EmpathyRoomEntry *entry);
+
+gboolean empathy_room_entry_matches (EmpathyRoomEntry *entry,
+    const gchar *filter);
+
+gchar * empathy_room_list_cache_dup_filename (TpAccount *account);
+
+gchar * empathy_room_list_cache_serialize (GPtrArray *entries);
+GPtrArray * empathy_room_list_cache_parse (const gchar *contents);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_ROOM_LIST_CACHE_H__ */
@@ -24,6 +24,8 @@
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "empathy-log-index.h"
+#include "empathy-member-set.h"
 #include "empathy-request-util.h"
 #include "empathy-utils.h"
 
@@ -35,9 +37,12 @@ struct _EmpathyTpChatPrivate
   TpAccount *account;
   EmpathyContact *user;
   EmpathyContact *remote_contact;
-  GList *members;
+  EmpathyMemberSet *members;
   /* Queue of messages signalled but not acked yet */
   GQueue *pending_messages_queue;
+  /* Set of PendingKey for the messages of pending_messages_queue, to
+   * recognize these messages when they come from the logs */
+  GHashTable *pending_keys;
 
   /* Subject */
   gboolean supports_subject;
@@ -56,6 +61,9 @@ struct _EmpathyTpChatPrivate
   /* GSimpleAsyncResult used when preparing EMPATHY_TP_CHAT_FEATURE_CORE */
   GSimpleAsyncResult *ready_result;
   gboolean preparing_password;
+
+  /* TRUE once a message went through this channel */
+  gboolean has_messages;
 };
 
 enum
@@ -233,10 +241,9 @@ empathy_tp_chat_get_members (EmpathyTpChat *self)
 {
   GList *members = NULL;
 
-  if (self->priv->members)
+  if (empathy_member_set_get_size (self->priv->members) > 0)
     {
-      members = g_list_copy (self->priv->members);
-      g_list_foreach (members, (GFunc) g_object_ref, NULL);
+      members = empathy_member_set_dup_members (self->priv->members);
     }
   else
     {
@@ -262,6 +269,82 @@ check_ready (EmpathyTpChat *self)
   tp_clear_object (&self->priv->ready_result);
 }
 
+typedef struct
+{
+  gint64 timestamp;
+  gchar *body;
+  /* Number of pending messages having this timestamp and body */
+  guint count;
+} PendingKey;
+
+static void
+pending_key_free (PendingKey *key)
+{
+  g_free (key->body);
+  g_slice_free (PendingKey, key);
+}
+
+static guint
+pending_key_hash (gconstpointer v)
+{
+  const PendingKey *key = v;
+
+  return g_int64_hash (&key->timestamp) ^
+    (key->body != NULL ? g_str_hash (key->body) : 0);
+}
+
+/* Same criteria as empathy_message_equal() */
+static gboolean
+pending_key_equal (gconstpointer a,
+    gconstpointer b)
+{
+  const PendingKey *key_a = a;
+  const PendingKey *key_b = b;
+
+  return key_a->timestamp == key_b->timestamp &&
+    !tp_strdiff (key_a->body, key_b->body);
+}
+
+static void
+add_pending_key (EmpathyTpChat *self,
+    EmpathyMessage *message)
+{
+  PendingKey lookup, *key;
+
+  lookup.timestamp = empathy_message_get_timestamp (message);
+  lookup.body = (gchar *) empathy_message_get_body (message);
+
+  key = g_hash_table_lookup (self->priv->pending_keys, &lookup);
+  if (key == NULL)
+    {
+      key = g_slice_new (PendingKey);
+      key->timestamp = lookup.timestamp;
+      key->body = g_strdup (lookup.body);
+      key->count = 0;
+
+      g_hash_table_add (self->priv->pending_keys, key);
+    }
+
+  key->count++;
+}
+
+static void
+remove_pending_key (EmpathyTpChat *self,
+    EmpathyMessage *message)
+{
+  PendingKey lookup, *key;
+
+  lookup.timestamp = empathy_message_get_timestamp (message);
+  lookup.body = (gchar *) empathy_message_get_body (message);
+
+  key = g_hash_table_lookup (self->priv->pending_keys, &lookup);
+  if (key == NULL)
+    return;
+
+  if (--key->count == 0)
+    g_hash_table_remove (self->priv->pending_keys, key);
+}
+
 static void
 tp_chat_build_message (EmpathyTpChat *self,
     TpMessage *msg,
@@ -270,6 +353,21 @@ tp_chat_build_message (EmpathyTpChat *self,
   EmpathyMessage *message;
   TpContact *sender;
 
+  if (!self->priv->has_messages)
+    {
+      EmpathyLogIndex *log_index;
+
+      /* The message is going to be logged, so what we know about the logs
+       * of this conversation may be wrong now */
+      log_index = empathy_log_index_dup_singleton ();
+      empathy_log_index_invalidate (log_index,
+          empathy_tp_chat_get_account (self),
+          tp_channel_get_identifier (TP_CHANNEL (self)));
+      g_object_unref (log_index);
+
+      self->priv->has_messages = TRUE;
+    }
+
   message = empathy_message_new_from_tp_message (msg, incoming);
   /* FIXME: this is actually a lie for incoming messages. */
   empathy_message_set_receiver (message, self->priv->user);
@@ -293,6 +391,7 @@ tp_chat_build_message (EmpathyTpChat *self,
     }
 
   g_queue_push_tail (self->priv->pending_messages_queue, message);
+  add_pending_key (self, message);
   g_signal_emit (self, signals[MESSAGE_RECEIVED], 0, message);
 }
 
@@ -438,6 +537,7 @@ pending_message_removed_cb (TpTextChannel   *channel,
 
   g_signal_emit (self, signals[MESSAGE_ACKNOWLEDGED], 0, m->data);
 
+  remove_pending_key (self, m->data);
   g_object_unref (m->data);
   g_queue_delete_link (self->priv->pending_messages_queue, m);
 }
@@ -684,6 +784,7 @@ tp_chat_dispose (GObject *object)
   g_queue_foreach (self->priv->pending_messages_queue,
     (GFunc) g_object_unref, NULL);
   g_queue_clear (self->priv->pending_messages_queue);
+  g_hash_table_remove_all (self->priv->pending_keys);
 
   tp_clear_object (&self->priv->ready_result);
 
@@ -699,7 +800,9 @@ tp_chat_finalize (GObject *object)
   DEBUG ("Finalize: %p", object);
 
   g_queue_free (self->priv->pending_messages_queue);
+  g_hash_table_unref (self->priv->pending_keys);
   g_hash_table_unref (self->priv->messages_being_sent);
+  empathy_member_set_free (self->priv->members);
 
   g_free (self->priv->title);
   g_free (self->priv->subject);
@@ -725,7 +828,8 @@ check_almost_ready (EmpathyTpChat *self)
   /* We need either the members (room) or the remote contact (private chat).
    * If the chat is protected by a password we can't get these information so
    * consider the chat as ready so it can be presented to the user. */
-  if (!tp_channel_password_needed (channel) && self->priv->members == NULL &&
+  if (!tp_channel_password_needed (channel) &&
+      empathy_member_set_get_size (self->priv->members) == 0 &&
       self->priv->remote_contact == NULL)
     return;
 
@@ -745,45 +849,71 @@ check_almost_ready (EmpathyTpChat *self)
   check_ready (self);
 }
 
-static void
-add_members_contact (EmpathyTpChat *self,
-    GPtrArray *contacts)
+static GPtrArray *
+dup_contacts_from_tp_contacts (GPtrArray *tp_contacts)
 {
+  GPtrArray *contacts;
   guint i;
 
-  for (i = 0; i < contacts->len; i++)
+  contacts = g_ptr_array_new_full (tp_contacts->len, g_object_unref);
+
+  for (i = 0; i < tp_contacts->len; i++)
     {
       EmpathyContact *contact;
 
       contact = empathy_contact_dup_from_tp_contact (g_ptr_array_index (
-            contacts, i));
-
-      self->priv->members = g_list_prepend (self->priv->members, contact);
+            tp_contacts, i));
 
-      g_signal_emit (self, signals[SIG_MEMBERS_CHANGED], 0,
-                 contact, NULL, 0, NULL, TRUE);
+      if (contact != NULL)
+        g_ptr_array_add (contacts, contact);
     }
 
-  check_almost_ready (self);
+  return contacts;
 }
 
 static void
-remove_member (EmpathyTpChat *self,
-    EmpathyContact *contact)
+update_members (EmpathyTpChat *self,
+    GPtrArray *added,
+    GPtrArray *removed,
+    EmpathyContact *actor,
+    TpChannelGroupChangeReason reason,
+    const gchar *message)
 {
-  GList *l;
+  GPtrArray *contacts, *really_added = NULL, *really_removed = NULL;
+
+  if (removed != NULL && removed->len > 0)
+    {
+      contacts = dup_contacts_from_tp_contacts (removed);
+      really_removed = empathy_member_set_remove_many (self->priv->members,
+          contacts);
+      g_ptr_array_unref (contacts);
+    }
 
-  for (l = self->priv->members; l; l = l->next)
+  if (added != NULL && added->len > 0)
     {
-      EmpathyContact *c = l->data;
+      contacts = dup_contacts_from_tp_contacts (added);
+      really_added = empathy_member_set_add_many (self->priv->members,
+          contacts);
+      g_ptr_array_unref (contacts);
+    }
 
-      if (contact == c)
-        {
-          self->priv->members = g_list_delete_link (self->priv->members, l);
-          g_object_unref (c);
-          break;
-        }
+  /* A single emission for the whole change, however many contacts it
+   * involves. */
+  if ((really_added != NULL && really_added->len > 0) ||
+      (really_removed != NULL && really_removed->len > 0))
+    {
+      DEBUG ("%u members added, %u removed",
+          really_added != NULL ? really_added->len : 0,
+          really_removed != NULL ? really_removed->len : 0);
+
+      g_signal_emit (self, signals[SIG_MEMBERS_CHANGED], 0,
+          really_added, really_removed, actor, reason, message);
     }
+
+  tp_clear_pointer (&really_added, g_ptr_array_unref);
+  tp_clear_pointer (&really_removed, g_ptr_array_unref);
+
+  check_almost_ready (self);
 }
 
 static void
@@ -798,11 +928,12 @@ contact_renamed (EmpathyTpChat *self,
   old = empathy_contact_dup_from_tp_contact (old_contact);
   new = empathy_contact_dup_from_tp_contact (new_contact);
 
-  self->priv->members = g_list_prepend (self->priv->members, new);
+  if (new != NULL)
+    empathy_member_set_add (self->priv->members, new);
 
   if (old != NULL)
     {
-      remove_member (self, old);
+      empathy_member_set_remove (self->priv->members, old);
 
       g_signal_emit (self, signals[SIG_MEMBER_RENAMED], 0, old, new,
           reason, message);
@@ -817,6 +948,8 @@ contact_renamed (EmpathyTpChat *self,
       g_object_notify (G_OBJECT (self), "self-contact");
     }
 
+  tp_clear_object (&new);
+
   check_almost_ready (self);
 }
 
@@ -831,7 +964,6 @@ tp_chat_group_contacts_changed_cb (TpChannel *channel,
     EmpathyTpChat *self)
 {
   EmpathyContact *actor_contact = NULL;
-  guint i;
   TpChannelGroupChangeReason reason;
   const gchar *message;
 
@@ -869,28 +1001,7 @@ tp_chat_group_contacts_changed_cb (TpChannel *channel,
         }
     }
 
-  /* Remove contacts that are not members anymore */
-  for (i = 0; i < removed->len; i++)
-    {
-      TpContact *tp_contact = g_ptr_array_index (removed, i);
-      EmpathyContact *contact;
-
-      contact = empathy_contact_dup_from_tp_contact (tp_contact);
-
-      if (contact != NULL)
-        {
-          remove_member (self, contact);
-
-          g_signal_emit (self, signals[SIG_MEMBERS_CHANGED], 0,
-                     contact, actor_contact, reason, message, FALSE);
-          g_object_unref (contact);
-        }
-    }
-
-  if (added->len > 0)
-    {
-      add_members_contact (self, added);
-    }
+  update_members (self, added, removed, actor_contact, reason, message);
 
   if (actor_contact != NULL)
     g_object_unref (actor_contact);
@@ -1062,13 +1173,26 @@ empathy_tp_chat_class_init (EmpathyTpChatClass *klass)
       4, EMPATHY_TYPE_CONTACT, EMPATHY_TYPE_CONTACT,
       G_TYPE_UINT, G_TYPE_STRING);
 
+  /**
+   * EmpathyTpChat::members-changed:
+   * @self: the #EmpathyTpChat
+   * @added: (allow-none): a #GPtrArray of the #EmpathyContact who joined
+   * @removed: (allow-none): a #GPtrArray of the #EmpathyContact who left
+   * @actor: (allow-none): the #EmpathyContact who made the change
+   * @reason: a #TpChannelGroupChangeReason
+   * @message: (allow-none): the message attached to the change
+   *
+   * Emitted once per membership change of the channel, which can involve
+   * any number of contacts. Renames are signalled by
+   * #EmpathyTpChat::member-renamed instead.
+   */
   signals[SIG_MEMBERS_CHANGED] = g_signal_new ("members-changed",
       G_OBJECT_CLASS_TYPE (klass),
       G_SIGNAL_RUN_LAST,
       0, NULL, NULL, NULL,
       G_TYPE_NONE,
-      5, EMPATHY_TYPE_CONTACT, EMPATHY_TYPE_CONTACT,
-      G_TYPE_UINT, G_TYPE_STRING, G_TYPE_BOOLEAN);
+      5, G_TYPE_PTR_ARRAY, G_TYPE_PTR_ARRAY, EMPATHY_TYPE_CONTACT,
+      G_TYPE_UINT, G_TYPE_STRING);
 
   g_type_class_add_private (object_class, sizeof (EmpathyTpChatPrivate));
 }
@@ -1080,8 +1204,11 @@ empathy_tp_chat_init (EmpathyTpChat *self)
       EmpathyTpChatPrivate);
 
   self->priv->pending_messages_queue = g_queue_new ();
+  self->priv->pending_keys = g_hash_table_new_full (pending_key_hash,
+      pending_key_equal, (GDestroyNotify) pending_key_free, NULL);
   self->priv->messages_being_sent = g_hash_table_new_full (
       g_str_hash, g_str_equal, g_free, NULL);
+  self->priv->members = empathy_member_set_new ();
 }
 
 EmpathyTpChat *
@@ -1168,6 +1295,33 @@ empathy_tp_chat_get_pending_messages (EmpathyTpChat *self)
   return self->priv->pending_messages_queue->head;
 }
 
+/**
+ * empathy_tp_chat_has_pending_message:
+ * @self: a #EmpathyTpChat
+ * @timestamp: the timestamp of the message
+ * @body: (allow-none): the body of the message
+ *
+ * Checks whether a message equal to the one described, in the sense of
+ * empathy_message_equal(), is pending, without having to build an
+ * #EmpathyMessage nor to go through all the pending messages.
+ *
+ * Returns: %TRUE if such a message is pending
+ */
+gboolean
+empathy_tp_chat_has_pending_message (EmpathyTpChat *self,
+    gint64 timestamp,
+    const gchar *body)
+{
+  PendingKey key;
+
+  g_return_val_if_fail (EMPATHY_IS_TP_CHAT (self), FALSE);
+
+  key.timestamp = timestamp;
+  key.body = (gchar *) body;
+
+  return g_hash_table_contains (self->priv->pending_keys, &key);
+}
+
 void
 empathy_tp_chat_acknowledge_message (EmpathyTpChat *self,
     EmpathyMessage *message)
@@ -1324,7 +1478,7 @@ continue_preparing (EmpathyTpChat *self)
 
       /* Get initial member contacts */
       contacts = tp_channel_group_dup_members_contacts (channel);
-      add_members_contact (self, contacts);
+      update_members (self, contacts, NULL, NULL, 0, NULL);
       g_ptr_array_unref (contacts);
 
       self->priv->can_upgrade_to_muc = FALSE;
@@ -84,6 +84,9 @@ void empathy_tp_chat_set_subject (EmpathyTpChat *self,
 
 /* Returns a read-only list of pending messages (should be a copy maybe ?) */
 const GList *  empathy_tp_chat_get_pending_messages (EmpathyTpChat *chat);
+gboolean       empathy_tp_chat_has_pending_message (EmpathyTpChat *self,
+    gint64 timestamp,
+    const gchar *body);
 void empathy_tp_chat_acknowledge_message (EmpathyTpChat *chat,
     EmpathyMessage *message);
 
@@ -0,0 +1,285 @@
+/*
+ * empathy-video-adapter.c - Source for the outgoing video quality policy
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-video-adapter.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_VOIP
+#include "empathy-debug.h"
+
+/* The latency of the frames reaching the encoder is what tells whether it
+ * keeps up. Samples above LATENCY_HIGH are overloaded, and so are those above
+ * LATENCY_LOW when the CPUs are busy too: a busy machine on which the encoder
+ * keeps up is not. Samples below both low thresholds are underloaded and
+ * anything in between keeps the current level. CPU load is a fraction of all
+ * the processors, so 1.0 is all of them fully busy. */
+#define CPU_HIGH 0.85
+#define CPU_LOW 0.5
+#define LATENCY_HIGH (150 * G_TIME_SPAN_MILLISECOND)
+#define LATENCY_LOW (60 * G_TIME_SPAN_MILLISECOND)
+
+/* Consecutive samples needed to step down and up */
+#define DOWN_SAMPLES 3
+#define UP_SAMPLES 10
+#define MAX_UP_SAMPLES 120
+
+/* Samples ignored after a change, while the pipeline settles */
+#define HOLD_SAMPLES 5
+
+/* Stepping down again within this many samples of stepping up means the step
+ * up was premature, so the next one waits twice as long */
+#define FLAP_SAMPLES 30
+
+typedef struct
+{
+  guint width;
+  guint height;
+  guint framerate;
+} Level;
+
+/* Candidate levels, best first */
+static const Level ladder[] = {
+  { 1280, 720, 30 },
+  { 640, 480, 30 },
+  { 640, 480, 20 },
+  { 320, 240, 20 },
+  { 320, 240, 15 },
+  { 320, 240, 10 },
+  { 160, 120, 10 },
+};
+
+struct _EmpathyVideoAdapter
+{
+  /* Level, best first, none of them exceeding the bounds */
+  GArray *levels;
+  guint level;
+
+  /* Consecutive overloaded and underloaded samples */
+  guint overloaded;
+  guint underloaded;
+  guint hold;
+
+  guint up_samples;
+  /* Samples since the last step up, G_MAXUINT if there was none */
+  guint since_up;
+};
+
+static guint64
+level_get_rate (const Level *level)
+{
+  return (guint64) level->width * level->height * level->framerate;
+}
+
+EmpathyVideoAdapter *
+empathy_video_adapter_new (void)
+{
+  EmpathyVideoAdapter *self = g_slice_new0 (EmpathyVideoAdapter);
+
+  self->levels = g_array_new (FALSE, FALSE, sizeof (Level));
+  self->up_samples = UP_SAMPLES;
+  self->since_up = G_MAXUINT;
+
+  return self;
+}
+
+void
+empathy_video_adapter_free (EmpathyVideoAdapter *self)
+{
+  if (self == NULL)
+    return;
+
+  g_array_unref (self->levels);
+  g_slice_free (EmpathyVideoAdapter, self);
+}
+
+/* The bounds are what the remote side asked for. They are the best level,
+ * followed by the levels of the ladder which fit in them, and the current
+ * level if it still does. */
+void
+empathy_video_adapter_set_bounds (EmpathyVideoAdapter *self,
+    guint width,
+    guint height,
+    guint framerate)
+{
+  Level bounds = { width, height, framerate };
+  Level current = { 0, 0, 0 };
+  guint64 current_rate = G_MAXUINT64;
+  guint i;
+
+  g_return_if_fail (width > 0 && height > 0 && framerate > 0);
+
+  if (self->levels->len > 0)
+    {
+      current = g_array_index (self->levels, Level, self->level);
+      current_rate = level_get_rate (&current);
+    }
+
+  g_array_set_size (self->levels, 0);
+  g_array_append_val (self->levels, bounds);
+
+  for (i = 0; i < G_N_ELEMENTS (ladder); i++)
+    {
+      Level level = ladder[i];
+      Level *last = &g_array_index (self->levels, Level,
+          self->levels->len - 1);
+
+      if (level.width > width || level.height > height)
+        continue;
+
+      level.framerate = MIN (level.framerate, framerate);
+
+      if (level_get_rate (&level) >= level_get_rate (last))
+        continue;
+
+      g_array_append_val (self->levels, level);
+    }
+
+  /* Changing the bounds never raises the quality by itself, that is left to
+   * the load samples */
+  for (i = 0; i < self->levels->len - 1; i++)
+    {
+      if (level_get_rate (&g_array_index (self->levels, Level, i)) <=
+          current_rate)
+        break;
+    }
+
+  /* Nor does it lower it if the current level is still allowed */
+  if (current_rate != G_MAXUINT64 &&
+      current.width <= width && current.height <= height &&
+      current.framerate <= framerate)
+    {
+      Level *level = &g_array_index (self->levels, Level, i);
+      guint64 rate = level_get_rate (level);
+
+      if (rate == current_rate)
+        {
+          *level = current;
+        }
+      else if (rate > current_rate)
+        {
+          /* Lighter than all the levels, so it comes last */
+          g_array_append_val (self->levels, current);
+          i = self->levels->len - 1;
+        }
+      else
+        {
+          g_array_insert_val (self->levels, i, current);
+        }
+    }
+
+  self->level = i;
+  self->overloaded = 0;
+  self->underloaded = 0;
+  self->up_samples = UP_SAMPLES;
+  self->since_up = G_MAXUINT;
+
+  DEBUG ("Bounds are %ux%u@%u, %u levels, starting at level %u",
+      width, height, framerate, self->levels->len, self->level);
+}
+
+/* Feeds the load measured over the last interval: the CPU load of the
+ * process, as a fraction of all the processors, and the latency, in
+ * microseconds, of the frames reaching the encoder. Returns TRUE if the
+ * current level changed. */
+gboolean
+empathy_video_adapter_add_sample (EmpathyVideoAdapter *self,
+    gdouble cpu_load,
+    gint64 latency)
+{
+  if (self->levels->len == 0)
+    return FALSE;
+
+  if (self->since_up != G_MAXUINT)
+    self->since_up++;
+
+  if (self->hold > 0)
+    {
+      self->hold--;
+      return FALSE;
+    }
+
+  if (latency > LATENCY_HIGH ||
+      (cpu_load > CPU_HIGH && latency > LATENCY_LOW))
+    {
+      self->overloaded++;
+      self->underloaded = 0;
+    }
+  else if (cpu_load < CPU_LOW && latency < LATENCY_LOW)
+    {
+      self->underloaded++;
+      self->overloaded = 0;
+    }
+  else
+    {
+      self->overloaded = 0;
+      self->underloaded = 0;
+    }
+
+  if (self->overloaded >= DOWN_SAMPLES &&
+      self->level + 1 < self->levels->len)
+    {
+      if (self->since_up <= FLAP_SAMPLES)
+        self->up_samples = MIN (self->up_samples * 2, MAX_UP_SAMPLES);
+
+      self->level++;
+      self->since_up = G_MAXUINT;
+    }
+  else if (self->underloaded >= self->up_samples && self->level > 0)
+    {
+      self->level--;
+      self->since_up = 0;
+    }
+  else
+    {
+      return FALSE;
+    }
+
+  DEBUG ("CPU load %.2f, latency %" G_GINT64_FORMAT " us, now at level %u",
+      cpu_load, latency, self->level);
+
+  self->overloaded = 0;
+  self->underloaded = 0;
+  self->hold = HOLD_SAMPLES;
+
+  return TRUE;
+}
+
+/* Returns FALSE if the bounds have not been set yet */
+gboolean
+empathy_video_adapter_get_current (EmpathyVideoAdapter *self,
+    guint *width,
+    guint *height,
+    guint *framerate)
+{
+  Level *level;
+
+  if (self->levels->len == 0)
+    return FALSE;
+
+  level = &g_array_index (self->levels, Level, self->level);
+
+  if (width != NULL)
+    *width = level->width;
+  if (height != NULL)
+    *height = level->height;
+  if (framerate != NULL)
+    *framerate = level->framerate;
+
+  return TRUE;
+}
@@ -0,0 +1,52 @@
+/*
+ * empathy-video-adapter.h - Header for the outgoing video quality policy
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_VIDEO_ADAPTER_H__
+#define __EMPATHY_VIDEO_ADAPTER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Picks the resolution and framerate of the outgoing video from the load of
+ * the machine, without ever exceeding what the remote side asked for. The
+ * quality is lowered quickly when overloaded and raised slowly once the load
+ * is low again, backing off further each time raising it had to be undone. */
+typedef struct _EmpathyVideoAdapter EmpathyVideoAdapter;
+
+EmpathyVideoAdapter * empathy_video_adapter_new (void);
+void empathy_video_adapter_free (EmpathyVideoAdapter *self);
+
+void empathy_video_adapter_set_bounds (EmpathyVideoAdapter *self,
+    guint width,
+    guint height,
+    guint framerate);
+
+gboolean empathy_video_adapter_add_sample (EmpathyVideoAdapter *self,
+    gdouble cpu_load,
+    gint64 latency);
+
+gboolean empathy_video_adapter_get_current (EmpathyVideoAdapter *self,
+    guint *width,
+    guint *height,
+    guint *framerate);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_VIDEO_ADAPTER_H__ */
@@ -192,6 +192,8 @@ create_sink (EmpathyGstAudioSink *self)
   const gchar *description;
 
   description = g_getenv ("EMPATHY_AUDIO_SINK");
+  if (description == NULL && empathy_call_use_test_sources ())
+    description = "fakesink sync=true";
 
   if (description != NULL)
     {
@@ -227,6 +227,8 @@ create_src (void)
   const gchar *description;
 
   description = g_getenv ("EMPATHY_AUDIO_SRC");
+  if (description == NULL && empathy_call_use_test_sources ())
+    description = "audiotestsrc is-live=true";
 
   if (description != NULL)
     {
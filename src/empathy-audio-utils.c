@@ -62,3 +62,42 @@ empathy_audio_set_stream_properties (GstElement *element,
 
   g_object_unref (gsettings_call);
 }
+
+/* Whether the call media elements should be replaced by test sources and
+ * fake sinks. The EMPATHY_CALL_TEST_SOURCES environment variable takes
+ * precedence over the GSettings key so the pipeline can be profiled without
+ * the schemas being installed. */
+gboolean
+empathy_call_use_test_sources (void)
+{
+  static gsize initialized = 0;
+  static gboolean use_test_sources = FALSE;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const gchar *env;
+
+      env = g_getenv ("EMPATHY_CALL_TEST_SOURCES");
+
+      if (env != NULL)
+        {
+          use_test_sources = g_strcmp0 (env, "0") != 0;
+        }
+      else
+        {
+          GSettings *gsettings_call;
+
+          gsettings_call = g_settings_new (EMPATHY_PREFS_CALL_SCHEMA);
+          use_test_sources = g_settings_get_boolean (gsettings_call,
+              EMPATHY_PREFS_CALL_TEST_SOURCES);
+          g_object_unref (gsettings_call);
+        }
+
+      if (use_test_sources)
+        DEBUG ("Using test sources and fake sinks");
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return use_test_sources;
+}
@@ -28,6 +28,8 @@ G_BEGIN_DECLS
 void empathy_audio_set_stream_properties (GstElement *element,
     gboolean echo_cancellation);
 
+gboolean empathy_call_use_test_sources (void);
+
 G_END_DECLS
 
 #endif
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Offline benchmark of the call video pipeline.
+ *
+ * Builds the same topology as EmpathyCallWindow: the video input feeds a tee
+ * whose first branch is the self preview, while the remote streams reach the
+ * output sink through a funnel. Farstream is not involved, the second tee
+ * branch is looped back into the funnel through a queue, which stands for
+ * the thread boundary of the conference. Sources and sinks are the test
+ * elements selected by EMPATHY_CALL_TEST_SOURCES, so no camera or display is
+ * needed. */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "empathy-video-src.h"
+
+typedef enum
+{
+  TAP_SOURCE,
+  TAP_PREVIEW,
+  TAP_FUNNEL,
+  TAP_OUTPUT,
+  NR_TAPS
+} Tap;
+
+static const gchar *tap_names[NR_TAPS] = {
+  "source", "preview", "funnel", "output" };
+
+typedef struct
+{
+  guint64 buffers;
+  GstClockTime total_latency;
+  GstClockTime max_latency;
+} TapStats;
+
+typedef struct
+{
+  GstElement *pipeline;
+  GMainLoop *loop;
+
+  /* Protects the fields below, which are updated from streaming threads */
+  GMutex lock;
+  TapStats taps[NR_TAPS];
+  guint64 preview_rendered;
+  guint64 output_rendered;
+} Benchmark;
+
+typedef struct
+{
+  Benchmark *benchmark;
+  Tap tap;
+} TapData;
+
+static gint duration = 10;
+static gchar *resolution = NULL;
+
+static GOptionEntry entries[] = {
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+    "Seconds to run each resolution for (default: 10)", "SECONDS" },
+  { "resolution", 'r', 0, G_OPTION_ARG_STRING, &resolution,
+    "Only benchmark the given resolution, e.g. 640x480", "WIDTHxHEIGHT" },
+  { NULL }
+};
+
+static const struct
+{
+  guint width;
+  guint height;
+} resolutions[] = {
+  { 320, 240 },
+  { 640, 480 },
+  { 1280, 720 },
+};
+
+/* Latency is the difference between the running time at which the buffer
+ * reaches the tap and the running time at which the live source captured it,
+ * so each tap reports the latency accumulated up to that point of the
+ * pipeline. */
+static GstPadProbeReturn
+tap_buffer_probe_cb (GstPad *pad,
+    GstPadProbeInfo *info,
+    gpointer user_data)
+{
+  TapData *data = user_data;
+  Benchmark *self = data->benchmark;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClock *clock;
+  GstClockTime now, latency;
+  TapStats *stats;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  clock = gst_element_get_clock (self->pipeline);
+  if (clock == NULL)
+    return GST_PAD_PROBE_OK;
+
+  now = gst_clock_get_time (clock) -
+    gst_element_get_base_time (self->pipeline);
+  gst_object_unref (clock);
+
+  latency = now > GST_BUFFER_PTS (buffer) ? now - GST_BUFFER_PTS (buffer) : 0;
+
+  g_mutex_lock (&self->lock);
+  stats = &self->taps[data->tap];
+  stats->buffers++;
+  stats->total_latency += latency;
+  stats->max_latency = MAX (stats->max_latency, latency);
+  g_mutex_unlock (&self->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+add_tap (Benchmark *self,
+    GstElement *element,
+    const gchar *pad_name,
+    Tap tap)
+{
+  GstPad *pad;
+  TapData *data;
+
+  pad = gst_element_get_static_pad (element, pad_name);
+  g_assert (pad != NULL);
+
+  data = g_new (TapData, 1);
+  data->benchmark = self;
+  data->tap = tap;
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, tap_buffer_probe_cb,
+      data, (GDestroyNotify) g_free);
+
+  gst_object_unref (pad);
+}
+
+static void
+preview_handoff_cb (GstElement *sink,
+    GstBuffer *buffer,
+    GstPad *pad,
+    Benchmark *self)
+{
+  g_mutex_lock (&self->lock);
+  self->preview_rendered++;
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+output_handoff_cb (GstElement *sink,
+    GstBuffer *buffer,
+    GstPad *pad,
+    Benchmark *self)
+{
+  g_mutex_lock (&self->lock);
+  self->output_rendered++;
+  g_mutex_unlock (&self->lock);
+}
+
+/* Same settings as a video sink would use, so late frames are dropped rather
+ * than rendered */
+static GstElement *
+create_sink (void)
+{
+  GstElement *sink;
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_assert (sink != NULL);
+
+  g_object_set (sink,
+      "sync", TRUE,
+      "qos", TRUE,
+      "max-lateness", (gint64) 20 * GST_MSECOND,
+      "signal-handoffs", TRUE,
+      NULL);
+
+  return sink;
+}
+
+static gboolean
+bus_message_cb (GstBus *bus,
+    GstMessage *message,
+    gpointer user_data)
+{
+  Benchmark *self = user_data;
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR)
+    {
+      GError *error = NULL;
+      gchar *debug = NULL;
+
+      gst_message_parse_error (message, &error, &debug);
+      g_printerr ("Error from %s: %s (%s)\n", GST_OBJECT_NAME (message->src),
+          error->message, debug != NULL ? debug : "no details");
+
+      g_error_free (error);
+      g_free (debug);
+      g_main_loop_quit (self->loop);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  Benchmark *self = user_data;
+
+  g_main_loop_quit (self->loop);
+  return FALSE;
+}
+
+static gint64
+get_cpu_time (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+    G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static gdouble
+get_framerate (GstElement *video_input)
+{
+  GstPad *pad;
+  GstCaps *caps;
+  gint num = 0, denom = 1;
+
+  pad = gst_element_get_static_pad (video_input, "src");
+  caps = gst_pad_get_current_caps (pad);
+  gst_object_unref (pad);
+
+  if (caps == NULL)
+    return 0;
+
+  gst_structure_get_fraction (gst_caps_get_structure (caps, 0), "framerate",
+      &num, &denom);
+  gst_caps_unref (caps);
+
+  return denom > 0 ? (gdouble) num / denom : 0;
+}
+
+static void
+print_tap (const TapStats *stats)
+{
+  if (stats->buffers == 0)
+    {
+      g_print ("  %11s", "-");
+      return;
+    }
+
+  g_print ("  %5.1f/%5.1f",
+      (gdouble) stats->total_latency / stats->buffers / GST_MSECOND,
+      (gdouble) stats->max_latency / GST_MSECOND);
+}
+
+static gboolean
+run_benchmark (guint width,
+    guint height)
+{
+  Benchmark self = { NULL, };
+  GstElement *video_input, *tee, *preview, *queue, *funnel, *output;
+  GstBus *bus;
+  guint bus_watch_id;
+  gint64 cpu_time;
+  guint64 dropped;
+  gdouble framerate, expected;
+  Tap tap;
+
+  g_mutex_init (&self.lock);
+  self.loop = g_main_loop_new (NULL, FALSE);
+  self.pipeline = gst_pipeline_new (NULL);
+
+  video_input = empathy_video_src_new ();
+  empathy_video_src_set_resolution (video_input, width, height);
+  tee = gst_element_factory_make ("tee", NULL);
+  preview = create_sink ();
+  queue = gst_element_factory_make ("queue", NULL);
+  funnel = gst_element_factory_make ("funnel", NULL);
+  output = create_sink ();
+
+  gst_bin_add_many (GST_BIN (self.pipeline), video_input, tee, preview, queue,
+      funnel, output, NULL);
+
+  if (!gst_element_link (video_input, tee) ||
+      !gst_element_link (tee, preview) ||
+      !gst_element_link_many (tee, queue, funnel, output, NULL))
+    {
+      g_printerr ("Could not link the video pipeline\n");
+      gst_object_unref (self.pipeline);
+      g_main_loop_unref (self.loop);
+      return FALSE;
+    }
+
+  add_tap (&self, video_input, "src", TAP_SOURCE);
+  add_tap (&self, preview, "sink", TAP_PREVIEW);
+  add_tap (&self, funnel, "src", TAP_FUNNEL);
+  add_tap (&self, output, "sink", TAP_OUTPUT);
+
+  g_signal_connect (preview, "handoff", G_CALLBACK (preview_handoff_cb),
+      &self);
+  g_signal_connect (output, "handoff", G_CALLBACK (output_handoff_cb),
+      &self);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (self.pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, bus_message_cb, &self);
+  g_object_unref (bus);
+
+  cpu_time = get_cpu_time ();
+
+  gst_element_set_state (self.pipeline, GST_STATE_PLAYING);
+  g_timeout_add_seconds (duration, timeout_cb, &self);
+  g_main_loop_run (self.loop);
+
+  cpu_time = get_cpu_time () - cpu_time;
+  framerate = get_framerate (video_input);
+
+  gst_element_set_state (self.pipeline, GST_STATE_NULL);
+  g_source_remove (bus_watch_id);
+
+  /* Frames the source failed to produce in time count as dropped too */
+  expected = framerate * duration;
+  dropped = (self.taps[TAP_PREVIEW].buffers - self.preview_rendered) +
+    (self.taps[TAP_OUTPUT].buffers - self.output_rendered);
+  if (expected > self.taps[TAP_SOURCE].buffers)
+    dropped += (guint64) expected - self.taps[TAP_SOURCE].buffers;
+
+  g_print ("%4ux%-4u %5.1f %7" G_GUINT64_FORMAT " %7" G_GUINT64_FORMAT,
+      width, height, framerate, self.taps[TAP_SOURCE].buffers, dropped);
+
+  for (tap = 0; tap < NR_TAPS; tap++)
+    print_tap (&self.taps[tap]);
+
+  if (self.taps[TAP_SOURCE].buffers > 0)
+    g_print ("  %9.1f\n", (gdouble) cpu_time / self.taps[TAP_SOURCE].buffers);
+  else
+    g_print ("  %9s\n", "-");
+
+  gst_object_unref (self.pipeline);
+  g_main_loop_unref (self.loop);
+  g_mutex_clear (&self.lock);
+
+  return TRUE;
+}
+
+int
+main (int argc,
+    char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  guint width = 0, height = 0;
+  Tap tap;
+  guint i;
+
+  /* Never touch the camera or the display */
+  g_setenv ("EMPATHY_CALL_TEST_SOURCES", "1", TRUE);
+
+  context = g_option_context_new ("- benchmark the call video pipeline");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free (context);
+
+  if (duration <= 0)
+    {
+      g_printerr ("Duration must be positive\n");
+      return EXIT_FAILURE;
+    }
+
+  if (resolution != NULL &&
+      sscanf (resolution, "%ux%u", &width, &height) != 2)
+    {
+      g_printerr ("Invalid resolution '%s'\n", resolution);
+      return EXIT_FAILURE;
+    }
+
+  g_print ("Latencies are average/maximum in ms since capture, CPU time is "
+      "in us per frame\n\n");
+  g_print ("%-9s %5s %7s %7s", "size", "fps", "frames", "dropped");
+  for (tap = 0; tap < NR_TAPS; tap++)
+    g_print ("  %11s", tap_names[tap]);
+  g_print ("  %9s\n", "cpu/frame");
+
+  if (resolution != NULL)
+    return run_benchmark (width, height) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  for (i = 0; i < G_N_ELEMENTS (resolutions); i++)
+    {
+      if (!run_benchmark (resolutions[i].width, resolutions[i].height))
+        return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
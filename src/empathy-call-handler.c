@@ -21,16 +21,37 @@
 #include "config.h"
 #include "empathy-call-handler.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
 #include <telepathy-farstream/telepathy-farstream.h>
 
 #include "empathy-call-utils.h"
+#include "empathy-gsettings.h"
 #include "empathy-utils.h"
+#include "empathy-video-adapter.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_VOIP
 #include "empathy-debug.h"
 
 G_DEFINE_TYPE(EmpathyCallHandler, empathy_call_handler, G_TYPE_OBJECT)
 
+G_DEFINE_BOXED_TYPE (EmpathyCallStats, empathy_call_stats,
+    empathy_call_stats_copy, empathy_call_stats_free)
+
+/* Seconds between two samples of the RTP statistics */
+#define STATS_INTERVAL 1
+
+/* Seconds between two samples of the load, for the video adaptation */
+#define ADAPT_INTERVAL 1
+
+/* Framerate assumed when the remote side did not ask for one, the maximum
+ * of the video source */
+#define DEFAULT_FRAMERATE 30
+
 /* signal enum */
 enum {
   CONFERENCE_ADDED,
@@ -61,8 +82,36 @@ enum {
   PROP_VIDEO_REMOTE_CANDIDATE,
   PROP_AUDIO_LOCAL_CANDIDATE,
   PROP_VIDEO_LOCAL_CANDIDATE,
+  PROP_AUDIO_STATS,
+  PROP_VIDEO_STATS,
 };
 
+/* Counters of the RTP session of a content. They are cumulative, so the
+ * previous sample is kept to compute rates over the last interval */
+typedef struct {
+  FsSession *session;
+  gint64 time;
+  guint64 octets_sent;
+  guint64 octets_received;
+  guint64 packets_received;
+  gint64 packets_lost;
+  EmpathyCallStats *stats;
+} MediaStats;
+
+/* Latency of the outgoing video frames, measured from the streaming thread.
+ * The probe has its own reference as it may still be running when it is
+ * removed. */
+typedef struct {
+  gint ref_count;
+  /* Protects the fields below */
+  GMutex lock;
+  /* Segment of the frames, to get their running time */
+  GstSegment segment;
+  /* Highest latency of the frames reaching the encoder since the last
+   * sample, in microseconds */
+  gint64 max_latency;
+} LatencyProbe;
+
 /* private structure */
 
 struct _EmpathyCallHandlerPriv {
@@ -81,15 +130,153 @@ struct _EmpathyCallHandlerPriv {
   FsCandidate *audio_local_candidate;
   FsCandidate *video_local_candidate;
   gboolean accept_when_initialised;
+
+  GstElement *rtpbin;
+  MediaStats audio_stats;
+  MediaStats video_stats;
+  guint stats_id;
+  /* Optional export of the statistics, see the stats-file setting */
+  FILE *stats_file;
+  gboolean stats_json;
+  gboolean stats_written;
+
+  /* Outgoing video: what the remote side asked for, and what we asked the
+   * video source for after adapting it to the load */
+  EmpathyVideoAdapter *video_adapter;
+  guint remote_width;
+  guint remote_height;
+  guint remote_framerate;
+  guint sent_width;
+  guint sent_height;
+  guint sent_framerate;
+
+  guint adapt_id;
+  gint64 last_sample_time;
+  gint64 last_cpu_time;
+  GstPad *video_sink_pad;
+  gulong video_sink_probe_id;
+  LatencyProbe *latency_probe;
 };
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyCallHandler)
 
+EmpathyCallStats *
+empathy_call_stats_copy (const EmpathyCallStats *stats)
+{
+  return g_slice_dup (EmpathyCallStats, stats);
+}
+
+void
+empathy_call_stats_free (EmpathyCallStats *stats)
+{
+  g_slice_free (EmpathyCallStats, stats);
+}
+
+static void
+media_stats_reset (MediaStats *media)
+{
+  tp_clear_object (&media->session);
+  tp_clear_pointer (&media->stats, empathy_call_stats_free);
+  media->time = 0;
+}
+
+static void
+stats_file_close (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  if (priv->stats_file == NULL)
+    return;
+
+  if (priv->stats_json)
+    fputs (priv->stats_written ? "\n]\n" : "[]\n", priv->stats_file);
+
+  fclose (priv->stats_file);
+  priv->stats_file = NULL;
+}
+
+static void
+stop_stats (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  if (priv->stats_id != 0)
+    {
+      g_source_remove (priv->stats_id);
+      priv->stats_id = 0;
+    }
+
+  tp_clear_object (&priv->rtpbin);
+  stats_file_close (self);
+}
+
+static LatencyProbe *
+latency_probe_new (void)
+{
+  LatencyProbe *probe = g_slice_new0 (LatencyProbe);
+
+  probe->ref_count = 1;
+  g_mutex_init (&probe->lock);
+  gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+
+  return probe;
+}
+
+static LatencyProbe *
+latency_probe_ref (LatencyProbe *probe)
+{
+  g_atomic_int_inc (&probe->ref_count);
+
+  return probe;
+}
+
+static void
+latency_probe_unref (LatencyProbe *probe)
+{
+  if (!g_atomic_int_dec_and_test (&probe->ref_count))
+    return;
+
+  g_mutex_clear (&probe->lock);
+  g_slice_free (LatencyProbe, probe);
+}
+
+static void
+stop_video_adaptation (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  if (priv->adapt_id != 0)
+    {
+      g_source_remove (priv->adapt_id);
+      priv->adapt_id = 0;
+    }
+
+  if (priv->video_sink_pad != NULL)
+    {
+      if (priv->video_sink_probe_id != 0)
+        gst_pad_remove_probe (priv->video_sink_pad,
+            priv->video_sink_probe_id);
+
+      priv->video_sink_probe_id = 0;
+      gst_object_unref (priv->video_sink_pad);
+      priv->video_sink_pad = NULL;
+    }
+
+  tp_clear_pointer (&priv->latency_probe, latency_probe_unref);
+
+  priv->last_sample_time = 0;
+}
+
 static void
 empathy_call_handler_dispose (GObject *object)
 {
   EmpathyCallHandlerPriv *priv = GET_PRIV (object);
 
+  stop_stats (EMPATHY_CALL_HANDLER (object));
+  stop_video_adaptation (EMPATHY_CALL_HANDLER (object));
+  media_stats_reset (&priv->audio_stats);
+  media_stats_reset (&priv->video_stats);
+
   tp_clear_object (&priv->tfchannel);
   tp_clear_object (&priv->call);
   tp_clear_object (&priv->contact);
@@ -110,6 +297,7 @@ empathy_call_handler_finalize (GObject *object)
   fs_candidate_destroy (priv->video_remote_candidate);
   fs_candidate_destroy (priv->audio_local_candidate);
   fs_candidate_destroy (priv->video_local_candidate);
+  empathy_video_adapter_free (priv->video_adapter);
 
   G_OBJECT_CLASS (empathy_call_handler_parent_class)->finalize (object);
 }
@@ -121,6 +309,8 @@ empathy_call_handler_init (EmpathyCallHandler *obj)
     EMPATHY_TYPE_CALL_HANDLER, EmpathyCallHandlerPriv);
 
   obj->priv = priv;
+
+  priv->video_adapter = empathy_video_adapter_new ();
 }
 
 static void
@@ -263,6 +453,12 @@ empathy_call_handler_get_property (GObject *object,
       case PROP_VIDEO_LOCAL_CANDIDATE:
         g_value_set_boxed (value, priv->video_local_candidate);
         break;
+      case PROP_AUDIO_STATS:
+        g_value_set_boxed (value, priv->audio_stats.stats);
+        break;
+      case PROP_VIDEO_STATS:
+        g_value_set_boxed (value, priv->video_stats.stats);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -361,6 +557,22 @@ empathy_call_handler_class_init (EmpathyCallHandlerClass *klass)
   g_object_class_install_property (object_class,
       PROP_VIDEO_REMOTE_CANDIDATE, param_spec);
 
+  param_spec = g_param_spec_boxed ("audio-stats",
+    "audio stats",
+    "RTP statistics of the audio stream, updated every second",
+    EMPATHY_TYPE_CALL_STATS,
+    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class,
+      PROP_AUDIO_STATS, param_spec);
+
+  param_spec = g_param_spec_boxed ("video-stats",
+    "video stats",
+    "RTP statistics of the video stream, updated every second",
+    EMPATHY_TYPE_CALL_STATS,
+    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class,
+      PROP_VIDEO_STATS, param_spec);
+
   signals[CONFERENCE_ADDED] =
     g_signal_new ("conference-added", G_TYPE_FROM_CLASS (klass),
       G_SIGNAL_RUN_LAST, 0, NULL, NULL,
@@ -626,11 +838,394 @@ empathy_call_handler_bus_message (EmpathyCallHandler *handler,
   tf_channel_bus_message (priv->tfchannel, message);
 }
 
+static MediaStats *
+get_media_stats (EmpathyCallHandler *self,
+    FsMediaType type)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  if (type == FS_MEDIA_TYPE_AUDIO)
+    return &priv->audio_stats;
+  else if (type == FS_MEDIA_TYPE_VIDEO)
+    return &priv->video_stats;
+
+  return NULL;
+}
+
+static guint64
+stats_get_uint64 (const GstStructure *s,
+    const gchar *field)
+{
+  const GValue *value = gst_structure_get_value (s, field);
+
+  if (value == NULL || !G_VALUE_HOLDS_UINT64 (value))
+    return 0;
+
+  return g_value_get_uint64 (value);
+}
+
+/* Each call gets its own file, named after the setting with the time the
+ * call started inserted before the extension: calls.csv becomes
+ * calls-20131024-153012.csv. Returns the file and sets @name, or NULL. */
+static FILE *
+stats_file_create (const gchar *path,
+    gchar **name)
+{
+  GDateTime *now;
+  gchar *stamp, *base;
+  const gchar *ext, *filename;
+  FILE *file = NULL;
+  guint i;
+
+  now = g_date_time_new_now_local ();
+  stamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+  g_date_time_unref (now);
+
+  /* Only a dot in the filename, other than its first character, starts the
+   * extension */
+  filename = strrchr (path, G_DIR_SEPARATOR);
+  filename = filename != NULL ? filename + 1 : path;
+  ext = strrchr (filename, '.');
+  if (ext == NULL || ext == filename)
+    ext = path + strlen (path);
+
+  base = g_strndup (path, ext - path);
+
+  for (i = 0; ; i++)
+    {
+      gint fd;
+
+      if (i == 0)
+        *name = g_strdup_printf ("%s-%s%s", base, stamp, ext);
+      else
+        *name = g_strdup_printf ("%s-%s-%u%s", base, stamp, i, ext);
+
+      /* Don't overwrite the file of a call started in the same second */
+      fd = g_open (*name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+      if (fd < 0 && errno == EEXIST)
+        {
+          g_free (*name);
+          continue;
+        }
+
+      if (fd >= 0)
+        file = fdopen (fd, "w");
+
+      if (file == NULL)
+        {
+          DEBUG ("Failed to open %s: %s", *name, g_strerror (errno));
+
+          if (fd >= 0)
+            close (fd);
+
+          tp_clear_pointer (name, g_free);
+        }
+
+      break;
+    }
+
+  g_free (base);
+  g_free (stamp);
+
+  return file;
+}
+
+static void
+stats_file_open (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+  GSettings *gsettings_call;
+  gchar *path;
+
+  gsettings_call = g_settings_new (EMPATHY_PREFS_CALL_SCHEMA);
+  path = g_settings_get_string (gsettings_call,
+      EMPATHY_PREFS_CALL_STATS_FILE);
+  g_object_unref (gsettings_call);
+
+  if (!tp_str_empty (path))
+    {
+      gchar *name = NULL;
+
+      priv->stats_file = stats_file_create (path, &name);
+
+      if (priv->stats_file != NULL)
+        {
+          DEBUG ("Writing call statistics to %s", name);
+
+          priv->stats_json = g_str_has_suffix (path, ".json");
+          priv->stats_written = FALSE;
+
+          if (!priv->stats_json)
+            fputs ("time,media,jitter_ms,packet_loss_percent,rtt_ms,"
+                "send_bitrate_bps,recv_bitrate_bps\n", priv->stats_file);
+        }
+
+      g_free (name);
+    }
+
+  g_free (path);
+}
+
+static void
+stats_file_write (EmpathyCallHandler *self,
+    gint64 time,
+    const gchar *media,
+    const EmpathyCallStats *stats)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+  gchar jitter[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar packet_loss[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar rtt[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar seconds[G_ASCII_DTOSTR_BUF_SIZE];
+
+  if (priv->stats_file == NULL)
+    return;
+
+  /* Always use '.' as decimal separator, whatever the locale */
+  g_ascii_formatd (seconds, sizeof (seconds), "%.3f",
+      (gdouble) time / G_USEC_PER_SEC);
+  g_ascii_formatd (jitter, sizeof (jitter), "%.2f", stats->jitter);
+  g_ascii_formatd (packet_loss, sizeof (packet_loss), "%.2f",
+      stats->packet_loss);
+  g_ascii_formatd (rtt, sizeof (rtt), "%.2f", stats->rtt);
+
+  if (priv->stats_json)
+    {
+      fprintf (priv->stats_file, "%s  { \"time\": %s, \"media\": \"%s\", "
+          "\"jitter_ms\": %s, \"packet_loss_percent\": %s, "
+          "\"rtt_ms\": %s, \"send_bitrate_bps\": %u, "
+          "\"recv_bitrate_bps\": %u }",
+          priv->stats_written ? ",\n" : "[\n",
+          seconds, media, jitter, packet_loss, rtt,
+          stats->send_bitrate, stats->recv_bitrate);
+    }
+  else
+    {
+      fprintf (priv->stats_file, "%s,%s,%s,%s,%s,%u,%u\n",
+          seconds, media, jitter, packet_loss, rtt,
+          stats->send_bitrate, stats->recv_bitrate);
+    }
+
+  priv->stats_written = TRUE;
+  fflush (priv->stats_file);
+}
+
+/* Returns TRUE if @media has a new sample */
+static gboolean
+sample_media_stats (EmpathyCallHandler *self,
+    MediaStats *media,
+    gint64 now)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+  GObject *rtp_session = NULL;
+  GValueArray *sources = NULL;
+  guint64 octets_sent = 0, octets_received = 0, packets_received = 0;
+  gint64 packets_lost = 0;
+  gdouble jitter = 0, rtt = 0, elapsed;
+  guint id, i;
+
+  if (media->session == NULL)
+    return FALSE;
+
+  g_object_get (media->session, "id", &id, NULL);
+  g_signal_emit_by_name (priv->rtpbin, "get-internal-session", id,
+      &rtp_session);
+
+  if (rtp_session == NULL)
+    return FALSE;
+
+  g_object_get (rtp_session, "sources", &sources, NULL);
+  g_object_unref (rtp_session);
+
+  if (sources == NULL)
+    return FALSE;
+
+  for (i = 0; i < sources->n_values; i++)
+    {
+      GObject *source = g_value_get_object (&sources->values[i]);
+      GstStructure *s = NULL;
+      gboolean internal = FALSE;
+
+      g_object_get (source, "stats", &s, NULL);
+      if (s == NULL)
+        continue;
+
+      gst_structure_get_boolean (s, "internal", &internal);
+
+      if (internal)
+        {
+          gboolean have_rb = FALSE;
+          guint round_trip;
+
+          octets_sent += stats_get_uint64 (s, "octets-sent");
+
+          /* The round trip is in 1/65536 seconds, taken from the receiver
+           * reports the remote side sent about our stream */
+          gst_structure_get_boolean (s, "have-rb", &have_rb);
+          if (have_rb && gst_structure_get_uint (s, "rb-round-trip",
+                  &round_trip))
+            rtt = MAX (rtt, round_trip * 1000.0 / 65536);
+        }
+      else
+        {
+          gint clock_rate, lost;
+          guint source_jitter;
+
+          octets_received += stats_get_uint64 (s, "octets-received");
+          packets_received += stats_get_uint64 (s, "packets-received");
+
+          if (gst_structure_get_int (s, "packets-lost", &lost))
+            packets_lost += lost;
+
+          /* Jitter is in timestamp units of the stream */
+          if (gst_structure_get_int (s, "clock-rate", &clock_rate) &&
+              clock_rate > 0 &&
+              gst_structure_get_uint (s, "jitter", &source_jitter))
+            jitter = MAX (jitter, source_jitter * 1000.0 / clock_rate);
+        }
+
+      gst_structure_free (s);
+    }
+
+  g_boxed_free (G_TYPE_VALUE_ARRAY, sources);
+
+  if (media->time != 0 && now > media->time)
+    {
+      guint64 received;
+      gint64 lost;
+
+      if (media->stats == NULL)
+        media->stats = g_slice_new0 (EmpathyCallStats);
+
+      elapsed = (gdouble) (now - media->time) / G_USEC_PER_SEC;
+
+      media->stats->jitter = jitter;
+      media->stats->rtt = rtt;
+      /* The sums go down when a source goes away, don't let the unsigned
+       * differences wrap around */
+      media->stats->send_bitrate = octets_sent > media->octets_sent ?
+          (octets_sent - media->octets_sent) * 8 / elapsed : 0;
+      media->stats->recv_bitrate =
+          octets_received > media->octets_received ?
+          (octets_received - media->octets_received) * 8 / elapsed : 0;
+
+      /* Duplicated packets can make the lost count go down */
+      received = packets_received > media->packets_received ?
+          packets_received - media->packets_received : 0;
+      lost = MAX (packets_lost - media->packets_lost, 0);
+      media->stats->packet_loss = received + lost > 0 ?
+          100.0 * lost / (received + lost) : 0;
+    }
+
+  media->time = now;
+  media->octets_sent = octets_sent;
+  media->octets_received = octets_received;
+  media->packets_received = packets_received;
+  media->packets_lost = packets_lost;
+
+  return media->stats != NULL;
+}
+
+static gboolean
+sample_stats_cb (gpointer user_data)
+{
+  EmpathyCallHandler *self = user_data;
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+  gint64 now = g_get_monotonic_time ();
+  gint64 real_time = g_get_real_time ();
+
+  if (sample_media_stats (self, &priv->audio_stats, now))
+    {
+      stats_file_write (self, real_time, "audio", priv->audio_stats.stats);
+      g_object_notify (G_OBJECT (self), "audio-stats");
+    }
+
+  if (sample_media_stats (self, &priv->video_stats, now))
+    {
+      stats_file_write (self, real_time, "video", priv->video_stats.stats);
+      g_object_notify (G_OBJECT (self), "video-stats");
+    }
+
+  return TRUE;
+}
+
+/* The statistics come from the sessions of the rtpbin inside the
+ * conference */
+static GstElement *
+find_rtpbin (GstElement *conference)
+{
+  GstIterator *it;
+  GValue item = G_VALUE_INIT;
+  GstElement *rtpbin = NULL;
+  gboolean done = FALSE;
+
+  if (!GST_IS_BIN (conference))
+    return NULL;
+
+  it = gst_bin_iterate_recurse (GST_BIN (conference));
+
+  while (!done)
+    {
+      switch (gst_iterator_next (it, &item))
+        {
+          case GST_ITERATOR_OK:
+            {
+              GstElement *element = g_value_get_object (&item);
+              GstElementFactory *factory = gst_element_get_factory (element);
+
+              if (factory != NULL && !tp_strdiff (gst_plugin_feature_get_name (
+                      GST_PLUGIN_FEATURE (factory)), "rtpbin"))
+                {
+                  rtpbin = gst_object_ref (element);
+                  done = TRUE;
+                }
+
+              g_value_reset (&item);
+              break;
+            }
+          case GST_ITERATOR_RESYNC:
+            gst_iterator_resync (it);
+            break;
+          default:
+            done = TRUE;
+            break;
+        }
+    }
+
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return rtpbin;
+}
+
+static void
+start_stats (EmpathyCallHandler *self,
+    GstElement *conference)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  if (priv->stats_id != 0)
+    return;
+
+  priv->rtpbin = find_rtpbin (conference);
+  if (priv->rtpbin == NULL)
+    {
+      DEBUG ("No rtpbin in the conference, not sampling statistics");
+      return;
+    }
+
+  stats_file_open (self);
+  priv->stats_id = g_timeout_add_seconds (STATS_INTERVAL, sample_stats_cb,
+      self);
+}
+
 static void
 on_tf_channel_conference_added_cb (TfChannel *tfchannel,
   GstElement *conference,
   EmpathyCallHandler *self)
 {
+  start_stats (self, conference);
+
   g_signal_emit (G_OBJECT (self), signals[CONFERENCE_ADDED], 0,
     conference);
 }
@@ -640,6 +1235,8 @@ on_tf_channel_conference_removed_cb (TfChannel *tfchannel,
   FsConference *conference,
   EmpathyCallHandler *self)
 {
+  stop_stats (self);
+
   g_signal_emit (G_OBJECT (self), signals[CONFERENCE_REMOVED], 0,
     GST_ELEMENT (conference));
 }
@@ -672,18 +1269,221 @@ on_tf_content_src_pad_added_cb (TfContent *content,
     g_idle_add (src_pad_added_error_idle, g_object_ref (content));
 }
 
+/* Asks the video source for the level picked by the adapter, or for what the
+ * remote side wants if we do not know its resolution yet */
+static void
+emit_video_level (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+  guint width, height, framerate;
+
+  if (!empathy_video_adapter_get_current (priv->video_adapter, &width,
+          &height, &framerate))
+    {
+      width = 0;
+      height = 0;
+      framerate = priv->remote_framerate;
+    }
+
+  if (framerate != 0 && framerate != priv->sent_framerate)
+    {
+      priv->sent_framerate = framerate;
+      g_signal_emit (G_OBJECT (self), signals[FRAMERATE_CHANGED], 0,
+          framerate);
+    }
+
+  if (width > 0 && height > 0 &&
+      (width != priv->sent_width || height != priv->sent_height))
+    {
+      priv->sent_width = width;
+      priv->sent_height = height;
+      g_signal_emit (G_OBJECT (self), signals[RESOLUTION_CHANGED], 0,
+          width, height);
+    }
+}
+
+static void
+update_video_bounds (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  if (priv->remote_width > 0 && priv->remote_height > 0)
+    empathy_video_adapter_set_bounds (priv->video_adapter,
+        priv->remote_width, priv->remote_height,
+        priv->remote_framerate > 0 ? priv->remote_framerate :
+            DEFAULT_FRAMERATE);
+
+  emit_video_level (self);
+}
+
+static gint64
+get_process_cpu_time (void)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+    G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/* Called from the streaming thread. The frames are timestamped with the
+ * running time at which they were captured, so their lateness when they
+ * reach the conference is the time spent queued behind the encoder. */
+static GstPadProbeReturn
+video_sink_probe_cb (GstPad *pad,
+    GstPadProbeInfo *info,
+    gpointer user_data)
+{
+  LatencyProbe *probe = user_data;
+  GstBuffer *buffer;
+  GstElement *element;
+  GstClock *clock;
+  GstClockTime now, running_time;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+      GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+      if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+        {
+          g_mutex_lock (&probe->lock);
+          gst_event_copy_segment (event, &probe->segment);
+          g_mutex_unlock (&probe->lock);
+        }
+
+      return GST_PAD_PROBE_OK;
+    }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&probe->lock);
+  running_time = GST_CLOCK_TIME_NONE;
+  if (probe->segment.format == GST_FORMAT_TIME)
+    running_time = gst_segment_to_running_time (&probe->segment,
+        GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  g_mutex_unlock (&probe->lock);
+
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return GST_PAD_PROBE_OK;
+
+  element = gst_pad_get_parent_element (pad);
+  if (element == NULL)
+    return GST_PAD_PROBE_OK;
+
+  clock = gst_element_get_clock (element);
+  if (clock != NULL)
+    {
+      now = gst_clock_get_time (clock) - gst_element_get_base_time (element);
+
+      if (now > running_time)
+        {
+          gint64 latency = GST_TIME_AS_USECONDS (now - running_time);
+
+          g_mutex_lock (&probe->lock);
+          probe->max_latency = MAX (probe->max_latency, latency);
+          g_mutex_unlock (&probe->lock);
+        }
+
+      gst_object_unref (clock);
+    }
+
+  gst_object_unref (element);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+adapt_video_cb (gpointer user_data)
+{
+  EmpathyCallHandler *self = user_data;
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+  gint64 now, cpu_time, latency = 0;
+
+  now = g_get_monotonic_time ();
+  cpu_time = get_process_cpu_time ();
+
+  if (priv->latency_probe != NULL)
+    {
+      g_mutex_lock (&priv->latency_probe->lock);
+      latency = priv->latency_probe->max_latency;
+      priv->latency_probe->max_latency = 0;
+      g_mutex_unlock (&priv->latency_probe->lock);
+    }
+
+  if (priv->last_sample_time != 0 && now > priv->last_sample_time)
+    {
+      gdouble cpu_load;
+
+      /* The time spent by all the threads of the process, over the time
+       * all the processors had */
+      cpu_load = (gdouble) (cpu_time - priv->last_cpu_time) /
+        (now - priv->last_sample_time) / g_get_num_processors ();
+
+      if (empathy_video_adapter_add_sample (priv->video_adapter, cpu_load,
+              latency))
+        emit_video_level (self);
+    }
+
+  priv->last_sample_time = now;
+  priv->last_cpu_time = cpu_time;
+
+  return TRUE;
+}
+
+static void
+start_video_adaptation (EmpathyCallHandler *self,
+    TfContent *content)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  stop_video_adaptation (self);
+
+  g_object_get (content, "sink-pad", &priv->video_sink_pad, NULL);
+
+  if (priv->video_sink_pad != NULL)
+    {
+      GstEvent *segment;
+
+      priv->latency_probe = latency_probe_new ();
+
+      /* The segment may have gone through already */
+      segment = gst_pad_get_sticky_event (priv->video_sink_pad,
+          GST_EVENT_SEGMENT, 0);
+      if (segment != NULL)
+        {
+          gst_event_copy_segment (segment, &priv->latency_probe->segment);
+          gst_event_unref (segment);
+        }
+
+      priv->video_sink_probe_id = gst_pad_add_probe (priv->video_sink_pad,
+          GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+          video_sink_probe_cb, latency_probe_ref (priv->latency_probe),
+          (GDestroyNotify) latency_probe_unref);
+    }
+
+  priv->adapt_id = g_timeout_add_seconds (ADAPT_INTERVAL, adapt_video_cb,
+      self);
+}
+
 static void
 on_tf_content_framerate_changed (TfContent *content,
   GParamSpec *spec,
   EmpathyCallHandler *handler)
 {
+  EmpathyCallHandlerPriv *priv = GET_PRIV (handler);
   guint framerate;
 
   g_object_get (content, "framerate", &framerate, NULL);
 
   if (framerate != 0)
-    g_signal_emit (G_OBJECT (handler), signals[FRAMERATE_CHANGED], 0,
-        framerate);
+    {
+      priv->remote_framerate = framerate;
+      update_video_bounds (handler);
+    }
 }
 
 static void
@@ -692,9 +1492,14 @@ on_tf_content_resolution_changed (TfContent *content,
    guint height,
    EmpathyCallHandler *handler)
 {
+  EmpathyCallHandlerPriv *priv = GET_PRIV (handler);
+
   if (width > 0 && height > 0)
-    g_signal_emit (G_OBJECT (handler), signals[RESOLUTION_CHANGED], 0,
-        width, height);
+    {
+      priv->remote_width = width;
+      priv->remote_height = height;
+      update_video_bounds (handler);
+    }
 }
 
 static void
@@ -702,12 +1507,14 @@ on_tf_channel_content_added_cb (TfChannel *tfchannel,
   TfContent *content,
   EmpathyCallHandler *handler)
 {
+  EmpathyCallHandlerPriv *priv = GET_PRIV (handler);
   FsMediaType mtype;
   FsSession *session;
 //  FsStream *fs_stream;
   FsCodec *codec;
 //  GList *codecs;
   gboolean retval;
+  MediaStats *media;
 
   g_signal_connect (content, "src-pad-added",
       G_CALLBACK (on_tf_content_src_pad_added_cb), handler);
@@ -730,6 +1537,14 @@ on_tf_channel_content_added_cb (TfChannel *tfchannel,
 
  update_sending_codec (handler, codec, session);
 
+ g_object_get (content, "media-type", &mtype, NULL);
+ media = get_media_stats (handler, mtype);
+ if (media != NULL)
+   {
+     media_stats_reset (media);
+     media->session = g_object_ref (session);
+   }
+
  tp_clear_object (&session);
  tp_clear_object (&codec);
 
@@ -744,8 +1559,6 @@ on_tf_channel_content_added_cb (TfChannel *tfchannel,
  tp_clear_object (&fs_stream);
 */
 
-  g_object_get (content, "media-type", &mtype, NULL);
-
  if (mtype == FS_MEDIA_TYPE_VIDEO)
    {
      guint framerate, width, height;
@@ -765,12 +1578,16 @@ on_tf_channel_content_added_cb (TfChannel *tfchannel,
          NULL);
 
      if (framerate > 0)
-       g_signal_emit (G_OBJECT (handler), signals[FRAMERATE_CHANGED], 0,
-           framerate);
+       priv->remote_framerate = framerate;
 
      if (width > 0 && height > 0)
-       g_signal_emit (G_OBJECT (handler), signals[RESOLUTION_CHANGED], 0,
-           width, height);
+       {
+         priv->remote_width = width;
+         priv->remote_height = height;
+       }
+
+     update_video_bounds (handler);
+     start_video_adaptation (handler, content);
    }
 }
 
@@ -780,9 +1597,19 @@ on_tf_channel_content_removed_cb (TfChannel *tfchannel,
   EmpathyCallHandler *handler)
 {
   gboolean retval;
+  FsMediaType mtype;
+  MediaStats *media;
 
   DEBUG ("removing content");
 
+  g_object_get (content, "media-type", &mtype, NULL);
+  media = get_media_stats (handler, mtype);
+  if (media != NULL)
+    media_stats_reset (media);
+
+  if (mtype == FS_MEDIA_TYPE_VIDEO)
+    stop_video_adaptation (handler);
+
   g_signal_emit (G_OBJECT (handler), signals[CONTENT_REMOVED], 0,
       content, &retval);
 
@@ -1035,3 +1862,19 @@ empathy_call_handler_get_contact (EmpathyCallHandler *self)
 {
   return self->priv->contact;
 }
+
+EmpathyCallStats *
+empathy_call_handler_get_audio_stats (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  return priv->audio_stats.stats;
+}
+
+EmpathyCallStats *
+empathy_call_handler_get_video_stats (EmpathyCallHandler *self)
+{
+  EmpathyCallHandlerPriv *priv = GET_PRIV (self);
+
+  return priv->video_stats.stats;
+}
@@ -32,6 +32,21 @@ typedef struct _EmpathyCallHandler EmpathyCallHandler;
 typedef struct _EmpathyCallHandlerClass EmpathyCallHandlerClass;
 typedef struct _EmpathyCallHandlerPriv EmpathyCallHandlerPriv;
 
+/* RTP statistics of a content, sampled once per second */
+typedef struct {
+    gdouble jitter; /* ms, of the incoming stream */
+    gdouble packet_loss; /* percentage of incoming packets lost */
+    gdouble rtt; /* ms, as reported by the remote side */
+    guint send_bitrate; /* bits per second */
+    guint recv_bitrate; /* bits per second */
+} EmpathyCallStats;
+
+#define EMPATHY_TYPE_CALL_STATS (empathy_call_stats_get_type ())
+GType empathy_call_stats_get_type (void);
+
+EmpathyCallStats * empathy_call_stats_copy (const EmpathyCallStats *stats);
+void empathy_call_stats_free (EmpathyCallStats *stats);
+
 struct _EmpathyCallHandlerClass {
     GObjectClass parent_class;
 };
@@ -102,6 +117,12 @@ FsCandidate * empathy_call_handler_get_video_local_candidate (
 
 EmpathyContact * empathy_call_handler_get_contact (EmpathyCallHandler *self);
 
+EmpathyCallStats * empathy_call_handler_get_audio_stats (
+    EmpathyCallHandler *self);
+
+EmpathyCallStats * empathy_call_handler_get_video_stats (
+    EmpathyCallHandler *self);
+
 G_END_DECLS
 
 #endif /* #ifndef __EMPATHY_CALL_HANDLER_H__*/
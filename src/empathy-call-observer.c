@@ -101,7 +101,6 @@ display_reject_notification (EmpathyCallObserver *self,
   NotifyNotification *notification;
   gchar *summary, *body;
   EmpathyContact *emp_contact;
-  GdkPixbuf *pixbuf;
 
   contact = tp_channel_get_target_contact (channel);
 
@@ -115,16 +114,8 @@ display_reject_notification (EmpathyCallObserver *self,
       NULL);
 
   emp_contact = empathy_contact_dup_from_tp_contact (contact);
-  pixbuf = empathy_notify_manager_get_pixbuf_for_notification (
-      self->priv->notify_mgr, emp_contact, TPAW_IMAGE_AVATAR_DEFAULT);
-
-  if (pixbuf != NULL)
-    {
-      notify_notification_set_icon_from_pixbuf (notification, pixbuf);
-      g_object_unref (pixbuf);
-    }
-
-  notify_notification_show (notification, NULL);
+  empathy_notify_manager_show_notification (self->priv->notify_mgr,
+      notification, emp_contact, TPAW_IMAGE_AVATAR_DEFAULT);
 
   g_object_unref (notification);
   g_free (summary);
@@ -34,6 +34,7 @@
 
 #include "empathy-about-dialog.h"
 #include "empathy-audio-sink.h"
+#include "empathy-audio-utils.h"
 #include "empathy-call-utils.h"
 #include "empathy-call-window-fullscreen.h"
 #include "empathy-camera-menu.h"
@@ -48,6 +49,7 @@
 #include "empathy-rounded-rectangle.h"
 #include "empathy-rounded-texture.h"
 #include "empathy-sound-manager.h"
+#include "empathy-sparkline.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
@@ -84,6 +86,9 @@
 
 #define PREVIEW_BUTTON_OPACITY 180
 
+/* Number of samples, one per second, shown in the statistics sparklines */
+#define STATS_HISTORY 60
+
 G_DEFINE_TYPE(EmpathyCallWindow, empathy_call_window, GTK_TYPE_WINDOW)
 
 enum {
@@ -111,6 +116,32 @@ typedef enum {
   CAMERA_STATE_ON,
 } CameraState;
 
+/* Rows of the statistics in the details pane */
+typedef enum {
+  STATS_JITTER,
+  STATS_PACKET_LOSS,
+  STATS_RTT,
+  STATS_SEND_BITRATE,
+  STATS_RECV_BITRATE,
+  NR_STATS
+} StatsRow;
+
+static const gchar *stats_titles[NR_STATS] = {
+  N_("Jitter:"),
+  N_("Packet Loss:"),
+  N_("Round Trip Time:"),
+  N_("Sending Bitrate:"),
+  N_("Receiving Bitrate:"),
+};
+
+static const gchar *stats_formats[NR_STATS] = {
+  N_("%.1f ms"),
+  N_("%.1f %%"),
+  N_("%.0f ms"),
+  N_("%.0f kbit/s"),
+  N_("%.0f kbit/s"),
+};
+
 typedef enum {
   PREVIEW_POS_NONE,
   PREVIEW_POS_TOP_LEFT,
@@ -216,6 +247,10 @@ struct _EmpathyCallWindowPriv
   GtkWidget *video_local_candidate_info_img;
   GtkWidget *audio_remote_candidate_info_img;
   GtkWidget *audio_local_candidate_info_img;
+  GtkWidget *audio_stats_labels[NR_STATS];
+  GtkWidget *audio_stats_sparklines[NR_STATS];
+  GtkWidget *video_stats_labels[NR_STATS];
+  GtkWidget *video_stats_sparklines[NR_STATS];
 
   GstElement *video_input;
   GstElement *video_preview_sink;
@@ -383,6 +418,29 @@ empathy_call_window_show_video_output (EmpathyCallWindow *self,
   clutter_actor_raise_top (self->priv->overlay_bin);
 }
 
+/* Returns a sink rendering into @texture, or a fake sink when profiling
+ * with test sources */
+static GstElement *
+create_video_sink (ClutterActor *texture)
+{
+  GstElement *sink;
+
+  if (empathy_call_use_test_sources ())
+    {
+      sink = gst_element_factory_make ("fakesink", NULL);
+      if (sink != NULL)
+        g_object_set (sink, "sync", TRUE, NULL);
+
+      return sink;
+    }
+
+  sink = gst_element_factory_make ("cluttersink", NULL);
+  if (sink != NULL)
+    g_object_set (sink, "texture", texture, NULL);
+
+  return sink;
+}
+
 static void
 create_video_output_widget (EmpathyCallWindow *self)
 {
@@ -396,11 +454,9 @@ create_video_output_widget (EmpathyCallWindow *self)
   clutter_texture_set_keep_aspect_ratio (CLUTTER_TEXTURE (priv->video_output),
       TRUE);
 
-  priv->video_output_sink = gst_element_factory_make ("cluttersink", NULL);
+  priv->video_output_sink = create_video_sink (priv->video_output);
   if (priv->video_output_sink == NULL)
     g_error ("Missing cluttersink");
-  else
-    g_object_set (priv->video_output_sink, "texture", priv->video_output, NULL);
 
   clutter_container_add_actor (CLUTTER_CONTAINER (priv->video_box),
       priv->video_output);
@@ -1077,10 +1133,9 @@ create_video_preview (EmpathyCallWindow *self)
   clutter_actor_set_size (preview,
       SELF_VIDEO_SECTION_WIDTH, SELF_VIDEO_SECTION_HEIGHT);
 
-  priv->video_preview_sink = gst_element_factory_make ("cluttersink", NULL);
+  priv->video_preview_sink = create_video_sink (preview);
   if (priv->video_preview_sink == NULL)
       g_error ("Missing cluttersink, check your clutter-gst installation");
-  g_object_set (priv->video_preview_sink, "texture", preview, NULL);
   g_object_add_weak_pointer (G_OBJECT (priv->video_preview_sink), (gpointer) &priv->video_preview_sink);
 
   /* Add a little offset to the video preview */
@@ -1612,12 +1667,77 @@ mic_button_clicked (GtkWidget *button,
       !self->priv->muted);
 }
 
+static guint
+get_grid_n_rows (GtkWidget *grid)
+{
+  GList *children, *l;
+  guint n_rows = 0;
+
+  children = gtk_container_get_children (GTK_CONTAINER (grid));
+
+  for (l = children; l != NULL; l = g_list_next (l))
+    {
+      gint top, height;
+
+      gtk_container_child_get (GTK_CONTAINER (grid), l->data,
+          "top-attach", &top,
+          "height", &height,
+          NULL);
+
+      n_rows = MAX (n_rows, (guint) (top + height));
+    }
+
+  g_list_free (children);
+
+  return n_rows;
+}
+
+/* Appends the statistics rows below the codecs and candidates of a media
+ * type */
+static void
+add_stats_rows (GtkWidget *grid,
+    GtkWidget **labels,
+    GtkWidget **sparklines)
+{
+  guint top, i;
+
+  top = get_grid_n_rows (grid);
+
+  for (i = 0; i < NR_STATS; i++)
+    {
+      GtkWidget *title;
+      gchar *markup;
+
+      title = gtk_label_new (NULL);
+      markup = g_markup_printf_escaped ("<i>%s</i>", _(stats_titles[i]));
+      gtk_label_set_markup (GTK_LABEL (title), markup);
+      g_free (markup);
+      gtk_widget_set_halign (title, GTK_ALIGN_START);
+
+      labels[i] = gtk_label_new (_("Unknown"));
+      gtk_label_set_selectable (GTK_LABEL (labels[i]), TRUE);
+      gtk_widget_set_halign (labels[i], GTK_ALIGN_START);
+
+      sparklines[i] = empathy_sparkline_new (STATS_HISTORY);
+      gtk_widget_set_valign (sparklines[i], GTK_ALIGN_CENTER);
+
+      gtk_grid_attach (GTK_GRID (grid), title, 0, top + i, 1, 1);
+      gtk_grid_attach (GTK_GRID (grid), labels[i], 1, top + i, 1, 1);
+      gtk_grid_attach (GTK_GRID (grid), sparklines[i], 2, top + i, 1, 1);
+
+      gtk_widget_show (title);
+      gtk_widget_show (labels[i]);
+      gtk_widget_show (sparklines[i]);
+    }
+}
+
 static void
 empathy_call_window_init (EmpathyCallWindow *self)
 {
   EmpathyCallWindowPriv *priv;
   GtkBuilder *gui;
   GtkWidget *top_vbox;
+  GtkWidget *audio_grid, *video_grid;
   gchar *filename;
   ClutterConstraint *constraint;
   ClutterActor *remote_avatar;
@@ -1666,9 +1786,16 @@ empathy_call_window_init (EmpathyCallWindow *self)
     "video_local_candidate_info_img", &priv->video_local_candidate_info_img,
     "audio_remote_candidate_info_img", &priv->audio_remote_candidate_info_img,
     "audio_local_candidate_info_img", &priv->audio_local_candidate_info_img,
+    "audio", &audio_grid,
+    "video", &video_grid,
     NULL);
   g_free (filename);
 
+  add_stats_rows (audio_grid, priv->audio_stats_labels,
+      priv->audio_stats_sparklines);
+  add_stats_rows (video_grid, priv->video_stats_labels,
+      priv->video_stats_sparklines);
+
   tpaw_builder_connect (gui, self,
     "hangup", "clicked", empathy_call_window_hangup_cb,
     "audiocall", "clicked", empathy_call_window_audio_call_cb,
@@ -1884,6 +2011,33 @@ empathy_call_window_init (EmpathyCallWindow *self)
   gtk_toolbar_set_style (GTK_TOOLBAR (priv->toolbar), GTK_TOOLBAR_ICONS);
 }
 
+static void
+contact_avatar_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpWeakRef *wr = user_data;
+  GtkWidget *image_widget;
+  GdkPixbuf *pixbuf_avatar;
+
+  pixbuf_avatar = empathy_pixbuf_avatar_from_contact_scaled_finish (
+      EMPATHY_CONTACT (source), result, NULL);
+
+  image_widget = tp_weak_ref_dup_object (wr);
+  if (image_widget == NULL || pixbuf_avatar == NULL)
+    goto out;
+
+  /* Ignore the avatar if a newer one has been requested in the meantime */
+  if (g_object_get_data (G_OBJECT (image_widget), "avatar-load") ==
+      tp_weak_ref_get_user_data (wr))
+    gtk_image_set_from_pixbuf (GTK_IMAGE (image_widget), pixbuf_avatar);
+
+out:
+  g_clear_object (&pixbuf_avatar);
+  g_clear_object (&image_widget);
+  tp_weak_ref_destroy (wr);
+}
+
 /* Instead of specifying a width and a height, we specify only one size. That's
    because we want a square avatar icon.  */
 static void
@@ -1891,24 +2045,27 @@ init_contact_avatar_with_size (EmpathyContact *contact,
     GtkWidget *image_widget,
     gint size)
 {
-  GdkPixbuf *pixbuf_avatar = NULL;
-
-  if (contact != NULL)
-    {
-      pixbuf_avatar = empathy_pixbuf_avatar_from_contact_scaled (contact,
-        size, size);
-    }
+  static guint last_load = 0;
+  GdkPixbuf *pixbuf_avatar;
+  gpointer load;
 
-  if (pixbuf_avatar == NULL)
-    {
-      pixbuf_avatar = tpaw_pixbuf_from_icon_name_sized (
-          TPAW_IMAGE_AVATAR_DEFAULT, size);
-    }
+  /* The default avatar is displayed until the contact's one is decoded, off
+   * the main thread */
+  pixbuf_avatar = tpaw_pixbuf_from_icon_name_sized (
+      TPAW_IMAGE_AVATAR_DEFAULT, size);
 
   gtk_image_set_from_pixbuf (GTK_IMAGE (image_widget), pixbuf_avatar);
 
   if (pixbuf_avatar != NULL)
     g_object_unref (pixbuf_avatar);
+
+  load = GUINT_TO_POINTER (++last_load);
+  g_object_set_data (G_OBJECT (image_widget), "avatar-load", load);
+
+  if (contact != NULL)
+    empathy_pixbuf_avatar_from_contact_scaled_async (contact, size, size,
+        NULL, contact_avatar_loaded_cb,
+        tp_weak_ref_new (image_widget, load, NULL));
 }
 
 static void
@@ -2247,6 +2404,71 @@ candidates_changed_cb (GObject *object,
     }
 }
 
+static void
+update_stats (EmpathyCallWindow *self,
+    gboolean audio)
+{
+  EmpathyCallWindowPriv *priv = GET_PRIV (self);
+  EmpathyCallStats *stats;
+  GtkWidget **labels, **sparklines;
+  gdouble values[NR_STATS];
+  guint i;
+
+  if (audio)
+    {
+      stats = empathy_call_handler_get_audio_stats (priv->handler);
+      labels = priv->audio_stats_labels;
+      sparklines = priv->audio_stats_sparklines;
+    }
+  else
+    {
+      stats = empathy_call_handler_get_video_stats (priv->handler);
+      labels = priv->video_stats_labels;
+      sparklines = priv->video_stats_sparklines;
+    }
+
+  if (stats == NULL)
+    return;
+
+  values[STATS_JITTER] = stats->jitter;
+  values[STATS_PACKET_LOSS] = stats->packet_loss;
+  values[STATS_RTT] = stats->rtt;
+  values[STATS_SEND_BITRATE] = stats->send_bitrate / 1000.0;
+  values[STATS_RECV_BITRATE] = stats->recv_bitrate / 1000.0;
+
+  for (i = 0; i < NR_STATS; i++)
+    {
+      gchar *tmp;
+
+      tmp = g_strdup_printf (_(stats_formats[i]), values[i]);
+      gtk_label_set_text (GTK_LABEL (labels[i]), tmp);
+      g_free (tmp);
+
+      empathy_sparkline_add_sample (EMPATHY_SPARKLINE (sparklines[i]),
+          values[i]);
+    }
+}
+
+static void
+audio_stats_notify_cb (GObject *object,
+    GParamSpec *pspec,
+    gpointer user_data)
+{
+  EmpathyCallWindow *self = user_data;
+
+  update_stats (self, TRUE);
+}
+
+static void
+video_stats_notify_cb (GObject *object,
+    GParamSpec *pspec,
+    gpointer user_data)
+{
+  EmpathyCallWindow *self = user_data;
+
+  update_stats (self, FALSE);
+}
+
 static void
 empathy_call_window_constructed (GObject *object)
 {
@@ -2299,6 +2521,11 @@ empathy_call_window_constructed (GObject *object)
 
   tp_g_signal_connect_object (priv->handler, "candidates-changed",
       G_CALLBACK (candidates_changed_cb), self, 0);
+
+  tp_g_signal_connect_object (priv->handler, "notify::audio-stats",
+      G_CALLBACK (audio_stats_notify_cb), self, 0);
+  tp_g_signal_connect_object (priv->handler, "notify::video-stats",
+      G_CALLBACK (video_stats_notify_cb), self, 0);
 }
 
 static void empathy_call_window_dispose (GObject *object);
@@ -2590,6 +2817,19 @@ empathy_call_window_reset_pipeline (EmpathyCallWindow *self)
     }
 }
 
+static void
+reset_stats_rows (GtkWidget **labels,
+    GtkWidget **sparklines)
+{
+  guint i;
+
+  for (i = 0; i < NR_STATS; i++)
+    {
+      gtk_label_set_text (GTK_LABEL (labels[i]), _("Unknown"));
+      empathy_sparkline_clear (EMPATHY_SPARKLINE (sparklines[i]));
+    }
+}
+
 static void
 reset_details_pane (EmpathyCallWindow *self)
 {
@@ -2599,6 +2839,10 @@ reset_details_pane (EmpathyCallWindow *self)
   gtk_label_set_text (GTK_LABEL (priv->acodec_encoding_label), _("Unknown"));
   gtk_label_set_text (GTK_LABEL (priv->vcodec_decoding_label), _("Unknown"));
   gtk_label_set_text (GTK_LABEL (priv->acodec_decoding_label), _("Unknown"));
+
+  /* The next call starts its own statistics */
+  reset_stats_rows (priv->audio_stats_labels, priv->audio_stats_sparklines);
+  reset_stats_rows (priv->video_stats_labels, priv->video_stats_sparklines);
 }
 
 static gboolean
@@ -110,6 +110,10 @@ struct _EmpathyChatWindowPriv
   EmpathySoundManager *sound_mgr;
 
   gboolean updating_menu;
+
+  /* Bumped whenever the icon is updated, so out of date avatar loads are
+   * ignored */
+  guint icon_serial;
 };
 
 static GList *chat_windows = NULL;
@@ -730,16 +734,42 @@ chat_window_title_update (EmpathyChatWindow *self)
   g_free (name);
 }
 
+static void
+chat_window_avatar_icon_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpWeakRef *wr = user_data;
+  EmpathyChatWindow *self;
+  GdkPixbuf *icon;
+
+  icon = empathy_pixbuf_avatar_from_contact_scaled_finish (
+      EMPATHY_CONTACT (source), result, NULL);
+
+  self = tp_weak_ref_dup_object (wr);
+  if (self == NULL)
+    goto out;
+
+  if (self->priv->icon_serial ==
+      GPOINTER_TO_UINT (tp_weak_ref_get_user_data (wr)))
+    gtk_window_set_icon (GTK_WINDOW (self), icon);
+
+out:
+  g_clear_object (&icon);
+  g_clear_object (&self);
+  tp_weak_ref_destroy (wr);
+}
+
 static void
 chat_window_icon_update (EmpathyChatWindow *self,
     gboolean new_messages)
 {
-  GdkPixbuf *icon;
   EmpathyContact *remote_contact;
   gboolean avatar_in_icon;
   guint n_chats;
 
   n_chats = g_list_length (self->priv->chats);
+  self->priv->icon_serial++;
 
   /* Update window icon */
   if (new_messages)
@@ -752,15 +782,19 @@ chat_window_icon_update (EmpathyChatWindow *self,
       avatar_in_icon = g_settings_get_boolean (self->priv->gsettings_chat,
           EMPATHY_PREFS_CHAT_AVATAR_IN_ICON);
 
+      remote_contact = NULL;
       if (n_chats == 1 && avatar_in_icon)
-        {
-          remote_contact = empathy_chat_get_remote_contact (self->priv->current_chat);
-          icon = empathy_pixbuf_avatar_from_contact_scaled (remote_contact,
-              0, 0);
-          gtk_window_set_icon (GTK_WINDOW (self), icon);
+        remote_contact = empathy_chat_get_remote_contact (
+            self->priv->current_chat);
 
-          if (icon != NULL)
-            g_object_unref (icon);
+      if (remote_contact != NULL)
+        {
+          /* Decoded off the main thread, the current icon stays until
+           * then */
+          empathy_pixbuf_avatar_from_contact_scaled_async (remote_contact,
+              0, 0, NULL, chat_window_avatar_icon_loaded_cb,
+              tp_weak_ref_new (self,
+                GUINT_TO_POINTER (self->priv->icon_serial), NULL));
         }
       else
         {
@@ -1586,7 +1620,6 @@ chat_window_show_or_update_notification (EmpathyChatWindow *self,
   const gchar *header;
   char *escaped;
   const char *body;
-  GdkPixbuf *pixbuf;
   gboolean res, has_x_canonical_append;
   NotifyNotification *notification = self->priv->notification;
 
@@ -1647,16 +1680,8 @@ chat_window_show_or_update_notification (EmpathyChatWindow *self,
           EMPATHY_NOTIFY_MANAGER_CAP_CATEGORY, g_variant_new_string (category));
     }
 
-  pixbuf = empathy_notify_manager_get_pixbuf_for_notification (self->priv->notify_mgr,
-    sender, EMPATHY_IMAGE_NEW_MESSAGE);
-
-  if (pixbuf != NULL)
-    {
-      notify_notification_set_icon_from_pixbuf (notification, pixbuf);
-      g_object_unref (pixbuf);
-    }
-
-  notify_notification_show (notification, NULL);
+  empathy_notify_manager_show_notification (self->priv->notify_mgr,
+      notification, sender, EMPATHY_IMAGE_NEW_MESSAGE);
 
   g_free (escaped);
 }
@@ -21,6 +21,15 @@
 
 var chat = document.getElementById("Chat");
 
+// While a batch is open, prepended messages are gathered in this
+// DocumentFragment and inserted into the chat at once by commitBatch()
+var batch = null;
+
+// Likewise for the appended messages, and whether the chat should then
+// scroll to them
+var appendBatch = null;
+var appendBatchScroll = false;
+
 
 function createHTMLNode(html) {
   var range = document.createRange();
@@ -61,8 +70,124 @@ function removePrependNodes(node) {
 }
 
 
+function beginBatch() {
+  batch = document.createDocumentFragment();
+  appendBatch = document.createDocumentFragment();
+  appendBatchScroll = false;
+}
+
+
+function commitAppendBatch() {
+  var fragment = appendBatch;
+  var scroll = appendBatchScroll;
+
+  appendBatch = null;
+  appendBatchScroll = false;
+  if (!fragment || !fragment.hasChildNodes())
+    return;
+
+  // Messages the theme is still coalescing are older than the batch
+  if (typeof coalescedHTML != "undefined" && coalescedHTML)
+    coalescedHTML.cancel();
+
+  // The last message of the batch has the #insert now
+  var insert = document.getElementById("insert");
+  if (insert)
+    insert.parentNode.removeChild(insert);
+
+  chat.appendChild(fragment);
+
+  if (typeof alignChat == "function")
+    alignChat(scroll);
+  else if (scroll)
+    window.scrollTo(0, document.body.scrollHeight);
+}
+
+
+function commitBatch() {
+  var fragment = batch;
+
+  batch = null;
+  commitAppendBatch();
+
+  if (!fragment || !fragment.hasChildNodes())
+    return;
+
+  chat.insertBefore(fragment, chat.firstChild);
+
+  removeInsertNodes(chat);
+  removePrependNodes(chat);
+}
+
+
+function batchWouldScroll() {
+  return typeof nearBottom == "function" ? nearBottom() : true;
+}
+
+
+function batchAppendMessageNoScroll(html) {
+  if (!appendBatch) {
+    appendMessageNoScroll(html);
+    return;
+  }
+
+  // Only the last message keeps its #insert
+  var insert = appendBatch.querySelector("#insert");
+  if (insert)
+    insert.parentNode.removeChild(insert);
+
+  appendBatch.appendChild(createHTMLNode(html));
+}
+
+
+function batchAppendMessage(html) {
+  // Nothing of the batch is displayed yet, so this is where the chat was
+  if (appendBatch && !appendBatchScroll)
+    appendBatchScroll = batchWouldScroll();
+
+  batchAppendMessageNoScroll(html);
+}
+
+
+function batchAppendNextMessageNoScroll(html) {
+  // The previous message is already displayed
+  if (!appendBatch || !appendBatch.hasChildNodes()) {
+    appendNextMessageNoScroll(html);
+    return;
+  }
+
+  var node = createHTMLNode(html);
+  var insert = appendBatch.querySelector("#insert");
+
+  if (insert)
+    insert.parentNode.replaceChild(node, insert);
+  else
+    appendBatch.appendChild(node);
+}
+
+
+function batchAppendNextMessage(html) {
+  if (!appendBatch || !appendBatch.hasChildNodes()) {
+    appendNextMessage(html);
+    return;
+  }
+
+  if (!appendBatchScroll)
+    appendBatchScroll = batchWouldScroll();
+
+  batchAppendNextMessageNoScroll(html);
+}
+
+
 function prepend(html) {
   var node = createHTMLNode(html);
+
+  // commitBatch() takes care of the #insert and #prepend nodes
+  if (batch) {
+    batch.insertBefore(node, batch.firstChild);
+    return;
+  }
+
   chat.insertBefore(node, chat.firstChild);
 
   // The lastChild should retain the #insert
@@ -75,7 +200,9 @@ function prepend(html) {
 
 
 function prependPrev(html) {
-  var pre = chat.firstChild.querySelector("#prepend");
+  // The previous message may still be in the batch
+  var first = (batch && batch.firstChild) ? batch.firstChild : chat.firstChild;
+  var pre = first.querySelector("#prepend");
 
   // For themes that don't support #prepend
   if (!pre) {
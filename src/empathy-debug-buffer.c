@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-debug-buffer.h"
+
+G_DEFINE_TYPE (EmpathyDebugBuffer, empathy_debug_buffer, G_TYPE_OBJECT)
+
+/* From G_LOG_LEVEL_ERROR to G_LOG_LEVEL_DEBUG */
+#define N_LEVELS 6
+
+struct _EmpathyDebugBufferPrivate
+{
+  /* One queue of owned EmpathyDebugEntry per level, the oldest first, so
+   * filtering on the level doesn't have to look at the other messages */
+  GQueue levels[N_LEVELS];
+  guint length;
+  guint capacity;
+
+  EmpathyDebugBufferEvictFunc evict_func;
+  gpointer user_data;
+};
+
+static guint
+level_to_index (GLogLevelFlags level)
+{
+  gint bit;
+
+  /* G_LOG_LEVEL_ERROR is bit 2, G_LOG_LEVEL_DEBUG bit 7 */
+  bit = g_bit_nth_lsf (level & G_LOG_LEVEL_MASK, -1);
+  if (bit < 2)
+    return 0;
+
+  return MIN (bit - 2, N_LEVELS - 1);
+}
+
+static void
+entry_free (EmpathyDebugEntry *entry)
+{
+  g_object_unref (entry->message);
+  g_slice_free (EmpathyDebugEntry, entry);
+}
+
+static void
+empathy_debug_buffer_finalize (GObject *object)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (object);
+  guint i;
+
+  for (i = 0; i < N_LEVELS; i++)
+    {
+      g_queue_foreach (&self->priv->levels[i], (GFunc) entry_free, NULL);
+      g_queue_clear (&self->priv->levels[i]);
+    }
+
+  G_OBJECT_CLASS (empathy_debug_buffer_parent_class)->finalize (object);
+}
+
+static void
+empathy_debug_buffer_class_init (EmpathyDebugBufferClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = empathy_debug_buffer_finalize;
+
+  g_type_class_add_private (klass, sizeof (EmpathyDebugBufferPrivate));
+}
+
+static void
+empathy_debug_buffer_init (EmpathyDebugBuffer *self)
+{
+  guint i;
+
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_DEBUG_BUFFER, EmpathyDebugBufferPrivate);
+
+  for (i = 0; i < N_LEVELS; i++)
+    g_queue_init (&self->priv->levels[i]);
+}
+
+/**
+ * empathy_debug_buffer_new:
+ * @capacity: the maximum number of messages kept, 0 for no limit
+ * @evict_func: (allow-none): called on the messages dropped because of
+ *   @capacity
+ * @user_data: data for @evict_func
+ *
+ * Returns: a new #EmpathyDebugBuffer
+ */
+EmpathyDebugBuffer *
+empathy_debug_buffer_new (guint capacity,
+    EmpathyDebugBufferEvictFunc evict_func,
+    gpointer user_data)
+{
+  EmpathyDebugBuffer *self;
+
+  self = g_object_new (EMPATHY_TYPE_DEBUG_BUFFER, NULL);
+
+  self->priv->capacity = capacity;
+  self->priv->evict_func = evict_func;
+  self->priv->user_data = user_data;
+
+  return self;
+}
+
+static void
+evict_oldest (EmpathyDebugBuffer *self)
+{
+  GQueue *oldest = NULL;
+  EmpathyDebugEntry *entry;
+  guint i;
+
+  /* The oldest message is at the head of one of the queues */
+  for (i = 0; i < N_LEVELS; i++)
+    {
+      EmpathyDebugEntry *head = g_queue_peek_head (&self->priv->levels[i]);
+
+      if (head == NULL)
+        continue;
+
+      if (oldest == NULL ||
+          head->serial < ((EmpathyDebugEntry *) g_queue_peek_head (
+              oldest))->serial)
+        oldest = &self->priv->levels[i];
+    }
+
+  g_return_if_fail (oldest != NULL);
+
+  entry = g_queue_pop_head (oldest);
+  self->priv->length--;
+
+  if (self->priv->evict_func != NULL)
+    self->priv->evict_func (entry, self->priv->user_data);
+
+  entry_free (entry);
+}
+
+static void
+enforce_capacity (EmpathyDebugBuffer *self,
+    guint room)
+{
+  if (self->priv->capacity == 0)
+    return;
+
+  while (self->priv->length > 0 &&
+      self->priv->length + room > self->priv->capacity)
+    evict_oldest (self);
+}
+
+/**
+ * empathy_debug_buffer_append:
+ * @self: a #EmpathyDebugBuffer
+ * @message: the new #TpDebugMessage
+ * @serial: a number greater than the serial of all the messages of @self
+ *
+ * Adds @message to @self, dropping the oldest message if @self is full.
+ *
+ * Returns: (transfer none): the entry of @message, valid until it's dropped
+ */
+EmpathyDebugEntry *
+empathy_debug_buffer_append (EmpathyDebugBuffer *self,
+    TpDebugMessage *message,
+    guint64 serial)
+{
+  EmpathyDebugEntry *entry;
+  guint level;
+
+  enforce_capacity (self, 1);
+
+  entry = g_slice_new0 (EmpathyDebugEntry);
+  entry->message = g_object_ref (message);
+  entry->serial = serial;
+
+  level = level_to_index (tp_debug_message_get_level (message));
+  g_queue_push_tail (&self->priv->levels[level], entry);
+  self->priv->length++;
+
+  return entry;
+}
+
+void
+empathy_debug_buffer_set_capacity (EmpathyDebugBuffer *self,
+    guint capacity)
+{
+  self->priv->capacity = capacity;
+
+  enforce_capacity (self, 0);
+}
+
+guint
+empathy_debug_buffer_get_length (EmpathyDebugBuffer *self)
+{
+  return self->priv->length;
+}
+
+/* Drops all the messages, without calling the evict function */
+void
+empathy_debug_buffer_clear (EmpathyDebugBuffer *self)
+{
+  guint i;
+
+  for (i = 0; i < N_LEVELS; i++)
+    {
+      g_queue_foreach (&self->priv->levels[i], (GFunc) entry_free, NULL);
+      g_queue_clear (&self->priv->levels[i]);
+    }
+
+  self->priv->length = 0;
+}
+
+/**
+ * empathy_debug_buffer_get_levels:
+ * @self: a #EmpathyDebugBuffer
+ * @max_level: the least severe level of interest
+ * @lists: a #GPtrArray
+ *
+ * Adds to @lists a #GList of #EmpathyDebugEntry for each level at least as
+ * severe as @max_level having messages, each sorted by serial. Merging them
+ * gives the messages of @self to display with this level filter. The lists
+ * are owned by @self and valid until it's modified.
+ */
+void
+empathy_debug_buffer_get_levels (EmpathyDebugBuffer *self,
+    GLogLevelFlags max_level,
+    GPtrArray *lists)
+{
+  guint i, max;
+
+  max = level_to_index (max_level);
+
+  for (i = 0; i <= max; i++)
+    {
+      GList *head = g_queue_peek_head_link (&self->priv->levels[i]);
+
+      if (head != NULL)
+        g_ptr_array_add (lists, head);
+    }
+}
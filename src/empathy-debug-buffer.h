@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_DEBUG_BUFFER_H__
+#define __EMPATHY_DEBUG_BUFFER_H__
+
+#include <gtk/gtk.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+#define EMPATHY_TYPE_DEBUG_BUFFER         (empathy_debug_buffer_get_type ())
+#define EMPATHY_DEBUG_BUFFER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), EMPATHY_TYPE_DEBUG_BUFFER, EmpathyDebugBuffer))
+#define EMPATHY_DEBUG_BUFFER_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), EMPATHY_TYPE_DEBUG_BUFFER, EmpathyDebugBufferClass))
+#define EMPATHY_IS_DEBUG_BUFFER(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), EMPATHY_TYPE_DEBUG_BUFFER))
+#define EMPATHY_IS_DEBUG_BUFFER_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), EMPATHY_TYPE_DEBUG_BUFFER))
+#define EMPATHY_DEBUG_BUFFER_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), EMPATHY_TYPE_DEBUG_BUFFER, EmpathyDebugBufferClass))
+
+typedef struct _EmpathyDebugBuffer        EmpathyDebugBuffer;
+typedef struct _EmpathyDebugBufferPrivate EmpathyDebugBufferPrivate;
+typedef struct _EmpathyDebugBufferClass   EmpathyDebugBufferClass;
+
+struct _EmpathyDebugBuffer
+{
+  GObject parent;
+  EmpathyDebugBufferPrivate *priv;
+};
+
+struct _EmpathyDebugBufferClass
+{
+  GObjectClass parent_class;
+};
+
+typedef struct
+{
+  TpDebugMessage *message;
+  /* Order of arrival, unique across all the buffers of a window */
+  guint64 serial;
+
+  /* Row of the entry in the view, valid if view_stamp is the stamp of the
+   * current content of the view */
+  guint view_stamp;
+  GtkTreeIter view_iter;
+} EmpathyDebugEntry;
+
+/* Called before @entry is dropped to make room for a new one */
+typedef void (*EmpathyDebugBufferEvictFunc) (EmpathyDebugEntry *entry,
+    gpointer user_data);
+
+GType empathy_debug_buffer_get_type (void) G_GNUC_CONST;
+
+EmpathyDebugBuffer * empathy_debug_buffer_new (guint capacity,
+    EmpathyDebugBufferEvictFunc evict_func,
+    gpointer user_data);
+
+EmpathyDebugEntry * empathy_debug_buffer_append (EmpathyDebugBuffer *self,
+    TpDebugMessage *message,
+    guint64 serial);
+
+void empathy_debug_buffer_set_capacity (EmpathyDebugBuffer *self,
+    guint capacity);
+
+guint empathy_debug_buffer_get_length (EmpathyDebugBuffer *self);
+
+void empathy_debug_buffer_clear (EmpathyDebugBuffer *self);
+
+void empathy_debug_buffer_get_levels (EmpathyDebugBuffer *self,
+    GLogLevelFlags max_level,
+    GPtrArray *lists);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_DEBUG_BUFFER_H__ */
@@ -27,7 +27,9 @@
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "empathy-debug-buffer.h"
 #include "empathy-geometry.h"
+#include "empathy-gsettings.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
@@ -56,7 +58,6 @@ enum
   COL_UNIQUE_NAME,
   COL_GONE,
   COL_ACTIVE_BUFFER,
-  COL_PAUSE_BUFFER,
   COL_PROXY,
   NUM_COLS
 };
@@ -82,7 +83,13 @@ struct _EmpathyDebugWindowPriv
   GtkWidget *level_filter;
 
   /* TreeView */
-  GtkTreeModel *store_filter;
+  /* Messages currently displayed, merged from the buffers of the selected
+   * services and filtered on their level */
+  GtkListStore *store;
+  /* Changed each time store is filled again */
+  guint store_stamp;
+  /* Buffer of the selected service, or NULL if "All" is selected */
+  EmpathyDebugBuffer *displayed_buffer;
   GtkWidget *view;
   GtkWidget *scrolled_win;
   GtkWidget *not_supported_label;
@@ -94,6 +101,14 @@ struct _EmpathyDebugWindowPriv
 
   /* Whether NewDebugMessage will be fired */
   gboolean paused;
+  /* Serial of the first message received since the pause */
+  guint64 pause_serial;
+  /* Serial of the next message received */
+  guint64 next_serial;
+
+  /* Maximum number of messages kept per service */
+  guint max_messages;
+  GSettings *gsettings_ui;
 
   /* Service (CM, Client) chooser store */
   GtkListStore *service_store;
@@ -108,7 +123,6 @@ struct _EmpathyDebugWindowPriv
   /* Misc. */
   gboolean dispose_run;
   TpAccountManager *am;
-  GtkListStore *all_active_buffer;
 };
 
 static const gchar *
@@ -156,37 +170,53 @@ get_active_service_name (EmpathyDebugWindow *self)
   return name;
 }
 
-static gboolean
-copy_buffered_messages (GtkTreeModel *buffer,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    gpointer data)
+static GLogLevelFlags
+get_level_filter (EmpathyDebugWindow *self)
 {
-  GtkListStore *active_buffer = data;
-  GtkTreeIter active_buffer_iter;
-  TpDebugMessage *msg;
+  GLogLevelFlags filter_value = G_LOG_LEVEL_DEBUG;
+  GtkTreeModel *filter_model;
+  GtkTreeIter filter_iter;
 
-  gtk_tree_model_get (buffer, iter,
-      COL_DEBUG_MESSAGE, &msg,
-      -1);
-  gtk_list_store_insert_with_values (active_buffer, &active_buffer_iter, -1,
-      COL_DEBUG_MESSAGE, msg,
-      -1);
+  filter_model = gtk_combo_box_get_model (
+      GTK_COMBO_BOX (self->priv->level_filter));
 
-  g_object_unref (msg);
+  if (gtk_combo_box_get_active_iter (GTK_COMBO_BOX (self->priv->level_filter),
+        &filter_iter))
+    gtk_tree_model_get (filter_model, &filter_iter,
+        COL_LEVEL_VALUE, &filter_value, -1);
 
-  return FALSE;
+  return filter_value;
 }
 
 static void
-insert_values_in_buffer (GtkListStore *store,
-    TpDebugMessage *msg)
+display_entry (EmpathyDebugWindow *self,
+    EmpathyDebugEntry *entry)
 {
-  GtkTreeIter iter;
-
-  gtk_list_store_insert_with_values (store, &iter, -1,
-      COL_DEBUG_MESSAGE, msg,
+  gtk_list_store_insert_with_values (self->priv->store, &entry->view_iter, -1,
+      COL_DEBUG_MESSAGE, entry->message,
       -1);
+
+  entry->view_stamp = self->priv->store_stamp;
+}
+
+static void
+entry_evicted_cb (EmpathyDebugEntry *entry,
+    gpointer user_data)
+{
+  EmpathyDebugWindow *self = user_data;
+
+  if (self->priv->store == NULL)
+    return;
+
+  if (entry->view_stamp == self->priv->store_stamp)
+    gtk_list_store_remove (self->priv->store, &entry->view_iter);
+}
+
+static EmpathyDebugBuffer *
+new_buffer_for_service (EmpathyDebugWindow *self)
+{
+  return empathy_debug_buffer_new (self->priv->max_messages,
+      entry_evicted_cb, self);
 }
 
 static void
@@ -194,22 +224,26 @@ debug_window_add_message (EmpathyDebugWindow *self,
     TpDebugClient *debug,
     TpDebugMessage *msg)
 {
-  GtkListStore *active_buffer, *pause_buffer;
+  EmpathyDebugBuffer *active_buffer;
+  EmpathyDebugEntry *entry;
 
-  pause_buffer = g_object_get_data (G_OBJECT (debug), "pause-buffer");
   active_buffer = g_object_get_data (G_OBJECT (debug), "active-buffer");
 
+  entry = empathy_debug_buffer_append (active_buffer, msg,
+      self->priv->next_serial++);
+
+  /* Messages received during the pause are displayed once it's released */
   if (self->priv->paused)
-    {
-      insert_values_in_buffer (pause_buffer, msg);
-    }
-  else
-    {
-      /* Append 'this' message to this service's and All's active-buffers */
-      insert_values_in_buffer (active_buffer, msg);
+    return;
 
-      insert_values_in_buffer (self->priv->all_active_buffer, msg);
-    }
+  if (self->priv->displayed_buffer != NULL &&
+      self->priv->displayed_buffer != active_buffer)
+    return;
+
+  if (tp_debug_message_get_level (msg) > get_level_filter (self))
+    return;
+
+  display_entry (self, entry);
 }
 
 static void
@@ -285,7 +319,7 @@ debug_window_set_toolbar_sensitivity (EmpathyDebugWindow *self,
 }
 
 static gboolean
-debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
+debug_window_get_iter_for_active_buffer (EmpathyDebugBuffer *active_buffer,
     GtkTreeIter *iter,
     EmpathyDebugWindow *self)
 {
@@ -297,7 +331,7 @@ debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
        valid_iter;
        valid_iter = gtk_tree_model_iter_next (model, iter))
     {
-      GtkListStore *stored_active_buffer;
+      EmpathyDebugBuffer *stored_active_buffer;
 
       gtk_tree_model_get (model, iter,
           COL_ACTIVE_BUFFER, &stored_active_buffer,
@@ -307,7 +341,7 @@ debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
           g_object_unref (stored_active_buffer);
           return valid_iter;
         }
-      g_object_unref (stored_active_buffer);
+      tp_clear_object (&stored_active_buffer);
     }
 
   return valid_iter;
@@ -366,7 +400,7 @@ debug_window_get_messages_cb (GObject *object,
   EmpathyDebugWindow *self = user_data;
   gchar *active_service_name;
   guint i;
-  GtkListStore *active_buffer;
+  EmpathyDebugBuffer *active_buffer;
   gboolean valid_iter;
   GtkTreeIter iter;
   gchar *proxy_service_name;
@@ -430,11 +464,6 @@ debug_window_get_messages_cb (GObject *object,
   tp_g_signal_connect_object (debug, "new-debug-message",
       G_CALLBACK (debug_window_new_debug_message_cb), self, 0);
 
-  /* Now that active-buffer is up to date, we can see which messages are
-   * to be visible */
-  gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (
-        self->priv->store_filter));
-
   /* Set the proxy to signal for new debug messages */
   debug_window_set_enabled (debug, TRUE);
 }
@@ -446,7 +475,7 @@ create_proxy_to_get_messages (EmpathyDebugWindow *self,
 {
   gchar *bus_name, *name = NULL;
   TpDebugClient *new_proxy, *stored_proxy = NULL;
-  GtkTreeModel *pause_buffer, *active_buffer;
+  EmpathyDebugBuffer *active_buffer;
   gboolean gone;
   GError *error = NULL;
 
@@ -454,7 +483,6 @@ create_proxy_to_get_messages (EmpathyDebugWindow *self,
       COL_NAME, &name,
       COL_GONE, &gone,
       COL_ACTIVE_BUFFER, &active_buffer,
-      COL_PAUSE_BUFFER, &pause_buffer,
       COL_PROXY, &stored_proxy,
       -1);
 
@@ -487,7 +515,6 @@ create_proxy_to_get_messages (EmpathyDebugWindow *self,
   g_free (bus_name);
 
   g_object_set_data (G_OBJECT (new_proxy), "active-buffer", active_buffer);
-  g_object_set_data (G_OBJECT (new_proxy), "pause-buffer", pause_buffer);
 
   /* Now we call GetMessages with fresh proxy.
    * The old proxy is NULL due to one of the following -
@@ -504,41 +531,6 @@ finally:
   g_free (name);
   tp_clear_object (&stored_proxy);
   g_object_unref (active_buffer);
-  g_object_unref (pause_buffer);
-}
-
-static GtkListStore *
-new_list_store_for_service (void)
-{
-  return gtk_list_store_new (NUM_DEBUG_COLS,
-             TP_TYPE_DEBUG_MESSAGE); /* COL_DEBUG_MESSAGE */
-}
-
-static gboolean
-debug_window_visible_func (GtkTreeModel *model,
-    GtkTreeIter *iter,
-    gpointer user_data)
-{
-  EmpathyDebugWindow *self = user_data;
-  GLogLevelFlags filter_value;
-  GtkTreeModel *filter_model;
-  GtkTreeIter filter_iter;
-  TpDebugMessage *msg;
-  gboolean result;
-
-  filter_model = gtk_combo_box_get_model (
-      GTK_COMBO_BOX (self->priv->level_filter));
-  gtk_combo_box_get_active_iter (GTK_COMBO_BOX (self->priv->level_filter),
-      &filter_iter);
-
-  gtk_tree_model_get (model, iter, COL_DEBUG_MESSAGE, &msg, -1);
-  gtk_tree_model_get (filter_model, &filter_iter,
-      COL_LEVEL_VALUE, &filter_value, -1);
-
-  result = (tp_debug_message_get_level (msg) <= filter_value);
-  g_object_unref (msg);
-
-  return result;
 }
 
 static gboolean
@@ -573,20 +565,92 @@ tree_view_search_equal_func_cb (GtkTreeModel *model,
 }
 
 static void
-update_store_filter (EmpathyDebugWindow *self,
-    GtkListStore *active_buffer)
+update_store (EmpathyDebugWindow *self)
 {
-  debug_window_set_toolbar_sensitivity (self, FALSE);
+  GtkTreeModel *service_store = GTK_TREE_MODEL (self->priv->service_store);
+  GLogLevelFlags level = get_level_filter (self);
+  GPtrArray *lists;
+
+  lists = g_ptr_array_new ();
 
-  tp_clear_object (&self->priv->store_filter);
-  self->priv->store_filter = gtk_tree_model_filter_new (
-      GTK_TREE_MODEL (active_buffer), NULL);
+  if (self->priv->displayed_buffer != NULL)
+    {
+      empathy_debug_buffer_get_levels (self->priv->displayed_buffer, level,
+          lists);
+    }
+  else
+    {
+      GtkTreeIter iter;
+      gboolean valid_iter;
+
+      /* Skipping the first service store iter which is reserved for "All" */
+      gtk_tree_model_get_iter_first (service_store, &iter);
+      for (valid_iter = gtk_tree_model_iter_next (service_store, &iter);
+           valid_iter;
+           valid_iter = gtk_tree_model_iter_next (service_store, &iter))
+        {
+          EmpathyDebugBuffer *service_active_buffer;
+          TpProxy *proxy = NULL;
+          gboolean gone;
+
+          gtk_tree_model_get (service_store, &iter,
+              COL_GONE, &gone,
+              COL_PROXY, &proxy,
+              COL_ACTIVE_BUFFER, &service_active_buffer,
+              -1);
+
+          if (service_active_buffer != NULL && (gone || proxy != NULL))
+            empathy_debug_buffer_get_levels (service_active_buffer, level,
+                lists);
+
+          tp_clear_object (&service_active_buffer);
+          tp_clear_object (&proxy);
+        }
+    }
+
+  /* Detach the store while filling it */
+  gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->view), NULL);
+
+  gtk_list_store_clear (self->priv->store);
+  self->priv->store_stamp++;
+
+  /* Merge the messages of all the lists in their order of arrival */
+  while (lists->len > 0)
+    {
+      EmpathyDebugEntry *entry = NULL;
+      GList *l;
+      guint i, oldest = 0;
+
+      for (i = 0; i < lists->len; i++)
+        {
+          EmpathyDebugEntry *head;
+
+          l = g_ptr_array_index (lists, i);
+          head = l->data;
+
+          if (entry == NULL || head->serial < entry->serial)
+            {
+              entry = head;
+              oldest = i;
+            }
+        }
+
+      if (self->priv->paused && entry->serial >= self->priv->pause_serial)
+        break;
+
+      display_entry (self, entry);
+
+      l = g_ptr_array_index (lists, oldest);
+      if (l->next != NULL)
+        g_ptr_array_index (lists, oldest) = l->next;
+      else
+        g_ptr_array_remove_index_fast (lists, oldest);
+    }
+
+  g_ptr_array_unref (lists);
 
-  gtk_tree_model_filter_set_visible_func (
-      GTK_TREE_MODEL_FILTER (self->priv->store_filter),
-      debug_window_visible_func, self, NULL);
   gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->view),
-      self->priv->store_filter);
+      GTK_TREE_MODEL (self->priv->store));
 
   /* Since view's model has changed, reset the search column and
    * search_equal_func */
@@ -594,8 +658,6 @@ update_store_filter (EmpathyDebugWindow *self,
       COL_DEBUG_MESSAGE);
   gtk_tree_view_set_search_equal_func (GTK_TREE_VIEW (self->priv->view),
       tree_view_search_equal_func_cb, NULL, NULL);
-
-  debug_window_set_toolbar_sensitivity (self, TRUE);
 }
 
 static void
@@ -605,9 +667,6 @@ refresh_all_buffer (EmpathyDebugWindow *self)
   GtkTreeIter iter;
   GtkTreeModel *service_store = GTK_TREE_MODEL (self->priv->service_store);
 
-  /* Clear All's active-buffer */
-  gtk_list_store_clear (self->priv->all_active_buffer);
-
   /* Skipping the first service store iter which is reserved for "All" */
   gtk_tree_model_get_iter_first (service_store, &iter);
   for (valid_iter = gtk_tree_model_iter_next (service_store, &iter);
@@ -615,51 +674,36 @@ refresh_all_buffer (EmpathyDebugWindow *self)
        valid_iter = gtk_tree_model_iter_next (service_store, &iter))
     {
       TpProxy *proxy = NULL;
-      GtkListStore *service_active_buffer;
       gboolean gone;
 
       gtk_tree_model_get (service_store, &iter,
           COL_GONE, &gone,
           COL_PROXY, &proxy,
-          COL_ACTIVE_BUFFER, &service_active_buffer,
           -1);
 
-      if (gone)
+      /* Get the messages of the services which are still around */
+      if (!gone && proxy == NULL)
         {
-          gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
-        }
-      else
-        {
-          if (proxy != NULL)
-            {
-              if (service_active_buffer == NULL)
-                break;
+          GError *error = NULL;
+          TpDBusDaemon *dbus = tp_dbus_daemon_dup (&error);
 
-              /* Copy the debug messages to all_active_buffer */
-              gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-                  copy_buffered_messages, self->priv->all_active_buffer);
-            }
-          else
+          if (error != NULL)
             {
-              GError *error = NULL;
-              TpDBusDaemon *dbus = tp_dbus_daemon_dup (&error);
-
-              if (error != NULL)
-                {
-                  DEBUG ("Failed at duping the dbus daemon: %s", error->message);
-                  g_error_free (error);
-                }
+              DEBUG ("Failed at duping the dbus daemon: %s", error->message);
+              g_error_free (error);
+            }
 
-              create_proxy_to_get_messages (self, &iter, dbus);
+          create_proxy_to_get_messages (self, &iter, dbus);
 
-              g_object_unref (dbus);
-            }
+          g_object_unref (dbus);
         }
 
-      g_object_unref (service_active_buffer);
       tp_clear_object (&proxy);
     }
+
+  /* "All" displays the buffers of the services having a proxy */
+  if (self->priv->displayed_buffer == NULL)
+    update_store (self);
 }
 
 static void
@@ -668,7 +712,7 @@ debug_window_service_chooser_changed_cb (GtkComboBox *chooser,
 {
   TpDBusDaemon *dbus;
   GError *error = NULL;
-  GtkListStore *stored_active_buffer = NULL;
+  EmpathyDebugBuffer *stored_active_buffer = NULL;
   gchar *name = NULL;
   GtkTreeIter iter;
   gboolean gone;
@@ -700,13 +744,16 @@ debug_window_service_chooser_changed_cb (GtkComboBox *chooser,
       goto finally;
     }
 
+  tp_clear_object (&self->priv->displayed_buffer);
+
   if (!tp_strdiff (name, "All"))
     {
-      update_store_filter (self, self->priv->all_active_buffer);
+      update_store (self);
       goto finally;
     }
 
-  update_store_filter (self, stored_active_buffer);
+  self->priv->displayed_buffer = g_object_ref (stored_active_buffer);
+  update_store (self);
 
   dbus = tp_dbus_daemon_dup (&error);
 
@@ -915,7 +962,7 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
   if (!debug_window_service_is_in_model (data->self, out, NULL, FALSE))
     {
       char *name;
-      GtkListStore *active_buffer, *pause_buffer;
+      EmpathyDebugBuffer *active_buffer;
 
       DEBUG ("Adding %s to list: %s at unique name: %s",
           service_type_to_string (data->type),
@@ -923,20 +970,17 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
 
       name = service_dup_display_name (self, data->type, data->name);
 
-      active_buffer = new_list_store_for_service ();
-      pause_buffer = new_list_store_for_service ();
+      active_buffer = new_buffer_for_service (self);
 
       gtk_list_store_insert_with_values (self->priv->service_store, &iter, -1,
           COL_NAME, name,
           COL_UNIQUE_NAME, out,
           COL_GONE, FALSE,
           COL_ACTIVE_BUFFER, active_buffer,
-          COL_PAUSE_BUFFER, pause_buffer,
           COL_PROXY, NULL,
           -1);
 
       g_object_unref (active_buffer);
-      g_object_unref (pause_buffer);
 
       if (self->priv->select_name != NULL &&
           !tp_strdiff (name, self->priv->select_name))
@@ -957,8 +1001,6 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
             COL_ACTIVE_BUFFER, NULL,
             -1);
 
-        self->priv->all_active_buffer = new_list_store_for_service ();
-
         /* Populate active buffers for all services */
         refresh_all_buffer (self);
 
@@ -1008,12 +1050,11 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
            &found_at_iter, TRUE))
         {
           GtkTreeIter iter;
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugBuffer *active_buffer;
 
           DEBUG ("Adding new service '%s' at %s.", name, arg2);
 
-          active_buffer = new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer = new_buffer_for_service (self);
 
           gtk_list_store_insert_with_values (self->priv->service_store,
               &iter, -1,
@@ -1021,25 +1062,22 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
               COL_UNIQUE_NAME, arg2,
               COL_GONE, FALSE,
               COL_ACTIVE_BUFFER, active_buffer,
-              COL_PAUSE_BUFFER, pause_buffer,
               COL_PROXY, NULL,
               -1);
 
           g_object_unref (active_buffer);
-          g_object_unref (pause_buffer);
         }
       else
         {
           /* a service with the same name is already in the service_store,
            * update it and set it as re-enabled.
            */
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugBuffer *active_buffer;
           TpProxy *stored_proxy;
 
           DEBUG ("Refreshing CM '%s' at '%s'.", name, arg2);
 
-          active_buffer= new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer = new_buffer_for_service (self);
 
           gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store),
               found_at_iter, COL_PROXY, &stored_proxy, -1);
@@ -1051,12 +1089,10 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
               COL_UNIQUE_NAME, arg2,
               COL_GONE, FALSE,
               COL_ACTIVE_BUFFER, active_buffer,
-              COL_PAUSE_BUFFER, pause_buffer,
               COL_PROXY, NULL,
               -1);
 
           g_object_unref (active_buffer);
-          g_object_unref (pause_buffer);
 
           gtk_tree_iter_free (found_at_iter);
 
@@ -1174,40 +1210,16 @@ static void
 debug_window_pause_toggled_cb (GtkToggleToolButton *pause_,
     EmpathyDebugWindow *self)
 {
-  GtkTreeIter iter;
-  gboolean valid_iter;
-  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
-
   self->priv->paused = gtk_toggle_tool_button_get_active (pause_);
 
-  if (!self->priv->paused)
+  if (self->priv->paused)
     {
-      /* Pause has been released - flush all pause buffers */
-      GtkTreeModel *service_store = GTK_TREE_MODEL (self->priv->service_store);
-
-      /* Skipping the first iter which is reserved for "All" */
-      gtk_tree_model_get_iter_first (model, &iter);
-      for (valid_iter = gtk_tree_model_iter_next (model, &iter);
-           valid_iter;
-           valid_iter = gtk_tree_model_iter_next (model, &iter))
-        {
-          GtkListStore *pause_buffer, *active_buffer;
-
-          gtk_tree_model_get (service_store, &iter,
-              COL_PAUSE_BUFFER, &pause_buffer,
-              COL_ACTIVE_BUFFER, &active_buffer,
-              -1);
-
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, active_buffer);
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
-
-          gtk_list_store_clear (pause_buffer);
-
-          g_object_unref (active_buffer);
-          g_object_unref (pause_buffer);
-        }
+      self->priv->pause_serial = self->priv->next_serial;
+    }
+  else
+    {
+      /* Pause has been released - display the messages received since */
+      update_store (self);
     }
 }
 
@@ -1215,33 +1227,43 @@ static void
 debug_window_filter_changed_cb (GtkComboBox *filter,
     EmpathyDebugWindow *self)
 {
-  gtk_tree_model_filter_refilter (
-      GTK_TREE_MODEL_FILTER (self->priv->store_filter));
+  update_store (self);
 }
 
 static void
 debug_window_clear_clicked_cb (GtkToolButton *clear_button,
     EmpathyDebugWindow *self)
 {
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
   GtkTreeIter iter;
-  GtkListStore *active_buffer;
+  gboolean valid_iter;
 
-  /* "All" is the first choice in the service chooser and it's buffer is
-   * not saved in the service-store but is accessed using a self->private
-   * reference */
-  if (gtk_combo_box_get_active (GTK_COMBO_BOX (self->priv->chooser)) == 0)
+  if (self->priv->displayed_buffer != NULL)
     {
-      gtk_list_store_clear (self->priv->all_active_buffer);
+      empathy_debug_buffer_clear (self->priv->displayed_buffer);
+      update_store (self);
       return;
     }
 
-  gtk_combo_box_get_active_iter (GTK_COMBO_BOX (self->priv->chooser), &iter);
-  gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store), &iter,
-      COL_ACTIVE_BUFFER, &active_buffer, -1);
+  /* "All" being a view of the buffers of all the services, clear them all.
+   * Skipping the first iter which is reserved for "All" */
+  gtk_tree_model_get_iter_first (model, &iter);
+  for (valid_iter = gtk_tree_model_iter_next (model, &iter);
+       valid_iter;
+       valid_iter = gtk_tree_model_iter_next (model, &iter))
+    {
+      EmpathyDebugBuffer *active_buffer;
 
-  gtk_list_store_clear (active_buffer);
+      gtk_tree_model_get (model, &iter,
+          COL_ACTIVE_BUFFER, &active_buffer, -1);
 
-  g_object_unref (active_buffer);
+      if (active_buffer != NULL)
+        empathy_debug_buffer_clear (active_buffer);
+
+      tp_clear_object (&active_buffer);
+    }
+
+  update_store (self);
 }
 
 static void
@@ -1264,9 +1286,9 @@ debug_window_menu_copy_activate_cb (GtkMenuItem *menu_item,
       return;
     }
 
-  gtk_tree_model_get_iter (self->priv->store_filter, &iter, path);
+  gtk_tree_model_get_iter (GTK_TREE_MODEL (self->priv->store), &iter, path);
 
-  gtk_tree_model_get (self->priv->store_filter, &iter,
+  gtk_tree_model_get (GTK_TREE_MODEL (self->priv->store), &iter,
       COL_DEBUG_MESSAGE, &msg,
       -1);
 
@@ -1525,7 +1547,7 @@ debug_window_save_file_chooser_response_cb (GtkDialog *dialog,
       goto OUT;
     }
 
-  gtk_tree_model_foreach (self->priv->store_filter,
+  gtk_tree_model_foreach (GTK_TREE_MODEL (self->priv->store),
       debug_window_copy_model_foreach, &debug_data);
 
   g_output_stream_write (G_OUTPUT_STREAM (output_stream), debug_data,
@@ -1719,7 +1741,7 @@ debug_window_send_to_pastebin_cb (GtkToolButton *tool_button,
 
   DEBUG ("Preparing debug data for sending to pastebin.");
 
-  gtk_tree_model_foreach (self->priv->store_filter,
+  gtk_tree_model_foreach (GTK_TREE_MODEL (self->priv->store),
       debug_window_copy_model_foreach, &debug_data);
 
   debug_window_send_to_pastebin (self, debug_data);
@@ -1733,7 +1755,7 @@ debug_window_copy_clicked_cb (GtkToolButton *tool_button,
   GtkClipboard *clipboard;
   gchar *text = NULL;
 
-  gtk_tree_model_foreach (self->priv->store_filter,
+  gtk_tree_model_foreach (GTK_TREE_MODEL (self->priv->store),
       debug_window_copy_model_foreach, &text);
 
   clipboard = gtk_clipboard_get_for_display (
@@ -1848,7 +1870,6 @@ am_prepared_cb (GObject *am,
       G_TYPE_STRING,  /* COL_UNIQUE_NAME */
       G_TYPE_BOOLEAN, /* COL_GONE */
       G_TYPE_OBJECT,  /* COL_ACTIVE_BUFFER */
-      G_TYPE_OBJECT,  /* COL_PAUSE_BUFFER */
       TP_TYPE_PROXY); /* COL_PROXY */
   gtk_combo_box_set_model (GTK_COMBO_BOX (self->priv->chooser),
       GTK_TREE_MODEL (self->priv->service_store));
@@ -2047,10 +2068,11 @@ am_prepared_cb (GObject *am,
       -1, _("Message"), renderer,
       (GtkTreeCellDataFunc) debug_window_message_formatter, NULL, NULL);
 
-  self->priv->store_filter = NULL;
+  self->priv->store = gtk_list_store_new (NUM_DEBUG_COLS,
+      TP_TYPE_DEBUG_MESSAGE); /* COL_DEBUG_MESSAGE */
 
   gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->view),
-      self->priv->store_filter);
+      GTK_TREE_MODEL (self->priv->store));
 
   /* Scrolled window */
   self->priv->scrolled_win = g_object_ref (gtk_scrolled_window_new (
@@ -2075,18 +2097,56 @@ am_prepared_cb (GObject *am,
 
   self->priv->view_visible = FALSE;
 
-  self->priv->all_active_buffer = NULL;
-
   debug_window_set_toolbar_sensitivity (EMPATHY_DEBUG_WINDOW (object), FALSE);
   debug_window_fill_service_chooser (EMPATHY_DEBUG_WINDOW (object));
   gtk_widget_show (GTK_WIDGET (object));
 }
 
+static void
+debug_window_max_messages_changed_cb (GSettings *settings,
+    const gchar *key,
+    EmpathyDebugWindow *self)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
+  GtkTreeIter iter;
+  gboolean valid_iter;
+
+  self->priv->max_messages = MAX (1, g_settings_get_uint (settings, key));
+
+  if (model == NULL)
+    return;
+
+  for (valid_iter = gtk_tree_model_get_iter_first (model, &iter);
+       valid_iter;
+       valid_iter = gtk_tree_model_iter_next (model, &iter))
+    {
+      EmpathyDebugBuffer *active_buffer;
+
+      gtk_tree_model_get (model, &iter,
+          COL_ACTIVE_BUFFER, &active_buffer, -1);
+
+      if (active_buffer != NULL)
+        empathy_debug_buffer_set_capacity (active_buffer,
+            self->priv->max_messages);
+
+      tp_clear_object (&active_buffer);
+    }
+}
+
 static void
 debug_window_constructed (GObject *object)
 {
   EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (object);
 
+  self->priv->gsettings_ui = g_settings_new (EMPATHY_PREFS_UI_SCHEMA);
+  self->priv->max_messages = MAX (1, g_settings_get_uint (
+        self->priv->gsettings_ui,
+        EMPATHY_PREFS_UI_DEBUG_WINDOW_MAX_MESSAGES));
+
+  tp_g_signal_connect_object (self->priv->gsettings_ui,
+      "changed::" EMPATHY_PREFS_UI_DEBUG_WINDOW_MAX_MESSAGES,
+      G_CALLBACK (debug_window_max_messages_changed_cb), self, 0);
+
   self->priv->am = tp_account_manager_dup ();
   tp_proxy_prepare_async (self->priv->am, NULL, am_prepared_cb, object);
 }
@@ -2180,7 +2240,9 @@ debug_window_dispose (GObject *object)
   g_clear_object (&self->priv->service_store);
   g_clear_object (&self->priv->dbus);
   g_clear_object (&self->priv->am);
-  g_clear_object (&self->priv->all_active_buffer);
+  g_clear_object (&self->priv->displayed_buffer);
+  g_clear_object (&self->priv->store);
+  g_clear_object (&self->priv->gsettings_ui);
 
   (G_OBJECT_CLASS (empathy_debug_window_parent_class)->dispose) (object);
 }
@@ -31,6 +31,7 @@
 #include "empathy-account-chooser.h"
 #include "empathy-gsettings.h"
 #include "empathy-request-util.h"
+#include "empathy-room-list-cache.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
@@ -40,6 +41,9 @@
 G_DEFINE_TYPE (EmpathyNewChatroomDialog, empathy_new_chatroom_dialog,
     GTK_TYPE_DIALOG)
 
+/* Rooms listed are added to the model at most this often, in ms */
+#define ROOMS_FLUSH_INTERVAL 250
+
 struct _EmpathyNewChatroomDialogPriv
 {
   TpRoomList *room_list;
@@ -65,6 +69,21 @@ struct _EmpathyNewChatroomDialogPriv
   GtkWidget *label_error_message;
   GtkWidget *viewport_error;
 
+  /* Owned EmpathyRoomEntry of all the rooms listed */
+  GPtrArray *rooms;
+  /* Set while some rooms listed are not in the model yet */
+  guint flush_id;
+  /* TRUE if rooms were loaded from the cache rather than listed */
+  gboolean rooms_from_cache;
+  /* Cancels loading the cache once it is outdated */
+  GCancellable *cache_cancellable;
+  /* TRUE if the current listing failed, its rooms can't replace the cache */
+  gboolean listing_failed;
+  /* Casefolded text the rooms of the model match, or NULL */
+  gchar *filter;
+  /* TRUE while the room entry is set from the selection */
+  gboolean setting_room;
+
   GSettings *gsettings;
 };
 
@@ -77,6 +96,7 @@ enum
   COL_MEMBERS,
   COL_MEMBERS_INT,
   COL_TOOLTIP,
+  COL_ENTRY,
   COL_COUNT
 };
 
@@ -236,11 +256,29 @@ new_chatroom_dialog_model_selection_changed (GtkTreeSelection *selection,
 
   gtk_entry_set_text (GTK_ENTRY (self->priv->entry_server),
       server ? server : "");
+
+  /* Don't filter the list on the room which has just been picked */
+  self->priv->setting_room = TRUE;
   gtk_entry_set_text (GTK_ENTRY (self->priv->entry_room), room ? room : "");
+  self->priv->setting_room = FALSE;
 
   g_free (room);
 }
 
+static GtkListStore *
+new_chatroom_dialog_store_new (void)
+{
+  return gtk_list_store_new (COL_COUNT,
+      G_TYPE_STRING,       /* Need password */
+      G_TYPE_STRING,       /* Invite only */
+      G_TYPE_STRING,       /* Name */
+      G_TYPE_STRING,       /* Room */
+      G_TYPE_STRING,       /* Member count */
+      G_TYPE_INT,          /* Member count int */
+      G_TYPE_STRING,       /* Tool tip */
+      G_TYPE_POINTER);     /* EmpathyRoomEntry */
+}
+
 static void
 new_chatroom_dialog_model_setup (EmpathyNewChatroomDialog *self)
 {
@@ -254,15 +292,8 @@ new_chatroom_dialog_model_setup (EmpathyNewChatroomDialog *self)
   g_signal_connect (view, "row-activated",
       G_CALLBACK (new_chatroom_dialog_model_row_activated_cb), self);
 
-  /* Store/Model */
-  store = gtk_list_store_new (COL_COUNT,
-      G_TYPE_STRING,       /* Need password */
-      G_TYPE_STRING,       /* Invite only */
-      G_TYPE_STRING,       /* Name */
-      G_TYPE_STRING,       /* Room */
-      G_TYPE_STRING,       /* Member count */
-      G_TYPE_INT,          /* Member count int */
-      G_TYPE_STRING);      /* Tool tip */
+  /* Store/Model, replaced by model_swap() whenever the rooms change */
+  store = new_chatroom_dialog_store_new ();
 
   self->priv->model = GTK_TREE_MODEL (store);
   gtk_tree_view_set_model (view, self->priv->model);
@@ -402,64 +433,384 @@ listing_failed_cb (TpRoomList *room_list,
       _("Failed to list rooms"));
   gtk_widget_show_all (self->priv->viewport_error);
   gtk_widget_set_sensitive (self->priv->treeview, FALSE);
+
+  self->priv->listing_failed = TRUE;
 }
 
 static void
-new_chatroom_dialog_got_room_cb (TpRoomList *room_list,
-    TpRoomInfo *room,
-    EmpathyNewChatroomDialog *self)
+model_append_room (GtkListStore *store,
+    EmpathyRoomEntry *entry)
 {
-  GtkListStore *store;
   gchar *members;
   gchar *tooltip;
-  const gchar *need_password;
-  const gchar *invite_only;
   gchar *tmp;
 
-  if (tp_str_empty (tp_room_info_get_handle_name (room)))
-    {
-      DEBUG ("Room handle name is empty - Broken CM");
-      return;
-    }
-
-  DEBUG ("New room listed: %s (%s)", tp_room_info_get_name (room),
-      tp_room_info_get_handle_name (room));
-
-  /* Add to model */
-  store = GTK_LIST_STORE (self->priv->model);
-  members = g_strdup_printf ("%d", tp_room_info_get_members_count (
-        room, NULL));
-  tmp = g_strdup_printf ("<b>%s</b>", tp_room_info_get_name (room));
+  members = g_strdup_printf ("%d", entry->members);
+  tmp = g_strdup_printf ("<b>%s</b>", entry->name);
 
   /* Translators: Room/Join's roomlist tooltip. Parameters are a channel name,
   yes/no, yes/no and a number. */
   tooltip = g_strdup_printf (
       _("%s\nInvite required: %s\nPassword required: %s\nMembers: %s"),
       tmp,
-      tp_room_info_get_invite_only (room, NULL) ? _("Yes") : _("No"),
-      tp_room_info_get_requires_password (room, NULL) ? _("Yes") : _("No"),
+      entry->invite_only ? _("Yes") : _("No"),
+      entry->need_password ? _("Yes") : _("No"),
       members);
   g_free (tmp);
 
-  invite_only = (tp_room_info_get_invite_only (room, NULL) ?
-    GTK_STOCK_INDEX : NULL);
-  need_password = (tp_room_info_get_requires_password (room, NULL) ?
-    GTK_STOCK_DIALOG_AUTHENTICATION : NULL);
-
   gtk_list_store_insert_with_values (store, NULL, -1,
-      COL_NEED_PASSWORD, need_password,
-      COL_INVITE_ONLY, invite_only,
-      COL_NAME, tp_room_info_get_name (room),
-      COL_ROOM, tp_room_info_get_handle_name (room),
+      COL_NEED_PASSWORD,
+        entry->need_password ? GTK_STOCK_DIALOG_AUTHENTICATION : NULL,
+      COL_INVITE_ONLY, entry->invite_only ? GTK_STOCK_INDEX : NULL,
+      COL_NAME, entry->name,
+      COL_ROOM, entry->room,
       COL_MEMBERS, members,
-      COL_MEMBERS_INT, tp_room_info_get_members_count (room, NULL),
+      COL_MEMBERS_INT, entry->members,
       COL_TOOLTIP, tooltip,
+      COL_ENTRY, entry,
       -1);
 
   g_free (members);
   g_free (tooltip);
 }
 
+static gboolean
+model_find_room (GtkTreeModel *model,
+    EmpathyRoomEntry *entry,
+    GtkTreeIter *iter)
+{
+  gboolean valid;
+
+  for (valid = gtk_tree_model_get_iter_first (model, iter);
+       valid;
+       valid = gtk_tree_model_iter_next (model, iter))
+    {
+      EmpathyRoomEntry *e;
+
+      gtk_tree_model_get (model, iter, COL_ENTRY, &e, -1);
+
+      if (e == entry)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Shows @store, which has been filled while detached from the view, in
+ * place of the current model. The selected room stays selected and the
+ * room at the top of the view stays there, if they are still listed. */
+static void
+model_swap (EmpathyNewChatroomDialog *self,
+    GtkListStore *store)
+{
+  GtkTreeView *view = GTK_TREE_VIEW (self->priv->treeview);
+  GtkTreeSelection *selection = gtk_tree_view_get_selection (view);
+  GtkTreeModel *model = self->priv->model;
+  EmpathyRoomEntry *selected = NULL, *top = NULL;
+  GtkTreePath *start;
+  GtkTreeIter iter;
+  gint sort_column;
+  GtkSortType order;
+
+  if (gtk_tree_selection_get_selected (selection, NULL, &iter))
+    gtk_tree_model_get (model, &iter, COL_ENTRY, &selected, -1);
+
+  if (gtk_tree_view_get_visible_range (view, &start, NULL))
+    {
+      if (gtk_tree_model_get_iter (model, &iter, start))
+        gtk_tree_model_get (model, &iter, COL_ENTRY, &top, -1);
+
+      gtk_tree_path_free (start);
+    }
+
+  /* Sorting the rows once they have all been added is much faster than
+   * inserting each of them in place. Keep the order picked by the user. */
+  if (!gtk_tree_sortable_get_sort_column_id (GTK_TREE_SORTABLE (model),
+        &sort_column, &order))
+    {
+      sort_column = COL_NAME;
+      order = GTK_SORT_ASCENDING;
+    }
+
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (store),
+      sort_column, order);
+
+  /* The selected room is selected again, there is no need to update the
+   * entries */
+  g_signal_handlers_block_by_func (selection,
+      new_chatroom_dialog_model_selection_changed, self);
+
+  gtk_tree_view_set_model (view, GTK_TREE_MODEL (store));
+  g_object_unref (self->priv->model);
+  self->priv->model = GTK_TREE_MODEL (store);
+  model = self->priv->model;
+
+  if (selected != NULL && model_find_room (model, selected, &iter))
+    gtk_tree_selection_select_iter (selection, &iter);
+
+  g_signal_handlers_unblock_by_func (selection,
+      new_chatroom_dialog_model_selection_changed, self);
+
+  if (top != NULL && model_find_room (model, top, &iter))
+    {
+      GtkTreePath *path = gtk_tree_model_get_path (model, &iter);
+
+      /* Done once the rows have been measured if they aren't yet */
+      gtk_tree_view_scroll_to_cell (view, path, NULL, TRUE, 0, 0);
+      gtk_tree_path_free (path);
+    }
+}
+
+/* Replaces the model by one holding the rooms matching the filter */
+static void
+model_rebuild (EmpathyNewChatroomDialog *self)
+{
+  GtkListStore *store;
+  guint i;
+
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  /* Not shown nor sorted yet, rows are just appended */
+  store = new_chatroom_dialog_store_new ();
+
+  for (i = 0; i < self->priv->rooms->len; i++)
+    {
+      EmpathyRoomEntry *entry = g_ptr_array_index (self->priv->rooms, i);
+
+      if (empathy_room_entry_matches (entry, self->priv->filter))
+        model_append_room (store, entry);
+    }
+
+  model_swap (self, store);
+}
+
+static gboolean
+flush_pending_rooms_cb (gpointer user_data)
+{
+  EmpathyNewChatroomDialog *self = user_data;
+
+  self->priv->flush_id = 0;
+  model_rebuild (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+flush_pending_rooms (EmpathyNewChatroomDialog *self)
+{
+  if (self->priv->flush_id != 0)
+    model_rebuild (self);
+}
+
+static void
+rooms_cache_cancel_load (EmpathyNewChatroomDialog *self)
+{
+  if (self->priv->cache_cancellable == NULL)
+    return;
+
+  g_cancellable_cancel (self->priv->cache_cancellable);
+  g_clear_object (&self->priv->cache_cancellable);
+}
+
+static void
+new_chatroom_dialog_model_clear (EmpathyNewChatroomDialog *self)
+{
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  rooms_cache_cancel_load (self);
+
+  /* The model points to the rooms, so it goes first */
+  model_swap (self, new_chatroom_dialog_store_new ());
+
+  g_ptr_array_set_size (self->priv->rooms, 0);
+  self->priv->rooms_from_cache = FALSE;
+}
+
+static void
+new_chatroom_dialog_got_room_cb (TpRoomList *room_list,
+    TpRoomInfo *room,
+    EmpathyNewChatroomDialog *self)
+{
+  EmpathyRoomEntry *entry;
+
+  if (tp_str_empty (tp_room_info_get_handle_name (room)))
+    {
+      DEBUG ("Room handle name is empty - Broken CM");
+      return;
+    }
+
+  DEBUG ("New room listed: %s (%s)", tp_room_info_get_name (room),
+      tp_room_info_get_handle_name (room));
+
+  /* The rooms from the cache are replaced by the ones actually listed */
+  if (self->priv->rooms_from_cache)
+    new_chatroom_dialog_model_clear (self);
+  else
+    rooms_cache_cancel_load (self);
+
+  entry = empathy_room_entry_new (tp_room_info_get_handle_name (room),
+      tp_room_info_get_name (room),
+      tp_room_info_get_subject (room, NULL),
+      tp_room_info_get_members_count (room, NULL),
+      tp_room_info_get_invite_only (room, NULL),
+      tp_room_info_get_requires_password (room, NULL));
+
+  g_ptr_array_add (self->priv->rooms, entry);
+
+  /* Add to model in chunks */
+  if (self->priv->flush_id == 0)
+    self->priv->flush_id = g_timeout_add (ROOMS_FLUSH_INTERVAL,
+        flush_pending_rooms_cb, self);
+}
+
+static void
+rooms_cache_saved_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (G_FILE (source), result, NULL,
+        &error))
+    {
+      DEBUG ("Failed to save the room list: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (user_data);
+}
+
+static void
+rooms_cache_save (EmpathyNewChatroomDialog *self)
+{
+  gchar *contents;
+  gchar *filename, *dirname;
+  GFile *file;
+
+  if (self->priv->account == NULL || self->priv->rooms_from_cache)
+    return;
+
+  contents = empathy_room_list_cache_serialize (self->priv->rooms);
+
+  filename = empathy_room_list_cache_dup_filename (self->priv->account);
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+
+  file = g_file_new_for_path (filename);
+
+  /* The contents are freed once they have been written */
+  g_file_replace_contents_async (file, contents, strlen (contents), NULL,
+      FALSE, G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL,
+      rooms_cache_saved_cb, contents);
+
+  g_object_unref (file);
+  g_free (dirname);
+  g_free (filename);
+}
+
+static void
+rooms_cache_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyNewChatroomDialog *self = user_data;
+  gchar *contents;
+  GPtrArray *entries;
+  GError *error = NULL;
+
+  if (!g_file_load_contents_finish (G_FILE (source), result, &contents, NULL,
+        NULL, &error))
+    {
+      /* Cancelled if the dialog is gone, or doesn't need the cache anymore */
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          DEBUG ("Failed to load the room list: %s", error->message);
+          g_clear_object (&self->priv->cache_cancellable);
+        }
+
+      g_error_free (error);
+      return;
+    }
+
+  g_clear_object (&self->priv->cache_cancellable);
+
+  entries = empathy_room_list_cache_parse (contents);
+  g_free (contents);
+
+  if (entries == NULL)
+    {
+      DEBUG ("Ignoring room list cache in an unknown format");
+      return;
+    }
+
+  DEBUG ("Loaded %u rooms from the cache", entries->len);
+
+  /* No room was listed yet, as that would have cancelled loading */
+  g_ptr_array_unref (self->priv->rooms);
+  self->priv->rooms = entries;
+
+  self->priv->rooms_from_cache = TRUE;
+  model_rebuild (self);
+}
+
+/* Shows the rooms of the latest listing of the account while it is
+ * listed again */
+static void
+rooms_cache_load (EmpathyNewChatroomDialog *self)
+{
+  gchar *filename;
+  GFile *file;
+
+  if (self->priv->account == NULL)
+    return;
+
+  rooms_cache_cancel_load (self);
+  self->priv->cache_cancellable = g_cancellable_new ();
+
+  filename = empathy_room_list_cache_dup_filename (self->priv->account);
+  file = g_file_new_for_path (filename);
+
+  g_file_load_contents_async (file, self->priv->cache_cancellable,
+      rooms_cache_loaded_cb, self);
+
+  g_object_unref (file);
+  g_free (filename);
+}
+
+/* Updates the model to contain the rooms matching the room entry */
+static void
+new_chatroom_dialog_filter_rooms (EmpathyNewChatroomDialog *self)
+{
+  const gchar *text;
+  gchar *filter = NULL;
+
+  text = gtk_entry_get_text (GTK_ENTRY (self->priv->entry_room));
+
+  /* "#" is the default text for IRC, all the rooms start with it */
+  if (!TPAW_STR_EMPTY (text) && tp_strdiff (text, "#"))
+    filter = g_utf8_casefold (text, -1);
+
+  if (!tp_strdiff (filter, self->priv->filter))
+    {
+      g_free (filter);
+      return;
+    }
+
+  g_free (self->priv->filter);
+  self->priv->filter = filter;
+
+  /* Rooms waiting to be flushed are added too */
+  model_rebuild (self);
+}
+
 static void
 new_chatroom_dialog_listing_cb (TpRoomList *room_list,
     GParamSpec *spec,
@@ -475,25 +826,34 @@ new_chatroom_dialog_listing_cb (TpRoomList *room_list,
     {
       gtk_spinner_stop (GTK_SPINNER (self->priv->throbber));
       gtk_widget_hide (self->priv->throbber);
-    }
-}
 
-static void
-new_chatroom_dialog_model_clear (EmpathyNewChatroomDialog *self)
-{
-  GtkListStore *store;
+      /* Listing is over */
+      flush_pending_rooms (self);
 
-  store = GTK_LIST_STORE (self->priv->model);
-  gtk_list_store_clear (store);
+      if (self->priv->listing_failed)
+        return;
+
+      /* Nothing was listed, so the cache is outdated too */
+      if (self->priv->rooms_from_cache)
+        new_chatroom_dialog_model_clear (self);
+      else
+        rooms_cache_cancel_load (self);
+
+      rooms_cache_save (self);
+    }
 }
 
 static void
 new_chatroom_dialog_browse_start (EmpathyNewChatroomDialog *self)
 {
   new_chatroom_dialog_model_clear (self);
+  self->priv->listing_failed = FALSE;
 
   if (self->priv->room_list != NULL)
-    tp_room_list_start (self->priv->room_list);
+    {
+      rooms_cache_load (self);
+      tp_room_list_start (self->priv->room_list);
+    }
 }
 
 static void
@@ -612,7 +972,8 @@ new_chatroom_dialog_entry_changed_cb (GtkWidget *entry,
     {
       update_join_button_sensitivity (self);
 
-      /* FIXME: Select the room in the list */
+      if (!self->priv->setting_room)
+        new_chatroom_dialog_filter_rooms (self);
     }
 }
 
@@ -707,8 +1068,18 @@ empathy_new_chatroom_dialog_dispose (GObject *object)
   void (*chain_up) (GObject *) =
       ((GObjectClass *) empathy_new_chatroom_dialog_parent_class)->dispose;
 
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  rooms_cache_cancel_load (self);
+
   g_clear_object (&self->priv->room_list);
   g_clear_object (&self->priv->model);
+  tp_clear_pointer (&self->priv->rooms, g_ptr_array_unref);
+  tp_clear_pointer (&self->priv->filter, g_free);
 
   if (self->priv->account != NULL)
     {
@@ -803,6 +1174,8 @@ empathy_new_chatroom_dialog_init (EmpathyNewChatroomDialog *self)
   g_object_unref (size_group);
 
   /* Set up chatrooms treeview */
+  self->priv->rooms = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) empathy_room_entry_free);
   new_chatroom_dialog_model_setup (self);
 
   /* Add throbber */
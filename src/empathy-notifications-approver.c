@@ -289,7 +289,6 @@ get_category_for_event_type (EmpathyEventType type)
 static void
 update_notification (EmpathyNotificationsApprover *self)
 {
-  GdkPixbuf *pixbuf = NULL;
   gchar *message_esc = NULL;
   gboolean has_x_canonical_append;
   NotifyNotification *notification;
@@ -367,18 +366,10 @@ update_notification (EmpathyNotificationsApprover *self)
         }
     }
 
-  pixbuf = empathy_notify_manager_get_pixbuf_for_notification (
-      self->priv->notify_mgr, self->priv->event->contact,
+  empathy_notify_manager_show_notification (self->priv->notify_mgr,
+      notification, self->priv->event->contact,
       self->priv->event->icon_name);
 
-  if (pixbuf != NULL)
-    {
-      notify_notification_set_image_from_pixbuf (notification, pixbuf);
-      g_object_unref (pixbuf);
-    }
-
-  notify_notification_show (notification, NULL);
-
   g_free (message_esc);
   g_object_unref (notification);
 }
@@ -0,0 +1,228 @@
+/*
+ * empathy-sparkline.c - Source for EmpathySparkline
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-sparkline.h"
+
+G_DEFINE_TYPE (EmpathySparkline, empathy_sparkline, GTK_TYPE_DRAWING_AREA)
+
+#define SPARKLINE_WIDTH 80
+#define SPARKLINE_HEIGHT 16
+
+enum {
+  PROP_N_SAMPLES = 1,
+};
+
+struct _EmpathySparklinePriv {
+  /* Ring buffer of the last n_samples values, oldest at first */
+  gdouble *samples;
+  guint n_samples;
+  guint first;
+  guint len;
+};
+
+static gdouble
+get_sample (EmpathySparkline *self,
+    guint i)
+{
+  return self->priv->samples[(self->priv->first + i) % self->priv->n_samples];
+}
+
+static gboolean
+empathy_sparkline_draw (GtkWidget *widget,
+    cairo_t *cr)
+{
+  EmpathySparkline *self = EMPATHY_SPARKLINE (widget);
+  GtkStyleContext *context;
+  GdkRGBA color;
+  gdouble max = 0, width, height, step;
+  guint i;
+
+  if (self->priv->len < 2)
+    return FALSE;
+
+  width = gtk_widget_get_allocated_width (widget);
+  height = gtk_widget_get_allocated_height (widget);
+
+  for (i = 0; i < self->priv->len; i++)
+    max = MAX (max, get_sample (self, i));
+
+  /* A flat line at the bottom when everything is zero */
+  if (max <= 0)
+    max = 1;
+
+  context = gtk_widget_get_style_context (widget);
+  gtk_style_context_get_color (context, gtk_widget_get_state_flags (widget),
+      &color);
+  gdk_cairo_set_source_rgba (cr, &color);
+  cairo_set_line_width (cr, 1);
+
+  /* Samples are right aligned so the line scrolls to the left */
+  step = width / (self->priv->n_samples - 1);
+
+  for (i = 0; i < self->priv->len; i++)
+    {
+      gdouble x, y;
+
+      x = width - (self->priv->len - 1 - i) * step;
+      y = height - 0.5 - (height - 1) * MAX (get_sample (self, i), 0) / max;
+
+      if (i == 0)
+        cairo_move_to (cr, x, y);
+      else
+        cairo_line_to (cr, x, y);
+    }
+
+  cairo_stroke (cr);
+
+  return FALSE;
+}
+
+static void
+empathy_sparkline_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathySparkline *self = EMPATHY_SPARKLINE (object);
+
+  switch (property_id)
+    {
+      case PROP_N_SAMPLES:
+        self->priv->n_samples = g_value_get_uint (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+empathy_sparkline_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathySparkline *self = EMPATHY_SPARKLINE (object);
+
+  switch (property_id)
+    {
+      case PROP_N_SAMPLES:
+        g_value_set_uint (value, self->priv->n_samples);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+empathy_sparkline_constructed (GObject *object)
+{
+  EmpathySparkline *self = EMPATHY_SPARKLINE (object);
+
+  self->priv->samples = g_new0 (gdouble, self->priv->n_samples);
+
+  G_OBJECT_CLASS (empathy_sparkline_parent_class)->constructed (object);
+}
+
+static void
+empathy_sparkline_finalize (GObject *object)
+{
+  EmpathySparkline *self = EMPATHY_SPARKLINE (object);
+
+  g_free (self->priv->samples);
+
+  G_OBJECT_CLASS (empathy_sparkline_parent_class)->finalize (object);
+}
+
+static void
+empathy_sparkline_init (EmpathySparkline *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_SPARKLINE, EmpathySparklinePriv);
+
+  gtk_widget_set_size_request (GTK_WIDGET (self), SPARKLINE_WIDTH,
+      SPARKLINE_HEIGHT);
+}
+
+static void
+empathy_sparkline_class_init (EmpathySparklineClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+  GParamSpec *param_spec;
+
+  g_type_class_add_private (klass, sizeof (EmpathySparklinePriv));
+
+  object_class->set_property = empathy_sparkline_set_property;
+  object_class->get_property = empathy_sparkline_get_property;
+  object_class->constructed = empathy_sparkline_constructed;
+  object_class->finalize = empathy_sparkline_finalize;
+
+  widget_class->draw = empathy_sparkline_draw;
+
+  param_spec = g_param_spec_uint ("n-samples",
+    "number of samples", "Number of samples shown by the sparkline",
+    2, G_MAXUINT, 60,
+    G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_N_SAMPLES, param_spec);
+}
+
+GtkWidget *
+empathy_sparkline_new (guint n_samples)
+{
+  return g_object_new (EMPATHY_TYPE_SPARKLINE,
+      "n-samples", n_samples,
+      NULL);
+}
+
+void
+empathy_sparkline_add_sample (EmpathySparkline *self,
+    gdouble value)
+{
+  EmpathySparklinePriv *priv;
+
+  g_return_if_fail (EMPATHY_IS_SPARKLINE (self));
+
+  priv = self->priv;
+
+  if (priv->len < priv->n_samples)
+    {
+      priv->samples[(priv->first + priv->len) % priv->n_samples] = value;
+      priv->len++;
+    }
+  else
+    {
+      /* Full, overwrite the oldest sample */
+      priv->samples[priv->first] = value;
+      priv->first = (priv->first + 1) % priv->n_samples;
+    }
+
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+void
+empathy_sparkline_clear (EmpathySparkline *self)
+{
+  g_return_if_fail (EMPATHY_IS_SPARKLINE (self));
+
+  self->priv->first = 0;
+  self->priv->len = 0;
+
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
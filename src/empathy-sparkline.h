@@ -0,0 +1,68 @@
+/*
+ * empathy-sparkline.h - Header for EmpathySparkline
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_SPARKLINE_H__
+#define __EMPATHY_SPARKLINE_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathySparkline EmpathySparkline;
+typedef struct _EmpathySparklineClass EmpathySparklineClass;
+typedef struct _EmpathySparklinePriv EmpathySparklinePriv;
+
+struct _EmpathySparklineClass {
+    GtkDrawingAreaClass parent_class;
+};
+
+struct _EmpathySparkline {
+    GtkDrawingArea parent;
+    EmpathySparklinePriv *priv;
+};
+
+GType empathy_sparkline_get_type (void);
+
+/* TYPE MACROS */
+#define EMPATHY_TYPE_SPARKLINE \
+  (empathy_sparkline_get_type ())
+#define EMPATHY_SPARKLINE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), EMPATHY_TYPE_SPARKLINE, \
+    EmpathySparkline))
+#define EMPATHY_SPARKLINE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), EMPATHY_TYPE_SPARKLINE, \
+    EmpathySparklineClass))
+#define EMPATHY_IS_SPARKLINE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), EMPATHY_TYPE_SPARKLINE))
+#define EMPATHY_IS_SPARKLINE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), EMPATHY_TYPE_SPARKLINE))
+#define EMPATHY_SPARKLINE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_SPARKLINE, \
+    EmpathySparklineClass))
+
+GtkWidget *empathy_sparkline_new (guint n_samples);
+
+void empathy_sparkline_add_sample (EmpathySparkline *self,
+    gdouble value);
+
+void empathy_sparkline_clear (EmpathySparkline *self);
+
+G_END_DECLS
+
+#endif /* #ifndef __EMPATHY_SPARKLINE_H__*/
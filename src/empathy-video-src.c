@@ -23,6 +23,8 @@
 
 #include <gst/video/colorbalance.h>
 
+#include "empathy-audio-utils.h"
+
 #define DEBUG_FLAG EMPATHY_DEBUG_VOIP
 #include "empathy-debug.h"
 
@@ -108,6 +110,34 @@ error:
   return NULL;
 }
 
+static GstElement *
+create_src (void)
+{
+  GstElement *src;
+  const gchar *description;
+
+  description = g_getenv ("EMPATHY_VIDEO_SRC");
+  if (description == NULL && empathy_call_use_test_sources ())
+    description = "videotestsrc is-live=true";
+
+  if (description != NULL)
+    {
+      GError *error = NULL;
+
+      src = gst_parse_bin_from_description (description, TRUE, &error);
+      if (src == NULL)
+        {
+          DEBUG ("Failed to create bin %s: %s", description, error->message);
+          g_error_free (error);
+        }
+
+      return src;
+    }
+
+  /* Use v4l2src as default */
+  return gst_element_factory_make ("v4l2src", NULL);
+}
+
 static GstPadProbeReturn
 empathy_video_src_drop_eos (GstPad *pad,
   GstPadProbeInfo *info,
@@ -135,9 +165,11 @@ empathy_video_src_init (EmpathyGstVideoSrc *obj)
     NULL);
 
   /* allocate any data required by the object here */
-  if ((element = empathy_gst_add_to_bin (GST_BIN (obj),
-      NULL, "v4l2src")) == NULL)
-    g_error ("Couldn't add \"v4l2src\" (gst-plugins-good missing?)");
+  if ((element = create_src ()) == NULL)
+    g_error ("Couldn't create video source (gst-plugins-good missing?)");
+
+  if (!gst_bin_add (GST_BIN (obj), element))
+    g_error ("Couldn't add video source to bin.");
 
   /* we need to save our source to priv->src */
   priv->src = element;
@@ -414,6 +446,10 @@ empathy_video_src_change_device (EmpathyGstVideoSrc *self,
 
   g_return_if_fail (state == GST_STATE_NULL);
 
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (priv->src),
+      "device") == NULL)
+    return;
+
   g_object_set (priv->src, "device", device, NULL);
 }
 
@@ -421,9 +457,11 @@ gchar *
 empathy_video_src_dup_device (EmpathyGstVideoSrc *self)
 {
   EmpathyGstVideoSrcPrivate *priv = EMPATHY_GST_VIDEO_SRC_GET_PRIVATE (self);
-  gchar *device;
+  gchar *device = NULL;
 
-  g_object_get (priv->src, "device", &device, NULL);
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (priv->src),
+      "device") != NULL)
+    g_object_get (priv->src, "device", &device, NULL);
 
   return device;
 }
@@ -0,0 +1,575 @@
+#include "config.h"
+
+#include <string.h>
+#include <tp-account-widgets/tpaw-time.h>
+
+#include "empathy-adium-template.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+#define N_MESSAGES 20000
+
+typedef struct
+{
+  const gchar *template;
+  const gchar *expected;
+} RenderTest;
+
+/* Rendered with the values of fill_values(), in UTC */
+static const RenderTest render_tests[] =
+  {
+    { "<div class=\"%messageClasses%\" dir=\"%messageDirection%\">\n"
+      "  <img src=\"%userIconPath%\"/>\n"
+      "  <span class=\"sender\" style=\"color: %senderColor%\">%sender%</span>\n"
+      "  <span class=\"time\">%time%</span>\n"
+      "  <p>%message%</p>\n"
+      "</div>\n"
+      "<div id=\"insert\"></div>",
+      "<div class=\\\"message incoming consecutive\\\" dir=\\\"ltr\\\">"
+      "  <img src=\\\"/tmp/avatar.png\\\"/>"
+      "  <span class=\\\"sender\\\" style=\\\"color: inherit\\\">Alice</span>"
+      "  <span class=\\\"time\\\">00:00</span>"
+      "  <p><div style=\\\"display: inline\\\">Hello \\\\o/ \\\"world\\\"</div>"
+      "</p>"
+      "</div>"
+      "<div id=\\\"insert\\\"></div>" },
+    { "<div class=\"%userIcons%\">%senderScreenName% (%service%) "
+      "%senderDisplayName%%senderPrefix% %shortTime%</div>",
+      "<div class=\\\"showIcons\\\">alice@example.com (Jabber) Alice 00:00"
+      "</div>" },
+    /* NSDateFormatter formats */
+    { "%time{y-M-d H:m:s}% %time{dd/MM/yyyy}%",
+      "2010-01-01 00:00:00 01/01/2010" },
+    /* Unsupported keywords are stripped */
+    { "a%senderStatusIcon%b%variant%c%status%d%textbackgroundcolor{0.5}%e",
+      "abcde" },
+    /* Things that are not keywords */
+    { "100% %foo% %% %time{ unterminated %message",
+      "100% %foo% %% %time{ unterminated %message" },
+    /* Things that must be escaped for JavaScript */
+    { "\"quoted\" \\back\\slash\\\"\n\nnew\nlines\"",
+      "\\\"quoted\\\" \\\\back\\\\slash\\\\\\\"newlines\\\"" },
+    { "", "" },
+  };
+
+static void
+fill_values (EmpathyAdiumTemplateValues *values,
+    gboolean outgoing)
+{
+  memset (values, 0, sizeof (EmpathyAdiumTemplateValues));
+
+  values->message = "<div style=\"display: inline\">Hello \\o/ \"world\"</div>";
+  values->avatar_filename = "/tmp/avatar.png";
+  values->name = "Alice";
+  values->contact_id = "alice@example.com";
+  values->service_name = "Jabber";
+  values->message_classes = "message incoming consecutive";
+  values->timestamp = 1262304000;
+  values->outgoing = outgoing;
+  values->show_avatars = TRUE;
+  values->direction = PANGO_DIRECTION_LTR;
+}
+
+/* The renderer from before templates were compiled, which rescans the
+ * template for each message. It's kept as a reference to check the compiled
+ * renderer against, and to measure it against. */
+static void
+reference_escape_and_append_len (GString *string, const gchar *str, gint len)
+{
+  while (str != NULL && *str != '\0' && len != 0)
+    {
+      switch (*str)
+        {
+          case '\\':
+            /* \ becomes \\ */
+            g_string_append (string, "\\\\");
+            break;
+          case '\"':
+            /* " becomes \" */
+            g_string_append (string, "\\\"");
+            break;
+          case '\n':
+            /* Remove end of lines */
+            break;
+          default:
+            g_string_append_c (string, *str);
+        }
+
+      str++;
+      len--;
+    }
+}
+
+static gboolean
+reference_match (const gchar **str,
+    const gchar *match)
+{
+  gint len;
+
+  len = strlen (match);
+  if (strncmp (*str, match, len) == 0)
+    {
+      *str += len - 1;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+reference_match_with_format (const gchar **str,
+    const gchar *match,
+    gchar **format)
+{
+  const gchar *cur = *str;
+  const gchar *end;
+
+  if (!reference_match (&cur, match))
+    return FALSE;
+
+  cur++;
+
+  end = strstr (cur, "}%");
+  if (!end)
+    return FALSE;
+
+  *format = g_strndup (cur , end - cur);
+  *str = end + 1;
+  return TRUE;
+}
+
+static const gchar *reference_colors[] = {
+  "aqua", "aquamarine", "blue", "blueviolet", "brown", "burlywood", "cadetblue",
+  "chartreuse", "chocolate", "coral", "cornflowerblue", "crimson", "cyan",
+  "darkblue", "darkcyan", "darkgoldenrod", "darkgreen", "darkgrey", "darkkhaki",
+  "darkmagenta", "darkolivegreen", "darkorange", "darkorchid", "darkred",
+  "darksalmon", "darkseagreen", "darkslateblue", "darkslategrey",
+  "darkturquoise", "darkviolet", "deeppink", "deepskyblue", "dimgrey",
+  "dodgerblue", "firebrick", "forestgreen", "fuchsia", "gold", "goldenrod",
+  "green", "greenyellow", "grey", "hotpink", "indianred", "indigo", "lawngreen",
+  "lightblue", "lightcoral",
+  "lightgreen", "lightgrey", "lightpink", "lightsalmon", "lightseagreen",
+  "lightskyblue", "lightslategrey", "lightsteelblue", "lime", "limegreen",
+  "magenta", "maroon", "mediumaquamarine", "mediumblue", "mediumorchid",
+  "mediumpurple", "mediumseagreen", "mediumslateblue", "mediumspringgreen",
+  "mediumturquoise", "mediumvioletred", "midnightblue", "navy", "olive",
+  "olivedrab", "orange", "orangered", "orchid", "palegreen", "paleturquoise",
+  "palevioletred", "peru", "pink", "plum", "powderblue", "purple", "red",
+  "rosybrown", "royalblue", "saddlebrown", "salmon", "sandybrown", "seagreen",
+  "sienna", "silver", "skyblue", "slateblue", "slategrey", "springgreen",
+  "steelblue", "tan", "teal", "thistle", "tomato", "turquoise", "violet",
+  "yellowgreen",
+};
+
+/* Converted formats, as the theme used to keep them */
+static GHashTable *reference_date_format_cache = NULL;
+
+static const gchar *
+reference_nsdate_to_strftime (const gchar *nsdate)
+{
+  static const gchar *convert_table[] = {
+    "a", "%p", // AM/PM
+    "A", NULL, // 0~86399999 (Millisecond of Day)
+
+    "cccc", "%A", // Sunday/Monday/Tuesday/Wednesday/Thursday/Friday/Saturday
+    "ccc", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+    "cc", "%u", // 1~7 (Day of Week)
+    "c", "%u", // 1~7 (Day of Week)
+
+    "dd", "%d", // 1~31 (0 padded Day of Month)
+    "d", "%d", // 1~31 (0 padded Day of Month)
+    "D", "%j", // 1~366 (0 padded Day of Year)
+
+    "e", "%u", // 1~7 (0 padded Day of Week)
+    "EEEE", "%A", // Sunday/Monday/Tuesday/Wednesday/Thursday/Friday/Saturday
+    "EEE", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+    "EE", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+    "E", "%a", // Sun/Mon/Tue/Wed/Thu/Fri/Sat
+
+    "F", NULL, // 1~5 (0 padded Week of Month, first day of week = Monday)
+
+    "g", NULL, // Julian Day Number (number of days since 4713 BC January 1)
+    "GGGG", NULL, // Before Christ/Anno Domini
+    "GGG", NULL, // BC/AD (Era Designator Abbreviated)
+    "GG", NULL, // BC/AD (Era Designator Abbreviated)
+    "G", NULL, // BC/AD (Era Designator Abbreviated)
+
+    "h", "%I", // 1~12 (0 padded Hour (12hr))
+    "H", "%H", // 0~23 (0 padded Hour (24hr))
+
+    "k", NULL, // 1~24 (0 padded Hour (24hr)
+    "K", NULL, // 0~11 (0 padded Hour (12hr))
+
+    "LLLL", "%B", // January/February/March/April/May/June/July/August/September/October/November/December
+    "LLL", "%b", // Jan/Feb/Mar/Apr/May/Jun/Jul/Aug/Sep/Oct/Nov/Dec
+    "LL", "%m", // 1~12 (0 padded Month)
+    "L", "%m", // 1~12 (0 padded Month)
+
+    "m", "%M", // 0~59 (0 padded Minute)
+    "MMMM", "%B", // January/February/March/April/May/June/July/August/September/October/November/December
+    "MMM", "%b", // Jan/Feb/Mar/Apr/May/Jun/Jul/Aug/Sep/Oct/Nov/Dec
+    "MM", "%m", // 1~12 (0 padded Month)
+    "M", "%m", // 1~12 (0 padded Month)
+
+    "qqqq", NULL, // 1st quarter/2nd quarter/3rd quarter/4th quarter
+    "qqq", NULL, // Q1/Q2/Q3/Q4
+    "qq", NULL, // 1~4 (0 padded Quarter)
+    "q", NULL, // 1~4 (0 padded Quarter)
+    "QQQQ", NULL, // 1st quarter/2nd quarter/3rd quarter/4th quarter
+    "QQQ", NULL, // Q1/Q2/Q3/Q4
+    "QQ", NULL, // 1~4 (0 padded Quarter)
+    "Q", NULL, // 1~4 (0 padded Quarter)
+
+    "s", "%S", // 0~59 (0 padded Second)
+    "S", NULL, // (rounded Sub-Second)
+
+    "u", "%Y", // (0 padded Year)
+
+    "vvvv", "%Z", // (General GMT Timezone Name)
+    "vvv", "%Z", // (General GMT Timezone Abbreviation)
+    "vv", "%Z", // (General GMT Timezone Abbreviation)
+    "v", "%Z", // (General GMT Timezone Abbreviation)
+
+    "w", "%W", // 1~53 (0 padded Week of Year, 1st day of week = Sunday, NB, 1st week of year starts from the last Sunday of last year)
+    "W", NULL, // 1~5 (0 padded Week of Month, 1st day of week = Sunday)
+
+    "yyyy", "%Y", // (Full Year)
+    "yyy", "%y", // (2 Digits Year)
+    "yy", "%y", // (2 Digits Year)
+    "y", "%Y", // (Full Year)
+    "YYYY", NULL, // (Full Year, starting from the Sunday of the 1st week of year)
+    "YYY", NULL, // (2 Digits Year, starting from the Sunday of the 1st week of year)
+    "YY", NULL, // (2 Digits Year, starting from the Sunday of the 1st week of year)
+    "Y", NULL, // (Full Year, starting from the Sunday of the 1st week of year)
+
+    "zzzz", NULL, // (Specific GMT Timezone Name)
+    "zzz", NULL, // (Specific GMT Timezone Abbreviation)
+    "zz", NULL, // (Specific GMT Timezone Abbreviation)
+    "z", NULL, // (Specific GMT Timezone Abbreviation)
+    "Z", "%z", // +0000 (RFC 822 Timezone)
+  };
+  const gchar *str;
+  GString *string;
+  guint i, j;
+
+  if (nsdate == NULL)
+    return NULL;
+
+  str = g_hash_table_lookup (reference_date_format_cache, nsdate);
+  if (str != NULL)
+    return str;
+
+  string = g_string_sized_new (strlen (nsdate));
+  for (i = 0; nsdate[i] != '\0'; i++)
+    {
+      gboolean found = FALSE;
+
+      for (j = 0; j < G_N_ELEMENTS (convert_table); j += 2)
+        {
+          if (g_str_has_prefix (nsdate + i, convert_table[j]))
+            {
+              found = TRUE;
+              break;
+            }
+        }
+
+      if (found)
+        {
+          if (convert_table[j + 1] != NULL)
+            g_string_append (string, convert_table[j + 1]);
+
+          i += strlen (convert_table[j]) - 1;
+        }
+      else
+        {
+          g_string_append_c (string, nsdate[i]);
+        }
+    }
+
+  /* The cache takes ownership of string->str */
+  g_hash_table_insert (reference_date_format_cache, g_strdup (nsdate),
+      string->str);
+  return g_string_free (string, FALSE);
+}
+
+static void
+reference_render (const gchar *html,
+    const EmpathyAdiumTemplateValues *values,
+    GString *string)
+{
+  const gchar *cur;
+
+  for (cur = html; *cur != '\0'; cur++)
+    {
+      const gchar *replace = NULL;
+      gchar *dup_replace = NULL;
+      gchar *format = NULL;
+
+      if (reference_match (&cur, "%userIconPath%"))
+        {
+          replace = values->avatar_filename;
+        }
+      else if (reference_match (&cur, "%senderScreenName%"))
+        {
+          replace = values->contact_id;
+        }
+      else if (reference_match (&cur, "%sender%"))
+        {
+          replace = values->name;
+        }
+      else if (reference_match (&cur, "%senderColor%"))
+        {
+          if (values->outgoing)
+            {
+              replace = "inherit";
+            }
+          else if (values->contact_id != NULL)
+            {
+              guint hash = g_str_hash (values->contact_id);
+              replace = reference_colors[hash %
+                  G_N_ELEMENTS (reference_colors)];
+            }
+        }
+      else if (reference_match (&cur, "%senderStatusIcon%"))
+        {
+        }
+      else if (reference_match (&cur, "%messageDirection%"))
+        {
+          switch (values->direction)
+            {
+              case PANGO_DIRECTION_LTR:
+              case PANGO_DIRECTION_TTB_LTR:
+              case PANGO_DIRECTION_WEAK_LTR:
+                replace = "ltr";
+                break;
+              case PANGO_DIRECTION_RTL:
+              case PANGO_DIRECTION_TTB_RTL:
+              case PANGO_DIRECTION_WEAK_RTL:
+                replace = "rtl";
+                break;
+              case PANGO_DIRECTION_NEUTRAL:
+              default:
+                break;
+            }
+        }
+      else if (reference_match (&cur, "%senderDisplayName%"))
+        {
+          replace = values->name;
+        }
+      else if (reference_match (&cur, "%senderPrefix%"))
+        {
+        }
+      else if (reference_match_with_format (&cur, "%textbackgroundcolor{",
+            &format))
+        {
+        }
+      else if (reference_match (&cur, "%message%"))
+        {
+          replace = values->message;
+        }
+      else if (reference_match (&cur, "%time%") ||
+           reference_match_with_format (&cur, "%time{", &format))
+        {
+          const gchar *strftime_format;
+
+          strftime_format = reference_nsdate_to_strftime (format);
+          if (values->is_backlog)
+            dup_replace = tpaw_time_to_string_local (values->timestamp,
+              strftime_format ? strftime_format :
+              TPAW_TIME_DATE_FORMAT_DISPLAY_SHORT);
+          else
+            dup_replace = tpaw_time_to_string_local (values->timestamp,
+              strftime_format ? strftime_format :
+              TPAW_TIME_FORMAT_DISPLAY_SHORT);
+
+          replace = dup_replace;
+        }
+      else if (reference_match (&cur, "%shortTime%"))
+        {
+          dup_replace = tpaw_time_to_string_local (values->timestamp,
+            TPAW_TIME_FORMAT_DISPLAY_SHORT);
+          replace = dup_replace;
+        }
+      else if (reference_match (&cur, "%service%"))
+        {
+          replace = values->service_name;
+        }
+      else if (reference_match (&cur, "%variant%"))
+        {
+        }
+      else if (reference_match (&cur, "%userIcons%"))
+        {
+          replace = values->show_avatars ? "showIcons" : "hideIcons";
+        }
+      else if (reference_match (&cur, "%messageClasses%"))
+        {
+          replace = values->message_classes;
+        }
+      else if (reference_match (&cur, "%status%"))
+        {
+        }
+      else
+        {
+          reference_escape_and_append_len (string, cur, 1);
+          continue;
+        }
+
+      reference_escape_and_append_len (string, replace, -1);
+
+      g_free (dup_replace);
+      g_free (format);
+    }
+}
+
+static void
+test_render (void)
+{
+  EmpathyAdiumTemplateValues values;
+  guint i;
+
+  /* Senders are outgoing so %senderColor% is deterministic */
+  fill_values (&values, TRUE);
+
+  for (i = 0; i < G_N_ELEMENTS (render_tests); i++)
+    {
+      EmpathyAdiumTemplate *tmpl;
+      GString *result;
+
+      tmpl = empathy_adium_template_new (render_tests[i].template);
+
+      result = g_string_new (NULL);
+      empathy_adium_template_render (tmpl, &values, result);
+
+      DEBUG ("'%s' => '%s'", render_tests[i].template, result->str);
+      g_assert_cmpstr (result->str, ==, render_tests[i].expected);
+
+      /* The reference renderer agrees */
+      g_string_truncate (result, 0);
+      reference_render (render_tests[i].template, &values, result);
+      g_assert_cmpstr (result->str, ==, render_tests[i].expected);
+
+      g_string_free (result, TRUE);
+      empathy_adium_template_free (tmpl);
+    }
+}
+
+static void
+test_render_sender_color (void)
+{
+  EmpathyAdiumTemplateValues values;
+  EmpathyAdiumTemplate *tmpl;
+  GString *first, *second;
+
+  fill_values (&values, FALSE);
+  tmpl = empathy_adium_template_new ("%senderColor%");
+
+  first = g_string_new (NULL);
+  empathy_adium_template_render (tmpl, &values, first);
+  g_assert_cmpuint (first->len, >, 0);
+  g_assert_cmpstr (first->str, !=, "inherit");
+
+  /* It's the color the theme used to pick */
+  second = g_string_new (NULL);
+  reference_render ("%senderColor%", &values, second);
+  g_assert_cmpstr (first->str, ==, second->str);
+  g_string_free (second, TRUE);
+
+  /* The same contact always gets the same color */
+  second = g_string_new (NULL);
+  empathy_adium_template_render (tmpl, &values, second);
+  g_assert_cmpstr (first->str, ==, second->str);
+
+  g_string_free (first, TRUE);
+  g_string_free (second, TRUE);
+  empathy_adium_template_free (tmpl);
+}
+
+static void
+test_render_null (void)
+{
+  EmpathyAdiumTemplateValues values;
+  EmpathyAdiumTemplate *tmpl;
+  GString *result;
+
+  fill_values (&values, TRUE);
+  tmpl = empathy_adium_template_new (NULL);
+
+  result = g_string_new (NULL);
+  empathy_adium_template_render (tmpl, &values, result);
+  g_assert_cmpuint (result->len, ==, 0);
+
+  g_string_free (result, TRUE);
+  empathy_adium_template_free (tmpl);
+}
+
+static void
+test_render_perf (void)
+{
+  EmpathyAdiumTemplateValues values;
+  EmpathyAdiumTemplate *tmpl;
+  GString *string;
+  gdouble reference_time, compiled_time;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  fill_values (&values, TRUE);
+  string = g_string_sized_new (4096);
+
+  g_test_timer_start ();
+  for (i = 0; i < N_MESSAGES; i++)
+    {
+      g_string_truncate (string, 0);
+      reference_render (render_tests[0].template, &values, string);
+    }
+  reference_time = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  tmpl = empathy_adium_template_new (render_tests[0].template);
+  for (i = 0; i < N_MESSAGES; i++)
+    {
+      g_string_truncate (string, 0);
+      empathy_adium_template_render (tmpl, &values, string);
+    }
+  compiled_time = g_test_timer_elapsed ();
+
+  g_test_maximized_result (N_MESSAGES / reference_time,
+      "reference renderer: %u messages in %.3f s", N_MESSAGES,
+      reference_time);
+  g_test_maximized_result (N_MESSAGES / compiled_time,
+      "compiled renderer: %u messages in %.3f s", N_MESSAGES, compiled_time);
+
+  g_string_free (string, TRUE);
+  empathy_adium_template_free (tmpl);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  /* The expected times are in UTC */
+  g_setenv ("TZ", "UTC", TRUE);
+
+  test_init (argc, argv);
+
+  reference_date_format_cache = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, g_free);
+
+  g_test_add_func ("/adium-template/render", test_render);
+  g_test_add_func ("/adium-template/render-sender-color",
+      test_render_sender_color);
+  g_test_add_func ("/adium-template/render-null", test_render_null);
+  g_test_add_func ("/adium-template/render-perf", test_render_perf);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  g_hash_table_unref (reference_date_format_cache);
+
+  return result;
+}
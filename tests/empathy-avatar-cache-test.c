@@ -0,0 +1,188 @@
+#include "config.h"
+
+#include "empathy-avatar-cache.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* Avatars are decoded at that size, in RGBA */
+#define SIZE 32
+#define PIXBUF_SIZE (SIZE * SIZE * 4)
+
+static gchar *png_data = NULL;
+static gsize png_len = 0;
+
+static void
+create_png (void)
+{
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 2 * SIZE, 2 * SIZE);
+  gdk_pixbuf_fill (pixbuf, 0x336699ff);
+
+  g_assert (gdk_pixbuf_save_to_buffer (pixbuf, &png_data, &png_len, "png",
+        &error, NULL));
+  g_assert_no_error (error);
+
+  g_object_unref (pixbuf);
+}
+
+static void
+load_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GdkPixbuf **pixbuf = user_data;
+  GError *error = NULL;
+
+  *pixbuf = empathy_avatar_cache_load_finish (result, &error);
+  g_assert_no_error (error);
+}
+
+static GdkPixbuf *
+load_sync (const gchar *source)
+{
+  GdkPixbuf *pixbuf = NULL;
+
+  empathy_avatar_cache_load_data_async (source, (guchar *) png_data, png_len,
+      SIZE, SIZE, FALSE, NULL, load_cb, &pixbuf);
+
+  while (pixbuf == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (gdk_pixbuf_get_width (pixbuf), ==, SIZE);
+  g_assert_cmpint (gdk_pixbuf_get_height (pixbuf), ==, SIZE);
+
+  return pixbuf;
+}
+
+static void
+load (const gchar *source)
+{
+  g_object_unref (load_sync (source));
+}
+
+static gboolean
+is_cached (const gchar *source)
+{
+  GdkPixbuf *pixbuf;
+
+  pixbuf = empathy_avatar_cache_lookup (source, SIZE, SIZE, FALSE);
+  if (pixbuf == NULL)
+    return FALSE;
+
+  g_object_unref (pixbuf);
+  return TRUE;
+}
+
+static void
+test_avatar_cache_lru (void)
+{
+  /* Start from an empty cache */
+  empathy_avatar_cache_set_budget (0);
+  empathy_avatar_cache_set_budget (3 * PIXBUF_SIZE);
+
+  load ("a");
+  load ("b");
+  load ("c");
+  g_assert_cmpuint (empathy_avatar_cache_get_size (), ==, 3 * PIXBUF_SIZE);
+
+  /* a is now the most recently used, so b is evicted first */
+  g_assert (is_cached ("a"));
+  load ("d");
+  g_assert_cmpuint (empathy_avatar_cache_get_size (), ==, 3 * PIXBUF_SIZE);
+
+  g_assert (!is_cached ("b"));
+
+  /* Looked up in that order, c is now the least recently used */
+  g_assert (is_cached ("c"));
+  g_assert (is_cached ("a"));
+  g_assert (is_cached ("d"));
+
+  /* Shrinking the budget evicts right away */
+  empathy_avatar_cache_set_budget (2 * PIXBUF_SIZE);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (), ==, 2 * PIXBUF_SIZE);
+
+  g_assert (!is_cached ("c"));
+  g_assert (is_cached ("a"));
+  g_assert (is_cached ("d"));
+
+  /* Sizes are part of the key */
+  g_assert (empathy_avatar_cache_lookup ("a", 2 * SIZE, 2 * SIZE,
+        FALSE) == NULL);
+}
+
+static void
+test_avatar_cache_budget (void)
+{
+  GdkPixbuf *pixbuf;
+
+  empathy_avatar_cache_set_budget (0);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (), ==, 0);
+
+  /* Too big to be cached at all, but still decoded */
+  empathy_avatar_cache_set_budget (PIXBUF_SIZE - 1);
+  pixbuf = load_sync ("big");
+  g_assert (!is_cached ("big"));
+  g_assert_cmpuint (empathy_avatar_cache_get_size (), ==, 0);
+  g_object_unref (pixbuf);
+
+  /* Without a source, the cache is bypassed */
+  empathy_avatar_cache_set_budget (2 * PIXBUF_SIZE);
+  pixbuf = load_sync (NULL);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (), ==, 0);
+  g_object_unref (pixbuf);
+}
+
+static void
+test_avatar_cache_shared (void)
+{
+  GdkPixbuf *first = NULL, *second = NULL, *third;
+
+  empathy_avatar_cache_set_budget (0);
+  empathy_avatar_cache_set_budget (2 * PIXBUF_SIZE);
+
+  /* Requested twice before the first decode is done: decoded once */
+  empathy_avatar_cache_load_data_async ("shared", (guchar *) png_data,
+      png_len, SIZE, SIZE, FALSE, NULL, load_cb, &first);
+  empathy_avatar_cache_load_data_async ("shared", (guchar *) png_data,
+      png_len, SIZE, SIZE, FALSE, NULL, load_cb, &second);
+
+  while (first == NULL || second == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert (first == second);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (), ==, PIXBUF_SIZE);
+
+  /* And then served from the cache */
+  third = load_sync ("shared");
+  g_assert (third == first);
+
+  g_object_unref (first);
+  g_object_unref (second);
+  g_object_unref (third);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  create_png ();
+
+  g_test_add_func ("/avatar-cache/lru", test_avatar_cache_lru);
+  g_test_add_func ("/avatar-cache/budget", test_avatar_cache_budget);
+  g_test_add_func ("/avatar-cache/shared", test_avatar_cache_shared);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  g_free (png_data);
+
+  return result;
+}
@@ -0,0 +1,181 @@
+#include "config.h"
+
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* Number of DEBUG() calls timed by each benchmark */
+#define N_MESSAGES 100000
+
+static void
+count_debug_log_func (const gchar *log_domain,
+    GLogLevelFlags log_level,
+    const gchar *message,
+    gpointer user_data)
+{
+  guint *count = user_data;
+
+  (*count)++;
+}
+
+/* Reference copy of what DEBUG() used to do, for comparison: the message
+ * was always formatted and handed to the debug sender, which was looked up
+ * each time, along with the domain of the flag. libempathy logs to the
+ * "empathy" domain. */
+static GHashTable *reference_flag_to_keys = NULL;
+
+static void
+reference_debug (EmpathyDebugFlags flag,
+    const gchar *format,
+    ...)
+{
+  TpDebugSender *sender;
+  gchar *message, *domain;
+  GTimeVal now;
+  va_list args;
+
+  va_start (args, format);
+  message = g_strdup_vprintf (format, args);
+  va_end (args);
+
+  sender = tp_debug_sender_dup ();
+
+  g_get_current_time (&now);
+
+  domain = g_strdup_printf ("empathy/%s",
+      (const gchar *) g_hash_table_lookup (reference_flag_to_keys,
+        GUINT_TO_POINTER (flag)));
+
+  tp_debug_sender_add_message (sender, &now, domain, G_LOG_LEVEL_DEBUG,
+      message);
+
+  g_free (domain);
+  g_object_unref (sender);
+
+  if (empathy_debug_flag_is_set (flag))
+    g_log ("empathy", G_LOG_LEVEL_DEBUG, "%s", message);
+
+  g_free (message);
+}
+
+static gdouble
+time_debug_messages (guint *logged)
+{
+  gdouble elapsed;
+  guint handler, i;
+
+  *logged = 0;
+  handler = g_log_set_handler ("empathy", G_LOG_LEVEL_DEBUG,
+      count_debug_log_func, logged);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < N_MESSAGES; i++)
+    DEBUG ("message %u from %s to %s", i, "alice@example.com",
+        "bob@example.com");
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_log_remove_handler ("empathy", handler);
+
+  return elapsed;
+}
+
+/* The old DEBUG(), with nobody listening either */
+static void
+test_debug_reference (void)
+{
+  gdouble elapsed;
+  guint handler, logged = 0, i;
+
+  if (empathy_debug_is_enabled (DEBUG_FLAG))
+    {
+      g_test_message ("Debugging already enabled, skipping");
+      return;
+    }
+
+  handler = g_log_set_handler ("empathy", G_LOG_LEVEL_DEBUG,
+      count_debug_log_func, &logged);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < N_MESSAGES; i++)
+    reference_debug (DEBUG_FLAG, "%s: message %u from %s to %s", G_STRFUNC,
+        i, "alice@example.com", "bob@example.com");
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_log_remove_handler ("empathy", handler);
+
+  g_assert_cmpuint (logged, ==, 0);
+
+  g_test_minimized_result (elapsed / N_MESSAGES * 1e9,
+      "Old DEBUG(): %.1f ns per message", elapsed / N_MESSAGES * 1e9);
+}
+
+/* Nobody listens: messages are not even formatted */
+static void
+test_debug_disabled (void)
+{
+  gdouble elapsed;
+  guint logged;
+
+  if (empathy_debug_is_enabled (DEBUG_FLAG))
+    {
+      g_test_message ("Debugging already enabled, skipping");
+      return;
+    }
+
+  elapsed = time_debug_messages (&logged);
+  g_assert_cmpuint (logged, ==, 0);
+
+  g_test_minimized_result (elapsed / N_MESSAGES * 1e9,
+      "Disabled DEBUG(): %.1f ns per message", elapsed / N_MESSAGES * 1e9);
+}
+
+/* The flag is set: messages are formatted and logged */
+static void
+test_debug_enabled (void)
+{
+  gdouble elapsed;
+  guint logged;
+
+  empathy_debug_set_flags ("Tests");
+  g_assert (empathy_debug_is_enabled (DEBUG_FLAG));
+
+  elapsed = time_debug_messages (&logged);
+  g_assert_cmpuint (logged, ==, N_MESSAGES);
+
+  g_test_minimized_result (elapsed / N_MESSAGES * 1e9,
+      "Enabled DEBUG(): %.1f ns per message", elapsed / N_MESSAGES * 1e9);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  reference_flag_to_keys = g_hash_table_new (g_direct_hash, g_direct_equal);
+  g_hash_table_insert (reference_flag_to_keys,
+      GUINT_TO_POINTER (EMPATHY_DEBUG_TESTS), "Tests");
+
+  /* The disabled cases must run first, flags can't be unset */
+  g_test_add_func ("/debug/reference", test_debug_reference);
+  g_test_add_func ("/debug/disabled", test_debug_disabled);
+#ifdef ENABLE_DEBUG
+  g_test_add_func ("/debug/enabled", test_debug_enabled);
+#endif
+
+  result = g_test_run ();
+
+  empathy_debug_free ();
+  test_deinit ();
+
+  g_hash_table_unref (reference_flag_to_keys);
+
+  return result;
+}
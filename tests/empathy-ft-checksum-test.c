@@ -0,0 +1,252 @@
+#include "config.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "empathy-ft-checksum.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* Size of the file hashed by the benchmark */
+#define PERF_FILE_SIZE (G_GUINT64_CONSTANT (2) * 1024 * 1024 * 1024)
+
+static GFile *
+create_file (guint64 size,
+    GChecksumType type,
+    gchar **expected)
+{
+  GFileIOStream *iostream;
+  GOutputStream *output;
+  GChecksum *checksum = NULL;
+  GFile *file;
+  guchar block[64 * 1024];
+  guint64 written = 0;
+  guint i;
+
+  for (i = 0; i < sizeof (block); i++)
+    block[i] = (guchar) (i * 31 + i / 251);
+
+  file = g_file_new_tmp ("empathy-ft-checksum-XXXXXX", &iostream, NULL);
+  g_assert (file != NULL);
+  output = g_io_stream_get_output_stream (G_IO_STREAM (iostream));
+
+  if (expected != NULL)
+    checksum = g_checksum_new (type);
+
+  while (written < size)
+    {
+      gsize len = MIN (sizeof (block), size - written);
+
+      /* Vary the content so a block misplaced by the reader is noticed */
+      block[0] = (guchar) (written / sizeof (block));
+
+      g_assert (g_output_stream_write_all (output, block, len, NULL, NULL,
+            NULL));
+
+      if (checksum != NULL)
+        g_checksum_update (checksum, block, len);
+
+      written += len;
+    }
+
+  g_assert (g_io_stream_close (G_IO_STREAM (iostream), NULL, NULL));
+  g_object_unref (iostream);
+
+  if (checksum != NULL)
+    {
+      *expected = g_strdup (g_checksum_get_string (checksum));
+      g_checksum_free (checksum);
+    }
+
+  return file;
+}
+
+static void
+progress_cb (guint64 current_bytes,
+    gpointer user_data)
+{
+  guint64 *last = user_data;
+
+  g_assert_cmpuint (current_bytes, >=, *last);
+  *last = current_bytes;
+}
+
+static void
+test_checksum_file (void)
+{
+  guint64 sizes[] = { 0, 1, 4095, 256 * 1024, 256 * 1024 + 1,
+      3 * 1024 * 1024 + 17 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      GChecksum *checksum;
+      GFile *file;
+      gchar *expected;
+      guint64 last = 0;
+
+      file = create_file (sizes[i], G_CHECKSUM_MD5, &expected);
+      checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+      g_assert (empathy_ft_checksum_file (file, checksum, NULL, progress_cb,
+            &last, NULL));
+      g_assert_cmpstr (g_checksum_get_string (checksum), ==, expected);
+
+      /* The last report is always the whole file */
+      g_assert_cmpuint (last, ==, sizes[i]);
+
+      g_checksum_free (checksum);
+      g_file_delete (file, NULL, NULL);
+      g_object_unref (file);
+      g_free (expected);
+    }
+}
+
+typedef struct {
+  GOutputStream *output;
+  GChecksum *expected;
+  guint chunks_left;
+  guint waits;
+} FollowData;
+
+/* Simulates a transfer: each time the reader catches up, more data arrives */
+static gboolean
+follow_wait_cb (guint64 current_bytes,
+    gpointer user_data)
+{
+  FollowData *data = user_data;
+  guchar chunk[4096];
+  gsize len;
+
+  data->waits++;
+
+  if (data->chunks_left == 0)
+    return FALSE;
+
+  /* Chunks of varying size */
+  len = 400 * data->chunks_left + 1;
+  memset (chunk, data->chunks_left, len);
+
+  g_assert (g_output_stream_write_all (data->output, chunk, len, NULL, NULL,
+        NULL));
+  g_assert (g_output_stream_flush (data->output, NULL, NULL));
+  g_checksum_update (data->expected, chunk, len);
+
+  data->chunks_left--;
+
+  return TRUE;
+}
+
+static void
+test_checksum_file_follow (void)
+{
+  GFileIOStream *iostream;
+  GChecksum *checksum;
+  FollowData data;
+  GFile *file;
+
+  file = g_file_new_tmp ("empathy-ft-checksum-XXXXXX", &iostream, NULL);
+  g_assert (file != NULL);
+
+  data.output = g_io_stream_get_output_stream (G_IO_STREAM (iostream));
+  data.expected = g_checksum_new (G_CHECKSUM_SHA1);
+  data.chunks_left = 10;
+  data.waits = 0;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_assert (empathy_ft_checksum_file_full (file, checksum, NULL, NULL,
+        follow_wait_cb, &data, NULL));
+
+  g_assert_cmpstr (g_checksum_get_string (checksum), ==,
+      g_checksum_get_string (data.expected));
+  g_assert_cmpuint (data.waits, ==, 11);
+
+  g_io_stream_close (G_IO_STREAM (iostream), NULL, NULL);
+  g_object_unref (iostream);
+  g_checksum_free (checksum);
+  g_checksum_free (data.expected);
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+}
+
+static void
+test_checksum_file_missing (void)
+{
+  GChecksum *checksum;
+  GFile *file;
+  GError *error = NULL;
+
+  file = g_file_new_for_path ("/nonexistent/empathy-ft-checksum-test");
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+  g_assert (!empathy_ft_checksum_file (file, checksum, NULL, NULL, NULL,
+        &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+
+  g_clear_error (&error);
+  g_checksum_free (checksum);
+  g_object_unref (file);
+}
+
+static void
+test_checksum_file_perf (void)
+{
+  struct {
+    GChecksumType type;
+    const gchar *name;
+  } types[] = {
+    { G_CHECKSUM_MD5, "MD5" },
+    { G_CHECKSUM_SHA1, "SHA1" },
+    { G_CHECKSUM_SHA256, "SHA256" },
+  };
+  GFile *file;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  file = create_file (PERF_FILE_SIZE, G_CHECKSUM_MD5, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (types); i++)
+    {
+      GChecksum *checksum;
+      gdouble elapsed, mb;
+
+      checksum = g_checksum_new (types[i].type);
+
+      g_test_timer_start ();
+      g_assert (empathy_ft_checksum_file (file, checksum, NULL, NULL, NULL,
+            NULL));
+      elapsed = g_test_timer_elapsed ();
+
+      mb = PERF_FILE_SIZE / (1024.0 * 1024.0);
+      g_test_maximized_result (mb / elapsed, "%s: %.0f MB in %.3f s, %.1f MB/s",
+          types[i].name, mb, elapsed, mb / elapsed);
+
+      g_checksum_free (checksum);
+    }
+
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/ft-checksum/file", test_checksum_file);
+  g_test_add_func ("/ft-checksum/file-follow", test_checksum_file_follow);
+  g_test_add_func ("/ft-checksum/file-missing", test_checksum_file_missing);
+  g_test_add_func ("/ft-checksum/file-perf", test_checksum_file_perf);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
@@ -5,6 +5,9 @@
 #include <string.h>
 #include <tp-account-widgets/tpaw-live-search.h>
 
+#include "empathy-ui-utils.h"
+#include "empathy-utils.h"
+#include "mock-tp-chat.h"
 #include "test-helper.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_TESTS
@@ -68,6 +71,87 @@ test_live_search (void)
     }
 }
 
+static void
+dup_contact_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpContact **contact = user_data;
+  GError *error = NULL;
+
+  *contact = tp_connection_dup_contact_by_id_finish (TP_CONNECTION (source),
+      result, &error);
+  g_assert_no_error (error);
+}
+
+/* empathy_individual_match_string() and the tokens the views keep for each
+ * individual must always agree */
+static void
+test_live_search_individual (void)
+{
+  LiveSearchTest tests[] =
+    {
+      /* Alias, which is the identifier here */
+      { NULL, "ali", TRUE },
+      { NULL, "exam", TRUE },
+      { NULL, "ALICE com", TRUE },
+      { NULL, "lice", FALSE },
+
+      /* Full prefix of the identifier */
+      { NULL, "alice@exa", TRUE },
+      { NULL, "alice@example.com", TRUE },
+      { NULL, "alice@example.org", FALSE },
+
+      { NULL, "bob", FALSE },
+      { NULL, "", TRUE },
+
+      { NULL, NULL, FALSE }
+    };
+  MockTpChat *mock;
+  TpContact *contact = NULL;
+  FolksIndividual *individual;
+  EmpathyIndividualTokens *tokens;
+  guint i;
+
+  mock = mock_tp_chat_new ();
+
+  tp_connection_dup_contact_by_id_async (mock->connection,
+      "alice@example.com", 0, NULL, dup_contact_cb, &contact);
+
+  while (contact == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  individual = empathy_ensure_individual_from_tp_contact (contact);
+  g_assert (individual != NULL);
+
+  tokens = empathy_individual_tokens_new (individual);
+
+  for (i = 0; tests[i].prefix != NULL; i++)
+    {
+      GPtrArray *words;
+      gboolean match;
+
+      words = tpaw_live_search_strip_utf8_string (tests[i].prefix);
+      match = empathy_individual_match_string (individual, tests[i].prefix,
+          words);
+
+      DEBUG ("'%s' %s", tests[i].prefix,
+          tests[i].should_match ? "should match" : "should NOT match");
+
+      g_assert_cmpint (match, ==, tests[i].should_match);
+      g_assert_cmpint (empathy_individual_tokens_match (tokens,
+            tests[i].prefix, words), ==, match);
+
+      if (words != NULL)
+        g_ptr_array_unref (words);
+    }
+
+  empathy_individual_tokens_free (tokens);
+  g_object_unref (individual);
+  g_object_unref (contact);
+  mock_tp_chat_free (mock);
+}
+
 int
 main (int argc,
     char **argv)
@@ -77,6 +161,7 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/live-search", test_live_search);
+  g_test_add_func ("/live-search/individual", test_live_search_individual);
 
   result = g_test_run ();
   test_deinit ();
@@ -0,0 +1,292 @@
+#include "config.h"
+
+#include "empathy-client-factory.h"
+#include "empathy-log-index.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+#define ACCOUNT_PATH TP_ACCOUNT_OBJECT_PATH_BASE "gabble/jabber/test0"
+/* How the logger names the directory of the account */
+#define ACCOUNT_DIR "gabble_jabber_test0"
+
+static gchar *data_dir = NULL;
+
+static TpAccount *
+dup_account (void)
+{
+  TpSimpleClientFactory *factory;
+  TpAccount *account;
+  GError *error = NULL;
+
+  factory = TP_SIMPLE_CLIENT_FACTORY (empathy_client_factory_dup ());
+  account = tp_simple_client_factory_ensure_account (factory, ACCOUNT_PATH,
+      NULL, &error);
+  g_assert_no_error (error);
+
+  g_object_unref (factory);
+
+  return account;
+}
+
+/* Logs a message with @id, the way the logger would */
+static void
+write_log (const gchar *id)
+{
+  gchar *dir, *file;
+  GError *error = NULL;
+
+  dir = g_build_filename (data_dir, "TpLogger", "logs", ACCOUNT_DIR, id,
+      NULL);
+  g_assert_cmpint (g_mkdir_with_parents (dir, 0700), ==, 0);
+
+  file = g_build_filename (dir, "20130101.log", NULL);
+  g_file_set_contents (file,
+      "<?xml version='1.0' encoding='utf-8'?>\n"
+      "<?xml-stylesheet type=\"text/xsl\" href=\"log-store-xml.xsl\"?>\n"
+      "<log>\n"
+      "<message time='20130101T10:00:00' id='me@example.com' name='Me' "
+      "token='' isuser='true' type='normal'>hello</message>\n"
+      "</log>\n", -1, &error);
+  g_assert_no_error (error);
+
+  g_free (file);
+  g_free (dir);
+}
+
+static void
+changed_cb (EmpathyLogIndex *log_index,
+    TpAccount *account,
+    const gchar *entity_id,
+    guint *n_changed)
+{
+  (*n_changed)++;
+}
+
+/* Returns whether there are logs for @id, waiting for the index to find out
+ * if it doesn't know */
+static gboolean
+lookup_sync (EmpathyLogIndex *log_index,
+    TpAccount *account,
+    const gchar *id)
+{
+  TplEntity *entity;
+  gboolean exists;
+  guint n_changed = 0;
+  gulong changed_id;
+
+  entity = tpl_entity_new (id, TPL_ENTITY_CONTACT, NULL, NULL);
+  changed_id = g_signal_connect (log_index, "changed",
+      G_CALLBACK (changed_cb), &n_changed);
+
+  while (!empathy_log_index_lookup (log_index, account, entity,
+        TPL_EVENT_MASK_TEXT, &exists))
+    {
+      guint n = n_changed;
+
+      while (n_changed == n)
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+  g_signal_handler_disconnect (log_index, changed_id);
+  g_object_unref (entity);
+
+  return exists;
+}
+
+static void
+exists_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  gint *exists = user_data;
+  GError *error = NULL;
+
+  *exists = empathy_log_index_exists_finish (EMPATHY_LOG_INDEX (source),
+      result, &error);
+  g_assert_no_error (error);
+}
+
+static gboolean
+exists_sync (EmpathyLogIndex *log_index,
+    TpAccount *account,
+    const gchar *id)
+{
+  TplEntity *entity;
+  gint exists = -1;
+
+  entity = tpl_entity_new (id, TPL_ENTITY_CONTACT, NULL, NULL);
+
+  empathy_log_index_exists_async (log_index, account, entity,
+      TPL_EVENT_MASK_TEXT, exists_cb, &exists);
+
+  while (exists == -1)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_object_unref (entity);
+
+  return exists;
+}
+
+static void
+test_log_index_lookup (void)
+{
+  EmpathyLogIndex *log_index;
+  TpAccount *account;
+  TplEntity *entity;
+  gboolean exists;
+
+  log_index = empathy_log_index_dup_singleton ();
+  account = dup_account ();
+
+  write_log ("alice@example.com");
+
+  /* Not known yet */
+  entity = tpl_entity_new ("alice@example.com", TPL_ENTITY_CONTACT, NULL,
+      NULL);
+  g_assert (!empathy_log_index_lookup (log_index, account, entity,
+        TPL_EVENT_MASK_TEXT, &exists));
+  g_object_unref (entity);
+
+  g_assert (lookup_sync (log_index, account, "alice@example.com"));
+  g_assert (!lookup_sync (log_index, account, "bob@example.com"));
+
+  /* Answered from the cache, without noticing new logs */
+  write_log ("bob@example.com");
+  g_assert (!exists_sync (log_index, account, "bob@example.com"));
+
+  g_object_unref (account);
+  g_object_unref (log_index);
+}
+
+static void
+test_log_index_invalidate (void)
+{
+  EmpathyLogIndex *log_index;
+  TpAccount *account;
+
+  log_index = empathy_log_index_dup_singleton ();
+  account = dup_account ();
+
+  g_assert (!exists_sync (log_index, account, "carol@example.com"));
+  g_assert (!exists_sync (log_index, account, "dave@example.com"));
+
+  write_log ("carol@example.com");
+  write_log ("dave@example.com");
+
+  empathy_log_index_invalidate (log_index, account, "carol@example.com");
+
+  g_assert (exists_sync (log_index, account, "carol@example.com"));
+  g_assert (!exists_sync (log_index, account, "dave@example.com"));
+
+  /* Everything */
+  empathy_log_index_invalidate (log_index, NULL, NULL);
+
+  g_assert (lookup_sync (log_index, account, "dave@example.com"));
+
+  g_object_unref (account);
+  g_object_unref (log_index);
+}
+
+static void
+test_log_index_prefetch (void)
+{
+  EmpathyLogIndex *log_index;
+  TpAccount *account;
+  TplEntity *entity;
+  gboolean exists;
+  guint n_changed = 0;
+  gulong changed_id;
+
+  log_index = empathy_log_index_dup_singleton ();
+  account = dup_account ();
+
+  write_log ("frank@example.com");
+
+  entity = tpl_entity_new ("frank@example.com", TPL_ENTITY_CONTACT, NULL,
+      NULL);
+  changed_id = g_signal_connect (log_index, "changed",
+      G_CALLBACK (changed_cb), &n_changed);
+
+  /* Nothing is checked until the main loop is idle */
+  empathy_log_index_prefetch (log_index, account, entity,
+      TPL_EVENT_MASK_TEXT);
+
+  while (n_changed == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Known without checking again */
+  g_assert (empathy_log_index_lookup (log_index, account, entity,
+        TPL_EVENT_MASK_TEXT, &exists));
+  g_assert (exists);
+
+  g_signal_handler_disconnect (log_index, changed_id);
+  g_object_unref (entity);
+  g_object_unref (account);
+  g_object_unref (log_index);
+}
+
+static gboolean
+quit_loop_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_log_index_logger_delay (void)
+{
+  EmpathyLogIndex *log_index;
+  TpAccount *account;
+  GMainLoop *loop;
+
+  log_index = empathy_log_index_dup_singleton ();
+  account = dup_account ();
+
+  /* Something went through, but the logger didn't write it yet */
+  empathy_log_index_invalidate (log_index, account, "eve@example.com");
+  g_assert (!exists_sync (log_index, account, "eve@example.com"));
+
+  write_log ("eve@example.com");
+
+  /* That negative answer was not cached for long */
+  loop = g_main_loop_new (NULL, FALSE);
+  g_timeout_add_seconds (6, quit_loop_cb, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  g_assert (exists_sync (log_index, account, "eve@example.com"));
+
+  g_object_unref (account);
+  g_object_unref (log_index);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  /* Logs are read from there */
+  data_dir = g_dir_make_tmp ("empathy-log-index-test-XXXXXX", NULL);
+  g_assert (data_dir != NULL);
+  g_setenv ("XDG_DATA_HOME", data_dir, TRUE);
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/log-index/lookup", test_log_index_lookup);
+  g_test_add_func ("/log-index/invalidate", test_log_index_invalidate);
+  g_test_add_func ("/log-index/prefetch", test_log_index_prefetch);
+
+  /* Has to wait for the negative answer to expire */
+  if (g_test_slow ())
+    g_test_add_func ("/log-index/logger-delay", test_log_index_logger_delay);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  g_free (data_dir);
+
+  return result;
+}
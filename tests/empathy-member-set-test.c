@@ -0,0 +1,249 @@
+#include "config.h"
+
+#include "empathy-member-set.h"
+#include "mock-tp-chat.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* Size of the room used by the storm test */
+#define STORM_MEMBERS 5000
+
+static void
+test_member_set_add_remove (void)
+{
+  EmpathyMemberSet *set;
+  GPtrArray *contacts;
+  EmpathyContact *contact;
+  GList *members;
+
+  contacts = create_contacts (2);
+  contact = g_ptr_array_index (contacts, 0);
+
+  set = empathy_member_set_new ();
+  g_assert_cmpuint (empathy_member_set_get_size (set), ==, 0);
+
+  g_assert (empathy_member_set_add (set, contact));
+  g_assert (!empathy_member_set_add (set, contact));
+  g_assert (empathy_member_set_contains (set, contact));
+  g_assert (!empathy_member_set_contains (set,
+        g_ptr_array_index (contacts, 1)));
+  g_assert_cmpuint (empathy_member_set_get_size (set), ==, 1);
+
+  members = empathy_member_set_dup_members (set);
+  g_assert_cmpuint (g_list_length (members), ==, 1);
+  g_assert (members->data == contact);
+  g_list_free_full (members, g_object_unref);
+
+  g_assert (empathy_member_set_remove (set, contact));
+  g_assert (!empathy_member_set_remove (set, contact));
+  g_assert_cmpuint (empathy_member_set_get_size (set), ==, 0);
+
+  /* The set holds its own reference */
+  g_assert (empathy_member_set_add (set, contact));
+  g_ptr_array_unref (contacts);
+  g_assert (EMPATHY_IS_CONTACT (contact));
+
+  empathy_member_set_free (set);
+}
+
+static void
+test_member_set_many (void)
+{
+  EmpathyMemberSet *set;
+  GPtrArray *contacts, *changed, *part;
+
+  contacts = create_contacts (10);
+  set = empathy_member_set_new ();
+
+  empathy_member_set_add (set, g_ptr_array_index (contacts, 3));
+
+  /* Contacts already in the room are not reported */
+  changed = empathy_member_set_add_many (set, contacts);
+  g_assert_cmpuint (changed->len, ==, 9);
+  g_assert (g_ptr_array_index (changed, 0) == g_ptr_array_index (contacts, 0));
+  g_assert (g_ptr_array_index (changed, 3) == g_ptr_array_index (contacts, 4));
+  g_ptr_array_unref (changed);
+  g_assert_cmpuint (empathy_member_set_get_size (set), ==, 10);
+
+  part = g_ptr_array_new ();
+  g_ptr_array_add (part, g_ptr_array_index (contacts, 7));
+  g_ptr_array_add (part, g_ptr_array_index (contacts, 7));
+  g_ptr_array_add (part, g_ptr_array_index (contacts, 2));
+
+  /* Contacts leaving stay alive as long as the returned array */
+  changed = empathy_member_set_remove_many (set, part);
+  g_ptr_array_unref (contacts);
+  g_assert_cmpuint (changed->len, ==, 2);
+  g_assert (EMPATHY_IS_CONTACT (g_ptr_array_index (changed, 0)));
+  g_assert (EMPATHY_IS_CONTACT (g_ptr_array_index (changed, 1)));
+  g_assert (!empathy_member_set_contains (set,
+        g_ptr_array_index (changed, 0)));
+  g_assert_cmpuint (empathy_member_set_get_size (set), ==, 8);
+
+  g_ptr_array_unref (changed);
+  g_ptr_array_unref (part);
+  empathy_member_set_free (set);
+}
+
+/* A netsplit: the whole room leaves and joins again, first in one change
+ * then one contact per change */
+static void
+test_member_set_storm (void)
+{
+  EmpathyMemberSet *set;
+  GPtrArray *contacts, *changed, *single;
+  gdouble elapsed;
+  guint i;
+
+  contacts = create_contacts (STORM_MEMBERS);
+  set = empathy_member_set_new ();
+  single = g_ptr_array_sized_new (1);
+  g_ptr_array_add (single, NULL);
+
+  g_test_timer_start ();
+
+  changed = empathy_member_set_add_many (set, contacts);
+  g_assert_cmpuint (changed->len, ==, STORM_MEMBERS);
+  g_ptr_array_unref (changed);
+
+  changed = empathy_member_set_remove_many (set, contacts);
+  g_assert_cmpuint (changed->len, ==, STORM_MEMBERS);
+  g_ptr_array_unref (changed);
+  g_assert_cmpuint (empathy_member_set_get_size (set), ==, 0);
+
+  for (i = 0; i < STORM_MEMBERS; i++)
+    {
+      g_ptr_array_index (single, 0) = g_ptr_array_index (contacts, i);
+
+      changed = empathy_member_set_add_many (set, single);
+      g_assert_cmpuint (changed->len, ==, 1);
+      g_ptr_array_unref (changed);
+    }
+
+  /* Leave in the opposite order, the worst case of a list */
+  for (i = STORM_MEMBERS; i > 0; i--)
+    {
+      g_ptr_array_index (single, 0) = g_ptr_array_index (contacts, i - 1);
+
+      changed = empathy_member_set_remove_many (set, single);
+      g_assert_cmpuint (changed->len, ==, 1);
+      g_ptr_array_unref (changed);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert_cmpuint (empathy_member_set_get_size (set), ==, 0);
+  g_test_minimized_result (elapsed, "%u members storm: %.3f ms",
+      STORM_MEMBERS, elapsed * 1000);
+
+  g_ptr_array_unref (single);
+  g_ptr_array_unref (contacts);
+  empathy_member_set_free (set);
+}
+
+typedef struct
+{
+  guint n_emissions;
+  guint n_added;
+  guint n_removed;
+} MembersChangedData;
+
+static void
+members_changed_cb (EmpathyTpChat *chat,
+    GPtrArray *added,
+    GPtrArray *removed,
+    EmpathyContact *actor,
+    guint reason,
+    const gchar *message,
+    MembersChangedData *data)
+{
+  data->n_emissions++;
+  data->n_added += added != NULL ? added->len : 0;
+  data->n_removed += removed != NULL ? removed->len : 0;
+}
+
+static guint
+count_members (EmpathyTpChat *chat)
+{
+  GList *members;
+  guint n;
+
+  members = empathy_tp_chat_get_members (chat);
+  n = g_list_length (members);
+  g_list_free_full (members, g_object_unref);
+
+  return n;
+}
+
+/* The same netsplit, in a room: each MembersChanged of the channel is a
+ * single EmpathyTpChat::members-changed, whatever the number of contacts */
+static void
+test_member_set_tp_chat_storm (void)
+{
+  MockTpChat *mock;
+  MembersChangedData data = { 0, };
+  GPtrArray *ids;
+  guint i;
+
+  mock = mock_tp_chat_new ();
+  mock_tp_chat_prepare (mock);
+
+  /* Only the user is in the room */
+  g_assert_cmpuint (count_members (mock->chat), ==, 1);
+
+  g_signal_connect (mock->chat, "members-changed",
+      G_CALLBACK (members_changed_cb), &data);
+
+  ids = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; i < STORM_MEMBERS; i++)
+    g_ptr_array_add (ids, g_strdup_printf ("member%u@example.com", i));
+
+  mock_tp_chat_change_members (mock, ids, NULL);
+
+  while (data.n_emissions == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (data.n_emissions, ==, 1);
+  g_assert_cmpuint (data.n_added, ==, STORM_MEMBERS);
+  g_assert_cmpuint (count_members (mock->chat), ==, STORM_MEMBERS + 1);
+
+  mock_tp_chat_change_members (mock, NULL, ids);
+
+  while (data.n_emissions == 1)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (data.n_emissions, ==, 2);
+  g_assert_cmpuint (data.n_removed, ==, STORM_MEMBERS);
+  g_assert_cmpuint (count_members (mock->chat), ==, 1);
+
+  /* Nothing else was pending */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  g_assert_cmpuint (data.n_emissions, ==, 2);
+
+  g_ptr_array_unref (ids);
+  mock_tp_chat_free (mock);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/member-set/add-remove", test_member_set_add_remove);
+  g_test_add_func ("/member-set/many", test_member_set_many);
+  g_test_add_func ("/member-set/storm", test_member_set_storm);
+  g_test_add_func ("/member-set/tp-chat-storm",
+      test_member_set_tp_chat_storm);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
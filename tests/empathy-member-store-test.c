@@ -0,0 +1,139 @@
+#include "config.h"
+
+#include "empathy-member-store.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* Size of the room populated by the benchmark */
+#define BENCHMARK_MEMBERS 10000
+
+static gchar *
+dup_name (GtkTreeModel *model,
+    gint n)
+{
+  GtkTreeIter iter;
+  gchar *name;
+
+  g_assert (gtk_tree_model_iter_nth_child (model, &iter, NULL, n));
+  gtk_tree_model_get (model, &iter,
+      EMPATHY_MEMBER_STORE_COL_NAME, &name,
+      -1);
+
+  return name;
+}
+
+static void
+test_member_store_add_remove (void)
+{
+  EmpathyMemberStore *store;
+  GtkTreeModel *model;
+  GPtrArray *contacts, *part;
+  gchar *name;
+
+  contacts = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (contacts, g_object_new (EMPATHY_TYPE_CONTACT,
+        "id", "bob@example.com", "alias", "Bob", NULL));
+  g_ptr_array_add (contacts, g_object_new (EMPATHY_TYPE_CONTACT,
+        "id", "alice@example.com", "alias", "Alice", NULL));
+  g_ptr_array_add (contacts, g_object_new (EMPATHY_TYPE_CONTACT,
+        "id", "carol@example.com", "alias", "Carol", NULL));
+
+  store = empathy_member_store_new (NULL);
+  model = GTK_TREE_MODEL (store);
+
+  empathy_member_store_add_members (store, contacts);
+  g_assert_cmpint (gtk_tree_model_iter_n_children (model, NULL), ==, 3);
+
+  /* Members already in the store are not added twice */
+  empathy_member_store_add_members (store, contacts);
+  g_assert_cmpint (gtk_tree_model_iter_n_children (model, NULL), ==, 3);
+
+  name = dup_name (model, 0);
+  g_assert_cmpstr (name, ==, "Alice");
+  g_free (name);
+  name = dup_name (model, 2);
+  g_assert_cmpstr (name, ==, "Carol");
+  g_free (name);
+
+  /* Renamed members move to their new place */
+  empathy_contact_set_alias (g_ptr_array_index (contacts, 2), "Aaron");
+  name = dup_name (model, 0);
+  g_assert_cmpstr (name, ==, "Aaron");
+  g_free (name);
+
+  part = g_ptr_array_new ();
+  g_ptr_array_add (part, g_ptr_array_index (contacts, 1));
+  empathy_member_store_remove_members (store, part);
+  empathy_member_store_remove_members (store, part);
+  g_assert_cmpint (gtk_tree_model_iter_n_children (model, NULL), ==, 2);
+
+  name = dup_name (model, 1);
+  g_assert_cmpstr (name, ==, "Bob");
+  g_free (name);
+
+  g_ptr_array_unref (part);
+  g_object_unref (store);
+  g_ptr_array_unref (contacts);
+}
+
+static void
+test_member_store_benchmark (void)
+{
+  EmpathyMemberStore *store;
+  GtkTreeModel *model;
+  GPtrArray *contacts;
+  gdouble elapsed;
+  gchar *name;
+  gint i;
+
+  contacts = create_contacts (BENCHMARK_MEMBERS);
+  store = empathy_member_store_new (NULL);
+  model = GTK_TREE_MODEL (store);
+
+  g_test_timer_start ();
+  empathy_member_store_add_members (store, contacts);
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert_cmpint (gtk_tree_model_iter_n_children (model, NULL), ==,
+      BENCHMARK_MEMBERS);
+
+  /* Sorted, whatever the order they were added in */
+  name = dup_name (model, 0);
+  g_assert_cmpstr (name, ==, "Member 0");
+  g_free (name);
+
+  for (i = 1; i < BENCHMARK_MEMBERS; i += BENCHMARK_MEMBERS / 10)
+    {
+      gchar *previous = dup_name (model, i - 1);
+
+      name = dup_name (model, i);
+      g_assert_cmpint (g_utf8_collate (previous, name), <, 0);
+      g_free (previous);
+      g_free (name);
+    }
+
+  g_test_minimized_result (elapsed, "%u members populated: %.3f ms",
+      BENCHMARK_MEMBERS, elapsed * 1000);
+
+  g_object_unref (store);
+  g_ptr_array_unref (contacts);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/member-store/add-remove", test_member_store_add_remove);
+  g_test_add_func ("/member-store/benchmark", test_member_store_benchmark);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
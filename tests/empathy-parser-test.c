@@ -78,6 +78,15 @@ test_parsers (void)
       "a:)b", "a[:)]b",
       ">:)", "[>:)]",
       ">:(", "&gt;[:(]",
+      ":-))", "[:-))]",
+      ":-)))", "[:-))])",
+      "a\xf0\x9f\x91\xbc" "b", "a[\xf0\x9f\x91\xbc]b",
+
+      /* Partial matches must not hide the smileys they contain */
+      ">:>:>:>:", "&gt;:&gt;:&gt;:&gt;:",
+      ">:>:>:)", "&gt;:&gt;:[>:)]",
+      ":-(|x", "[:-(]|x",
+      ">:-(|)", "&gt;[:-(|)]",
 
       /* Smileys and links mixed */
       ":)http://foo.com", "[:)][http://foo.com]",
@@ -122,6 +131,44 @@ test_parsers (void)
     }
 }
 
+static void
+test_parsers_smiley_runs (void)
+{
+  TpawStringParser parsers[] =
+    {
+      {empathy_string_match_smiley, test_replace_match},
+      {tpaw_string_match_all, tpaw_string_replace_escaped},
+      {NULL, NULL}
+    };
+  GString *input, *expected, *string;
+  guint i;
+
+  /* A long run of almost-smileys, each of which has to be abandoned
+   * before finding the real one at the end */
+  input = g_string_new (NULL);
+  expected = g_string_new (NULL);
+  for (i = 0; i < 100000; i++)
+    {
+      g_string_append (input, ">:");
+      g_string_append (expected, "&gt;:");
+    }
+  g_string_append (input, ">:)");
+  g_string_append (expected, "[>:)]");
+
+  string = g_string_sized_new (expected->len);
+  tpaw_string_parser_substr (input->str, -1, parsers, string);
+  g_assert_cmpstr (string->str, ==, expected->str);
+
+  /* Only the len first bytes are parsed */
+  g_string_truncate (string, 0);
+  tpaw_string_parser_substr (":-)))", 3, parsers, string);
+  g_assert_cmpstr (string->str, ==, "[:-)]");
+
+  g_string_free (input, TRUE);
+  g_string_free (expected, TRUE);
+  g_string_free (string, TRUE);
+}
+
 int
 main (int argc,
     char **argv)
@@ -131,6 +178,7 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/parsers", test_parsers);
+  g_test_add_func ("/parsers/smiley-runs", test_parsers_smiley_runs);
 
   result = g_test_run ();
   test_deinit ();
@@ -0,0 +1,139 @@
+#include "config.h"
+
+#include "empathy-room-list-cache.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+static GPtrArray *
+create_entries (void)
+{
+  GPtrArray *entries;
+
+  entries = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) empathy_room_entry_free);
+
+  g_ptr_array_add (entries, empathy_room_entry_new ("#empathy", "Empathy",
+        "Telepathy\tclient\nfor GNOME", 42, FALSE, FALSE));
+  g_ptr_array_add (entries, empathy_room_entry_new ("#secret", NULL, NULL,
+        3, TRUE, TRUE));
+
+  return entries;
+}
+
+static void
+test_room_list_cache_round_trip (void)
+{
+  GPtrArray *entries, *parsed;
+  EmpathyRoomEntry *entry;
+  gchar *contents;
+
+  entries = create_entries ();
+  contents = empathy_room_list_cache_serialize (entries);
+  parsed = empathy_room_list_cache_parse (contents);
+
+  g_assert (parsed != NULL);
+  g_assert_cmpuint (parsed->len, ==, 2);
+
+  entry = g_ptr_array_index (parsed, 0);
+  g_assert_cmpstr (entry->room, ==, "#empathy");
+  g_assert_cmpstr (entry->name, ==, "Empathy");
+  g_assert_cmpstr (entry->topic, ==, "Telepathy\tclient\nfor GNOME");
+  g_assert_cmpint (entry->members, ==, 42);
+  g_assert (!entry->invite_only);
+  g_assert (!entry->need_password);
+
+  entry = g_ptr_array_index (parsed, 1);
+  g_assert_cmpstr (entry->room, ==, "#secret");
+  g_assert_cmpstr (entry->name, ==, "");
+  g_assert_cmpstr (entry->topic, ==, "");
+  g_assert_cmpint (entry->members, ==, 3);
+  g_assert (entry->invite_only);
+  g_assert (entry->need_password);
+
+  g_ptr_array_unref (parsed);
+  g_free (contents);
+  g_ptr_array_unref (entries);
+}
+
+static void
+test_room_list_cache_empty (void)
+{
+  GPtrArray *entries, *parsed;
+  gchar *contents;
+
+  /* An empty listing is cached too, so it replaces the previous one */
+  entries = g_ptr_array_new ();
+  contents = empathy_room_list_cache_serialize (entries);
+  parsed = empathy_room_list_cache_parse (contents);
+
+  g_assert (parsed != NULL);
+  g_assert_cmpuint (parsed->len, ==, 0);
+
+  g_ptr_array_unref (parsed);
+  g_free (contents);
+  g_ptr_array_unref (entries);
+}
+
+static void
+test_room_list_cache_unknown_format (void)
+{
+  GPtrArray *parsed;
+
+  g_assert (empathy_room_list_cache_parse ("") == NULL);
+  g_assert (empathy_room_list_cache_parse (
+        "# Empathy room list 2\n#empathy\t\t\t1\t0\t0\n") == NULL);
+
+  /* Malformed lines are skipped */
+  parsed = empathy_room_list_cache_parse (
+      "# Empathy room list 1\n#broken\t1\n#ok\t\t\t1\t0\t0\n");
+  g_assert (parsed != NULL);
+  g_assert_cmpuint (parsed->len, ==, 1);
+  g_assert_cmpstr (((EmpathyRoomEntry *) g_ptr_array_index (parsed, 0))->room,
+      ==, "#ok");
+  g_ptr_array_unref (parsed);
+}
+
+static void
+test_room_entry_matches (void)
+{
+  GPtrArray *entries;
+  EmpathyRoomEntry *entry;
+  gchar *filter;
+
+  entries = create_entries ();
+  entry = g_ptr_array_index (entries, 0);
+
+  g_assert (empathy_room_entry_matches (entry, NULL));
+  g_assert (empathy_room_entry_matches (entry, "#emp"));
+  g_assert (empathy_room_entry_matches (entry, "gnome"));
+  g_assert (!empathy_room_entry_matches (entry, "kde"));
+
+  /* Filters are casefolded by the caller */
+  filter = g_utf8_casefold ("TELEPATHY", -1);
+  g_assert (empathy_room_entry_matches (entry, filter));
+  g_free (filter);
+
+  g_ptr_array_unref (entries);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/room-list-cache/round-trip",
+      test_room_list_cache_round_trip);
+  g_test_add_func ("/room-list-cache/empty", test_room_list_cache_empty);
+  g_test_add_func ("/room-list-cache/unknown-format",
+      test_room_list_cache_unknown_format);
+  g_test_add_func ("/room-list-cache/matches", test_room_entry_matches);
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
@@ -0,0 +1,83 @@
+#include "config.h"
+
+#include "empathy-tp-chat.h"
+#include "mock-tp-chat.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+static void
+wait_for_pending_messages (EmpathyTpChat *chat,
+    guint n)
+{
+  while (g_list_length ((GList *) empathy_tp_chat_get_pending_messages (
+          chat)) != n)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_tp_chat_has_pending_message (void)
+{
+  MockTpChat *mock;
+  EmpathyTpChat *chat;
+  const GList *pending;
+
+  mock = mock_tp_chat_new ();
+  chat = mock->chat;
+
+  /* Already pending when the chat becomes ready */
+  mock_tp_chat_receive_message (mock, "alice@example.com", 1000, "hello");
+  mock_tp_chat_prepare (mock);
+  wait_for_pending_messages (chat, 1);
+
+  g_assert (empathy_tp_chat_has_pending_message (chat, 1000, "hello"));
+  g_assert (!empathy_tp_chat_has_pending_message (chat, 1000, "hi"));
+  g_assert (!empathy_tp_chat_has_pending_message (chat, 1001, "hello"));
+  g_assert (!empathy_tp_chat_has_pending_message (chat, 1000, NULL));
+
+  /* Received once the chat is ready, twice the same */
+  mock_tp_chat_receive_message (mock, "bob@example.com", 2000, "again");
+  mock_tp_chat_receive_message (mock, "bob@example.com", 2000, "again");
+  wait_for_pending_messages (chat, 3);
+
+  g_assert (empathy_tp_chat_has_pending_message (chat, 2000, "again"));
+
+  /* Acknowledging one of them keeps the other one pending */
+  pending = empathy_tp_chat_get_pending_messages (chat);
+  empathy_tp_chat_acknowledge_message (chat, pending->next->data);
+  wait_for_pending_messages (chat, 2);
+
+  g_assert (empathy_tp_chat_has_pending_message (chat, 2000, "again"));
+
+  pending = empathy_tp_chat_get_pending_messages (chat);
+  empathy_tp_chat_acknowledge_message (chat, pending->next->data);
+  wait_for_pending_messages (chat, 1);
+
+  g_assert (!empathy_tp_chat_has_pending_message (chat, 2000, "again"));
+  g_assert (empathy_tp_chat_has_pending_message (chat, 1000, "hello"));
+
+  pending = empathy_tp_chat_get_pending_messages (chat);
+  empathy_tp_chat_acknowledge_message (chat, pending->data);
+  wait_for_pending_messages (chat, 0);
+
+  g_assert (!empathy_tp_chat_has_pending_message (chat, 1000, "hello"));
+
+  mock_tp_chat_free (mock);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/tp-chat/has-pending-message",
+      test_tp_chat_has_pending_message);
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
@@ -0,0 +1,276 @@
+#include "config.h"
+
+#include "empathy-video-adapter.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* Synthetic load source: the machine has a single core encoding @capacity
+ * pixels per second, so the CPU load is proportional to the current level.
+ * Frames start queueing in front of the encoder once it is not enough. */
+static guint
+feed_synthetic_load (EmpathyVideoAdapter *adapter,
+    gdouble capacity,
+    guint n_samples,
+    guint *n_steps_up)
+{
+  guint i, n_changes = 0;
+
+  if (n_steps_up != NULL)
+    *n_steps_up = 0;
+
+  for (i = 0; i < n_samples; i++)
+    {
+      guint width, height, framerate, new_width, new_height, new_framerate;
+      gdouble load;
+      gint64 latency;
+
+      g_assert (empathy_video_adapter_get_current (adapter, &width, &height,
+            &framerate));
+
+      load = (gdouble) width * height * framerate / capacity;
+
+      if (load > 1)
+        latency = (load - 1) * G_TIME_SPAN_SECOND;
+      else
+        latency = 20 * G_TIME_SPAN_MILLISECOND;
+
+      if (!empathy_video_adapter_add_sample (adapter, load, latency))
+        continue;
+
+      n_changes++;
+
+      empathy_video_adapter_get_current (adapter, &new_width, &new_height,
+          &new_framerate);
+
+      if (n_steps_up != NULL &&
+          new_width * new_height * new_framerate > width * height * framerate)
+        (*n_steps_up)++;
+    }
+
+  return n_changes;
+}
+
+static void
+assert_current (EmpathyVideoAdapter *adapter,
+    guint width,
+    guint height,
+    guint framerate)
+{
+  guint w, h, f;
+
+  g_assert (empathy_video_adapter_get_current (adapter, &w, &h, &f));
+  g_assert_cmpuint (w, ==, width);
+  g_assert_cmpuint (h, ==, height);
+  g_assert_cmpuint (f, ==, framerate);
+}
+
+static void
+test_video_adapter_bounds (void)
+{
+  EmpathyVideoAdapter *adapter;
+  guint i;
+
+  adapter = empathy_video_adapter_new ();
+
+  /* Nothing to adapt until the remote side asked for something */
+  g_assert (!empathy_video_adapter_get_current (adapter, NULL, NULL, NULL));
+  g_assert (!empathy_video_adapter_add_sample (adapter, 2.0, 0));
+
+  empathy_video_adapter_set_bounds (adapter, 640, 480, 30);
+  assert_current (adapter, 640, 480, 30);
+
+  /* Hopelessly slow machine, go down to the lowest level */
+  feed_synthetic_load (adapter, 1000, 200, NULL);
+  assert_current (adapter, 160, 120, 10);
+
+  /* Idle machine, climb back up but never above the bounds */
+  for (i = 0; i < 200; i++)
+    {
+      guint width, height, framerate;
+
+      feed_synthetic_load (adapter, 1e12, 10, NULL);
+
+      empathy_video_adapter_get_current (adapter, &width, &height,
+          &framerate);
+      g_assert_cmpuint (width, <=, 640);
+      g_assert_cmpuint (height, <=, 480);
+      g_assert_cmpuint (framerate, <=, 30);
+    }
+
+  assert_current (adapter, 640, 480, 30);
+
+  /* Lower bounds apply right away, higher ones wait for the load samples */
+  empathy_video_adapter_set_bounds (adapter, 320, 240, 15);
+  assert_current (adapter, 320, 240, 15);
+
+  empathy_video_adapter_set_bounds (adapter, 1280, 720, 30);
+  assert_current (adapter, 320, 240, 15);
+
+  /* Higher bounds keep the current level even when it is not one of the
+   * ladder, and stepping up from there goes to the next better one */
+  empathy_video_adapter_set_bounds (adapter, 320, 240, 30);
+  assert_current (adapter, 320, 240, 15);
+  feed_synthetic_load (adapter, 1e12, 50, NULL);
+  assert_current (adapter, 320, 240, 30);
+
+  empathy_video_adapter_set_bounds (adapter, 640, 480, 30);
+  assert_current (adapter, 320, 240, 30);
+
+  feed_synthetic_load (adapter, 1e12, 10, NULL);
+  assert_current (adapter, 640, 480, 20);
+
+  /* A current level lighter than all the levels of the ladder comes last,
+   * so stepping up from there goes to the lightest of them */
+  empathy_video_adapter_set_bounds (adapter, 160, 120, 5);
+  assert_current (adapter, 160, 120, 5);
+
+  empathy_video_adapter_set_bounds (adapter, 320, 240, 30);
+  assert_current (adapter, 160, 120, 5);
+
+  feed_synthetic_load (adapter, 1e12, 15, NULL);
+  assert_current (adapter, 160, 120, 10);
+
+  feed_synthetic_load (adapter, 1000, 10, NULL);
+  assert_current (adapter, 160, 120, 5);
+
+  empathy_video_adapter_free (adapter);
+}
+
+/* Frames are a little late, which only counts when the CPUs are busy */
+#define LAGGING (100 * G_TIME_SPAN_MILLISECOND)
+
+static void
+test_video_adapter_hysteresis (void)
+{
+  EmpathyVideoAdapter *adapter;
+  guint i;
+
+  adapter = empathy_video_adapter_new ();
+  empathy_video_adapter_set_bounds (adapter, 640, 480, 30);
+
+  /* Isolated spikes are ignored */
+  g_assert (!empathy_video_adapter_add_sample (adapter, 1.0, LAGGING));
+  g_assert (!empathy_video_adapter_add_sample (adapter, 1.0, LAGGING));
+  g_assert (!empathy_video_adapter_add_sample (adapter, 0.3, 0));
+  g_assert (!empathy_video_adapter_add_sample (adapter, 1.0, LAGGING));
+  g_assert (!empathy_video_adapter_add_sample (adapter, 1.0, LAGGING));
+  assert_current (adapter, 640, 480, 30);
+
+  /* A sustained overload is not */
+  g_assert (empathy_video_adapter_add_sample (adapter, 1.0, LAGGING));
+  assert_current (adapter, 640, 480, 20);
+
+  /* The pipeline is given some time to settle after a change */
+  for (i = 0; i < 5; i++)
+    g_assert (!empathy_video_adapter_add_sample (adapter, 1.0, LAGGING));
+
+  /* Loads between the thresholds keep the current level */
+  for (i = 0; i < 100; i++)
+    g_assert (!empathy_video_adapter_add_sample (adapter, 0.7, 0));
+
+  assert_current (adapter, 640, 480, 20);
+
+  /* Stepping up needs a longer streak than stepping down */
+  for (i = 0; i < 9; i++)
+    g_assert (!empathy_video_adapter_add_sample (adapter, 0.1, 0));
+
+  g_assert (empathy_video_adapter_add_sample (adapter, 0.1, 0));
+  assert_current (adapter, 640, 480, 30);
+
+  empathy_video_adapter_free (adapter);
+}
+
+static void
+test_video_adapter_latency (void)
+{
+  EmpathyVideoAdapter *adapter;
+  guint i;
+
+  adapter = empathy_video_adapter_new ();
+  empathy_video_adapter_set_bounds (adapter, 640, 480, 30);
+
+  /* Frames queueing in front of the encoder count as an overload, even if
+   * the process does not look busy */
+  g_assert (!empathy_video_adapter_add_sample (adapter, 0.1,
+        200 * G_TIME_SPAN_MILLISECOND));
+  g_assert (!empathy_video_adapter_add_sample (adapter, 0.1,
+        200 * G_TIME_SPAN_MILLISECOND));
+  g_assert (empathy_video_adapter_add_sample (adapter, 0.1,
+        200 * G_TIME_SPAN_MILLISECOND));
+  assert_current (adapter, 640, 480, 20);
+
+  empathy_video_adapter_free (adapter);
+
+  adapter = empathy_video_adapter_new ();
+  empathy_video_adapter_set_bounds (adapter, 640, 480, 30);
+
+  /* Busy CPUs alone are not, as long as the encoder keeps up */
+  for (i = 0; i < 100; i++)
+    g_assert (!empathy_video_adapter_add_sample (adapter, 1.0,
+          20 * G_TIME_SPAN_MILLISECOND));
+
+  assert_current (adapter, 640, 480, 30);
+
+  empathy_video_adapter_free (adapter);
+}
+
+static void
+test_video_adapter_settles (void)
+{
+  EmpathyVideoAdapter *adapter;
+
+  adapter = empathy_video_adapter_new ();
+  empathy_video_adapter_set_bounds (adapter, 640, 480, 30);
+
+  /* 640x480@30 takes 1.2 cores while 640x480@20 takes 0.8, which is between
+   * the thresholds: step down once and stay there */
+  g_assert_cmpuint (feed_synthetic_load (adapter, 640 * 480 * 30 / 1.2, 300,
+        NULL), ==, 1);
+  assert_current (adapter, 640, 480, 20);
+
+  empathy_video_adapter_free (adapter);
+}
+
+static void
+test_video_adapter_flapping (void)
+{
+  EmpathyVideoAdapter *adapter;
+  guint n_steps_up;
+
+  adapter = empathy_video_adapter_new ();
+  empathy_video_adapter_set_bounds (adapter, 640, 480, 30);
+
+  /* 320x240@20 is so light that the adapter keeps trying 640x480@20, which
+   * is overloaded. Each failed attempt doubles the wait before the next one,
+   * a fixed wait would step up more than 20 times in 600 samples. */
+  feed_synthetic_load (adapter, 320 * 240 * 20 / 0.4, 600, &n_steps_up);
+
+  DEBUG ("%u steps up", n_steps_up);
+  g_assert_cmpuint (n_steps_up, >, 0);
+  g_assert_cmpuint (n_steps_up, <=, 8);
+
+  empathy_video_adapter_free (adapter);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/video-adapter/bounds", test_video_adapter_bounds);
+  g_test_add_func ("/video-adapter/hysteresis",
+      test_video_adapter_hysteresis);
+  g_test_add_func ("/video-adapter/latency", test_video_adapter_latency);
+  g_test_add_func ("/video-adapter/settles", test_video_adapter_settles);
+  g_test_add_func ("/video-adapter/flapping", test_video_adapter_flapping);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
@@ -0,0 +1,523 @@
+/*
+ * mock-tp-chat.c - Source for an in-process text chat room to test
+ * EmpathyTpChat against
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "mock-tp-chat.h"
+
+#include <telepathy-glib/telepathy-glib-dbus.h>
+
+#include "empathy-client-factory.h"
+
+/* Only what EmpathyTpChat needs: contacts, a room handle repository and a
+ * Text channel implementing Messages and Group. */
+
+/* MockConnection */
+
+GType mock_connection_get_type (void);
+
+typedef struct
+{
+  TpBaseConnection parent;
+  TpContactsMixin contacts;
+} MockConnection;
+
+typedef struct
+{
+  TpBaseConnectionClass parent_class;
+  TpContactsMixinClass contacts_class;
+} MockConnectionClass;
+
+G_DEFINE_TYPE_WITH_CODE (MockConnection, mock_connection,
+    TP_TYPE_BASE_CONNECTION,
+    G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CONNECTION_INTERFACE_CONTACTS,
+      tp_contacts_mixin_iface_init))
+
+static void
+mock_connection_create_handle_repos (TpBaseConnection *conn,
+    TpHandleRepoIface *repos[TP_NUM_HANDLE_TYPES])
+{
+  repos[TP_HANDLE_TYPE_CONTACT] = tp_dynamic_handle_repo_new (
+      TP_HANDLE_TYPE_CONTACT, NULL, NULL);
+  repos[TP_HANDLE_TYPE_ROOM] = tp_dynamic_handle_repo_new (
+      TP_HANDLE_TYPE_ROOM, NULL, NULL);
+}
+
+static gchar *
+mock_connection_get_unique_connection_name (TpBaseConnection *conn)
+{
+  static guint serial = 0;
+
+  return g_strdup_printf ("mock%u", serial++);
+}
+
+static GPtrArray *
+mock_connection_create_channel_managers (TpBaseConnection *conn)
+{
+  return g_ptr_array_new ();
+}
+
+static gboolean
+mock_connection_pretend_connected (gpointer user_data)
+{
+  TpBaseConnection *conn = user_data;
+
+  if (tp_base_connection_get_status (conn) == TP_CONNECTION_STATUS_CONNECTING)
+    tp_base_connection_change_status (conn, TP_CONNECTION_STATUS_CONNECTED,
+        TP_CONNECTION_STATUS_REASON_REQUESTED);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+mock_connection_start_connecting (TpBaseConnection *conn,
+    GError **error)
+{
+  TpHandleRepoIface *contact_repo;
+  TpHandle self_handle;
+
+  contact_repo = tp_base_connection_get_handles (conn,
+      TP_HANDLE_TYPE_CONTACT);
+
+  self_handle = tp_handle_ensure (contact_repo, "me@example.com", NULL,
+      error);
+  if (self_handle == 0)
+    return FALSE;
+
+  tp_base_connection_set_self_handle (conn, self_handle);
+
+  tp_base_connection_change_status (conn, TP_CONNECTION_STATUS_CONNECTING,
+      TP_CONNECTION_STATUS_REASON_REQUESTED);
+
+  g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, mock_connection_pretend_connected,
+      g_object_ref (conn), g_object_unref);
+
+  return TRUE;
+}
+
+static void
+mock_connection_shut_down (TpBaseConnection *conn)
+{
+  tp_base_connection_finish_shutdown (conn);
+}
+
+static GPtrArray *
+mock_connection_get_interfaces_always_present (TpBaseConnection *conn)
+{
+  GPtrArray *interfaces;
+
+  interfaces = TP_BASE_CONNECTION_CLASS (
+      mock_connection_parent_class)->get_interfaces_always_present (conn);
+
+  g_ptr_array_add (interfaces, TP_IFACE_CONNECTION_INTERFACE_CONTACTS);
+
+  return interfaces;
+}
+
+static void
+mock_connection_constructed (GObject *object)
+{
+  G_OBJECT_CLASS (mock_connection_parent_class)->constructed (object);
+
+  tp_contacts_mixin_init (object, G_STRUCT_OFFSET (MockConnection, contacts));
+  tp_base_connection_register_with_contacts_mixin (
+      TP_BASE_CONNECTION (object));
+}
+
+static void
+mock_connection_finalize (GObject *object)
+{
+  tp_contacts_mixin_finalize (object);
+
+  G_OBJECT_CLASS (mock_connection_parent_class)->finalize (object);
+}
+
+static void
+mock_connection_class_init (MockConnectionClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  TpBaseConnectionClass *base_class = TP_BASE_CONNECTION_CLASS (klass);
+
+  object_class->constructed = mock_connection_constructed;
+  object_class->finalize = mock_connection_finalize;
+
+  base_class->create_handle_repos = mock_connection_create_handle_repos;
+  base_class->get_unique_connection_name =
+    mock_connection_get_unique_connection_name;
+  base_class->create_channel_managers =
+    mock_connection_create_channel_managers;
+  base_class->start_connecting = mock_connection_start_connecting;
+  base_class->shut_down = mock_connection_shut_down;
+  base_class->get_interfaces_always_present =
+    mock_connection_get_interfaces_always_present;
+
+  tp_contacts_mixin_class_init (object_class,
+      G_STRUCT_OFFSET (MockConnectionClass, contacts_class));
+}
+
+static void
+mock_connection_init (MockConnection *self)
+{
+}
+
+/* MockTextChannel */
+
+GType mock_text_channel_get_type (void);
+
+typedef struct
+{
+  TpBaseChannel parent;
+  TpMessageMixin message;
+  TpGroupMixin group;
+} MockTextChannel;
+
+typedef struct
+{
+  TpBaseChannelClass parent_class;
+  TpGroupMixinClass group_class;
+} MockTextChannelClass;
+
+G_DEFINE_TYPE_WITH_CODE (MockTextChannel, mock_text_channel,
+    TP_TYPE_BASE_CHANNEL,
+    G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CHANNEL_TYPE_TEXT,
+      tp_message_mixin_text_iface_init);
+    G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CHANNEL_INTERFACE_MESSAGES,
+      tp_message_mixin_messages_iface_init);
+    G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CHANNEL_INTERFACE_GROUP,
+      tp_group_mixin_iface_init))
+
+static void
+mock_text_channel_send (GObject *object,
+    TpMessage *message,
+    TpMessageSendingFlags flags)
+{
+  tp_message_mixin_sent (object, message, flags, "", NULL);
+}
+
+static gboolean
+mock_text_channel_add_member (GObject *object,
+    TpHandle handle,
+    const gchar *message,
+    GError **error)
+{
+  TpIntset *add;
+
+  add = tp_intset_new_containing (handle);
+  tp_group_mixin_change_members (object, message, add, NULL, NULL, NULL, 0,
+      TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
+  tp_intset_destroy (add);
+
+  return TRUE;
+}
+
+static GPtrArray *
+mock_text_channel_get_interfaces (TpBaseChannel *base)
+{
+  GPtrArray *interfaces;
+
+  interfaces = TP_BASE_CHANNEL_CLASS (
+      mock_text_channel_parent_class)->get_interfaces (base);
+
+  g_ptr_array_add (interfaces, TP_IFACE_CHANNEL_INTERFACE_MESSAGES);
+  g_ptr_array_add (interfaces, TP_IFACE_CHANNEL_INTERFACE_GROUP);
+
+  return interfaces;
+}
+
+static void
+mock_text_channel_fill_immutable_properties (TpBaseChannel *base,
+    GHashTable *properties)
+{
+  TP_BASE_CHANNEL_CLASS (
+      mock_text_channel_parent_class)->fill_immutable_properties (base,
+      properties);
+
+  tp_dbus_properties_mixin_fill_properties_hash (G_OBJECT (base), properties,
+      TP_IFACE_CHANNEL_INTERFACE_MESSAGES, "MessagePartSupportFlags",
+      TP_IFACE_CHANNEL_INTERFACE_MESSAGES, "DeliveryReportingSupport",
+      TP_IFACE_CHANNEL_INTERFACE_MESSAGES, "SupportedContentTypes",
+      TP_IFACE_CHANNEL_INTERFACE_MESSAGES, "MessageTypes",
+      NULL);
+}
+
+static void
+mock_text_channel_close (TpBaseChannel *base)
+{
+  tp_base_channel_destroyed (base);
+}
+
+static void
+mock_text_channel_constructed (GObject *object)
+{
+  TpBaseChannel *base = TP_BASE_CHANNEL (object);
+  TpBaseConnection *conn = tp_base_channel_get_connection (base);
+  TpHandle self_handle = tp_base_connection_get_self_handle (conn);
+  static const TpChannelTextMessageType types[] = {
+      TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL,
+  };
+  static const gchar * const content_types[] = { "*/*", NULL };
+  TpIntset *add;
+
+  G_OBJECT_CLASS (mock_text_channel_parent_class)->constructed (object);
+
+  tp_message_mixin_init (object, G_STRUCT_OFFSET (MockTextChannel, message),
+      conn);
+  tp_message_mixin_implement_sending (object, mock_text_channel_send,
+      G_N_ELEMENTS (types), types, 0, 0, content_types);
+
+  tp_group_mixin_init (object, G_STRUCT_OFFSET (MockTextChannel, group),
+      tp_base_connection_get_handles (conn, TP_HANDLE_TYPE_CONTACT),
+      self_handle);
+  tp_group_mixin_change_flags (object,
+      TP_CHANNEL_GROUP_FLAG_MEMBERS_CHANGED_DETAILED, 0);
+
+  /* We are in the room from the start */
+  add = tp_intset_new_containing (self_handle);
+  tp_group_mixin_change_members (object, "", add, NULL, NULL, NULL, 0,
+      TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
+  tp_intset_destroy (add);
+}
+
+static void
+mock_text_channel_finalize (GObject *object)
+{
+  tp_message_mixin_finalize (object);
+  tp_group_mixin_finalize (object);
+
+  G_OBJECT_CLASS (mock_text_channel_parent_class)->finalize (object);
+}
+
+static void
+mock_text_channel_class_init (MockTextChannelClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  TpBaseChannelClass *base_class = TP_BASE_CHANNEL_CLASS (klass);
+
+  object_class->constructed = mock_text_channel_constructed;
+  object_class->finalize = mock_text_channel_finalize;
+
+  base_class->channel_type = TP_IFACE_CHANNEL_TYPE_TEXT;
+  base_class->target_handle_type = TP_HANDLE_TYPE_ROOM;
+  base_class->get_interfaces = mock_text_channel_get_interfaces;
+  base_class->fill_immutable_properties =
+    mock_text_channel_fill_immutable_properties;
+  base_class->close = mock_text_channel_close;
+
+  tp_message_mixin_init_dbus_properties (object_class);
+
+  tp_group_mixin_class_init (object_class,
+      G_STRUCT_OFFSET (MockTextChannelClass, group_class),
+      mock_text_channel_add_member, NULL);
+  tp_group_mixin_init_dbus_properties (object_class);
+}
+
+static void
+mock_text_channel_init (MockTextChannel *self)
+{
+}
+
+/* MockTpChat */
+
+static void
+prepare_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GMainLoop *loop = user_data;
+  GError *error = NULL;
+
+  tp_proxy_prepare_finish (source, result, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_quit (loop);
+}
+
+static void
+prepare_feature (gpointer proxy,
+    GQuark feature)
+{
+  GQuark features[] = { feature, 0 };
+  GMainLoop *loop;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  tp_proxy_prepare_async (proxy, features, prepare_cb, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+}
+
+MockTpChat *
+mock_tp_chat_new (void)
+{
+  MockTpChat *self;
+  TpSimpleClientFactory *factory;
+  TpHandleRepoIface *room_repo;
+  TpHandle room;
+  gchar *bus_name, *object_path;
+  GHashTable *properties;
+  GError *error = NULL;
+
+  self = g_slice_new0 (MockTpChat);
+
+  self->base_connection = g_object_new (mock_connection_get_type (),
+      "protocol", "mock",
+      NULL);
+
+  tp_base_connection_register (self->base_connection, "mock", &bus_name,
+      &object_path, &error);
+  g_assert_no_error (error);
+
+  factory = TP_SIMPLE_CLIENT_FACTORY (empathy_client_factory_dup ());
+
+  /* EmpathyContact expects the connections of its contacts to have an
+   * account */
+  self->account = tp_simple_client_factory_ensure_account (factory,
+      TP_ACCOUNT_OBJECT_PATH_BASE "mock/mock/account0", NULL, &error);
+  g_assert_no_error (error);
+
+  self->connection = g_object_new (TP_TYPE_CONNECTION,
+      "dbus-daemon", tp_simple_client_factory_get_dbus_daemon (factory),
+      "bus-name", bus_name,
+      "object-path", object_path,
+      "factory", factory,
+      "account", self->account,
+      NULL);
+
+  tp_cli_connection_call_connect (self->connection, -1, NULL, NULL, NULL,
+      NULL);
+  prepare_feature (self->connection, TP_CONNECTION_FEATURE_CONNECTED);
+
+  self->contact_repo = tp_base_connection_get_handles (self->base_connection,
+      TP_HANDLE_TYPE_CONTACT);
+  room_repo = tp_base_connection_get_handles (self->base_connection,
+      TP_HANDLE_TYPE_ROOM);
+
+  room = tp_handle_ensure (room_repo, "room@conference.example.com", NULL,
+      &error);
+  g_assert_no_error (error);
+
+  self->channel = g_object_new (mock_text_channel_get_type (),
+      "connection", self->base_connection,
+      "handle", room,
+      "initiator-handle",
+        tp_base_connection_get_self_handle (self->base_connection),
+      "requested", TRUE,
+      NULL);
+  tp_base_channel_register (self->channel);
+
+  g_object_get (self->channel, "channel-properties", &properties, NULL);
+
+  self->chat = empathy_tp_chat_new (factory, self->connection,
+      tp_base_channel_get_object_path (self->channel), properties);
+
+  g_hash_table_unref (properties);
+  g_object_unref (factory);
+  g_free (bus_name);
+  g_free (object_path);
+
+  return self;
+}
+
+void
+mock_tp_chat_free (MockTpChat *self)
+{
+  g_object_unref (self->chat);
+  g_object_unref (self->connection);
+  g_object_unref (self->account);
+
+  tp_base_channel_destroyed (self->channel);
+  g_object_unref (self->channel);
+
+  tp_base_connection_change_status (self->base_connection,
+      TP_CONNECTION_STATUS_DISCONNECTED,
+      TP_CONNECTION_STATUS_REASON_REQUESTED);
+  g_object_unref (self->base_connection);
+
+  g_slice_free (MockTpChat, self);
+}
+
+/* Waits for the chat to be ready; messages received before that are listed
+ * as pending by the room. */
+void
+mock_tp_chat_prepare (MockTpChat *self)
+{
+  prepare_feature (self->chat, EMPATHY_TP_CHAT_FEATURE_READY);
+}
+
+void
+mock_tp_chat_receive_message (MockTpChat *self,
+    const gchar *sender,
+    gint64 timestamp,
+    const gchar *body)
+{
+  TpMessage *message;
+  TpHandle handle;
+
+  handle = tp_handle_ensure (self->contact_repo, sender, NULL, NULL);
+  g_assert (handle != 0);
+
+  message = tp_cm_message_new_text (self->base_connection, handle,
+      TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL, body);
+  tp_message_set_int64 (message, 0, "message-sent", timestamp);
+  tp_message_set_int64 (message, 0, "message-received", timestamp);
+
+  tp_message_mixin_take_received ((GObject *) self->channel, message);
+}
+
+static TpIntset *
+dup_handles (MockTpChat *self,
+    GPtrArray *ids)
+{
+  TpIntset *handles;
+  guint i;
+
+  handles = tp_intset_new ();
+
+  for (i = 0; ids != NULL && i < ids->len; i++)
+    {
+      TpHandle handle;
+
+      handle = tp_handle_ensure (self->contact_repo,
+          g_ptr_array_index (ids, i), NULL, NULL);
+      g_assert (handle != 0);
+
+      tp_intset_add (handles, handle);
+    }
+
+  return handles;
+}
+
+/* Changes the members of the room in one go, as a single MembersChanged
+ * signal, whatever the number of contacts involved. @added and @removed are
+ * arrays of contact identifiers and may be %NULL. */
+void
+mock_tp_chat_change_members (MockTpChat *self,
+    GPtrArray *added,
+    GPtrArray *removed)
+{
+  TpIntset *add, *del;
+
+  add = dup_handles (self, added);
+  del = dup_handles (self, removed);
+
+  tp_group_mixin_change_members ((GObject *) self->channel, "", add, del,
+      NULL, NULL, 0, TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
+
+  tp_intset_destroy (add);
+  tp_intset_destroy (del);
+}
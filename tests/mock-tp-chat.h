@@ -0,0 +1,55 @@
+/*
+ * mock-tp-chat.h - Header for an in-process text chat room to test
+ * EmpathyTpChat against
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __MOCK_TP_CHAT_H__
+#define __MOCK_TP_CHAT_H__
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "empathy-tp-chat.h"
+
+/* A connection and a Text room implemented in the test process itself, and
+ * the EmpathyTpChat looking at that room over D-Bus. */
+typedef struct
+{
+  TpBaseConnection *base_connection;
+  TpBaseChannel *channel;
+  TpHandleRepoIface *contact_repo;
+
+  TpAccount *account;
+  TpConnection *connection;
+  EmpathyTpChat *chat;
+} MockTpChat;
+
+MockTpChat * mock_tp_chat_new (void);
+void mock_tp_chat_free (MockTpChat *self);
+
+void mock_tp_chat_prepare (MockTpChat *self);
+
+void mock_tp_chat_receive_message (MockTpChat *self,
+    const gchar *sender,
+    gint64 timestamp,
+    const gchar *body);
+
+void mock_tp_chat_change_members (MockTpChat *self,
+    GPtrArray *added,
+    GPtrArray *removed);
+
+#endif
@@ -20,6 +20,7 @@
 #include "config.h"
 #include "test-helper.h"
 
+#include "empathy-contact.h"
 #include "empathy-ui-utils.h"
 
 void
@@ -73,3 +74,29 @@ copy_xml_file (const gchar *orig,
   g_free (buffer);
 }
 
+/* Returns @n new contacts, whose aliases are not in the order of their
+ * identifiers */
+GPtrArray *
+create_contacts (guint n)
+{
+  GPtrArray *contacts;
+  guint i;
+
+  contacts = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < n; i++)
+    {
+      gchar *id = g_strdup_printf ("member%u@example.com", i);
+      /* Not in the order they are sorted in */
+      gchar *alias = g_strdup_printf ("Member %u", (i * 7919) % n);
+
+      g_ptr_array_add (contacts, g_object_new (EMPATHY_TYPE_CONTACT,
+            "id", id,
+            "alias", alias,
+            NULL));
+      g_free (id);
+      g_free (alias);
+    }
+
+  return contacts;
+}
@@ -33,5 +33,7 @@ void copy_xml_file (const gchar *orig, const gchar *dest);
 TpAccount * get_test_account (void);
 void destroy_test_account (TpAccount *account);
 
+GPtrArray * create_contacts (guint n);
+
 
 #endif